@@ -20,6 +20,7 @@
 
 #include "blocksize_2MB.h"
 #include <algorithm>
+#include <vector>
 #include <tpie/array.h>
 #include <tpie/tpie.h>
 #include <tpie/btree/btree.h>
@@ -32,11 +33,14 @@
 using namespace tpie;
 using namespace tpie::test;
 
+const memory_size_type small_cache = 64;
+
 void usage() {
-	std::cout << "Parameters: [repetitions] [size]" << std::endl;
+	std::cout << "Parameters: [repetitions] [size] [block sizes...]" << std::endl;
 }
 
-void test(size_t times, size_t size) {
+template <typename tree_t>
+void test(size_t times, size_t size, memory_size_type blockSize, memory_size_type cacheSize) {
 	// display code
 	std::vector<const char *> names;
 	names.resize(3);
@@ -56,7 +60,7 @@ void test(size_t times, size_t size) {
 		btree<btree_internal_store<int> > tree(store);*/
 		temp_file tmp;
 
-		btree<int, btree_external> tree(tmp.path());
+		tree_t tree(tmp.path(), default_comp(), empty_augmenter(), blockSize, cacheSize);
 
 		// pre-protocol
 		int x[count];
@@ -69,6 +73,7 @@ void test(size_t times, size_t size) {
 		for(size_t i = 0; i < count; ++i) {
 			tree.insert(x[i]);
 		}
+		tree.flush();
 		getTestRealtime(end);
 		s(testRealtimeDiff(start,end));
 
@@ -120,12 +125,40 @@ int main(int argc, char **argv) {
 		}
 	}
 
+	// Sweep the node size, from a small page up to what suits an SSD.
+	std::vector<memory_size_type> blockSizes;
+	for (int i = 3; i < argc; ++i) {
+		memory_size_type blockSize = 0;
+		std::stringstream(argv[i]) >> blockSize;
+		if (!blockSize) {
+			usage();
+			return EXIT_FAILURE;
+		}
+		blockSizes.push_back(blockSize);
+	}
+	if (blockSizes.empty()) {
+		blockSizes.push_back(4096);
+		blockSizes.push_back(7000);
+		blockSizes.push_back(16384);
+		blockSizes.push_back(65536);
+	}
+
 	tpie::tpie_init();
 	tpie::get_memory_manager().set_limit(1000 * 1024 * 1024);
 
 	log_info() << "Repetitions: " << times << std::endl;
 	log_info() << "Test size: " << size << " KB" << std::endl;
-	::test(times, size);
+	for (size_t i = 0; i < blockSizes.size(); ++i) {
+		log_info() << "Block size: " << blockSizes[i] << " B" << std::endl;
+		::test<btree<int, btree_external> >(times, size, blockSizes[i], 0);
+		log_info() << "Block size: " << blockSizes[i] << " B, buffered inserts" << std::endl;
+		::test<btree<int, btree_external, btree_buffered> >(times, size, blockSizes[i], 0);
+		// a cache much smaller than the tree, so most nodes are read from disk
+		log_info() << "Block size: " << blockSizes[i] << " B, " << small_cache << " cached nodes" << std::endl;
+		::test<btree<int, btree_external> >(times, size, blockSizes[i], small_cache);
+		log_info() << "Block size: " << blockSizes[i] << " B, " << small_cache << " cached nodes, buffered inserts" << std::endl;
+		::test<btree<int, btree_external, btree_buffered> >(times, size, blockSizes[i], small_cache);
+	}
 
 	tpie::tpie_finish();
 
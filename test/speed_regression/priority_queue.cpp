@@ -29,15 +29,18 @@
 #include "testinfo.h"
 #include <random>
 #include <tpie/types.h>
+#include <vector>
+#include <iterator>
 
 using namespace tpie;
 using namespace tpie::ami;
 using namespace tpie::test;
 
 const size_t mb_default=1;
+const size_t batch_default=4096;
 
 void usage() {
-	std::cout << "Parameters: [times] [mb]" << std::endl;
+	std::cout << "Parameters: [-s] [-b batch] [times] [mb] [blockfactor]" << std::endl;
 }
 
 struct intgenerator {
@@ -59,14 +62,16 @@ struct segmentgenerator {
 };
 
 template <typename Generator>
-void test(Generator g, size_t mb, size_t times, float blockFactor = 0.125f) {
+void test(Generator g, size_t mb, size_t times, float blockFactor = 0.125f, size_t batch = batch_default) {
 	typedef typename Generator::item_type test_t;
 	test_t a = test_t();
 
 	std::vector<const char *> names;
-	names.resize(2);
+	names.resize(4);
 	names[0] = "Push";
 	names[1] = "Pop";
+	names[2] = "Push batch";
+	names[3] = "Pop batch";
 
 	tpie::test::stat s(names);
 	TPIE_OS_OFFSET count=TPIE_OS_OFFSET(mb)*1024*1024/sizeof(test_t);
@@ -94,6 +99,29 @@ void test(Generator g, size_t mb, size_t times, float blockFactor = 0.125f) {
 			getTestRealtime(end);
 			s(testRealtimeDiff(start,end));
 		}
+		{
+			tpie::ami::priority_queue<test_t> pq(0.95f, blockFactor);
+			std::vector<test_t> items;
+			items.reserve(batch);
+
+			getTestRealtime(start);
+			for(TPIE_OS_OFFSET i=0; i < count;) {
+				items.clear();
+				for(size_t j=0; j < batch && i < count; ++j, ++i) items.push_back(g());
+				pq.push_batch(tpie::array_view<const test_t>(items));
+			}
+			getTestRealtime(end);
+			s(testRealtimeDiff(start,end));
+
+			getTestRealtime(start);
+			while(!pq.empty()) {
+				items.clear();
+				pq.pop_batch(std::back_inserter(items), batch);
+				for(size_t j=0; j < items.size(); ++j) g.use(a, items[j]);
+			}
+			getTestRealtime(end);
+			s(testRealtimeDiff(start,end));
+		}
 	}
 	if (a == g()) std::cout << "oh rly" << std::endl;
 }
@@ -102,6 +130,7 @@ int main(int argc, char **argv) {
 	size_t times = 10;
 	size_t mb = mb_default;
 	float blockFactor = 0.125;
+	size_t batch = batch_default;
 	bool segments = false;
 
 	int i;
@@ -109,6 +138,12 @@ int main(int argc, char **argv) {
 		std::string arg(argv[i]);
 		if (arg == "-s") {
 			segments = true;
+		} else if (arg == "-b" && i+1 < argc) {
+			std::stringstream(argv[++i]) >> batch;
+			if (!batch) {
+				usage();
+				return EXIT_FAILURE;
+			}
 		} else {
 			break;
 		}
@@ -143,12 +178,13 @@ int main(int argc, char **argv) {
 
 	testinfo t("Priority queue speed test", 1024, mb, times);
 	sysinfo().printinfo("Block factor", blockFactor);
+	sysinfo().printinfo("Batch size", batch);
 	if (segments) {
 		sysinfo().printinfo("Item type", "segments");
-		::test(intgenerator(), mb, times, blockFactor);
+		::test(intgenerator(), mb, times, blockFactor, batch);
 	} else {
 		sysinfo().printinfo("Item type", "64-bit integers");
-		::test(segmentgenerator(), mb, times, blockFactor);
+		::test(segmentgenerator(), mb, times, blockFactor, batch);
 	}
 	return EXIT_SUCCESS;
 }
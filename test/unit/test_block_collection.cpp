@@ -22,6 +22,7 @@
 #include "common.h"
 #include <tpie/tpie.h>
 #include <tpie/blocks/block_collection.h>
+#include <tpie/blocks/block_codec.h>
 #include <tpie/tempname.h>
 #include <vector>
 #include <deque>
@@ -195,9 +196,190 @@ bool overwrite() {
 	return true;
 }
 
+// fill a block with a count followed by sorted 8-byte records, or with
+// random bytes that do not compress
+void fill_block(block & b, memory_size_type seed, bool sorted) {
+	std::fill(b.begin(), b.end(), 0);
+	if(!sorted) {
+		for(memory_size_type i = 0; i < b.size(); ++i)
+			b[i] = static_cast<char>(random(seed + i) >> 7);
+		return;
+	}
+	memory_size_type count = (b.size() - sizeof(memory_size_type)) / sizeof(uint64_t) - seed % 100;
+	std::memcpy(b.get(), &count, sizeof(count));
+	for(memory_size_type i = 0; i < count; ++i) {
+		uint64_t v = (seed << 32) + 3 * i;
+		std::memcpy(b.get() + sizeof(memory_size_type) + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+bool codec() {
+	std::shared_ptr<const block_codec> records
+		= std::make_shared<record_codec>(sizeof(memory_size_type), sizeof(uint64_t));
+	scheme_codec compressed(get_compression_scheme_none(), records);
+
+	// sizes that do not end on a record boundary
+	memory_size_type sizes[] = {0, 5, 8, 16, 1001, 4096};
+	for(memory_size_type s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+		for(memory_size_type seed = 1; seed < 4; ++seed) {
+			block b(sizes[s]);
+			if(b.size() >= sizeof(memory_size_type) + 100 * sizeof(uint64_t))
+				fill_block(b, seed, true);
+			else
+				fill_block(b, seed, false);
+
+			const block_codec * codecs[] = {records.get(), &compressed};
+			for(memory_size_type c = 0; c < 2; ++c) {
+				array<char> encoded(codecs[c]->max_encoded_size(b.size()));
+				memory_size_type length = codecs[c]->encode(b.get(), b.size(), encoded.get());
+				TEST_ENSURE(length <= encoded.size(), "encode wrote past the bound");
+
+				block d(b.size(), 1);
+				codecs[c]->decode(encoded.get(), length, d.get(), d.size());
+				TEST_ENSURE(std::equal(b.begin(), b.end(), d.begin()), "decoded block differs");
+			}
+		}
+	}
+
+	// sorted records with a common high part are stored in a few bytes each
+	block b(4096);
+	fill_block(b, 7, true);
+	array<char> encoded(records->max_encoded_size(b.size()));
+	memory_size_type length = records->encode(b.get(), b.size(), encoded.get());
+	TEST_ENSURE(length < b.size() / 2, "sorted records were not compressed");
+
+	// truncated input is detected
+	bool thrown = false;
+	try {
+		block d(b.size());
+		records->decode(encoded.get(), length / 2, d.get(), d.size());
+	} catch(tpie::exception &) {
+		thrown = true;
+	}
+	TEST_ENSURE(thrown, "a truncated block was decoded");
+	return true;
+}
+
+bool encoded() {
+	const memory_size_type nodeSize = 4096;
+	const memory_size_type diskSize = 512;
+	std::shared_ptr<const block_codec> codec
+		= std::make_shared<record_codec>(sizeof(memory_size_type), sizeof(uint64_t));
+
+	temp_file file;
+	std::vector<std::pair<block_handle, memory_size_type> > blocks;
+	{
+		block_collection collection(file.path(), nodeSize, true, codec, diskSize);
+
+		// alternate between content that fits in one slot and content that
+		// needs overflow slots
+		for(memory_size_type i = 0; i < 40; ++i) {
+			block_handle handle = collection.get_free_block();
+			TEST_ENSURE_EQUALITY(nodeSize, handle.size, "The size of the returned block is not correct.");
+			block b(handle.size);
+			fill_block(b, i, i % 3 != 0);
+			collection.write_block(handle, b);
+			blocks.push_back(std::make_pair(handle, i));
+		}
+
+		// rewrite blocks so their encoding grows and shrinks, and free some
+		for(memory_size_type i = 40; i < 100; ++i) {
+			memory_size_type j = random(i) % blocks.size();
+			if(i % 5 == 0) {
+				collection.free_block(blocks[j].first);
+				blocks[j].first = collection.get_free_block();
+			}
+			block b(nodeSize);
+			fill_block(b, i, i % 2 == 0);
+			collection.write_block(blocks[j].first, b);
+			blocks[j].second = i;
+		}
+	}
+
+	block_collection collection(file.path(), nodeSize, false, codec, diskSize);
+	for(memory_size_type i = 0; i < blocks.size(); ++i) {
+		block expected(nodeSize);
+		memory_size_type seed = blocks[i].second;
+		fill_block(expected, seed, seed < 40 ? seed % 3 != 0 : seed % 2 == 0);
+
+		block b;
+		collection.read_block(blocks[i].first, b);
+		TEST_ENSURE_EQUALITY(nodeSize, b.size(), "The block size should be equal to the handle size");
+		TEST_ENSURE(std::equal(b.begin(), b.end(), expected.begin()), "the content of the returned block is not correct");
+	}
+	return true;
+}
+
+// the positions of the overflow slots listed at the start of a block
+std::vector<stream_size_type> overflow_slots(const std::string & path, block_handle handle) {
+	tpie::file_accessor::raw_file_accessor accessor;
+	accessor.open_ro(path);
+	uint32_t header[2];
+	accessor.seek_i(handle.position);
+	accessor.read_i(header, sizeof(header));
+	std::vector<stream_size_type> overflow(header[1]);
+	if(!overflow.empty())
+		accessor.read_i(&overflow[0], overflow.size() * sizeof(stream_size_type));
+	accessor.close_i();
+	return overflow;
+}
+
+bool overflow_extent() {
+	const memory_size_type nodeSize = 4096;
+	const memory_size_type diskSize = 512;
+	std::shared_ptr<const block_codec> codec
+		= std::make_shared<record_codec>(sizeof(memory_size_type), sizeof(uint64_t));
+
+	temp_file file;
+	block_collection collection(file.path(), nodeSize, true, codec, diskSize);
+	std::vector<block_handle> handles;
+	for(memory_size_type i = 0; i < 10; ++i)
+		handles.push_back(collection.get_free_block());
+
+	// the slots after the last block are free
+	block b(nodeSize);
+	fill_block(b, 1, false);
+	collection.write_block(handles.back(), b);
+	std::vector<stream_size_type> overflow = overflow_slots(file.path(), handles.back());
+	TEST_ENSURE(!overflow.empty(), "the block has no overflow slots");
+	TEST_ENSURE_EQUALITY(handles.back().position + diskSize, overflow[0], "the overflow slots are not after the block");
+
+	// grow and shrink the encodings; the overflow slots of a block stay adjacent
+	for(memory_size_type i = 0; i < 50; ++i) {
+		memory_size_type j = random(i) % handles.size();
+		fill_block(b, i, i % 2 == 0);
+		collection.write_block(handles[j], b);
+
+		for(memory_size_type k = 0; k < handles.size(); ++k) {
+			overflow = overflow_slots(file.path(), handles[k]);
+			for(memory_size_type l = 1; l < overflow.size(); ++l)
+				TEST_ENSURE_EQUALITY(overflow[l-1] + diskSize, overflow[l], "the overflow slots are not adjacent");
+		}
+	}
+	return true;
+}
+
+// a slot too small to list the overflow slots of a block is rejected
+bool disk_size() {
+	std::shared_ptr<const block_codec> codec
+		= std::make_shared<record_codec>(sizeof(memory_size_type), sizeof(uint64_t));
+	temp_file file;
+	try {
+		block_collection collection(file.path(), 65536, true, codec, 64);
+	} catch(const invalid_argument_exception &) {
+		return true;
+	}
+	log_error() << "A disk block size of 64 bytes was accepted for blocks of 65536 bytes" << std::endl;
+	return false;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.test(basic, "basic")
 		.test(erase, "erase")
-		.test(overwrite, "overwrite");
+		.test(overwrite, "overwrite")
+		.test(codec, "codec")
+		.test(encoded, "encoded")
+		.test(overflow_extent, "overflow_extent")
+		.test(disk_size, "disk_size");
 }
@@ -22,10 +22,18 @@
 #include "common.h"
 #include <tpie/tpie.h>
 #include <tpie/blocks/block_collection_cache.h>
+#include <tpie/blocks/sharded_block_cache.h>
+#include <tpie/blocks/block_codec.h>
 #include <tpie/tempname.h>
 #include <vector>
 #include <deque>
+#include <list>
+#include <map>
 #include <algorithm>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <tpie/file_accessor/file_accessor.h>
 
 using namespace tpie;
@@ -191,9 +199,188 @@ bool overwrite() {
 	return true;
 }
 
+// Random reads, writes, allocations and frees on many more blocks than fit
+// in the cache, so that blocks are evicted and written back in batches.
+template <typename cache_t>
+bool random_access() {
+	typedef std::map<stream_size_type, std::pair<block_handle, char> > block_map_t;
+
+	temp_file file;
+	cache_t collection(file.path(), BLOCK_SIZE, 7, true);
+	block_map_t blocks;
+
+	for(memory_size_type i = 0; i < 5000; ++i) {
+		char content = static_cast<char>(random(i) % 127);
+		memory_size_type action = random(i) / 7 % 10;
+
+		if(blocks.size() < 10 || action == 0) {
+			block_handle handle = collection.get_free_block();
+			block * b = collection.read_block(handle);
+			std::fill(b->begin(), b->end(), content);
+			collection.write_block(handle);
+			blocks[handle.position] = std::make_pair(handle, content);
+			continue;
+		}
+
+		block_map_t::iterator j = blocks.begin();
+		std::advance(j, random(i + 1) % blocks.size());
+		block * b = collection.read_block(j->second.first);
+
+		if(action == 1) {
+			collection.free_block(j->second.first);
+			blocks.erase(j);
+		} else if(action < 5) {
+			std::fill(b->begin(), b->end(), content);
+			collection.write_block(j->second.first);
+			j->second.second = content;
+		} else {
+			TEST_ENSURE_EQUALITY(j->second.first.size, b->size(), "The block size should be equal to the handle size");
+			TEST_ENSURE_EQUALITY((int) j->second.second, (int) (*b)[0], "the content of the returned block is not correct");
+			TEST_ENSURE_EQUALITY((int) j->second.second, (int) (*b)[b->size() - 1], "the content of the returned block is not correct");
+		}
+	}
+
+	collection.flush();
+	for(block_map_t::iterator i = blocks.begin(); i != blocks.end(); ++i) {
+		block * b = collection.read_block(i->second.first);
+		for(block::iterator j = b->begin(); j != b->end(); ++j)
+			TEST_ENSURE_EQUALITY((int) *j, (int) i->second.second, "the content of the returned block is not correct");
+	}
+	return true;
+}
+
+// Read blocks ahead of time, also blocks that are changed or freed before
+// the prefetched content is used.
+template <bool encoded>
+bool prefetch() {
+	temp_file file;
+	std::shared_ptr<const block_codec> codec;
+	if(encoded) codec = std::make_shared<record_codec>(0, 64);
+	block_collection_cache collection(file.path(), BLOCK_SIZE, 8, true, codec, encoded ? 512 : BLOCK_SIZE);
+	std::vector<block_handle> blocks;
+
+	for(memory_size_type i = 0; i < 40; ++i) {
+		block_handle handle = collection.get_free_block();
+		block * b = collection.read_block(handle);
+		std::fill(b->begin(), b->end(), static_cast<char>(i));
+		collection.write_block(handle);
+		blocks.push_back(handle);
+	}
+	collection.flush();
+
+	for(memory_size_type round = 0; round < 20; ++round) {
+		for(memory_size_type i = 0; i < blocks.size(); ++i) {
+			collection.prefetch(blocks[(i + 1) % blocks.size()]);
+			collection.prefetch(blocks[(i + 2) % blocks.size()]);
+			block * b = collection.read_block(blocks[i]);
+			TEST_ENSURE_EQUALITY((int) i, (int) (*b)[0], "the content of the returned block is not correct");
+			TEST_ENSURE_EQUALITY((int) i, (int) (*b)[b->size() - 1], "the content of the returned block is not correct");
+			if(random(round * blocks.size() + i) % 3 == 0) {
+				// change a block that may be read ahead
+				memory_size_type j = (i + 1) % blocks.size();
+				block * c = collection.read_block(blocks[j]);
+				std::fill(c->begin(), c->end(), static_cast<char>(j));
+				collection.write_block(blocks[j]);
+			}
+		}
+	}
+
+	// a freed and reallocated block must not get prefetched content
+	collection.prefetch(blocks[5]);
+	collection.free_block(blocks[5]);
+	block_handle handle = collection.get_free_block();
+	block * b = collection.read_block(handle);
+	std::fill(b->begin(), b->end(), 99);
+	collection.write_block(handle);
+	for(memory_size_type i = 0; i < blocks.size(); ++i)
+		if(i != 5) collection.read_block(blocks[i]);
+	b = collection.read_block(handle);
+	TEST_ENSURE_EQUALITY(99, (int) (*b)[0], "the reallocated block has stale content");
+	return true;
+}
+
+// Several threads reading blocks at random through a sharded cache that
+// is much smaller than the collection.
+bool sharded_threads(size_t threads) {
+	temp_file file;
+	sharded_block_cache collection(file.path(), BLOCK_SIZE, 16, true, 4);
+	std::vector<block_handle> blocks;
+
+	for(memory_size_type i = 0; i < 100; ++i) {
+		block_handle handle = collection.get_free_block();
+		block * b = collection.read_block(handle);
+		std::fill(b->begin(), b->end(), static_cast<char>(i));
+		collection.write_block(handle);
+		blocks.push_back(handle);
+	}
+
+	std::atomic<bool> ok(true);
+	std::vector<std::thread> workers;
+	for(size_t t = 0; t < threads; ++t) {
+		workers.push_back(std::thread([&, t]() {
+			for(memory_size_type i = 0; i < 20000 && ok; ++i) {
+				memory_size_type j = random(i * threads + t) % blocks.size();
+				block * b = collection.read_block(blocks[j]);
+				sharded_block_cache::block_ptr p = collection.pin(blocks[(j + 1) % blocks.size()]);
+				if((*b)[0] != static_cast<char>(j) || (*b)[b->size() - 1] != static_cast<char>(j)
+					|| (*p)[0] != static_cast<char>((j + 1) % blocks.size()))
+					ok = false;
+			}
+		}));
+	}
+	for(size_t t = 0; t < threads; ++t) workers[t].join();
+
+	TEST_ENSURE(ok, "A thread read the wrong block content");
+	return true;
+}
+
+// Destroying a sharded cache releases the blocks that other threads
+// still hold in their pin rings.
+bool sharded_release() {
+	temp_file file;
+	memory_size_type used = get_memory_manager().used();
+	std::mutex mutex;
+	std::condition_variable cond;
+	bool pinned = false;
+	bool destroyed = false;
+	std::thread worker;
+	{
+		sharded_block_cache collection(file.path(), BLOCK_SIZE, 16, true, 4);
+		std::vector<block_handle> blocks;
+		for(memory_size_type i = 0; i < 4; ++i) blocks.push_back(collection.get_free_block());
+		collection.flush();
+
+		worker = std::thread([&]() {
+			for(memory_size_type i = 0; i < blocks.size(); ++i) collection.read_block(blocks[i]);
+			std::unique_lock<std::mutex> lock(mutex);
+			pinned = true;
+			cond.notify_all();
+			while(!destroyed) cond.wait(lock);
+		});
+		std::unique_lock<std::mutex> lock(mutex);
+		while(!pinned) cond.wait(lock);
+	}
+	memory_size_type after = get_memory_manager().used();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		destroyed = true;
+		cond.notify_all();
+	}
+	worker.join();
+
+	TEST_ENSURE_EQUALITY(used, after, "Blocks pinned by another thread outlived the cache");
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.test(basic, "basic")
 		.test(erase, "erase")
-		.test(overwrite, "overwrite");
+		.test(overwrite, "overwrite")
+		.test(random_access<block_collection_cache>, "random_access")
+		.test(random_access<sharded_block_cache>, "sharded_random_access")
+		.test(prefetch<false>, "prefetch")
+		.test(prefetch<true>, "encoded_prefetch")
+		.test(sharded_threads, "sharded_threads", "threads", static_cast<size_t>(4))
+		.test(sharded_release, "sharded_release");
 }
@@ -21,10 +21,20 @@
 #include <tpie/tpie.h>
 #include <tpie/btree.h>
 #include <tpie/tempname.h>
+#include <tpie/stats.h>
+#include <tpie/file_stream.h>
+#include <tpie/pipelining.h>
+#include <tpie/pipelining/btree.h>
 #include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <thread>
 #include <set>
 #include <map>
 #include <numeric>
+#include <random>
+#include <string>
 using namespace tpie;
 using namespace std;
 
@@ -477,6 +487,537 @@ bool external_bound_test() {
 	return bound_test(TA<btree_external>(), tmp.path());
 }
 
+bool external_block_size_test() {
+	temp_file tmp;
+	std::vector<int> x(20000);
+	std::iota(x.begin(), x.end(), 0);
+	std::random_shuffle(x.begin(), x.end());
+	{
+		btree<int, btree_external> tree(tmp.path(), default_comp(), empty_augmenter(), 512, 4);
+		for (int v: x) tree.insert(v);
+		TEST_ENSURE_EQUALITY(x.size(), tree.size(), "The tree has the wrong size");
+		TEST_ENSURE(tree.root().count() <= (512 - sizeof(memory_size_type)) / sizeof(int),
+					"The root is larger than the block size allows");
+	}
+	{
+		// The block size of an existing tree is used when none is given.
+		btree<int, btree_external> tree(tmp.path());
+		TEST_ENSURE_EQUALITY(x.size(), tree.size(), "The reopened tree has the wrong size");
+		set<int> tree2(x.begin(), x.end());
+		TEST_ENSURE(compare(tree, tree2), "Compare failed after reopening");
+	}
+	try {
+		btree<int, btree_external> tree(tmp.path(), default_comp(), empty_augmenter(), 1024);
+		TEST_FAIL("Opening with a different block size should throw");
+	} catch (const tpie::exception &) {
+	}
+	return true;
+}
+
+bool external_concurrent_test(size_t threads) {
+	typedef btree<int, btree_external, btree_concurrent> tree_t;
+	temp_file tmp;
+	tree_t tree(tmp.path(), default_comp(), empty_augmenter(), 512, 8);
+	std::vector<int> x(20000);
+	for (size_t i = 0; i < x.size(); ++i) x[i] = 2 * i;
+	std::random_shuffle(x.begin(), x.end());
+	for (int v: x) tree.insert(v);
+
+	std::atomic<bool> ok(true);
+	std::vector<std::thread> workers;
+	for (size_t t = 0; t < threads; ++t) {
+		workers.push_back(std::thread([&, t]() {
+			for (size_t i = t; i < x.size() && ok; i += threads) {
+				int v = x[i];
+				tree_t::iterator j = tree.find(v);
+				if (j == tree.end() || *j != v) ok = false;
+				if (tree.find(v + 1) != tree.end()) ok = false;
+				// walk a few items from the lower bound
+				j = tree.lower_bound(v - 1);
+				for (int k = 0; k < 10 && j != tree.end(); ++k, ++j)
+					if (*j != v + 2 * k) ok = false;
+			}
+		}));
+	}
+	for (size_t t = 0; t < threads; ++t) workers[t].join();
+
+	TEST_ENSURE(ok, "Concurrent lookups returned wrong items");
+	return true;
+}
+
+bool external_bulk_load_test(size_t items, double fillFactor) {
+	temp_file streamFile;
+	file_stream<int> in;
+	in.open(streamFile);
+	for (size_t i = 0; i < items; ++i) in.write(3 * i);
+	in.seek(0);
+
+	temp_file tmp;
+	btree_builder<int, btree_external> builder(tmp.path());
+	builder.set_fill_factor(fillFactor);
+	builder.push(in);
+	auto tree = builder.build();
+	TEST_ENSURE_EQUALITY(items, tree.size(), "The tree has the wrong size");
+
+	set<int> tree2;
+	for (size_t i = 0; i < items; ++i) tree2.insert(3 * i);
+	TEST_ENSURE(compare(tree, tree2), "Compare failed");
+
+	// the tree must stay valid under updates
+	for (size_t i = 0; i < items; i += 7) {
+		tree.insert(3 * i + 1);
+		tree2.insert(3 * i + 1);
+	}
+	for (size_t i = 0; i < items; i += 5) {
+		tree.erase(3 * i);
+		tree2.erase(3 * i);
+	}
+	TEST_ENSURE(compare(tree, tree2), "Compare failed after updates");
+	return true;
+}
+
+bool external_pipelined_build_test(size_t items) {
+	std::vector<int> input(items);
+	std::iota(input.begin(), input.end(), 0);
+
+	temp_file tmp;
+	btree_builder<int, btree_external> builder(tmp.path());
+	pipelining::pipeline p = pipelining::input_vector(input) | pipelining::btree_output(builder);
+	p();
+	auto tree = builder.build();
+
+	set<int> tree2(input.begin(), input.end());
+	TEST_ENSURE_EQUALITY(items, tree.size(), "The tree has the wrong size");
+	TEST_ENSURE(compare(tree, tree2), "Compare failed");
+	return true;
+}
+
+template<typename ... TT, typename ... A>
+bool find_many_test(TA<TT...>, size_t items, A && ... a) {
+	btree<int, TT...> tree(std::forward<A>(a)...);
+	// every third integer, twice
+	std::vector<int> x;
+	for (size_t i = 0; i < items; ++i) {
+		x.push_back(3 * i);
+		x.push_back(3 * i);
+	}
+	std::random_shuffle(x.begin(), x.end());
+	for (int v: x) tree.insert(v);
+
+	// sorted keys with gaps, repeats and keys outside the tree
+	std::vector<int> keys;
+	for (int k = -5; k < 3 * (int)items + 5; k += 1 + (keys.size() * 7919) % 5) {
+		keys.push_back(k);
+		if (k % 4 == 0) keys.push_back(k);
+	}
+
+	typedef typename btree<int, TT...>::iterator iterator;
+	std::vector<iterator> lower, found;
+	tree.lower_bound_many(keys.begin(), keys.end(), std::back_inserter(lower), 2);
+	tree.find_many(keys.begin(), keys.end(), std::back_inserter(found));
+	TEST_ENSURE_EQUALITY(keys.size(), lower.size(), "Wrong number of lower bounds");
+	TEST_ENSURE_EQUALITY(keys.size(), found.size(), "Wrong number of finds");
+	for (size_t i = 0; i < keys.size(); ++i) {
+		TEST_ENSURE(lower[i] == tree.lower_bound(keys[i]), "Wrong lower bound");
+		// find may return any copy of a repeated key, find_many the first
+		bool present = tree.find(keys[i]) != tree.end();
+		TEST_ENSURE(present ? found[i] == lower[i] : found[i] == tree.end(), "Wrong find");
+	}
+
+	// a merge join of the keys with the tree
+	std::vector<int> joined;
+	pipelining::pipeline p = pipelining::input_vector(keys)
+		| pipelining::btree_lookup(tree, 2)
+		| pipelining::output_vector(joined);
+	p();
+	std::vector<int> expected;
+	for (int k: keys)
+		if (k >= 0 && k % 3 == 0 && k < 3 * (int)items) {
+			expected.push_back(k);
+			expected.push_back(k);
+		}
+	TEST_ENSURE(joined == expected, "Wrong join result");
+	return true;
+}
+
+// a comparator that is not recognised as arithmetic, so nodes are searched
+// through it
+struct plain_less {
+	bool operator()(int a, int b) const {return a < b;}
+};
+
+template<typename ... TT, typename ... A>
+bool node_search_test(TA<TT...>, size_t items, A && ... a) {
+	btree<int, TT...> fast(std::forward<A>(a)...);
+	btree<int, btree_internal, btree_comp<plain_less> > plain;
+	std::vector<int> x;
+	for (size_t i = 0; i < items; ++i) x.push_back((i * 7) % (items / 2) * 2);
+	std::random_shuffle(x.begin(), x.end());
+	for (int v: x) {
+		fast.insert(v);
+		plain.insert(v);
+	}
+
+	for (int k = -2; k < (int)items + 2; ++k) {
+		auto l = fast.lower_bound(k);
+		auto u = fast.upper_bound(k);
+		auto pl = plain.lower_bound(k);
+		auto pu = plain.upper_bound(k);
+		TEST_ENSURE_EQUALITY((pl == plain.end()), (l == fast.end()), "Wrong lower bound");
+		TEST_ENSURE_EQUALITY((pu == plain.end()), (u == fast.end()), "Wrong upper bound");
+		if (l != fast.end()) TEST_ENSURE_EQUALITY(*pl, *l, "Wrong lower bound");
+		if (u != fast.end()) TEST_ENSURE_EQUALITY(*pu, *u, "Wrong upper bound");
+		TEST_ENSURE_EQUALITY((plain.find(k) == plain.end()), (fast.find(k) == fast.end()), "Wrong find");
+	}
+	return true;
+}
+
+bool internal_node_search_test(size_t items) {
+	// fanouts on both sides of the linear scan limit
+	return node_search_test(TA<btree_internal, btree_fanout<4, 16> >(), items)
+		&& node_search_test(TA<btree_internal, btree_fanout<16, 64> >(), items);
+}
+
+bool internal_find_many_test(size_t items) {
+	return find_many_test(TA<btree_internal>(), items);
+}
+
+bool external_find_many_test(size_t items) {
+	temp_file tmp;
+	return find_many_test(TA<btree_external>(), items, tmp.path(), default_comp(), empty_augmenter(), 512, 16);
+}
+
+bool external_range_scan_test(size_t items, size_t prefetch) {
+	temp_file tmp;
+	btree<int, btree_external> tree(tmp.path(), default_comp(), empty_augmenter(), 512, 16);
+	std::vector<int> x(items);
+	std::iota(x.begin(), x.end(), 0);
+	std::random_shuffle(x.begin(), x.end());
+	for (int v: x) tree.insert(v);
+
+	int ranges[][2] = {{0, 10}, {-5, 100}, {1000, 20000}, {0, (int)items}, {(int)items - 3, (int)items + 10}, {50, 50}};
+	for (auto & r: ranges) {
+		auto p = tree.range(r[0], r[1], prefetch);
+		int expected = std::max(r[0], 0);
+		for (auto i = p.first; i != p.second; ++i) {
+			TEST_ENSURE_EQUALITY(expected, *i, "Wrong item in range");
+			++expected;
+		}
+		TEST_ENSURE_EQUALITY(std::min(std::max(r[1], 0), (int)items), expected, "Range ended early");
+	}
+	return true;
+}
+
+stream_size_type file_size(const std::string & path) {
+	std::ifstream f(path, std::ios::binary | std::ios::ate);
+	return f.tellg();
+}
+
+template <typename tree_t>
+stream_size_type build_large_keys(const std::string & path, const std::vector<uint64_t> & x) {
+	{
+		tree_t tree(path, default_comp(), empty_augmenter(), 512, 16);
+		for (uint64_t v: x) tree.insert(v);
+		for (size_t i = 0; i < x.size(); i += 3) tree.erase(x[i]);
+	}
+	return file_size(path);
+}
+
+bool external_compressed_test(size_t items) {
+	typedef btree<uint64_t, btree_external, btree_compressed> tree_t;
+	// keys that share their high-order bytes
+	std::vector<uint64_t> x(items);
+	for (size_t i = 0; i < items; ++i) x[i] = (uint64_t(1) << 48) + 5 * i;
+	std::random_shuffle(x.begin(), x.end());
+	std::set<uint64_t> expected(x.begin(), x.end());
+	for (size_t i = 0; i < x.size(); i += 3) expected.erase(x[i]);
+
+	temp_file tmp, plain;
+	stream_size_type compressedSize = build_large_keys<tree_t>(tmp.path(), x);
+	stream_size_type plainSize = build_large_keys<btree<uint64_t, btree_external> >(plain.path(), x);
+	TEST_ENSURE(compressedSize < plainSize, "The compressed tree is not smaller");
+
+	try {
+		// the node size of the tree is not its block size
+		tree_t tree(tmp.path(), default_comp(), empty_augmenter(), 2048);
+		TEST_FAIL("Opening with a different block size should throw");
+	} catch (const tpie::exception &) {
+	}
+
+	tree_t tree(tmp.path(), default_comp(), empty_augmenter(), 512);
+	TEST_ENSURE_EQUALITY(expected.size(), tree.size(), "The reopened tree has the wrong size");
+	TEST_ENSURE(compare(tree, expected), "Compare failed after reopening");
+	for (uint64_t v: expected) {
+		TEST_ENSURE(tree.find(v) != tree.end(), "Item not found");
+		TEST_ENSURE(tree.find(v + 1) == tree.end(), "Missing item found");
+	}
+	return true;
+}
+
+// a tree of fanout four has many levels of node buffers
+bool internal_buffered_test(size_t items) {
+	btree<int, btree_internal, btree_buffered, btree_augment<ss_augmenter> > tree;
+	tree.set_buffer_size(8);
+	std::multiset<int> expected;
+	std::mt19937 rnd(42);
+	for (size_t i = 0; i < items; ++i) {
+		int v = rnd() % (items / 2);
+		tree.insert(v);
+		expected.insert(v);
+		TEST_ENSURE_EQUALITY(expected.size(), tree.size(), "The tree has the wrong size during insert stage.");
+		if (i % 1000 == 999) {
+			int k = rnd() % (items / 2);
+			TEST_ENSURE_EQUALITY((expected.count(k) != 0), (tree.find(k) != tree.end()), "Wrong result of find");
+		}
+	}
+
+	auto i1 = tree.begin();
+	size_t rank = 0;
+	size_t sum = 0;
+	for (int v: expected) {
+		TEST_ENSURE_EQUALITY(v, *i1, "Wrong item");
+		TEST_ENSURE(rank_sum(i1) == ss_augment(rank, sum), "Wrong augmentation");
+		sum += v;
+		++rank;
+		++i1;
+	}
+	TEST_ENSURE(i1 == tree.end(), "Too many items");
+	return true;
+}
+
+template <typename tree_t>
+stream_size_type random_insert_io(const std::vector<int> & x) {
+	temp_file tmp;
+	stream_size_type before = get_bytes_read() + get_bytes_written();
+	{
+		tree_t tree(tmp.path(), default_comp(), empty_augmenter(), 512, 16);
+		for (int v: x) tree.insert(v);
+	}
+	return get_bytes_read() + get_bytes_written() - before;
+}
+
+// random inserts into a tree much larger than the cache transfer fewer
+// blocks when they are buffered in the internal nodes
+bool external_buffered_io_test(size_t items) {
+	std::vector<int> x(items);
+	for (size_t i = 0; i < items; ++i) x[i] = i;
+	std::random_shuffle(x.begin(), x.end());
+	stream_size_type plain = random_insert_io<btree<int, btree_external> >(x);
+	stream_size_type buffered = random_insert_io<btree<int, btree_external, btree_buffered> >(x);
+	log_debug() << "Unbuffered: " << plain << " bytes, buffered: " << buffered << " bytes" << std::endl;
+	TEST_ENSURE(buffered * 4 < plain, "Buffered inserts do not save I/O");
+	return true;
+}
+
+bool external_buffered_test(size_t items, size_t buffer) {
+	typedef btree<int, btree_external, btree_buffered, btree_augment<ss_augmenter> > tree_t;
+	temp_file tmp;
+	// keys repeat, so equal keys must keep their order through the buffer
+	std::vector<int> x(items);
+	for (size_t i = 0; i < items; ++i) x[i] = i / 3;
+	std::random_shuffle(x.begin(), x.end());
+	{
+		tree_t tree(tmp.path(), default_comp(), ss_augmenter(), 512, 16);
+		tree.set_buffer_size(buffer);
+		for (size_t i = 0; i < x.size(); ++i) {
+			tree.insert(x[i]);
+			TEST_ENSURE_EQUALITY(i + 1, tree.size(), "The tree has the wrong size during insert stage.");
+		}
+
+		std::vector<int> sorted(x);
+		std::sort(sorted.begin(), sorted.end());
+		auto i1 = tree.begin();
+		size_t sum = 0;
+		for (size_t i = 0; i < sorted.size(); ++i) {
+			TEST_ENSURE(rank_sum(i1) == ss_augment(i, sum), "Wrong augmentation");
+			sum += sorted[i];
+			++i1;
+		}
+		TEST_ENSURE(i1 == tree.end(), "Too many items");
+
+		// inserts after a query are buffered again and are seen by find
+		for (int v = 0; v < 10; ++v) tree.insert((int)items + v);
+		TEST_ENSURE(tree.find((int)items + 5) != tree.end(), "A buffered item was not found");
+		TEST_ENSURE_EQUALITY(3, tree.erase(7), "Wrong number of items erased");
+		for (int v = 0; v < 10; ++v) tree.insert(-v - 1);
+	}
+
+	// the destructor applies the last inserts
+	tree_t tree(tmp.path(), default_comp(), ss_augmenter(), 512, 16);
+	std::multiset<int> expected(x.begin(), x.end());
+	expected.erase(7);
+	for (int v = 0; v < 10; ++v) {
+		expected.insert((int)items + v);
+		expected.insert(-v - 1);
+	}
+	TEST_ENSURE_EQUALITY(expected.size(), tree.size(), "The reopened tree has the wrong size");
+	TEST_ENSURE(compare(tree, expected), "Compare failed after reopening");
+	return true;
+}
+
+bool external_snapshot_test(size_t items) {
+	typedef btree<int, btree_external> tree_t;
+	temp_file tmp;
+	std::vector<int> x(items);
+	std::iota(x.begin(), x.end(), 0);
+	std::random_shuffle(x.begin(), x.end());
+
+	set<int> current, first, second;
+	std::unique_ptr<tree_t> last;
+	{
+		tree_t tree(tmp.path(), default_comp(), empty_augmenter(), 512, 16);
+		{
+			// a rejected change leaves an empty snapshot empty
+			tree_t empty = tree.snapshot();
+			try {
+				empty.insert(1);
+				TEST_FAIL("Changing a snapshot should throw");
+			} catch (const tpie::exception &) {
+			}
+			TEST_ENSURE_EQUALITY(0, empty.size(), "A rejected insert changed the size");
+			TEST_ENSURE(empty.begin() == empty.end(), "A rejected insert changed the snapshot");
+		}
+		for (size_t i = 0; i < items / 2; ++i) {
+			tree.insert(x[i]);
+			current.insert(x[i]);
+		}
+		first = current;
+		tree_t s1 = tree.snapshot();
+
+		// grow the tree, splitting nodes the snapshot sees
+		for (size_t i = items / 2; i < items; ++i) {
+			tree.insert(x[i]);
+			current.insert(x[i]);
+		}
+		second = current;
+		tree_t s2 = tree.snapshot();
+
+		// shrink it, merging and freeing nodes both snapshots see
+		for (size_t i = 0; i < items; i += 2) {
+			tree.erase(x[i]);
+			current.erase(x[i]);
+		}
+		TEST_ENSURE(compare(tree, current), "Compare failed on the tree");
+		TEST_ENSURE(compare(s1, first), "Compare failed on the first snapshot");
+		TEST_ENSURE(compare(s2, second), "Compare failed on the second snapshot");
+		TEST_ENSURE_EQUALITY(first.size(), s1.size(), "The first snapshot has the wrong size");
+		for (int v: first) TEST_ENSURE(s1.find(v) != s1.end(), "Item not found in snapshot");
+
+		try {
+			s1.insert(-1);
+			TEST_FAIL("Changing a snapshot should throw");
+		} catch (const tpie::exception &) {
+		}
+		try {
+			s1.erase(*s1.begin());
+			TEST_FAIL("Changing a snapshot should throw");
+		} catch (const tpie::exception &) {
+		}
+		TEST_ENSURE_EQUALITY(first.size(), s1.size(), "A rejected change altered the snapshot size");
+
+		{
+			// releasing the older snapshot keeps the copies the newer reads
+			tree_t moved(std::move(s1));
+		}
+		for (size_t i = 1; i < items; i += 4) {
+			tree.erase(x[i]);
+			current.erase(x[i]);
+		}
+		TEST_ENSURE(compare(s2, second), "Compare failed after releasing a snapshot");
+
+		last.reset(new tree_t(tree.snapshot()));
+		tree.insert(-1);
+	}
+
+	// the snapshot outlives the tree
+	TEST_ENSURE(compare(*last, current), "Compare failed on a snapshot of a closed tree");
+	last.reset();
+
+	current.insert(-1);
+	tree_t tree(tmp.path());
+	TEST_ENSURE(compare(tree, current), "Compare failed after reopening");
+	return true;
+}
+
+bool external_serialized_test(size_t items) {
+	typedef serialization_btree<int, std::string> tree_t;
+	temp_file tmp;
+	std::map<int, std::string> reference;
+	std::mt19937 rng(11);
+	{
+		tree_t tree(tmp.path());
+		for (size_t i = 0; i < items; ++i) {
+			int k = rng() % items;
+			// values that fit in the leaf, in a shared page, or span several pages
+			size_t length = rng() % 10 == 0 ? rng() % 20000 : rng() % 3 == 0 ? rng() % 4200 : rng() % 40;
+			std::string v(length, static_cast<char>('a' + k % 26));
+			if (!v.empty()) v[rng() % v.size()] = 'X';
+			bool added = reference.insert(std::make_pair(k, v)).second;
+			reference[k] = v;
+			TEST_ENSURE_EQUALITY(added, tree.insert(k, v), "insert() reported the wrong result");
+			if (i % 3 == 0) {
+				int e = rng() % items;
+				TEST_ENSURE_EQUALITY((reference.erase(e) == 1), tree.erase(e), "erase() reported the wrong result");
+			}
+		}
+		TEST_ENSURE_EQUALITY(reference.size(), tree.size(), "Wrong size");
+		for (int k = 0; k < static_cast<int>(items); ++k) {
+			std::string v;
+			auto i = reference.find(k);
+			TEST_ENSURE_EQUALITY((i != reference.end()), tree.find(k, v), "find() reported the wrong result");
+			if (i != reference.end()) TEST_ENSURE(v == i->second, "Wrong value");
+		}
+	}
+
+	tree_t tree(tmp.path());
+	TEST_ENSURE_EQUALITY(reference.size(), tree.size(), "Wrong size after reopening");
+	auto r = reference.begin();
+	for (auto i = tree.begin(); i != tree.end(); ++i, ++r) {
+		TEST_ENSURE_EQUALITY(r->first, i.key(), "Wrong key after reopening");
+		TEST_ENSURE(i.value() == r->second, "Wrong value after reopening");
+	}
+	TEST_ENSURE(r == reference.end(), "Missing keys after reopening");
+	return true;
+}
+
+// values of a few hundred bytes share pages, and the space of removed
+// values is used again, also after reopening
+bool external_serialized_shared_test(size_t items) {
+	typedef serialization_btree<int, std::string> tree_t;
+	temp_file tmp;
+	std::map<int, std::string> reference;
+	std::mt19937 rng(13);
+	std::string values = tmp.path() + ".values";
+	for (size_t round = 0; round < 3; ++round) {
+		tree_t tree(tmp.path());
+		for (size_t i = 0; i < items; ++i) {
+			int k = rng() % (2 * items);
+			std::string v(100 + rng() % 200, static_cast<char>('a' + k % 26));
+			v[rng() % v.size()] = 'X';
+			reference[k] = v;
+			tree.insert(k, v);
+			int e = rng() % (2 * items);
+			TEST_ENSURE_EQUALITY((reference.erase(e) == 1), tree.erase(e), "erase() reported the wrong result");
+		}
+		TEST_ENSURE_EQUALITY(reference.size(), tree.size(), "Wrong size");
+		auto r = reference.begin();
+		for (auto i = tree.begin(); i != tree.end(); ++i, ++r) {
+			TEST_ENSURE_EQUALITY(r->first, i.key(), "Wrong key");
+			TEST_ENSURE(i.value() == r->second, "Wrong value");
+		}
+		TEST_ENSURE(r == reference.end(), "Missing keys");
+
+		file_accessor::raw_file_accessor f;
+		f.open_ro(values);
+		stream_size_type size = f.file_size_i();
+		f.close_i();
+		// about 200 bytes of each value are outside the leaf, and the pages
+		// are at least half full
+		TEST_ENSURE(size <= 2 * 200 * reference.size() + 4096, "The values take too much space");
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.test(internal_basic_test, "internal_basic")
@@ -487,12 +1028,28 @@ int main(int argc, char **argv) {
 		.test(internal_static_test, "internal_static")
 		.test(internal_unordered_test, "internal_unordered")
 		.test(internal_bound_test, "internal_bound")
+		.test(internal_find_many_test, "internal_find_many", "items", static_cast<size_t>(5000))
+		.test(internal_node_search_test, "internal_node_search", "items", static_cast<size_t>(20000))
+		.test(internal_buffered_test, "internal_buffered", "items", static_cast<size_t>(20000))
 		.test(external_basic_test, "external_basic")
 		.test(external_iterator_test, "external_iterator")
 		.test(external_key_and_comparator_test, "external_key_and_compare")
 		.test(external_augment_test, "external_augment")
         .test(external_build_test, "external_build")
-		.test(external_bound_test, "external_bound");
+		.test(external_bound_test, "external_bound")
+		.test(external_block_size_test, "external_block_size")
+		.test(external_concurrent_test, "external_concurrent", "threads", static_cast<size_t>(4))
+		.test(external_bulk_load_test, "external_bulk_load", "items", static_cast<size_t>(100000), "fill", 0.9)
+		.test(external_pipelined_build_test, "external_pipelined_build", "items", static_cast<size_t>(50000))
+		.test(external_range_scan_test, "external_range_scan", "items", static_cast<size_t>(50000), "prefetch", static_cast<size_t>(8))
+		.test(external_range_scan_test, "external_range_scan_wide", "items", static_cast<size_t>(200000), "prefetch", static_cast<size_t>(100))
+		.test(external_compressed_test, "external_compressed", "items", static_cast<size_t>(50000))
+		.test(external_buffered_test, "external_buffered", "items", static_cast<size_t>(30000), "buffer", static_cast<size_t>(1000))
+		.test(external_buffered_io_test, "external_buffered_io", "items", static_cast<size_t>(100000))
+		.test(external_find_many_test, "external_find_many", "items", static_cast<size_t>(20000))
+		.test(external_snapshot_test, "external_snapshot", "items", static_cast<size_t>(20000))
+		.test(external_serialized_test, "external_serialized", "items", static_cast<size_t>(3000))
+		.test(external_serialized_shared_test, "external_serialized_shared", "items", static_cast<size_t>(2000));
 }
 
 
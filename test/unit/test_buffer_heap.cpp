@@ -0,0 +1,159 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/buffer_heap.h>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace tpie;
+
+typedef buffer_heap<uint64_t, uint64_t> heap_t;
+
+// Compare a buffer_heap against std::map and std::set under a random mix of
+// decrease_key, erase and pop.
+bool basic_test(size_t operations, size_t keys, size_t mmavail, size_t blockSize) {
+	heap_t heap(mmavail, blockSize);
+	std::map<uint64_t, uint64_t> index;
+	std::set<std::pair<uint64_t, uint64_t> > order;
+	std::mt19937 rng(42);
+
+	for (size_t i = 0; i < operations; ++i) {
+		// Push more than pop in the first half and pop more in the second.
+		size_t popWeight = i < operations / 2 ? 2 : 5;
+		size_t r = rng() % 10;
+		uint64_t key = rng() % keys;
+		if (r < popWeight) {
+			if (order.empty()) {
+				TEST_ENSURE(heap.empty(), "Heap should be empty");
+				continue;
+			}
+			TEST_ENSURE(!heap.empty(), "Heap should not be empty");
+			std::pair<uint64_t, uint64_t> expected = *order.begin();
+			heap_t::value_type actual = heap.top();
+			if (actual.second != expected.first) {
+				log_error() << "Operation " << i << ": expected priority " << expected.first
+							<< ", got " << actual.second << std::endl;
+				return false;
+			}
+			TEST_ENSURE(index.count(actual.first) && index[actual.first] == actual.second,
+						"Wrong key returned by top()");
+			order.erase(std::make_pair(actual.second, actual.first));
+			index.erase(actual.first);
+			heap.pop();
+		} else if (r < 8) {
+			uint64_t priority = rng() % (keys * 4);
+			std::map<uint64_t, uint64_t>::iterator j = index.find(key);
+			if (j == index.end()) {
+				index[key] = priority;
+				order.insert(std::make_pair(priority, key));
+			} else if (priority < j->second) {
+				order.erase(std::make_pair(j->second, key));
+				j->second = priority;
+				order.insert(std::make_pair(priority, key));
+			}
+			heap.decrease_key(key, priority);
+		} else {
+			std::map<uint64_t, uint64_t>::iterator j = index.find(key);
+			if (j != index.end()) {
+				order.erase(std::make_pair(j->second, key));
+				index.erase(j);
+			}
+			heap.erase(key);
+		}
+	}
+
+	while (!order.empty()) {
+		TEST_ENSURE(!heap.empty(), "Heap should not be empty");
+		TEST_ENSURE_EQUALITY(order.begin()->first, heap.top().second, "Wrong priority");
+		order.erase(order.begin());
+		heap.pop();
+	}
+	TEST_ENSURE(heap.empty(), "Heap should be empty");
+	return true;
+}
+
+// Single source shortest paths on a random graph, using decrease_key instead
+// of inserting duplicates.
+bool dijkstra_test(size_t nodes, size_t degree, size_t mmavail) {
+	std::mt19937 rng(1337);
+	std::vector<std::vector<std::pair<uint64_t, uint64_t> > > edges(nodes);
+	for (size_t u = 0; u < nodes; ++u) {
+		edges[u].push_back(std::make_pair((u + 1) % nodes, 1000));
+		for (size_t i = 1; i < degree; ++i)
+			edges[u].push_back(std::make_pair(rng() % nodes, rng() % 100));
+	}
+
+	const uint64_t infinity = std::numeric_limits<uint64_t>::max();
+	std::vector<uint64_t> expected(nodes, infinity);
+	{
+		typedef std::pair<uint64_t, uint64_t> item_t;
+		std::priority_queue<item_t, std::vector<item_t>, std::greater<item_t> > pq;
+		expected[0] = 0;
+		pq.push(item_t(0, 0));
+		while (!pq.empty()) {
+			item_t x = pq.top();
+			pq.pop();
+			if (x.first != expected[x.second]) continue;
+			for (size_t i = 0; i < edges[x.second].size(); ++i) {
+				uint64_t v = edges[x.second][i].first;
+				uint64_t d = x.first + edges[x.second][i].second;
+				if (d < expected[v]) {
+					expected[v] = d;
+					pq.push(item_t(d, v));
+				}
+			}
+		}
+	}
+
+	std::vector<uint64_t> distance(nodes, infinity);
+	std::vector<bool> settled(nodes, false);
+	heap_t heap(mmavail, 4096);
+	heap.decrease_key(0, 0);
+	while (!heap.empty()) {
+		heap_t::value_type x = heap.top();
+		heap.pop();
+		TEST_ENSURE(!settled[x.first], "Node popped twice");
+		settled[x.first] = true;
+		distance[x.first] = x.second;
+		for (size_t i = 0; i < edges[x.first].size(); ++i) {
+			uint64_t v = edges[x.first][i].first;
+			if (!settled[v]) heap.decrease_key(v, x.second + edges[x.first][i].second);
+		}
+	}
+
+	TEST_ENSURE(distance == expected, "Wrong distances");
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(basic_test, "basic",
+			  "operations", static_cast<size_t>(300000),
+			  "keys", static_cast<size_t>(50000),
+			  "mmavail", static_cast<size_t>(256*1024),
+			  "blocksize", static_cast<size_t>(4096))
+		.test(dijkstra_test, "dijkstra",
+			  "nodes", static_cast<size_t>(100000),
+			  "degree", static_cast<size_t>(4),
+			  "mmavail", static_cast<size_t>(256*1024));
+}
@@ -19,6 +19,11 @@
 #include "common.h"
 #include <tpie/priority_queue.h>
 #include <vector>
+#include <set>
+#include <random>
+#include <iterator>
+#include <atomic>
+#include <thread>
 #include "priority_queue.h"
 #include "../test_portability.h"
 
@@ -286,6 +291,233 @@ bool remove_group_buffer_test(memory_size_type mmAvail, float blockFact, stream_
 	return cyclic_pq_test(pq, items, iterations);
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Mix push_batch, pop_batch, pop_until and single element operations, and
+// compare against std::multiset.
+///////////////////////////////////////////////////////////////////////////////
+bool batch_test(memory_size_type mmAvail, float blockFact, stream_size_type iterations) {
+	ami::priority_queue<uint64_t> pq(mmAvail, blockFact);
+	std::multiset<uint64_t> expect;
+	std::mt19937 rnd(42);
+	std::vector<uint64_t> items;
+	for (stream_size_type i = 0; i < iterations; ++i) {
+		memory_size_type n = rnd() % 500;
+		items.clear();
+		switch (rnd() % 5) {
+			case 0:
+			case 1:
+				for (memory_size_type j = 0; j < n; ++j) items.push_back(rnd() % 100000);
+				pq.push_batch(array_view<const uint64_t>(items));
+				expect.insert(items.begin(), items.end());
+				break;
+			case 2: {
+				pq.pop_batch(std::back_inserter(items), n);
+				TEST_ENSURE_EQUALITY(std::min(n, static_cast<memory_size_type>(expect.size())), items.size(), "pop_batch size");
+				std::multiset<uint64_t>::iterator e = expect.begin();
+				for (memory_size_type j = 0; j < items.size(); ++j, ++e)
+					TEST_ENSURE_EQUALITY(*e, items[j], "pop_batch item");
+				expect.erase(expect.begin(), e);
+				break;
+			}
+			case 3: {
+				// Keep the queue growing, so the insertion heap is flushed.
+				uint64_t key = rnd() % 1000;
+				pq.pop_until(key, std::back_inserter(items));
+				std::multiset<uint64_t>::iterator e = expect.lower_bound(key);
+				TEST_ENSURE_EQUALITY(static_cast<memory_size_type>(std::distance(expect.begin(), e)), items.size(), "pop_until size");
+				TEST_ENSURE(std::equal(items.begin(), items.end(), expect.begin()), "pop_until items");
+				expect.erase(expect.begin(), e);
+				break;
+			}
+			case 4:
+				if (rnd() % 2 || expect.empty()) {
+					uint64_t x = rnd() % 100000;
+					pq.push(x);
+					expect.insert(x);
+				} else {
+					TEST_ENSURE_EQUALITY(*expect.begin(), pq.top(), "top");
+					pq.pop();
+					expect.erase(expect.begin());
+				}
+				break;
+		}
+		TEST_ENSURE_EQUALITY(expect.size(), pq.size(), "size");
+	}
+	items.clear();
+	pq.pop_batch(std::back_inserter(items), std::numeric_limits<memory_size_type>::max());
+	TEST_ENSURE(pq.empty(), "not empty");
+	TEST_ENSURE(std::equal(items.begin(), items.end(), expect.begin()) && items.size() == expect.size(), "final items");
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Merge random sorted runs, some of them empty, with pq_loser_tree.
+///////////////////////////////////////////////////////////////////////////////
+bool loser_tree_test(memory_size_type runs, stream_size_type iterations) {
+	std::mt19937 rnd(42);
+	for (stream_size_type i = 0; i < iterations; ++i) {
+		memory_size_type k = 1 + rnd() % runs;
+		std::vector<std::vector<uint64_t> > data(k);
+		std::vector<uint64_t> expect;
+		for (memory_size_type j = 0; j < k; ++j) {
+			data[j].resize(rnd() % 50);
+			for (memory_size_type l = 0; l < data[j].size(); ++l) data[j][l] = rnd() % 100;
+			std::sort(data[j].begin(), data[j].end());
+			expect.insert(expect.end(), data[j].begin(), data[j].end());
+		}
+		std::sort(expect.begin(), expect.end());
+
+		pq_loser_tree<uint64_t> tree(k);
+		std::vector<memory_size_type> pos(k, 1);
+		for (memory_size_type j = 0; j < k; ++j)
+			if (!data[j].empty()) tree.push(data[j][0], j);
+		std::vector<uint64_t> merged;
+		while (!tree.empty()) {
+			memory_size_type run = tree.top_run();
+			merged.push_back(tree.top());
+			if (pos[run] == data[run].size()) tree.pop();
+			else tree.pop_and_push(data[run][pos[run]++], run);
+		}
+		TEST_ENSURE(merged == expect, "merged runs differ");
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Use pq_overflow_heap with a tiny insertion heap, so that it forms many
+// sequences and compacts them, and compare against std::multiset.
+///////////////////////////////////////////////////////////////////////////////
+bool overflow_heap_test(memory_size_type maxSize, memory_size_type heapSize, stream_size_type iterations) {
+	pq_overflow_heap<uint64_t> opq(maxSize, std::less<uint64_t>(), heapSize);
+	std::multiset<uint64_t> expect;
+	std::mt19937 rnd(42);
+	std::vector<uint64_t> items;
+	for (stream_size_type i = 0; i < iterations; ++i) {
+		switch (rnd() % 8) {
+			case 0: {
+				items.clear();
+				memory_size_type n = rnd() % (maxSize - expect.size() + 1);
+				for (memory_size_type j = 0; j < n; ++j) items.push_back(rnd() % 1000);
+				opq.push_batch(items.data(), items.data() + n);
+				expect.insert(items.begin(), items.end());
+				break;
+			}
+			case 1:
+				if (opq.full()) {
+					uint64_t * a = opq.sorted_array();
+					TEST_ENSURE_EQUALITY(expect.size(), opq.sorted_size(), "sorted_size");
+					TEST_ENSURE(std::equal(a, a + opq.sorted_size(), expect.begin()), "sorted_array");
+					opq.sorted_pop();
+					expect.clear();
+				}
+				break;
+			case 2:
+			case 3:
+			case 4:
+				if (!opq.full()) {
+					uint64_t x = rnd() % 1000;
+					opq.push(x);
+					expect.insert(x);
+				}
+				break;
+			default:
+				for (memory_size_type n = rnd() % 20; n > 0 && !expect.empty(); --n) {
+					TEST_ENSURE_EQUALITY(*expect.begin(), opq.top(), "top");
+					opq.pop();
+					expect.erase(expect.begin());
+				}
+				break;
+		}
+		TEST_ENSURE_EQUALITY(expect.size(), opq.size(), "size");
+		TEST_ENSURE(!opq.full() || expect.size() > maxSize - maxSize / 4, "full with room to spare");
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Merge full groups on worker threads, with enough items that the higher
+// groups are merged too.
+///////////////////////////////////////////////////////////////////////////////
+bool background_test(memory_size_type mmAvail, float blockFact, memory_size_type merges, stream_size_type items) {
+	ami::priority_queue<uint64_t, bit_pertume_compare< std::greater<uint64_t> > > pq(mmAvail, blockFact, merges);
+	return basic_pq_test(pq, items);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Pop the least item and push later items, as in an event simulation, so the
+// deletion buffer is refilled while merges into other groups are running.
+///////////////////////////////////////////////////////////////////////////////
+bool background_cyclic_test(memory_size_type mmAvail, float blockFact, memory_size_type merges,
+							stream_size_type items, stream_size_type iterations) {
+	ami::priority_queue<uint64_t> pq(mmAvail, blockFact, merges);
+	std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t> > expect;
+	std::mt19937 rnd(42);
+	for (stream_size_type i = 0; i < items; ++i) {
+		uint64_t x = rnd() % items;
+		pq.push(x);
+		expect.push(x);
+	}
+	for (stream_size_type i = 0; i < iterations; ++i) {
+		TEST_ENSURE_EQUALITY(expect.size(), pq.size(), "size");
+		TEST_ENSURE_EQUALITY(expect.top(), pq.top(), "top");
+		uint64_t x = pq.top();
+		pq.pop();
+		expect.pop();
+		for (memory_size_type j = (i % 4 == 0) ? 2 : 1; j > 0; --j) {
+			uint64_t y = x + rnd() % items;
+			pq.push(y);
+			expect.push(y);
+		}
+	}
+	while (!expect.empty()) {
+		TEST_ENSURE_EQUALITY(expect.top(), pq.top(), "top");
+		pq.pop();
+		expect.pop();
+	}
+	TEST_ENSURE(pq.empty(), "empty");
+	return true;
+}
+
+std::atomic<bool> failing_compare_fail(false);
+std::thread::id failing_compare_thread;
+
+///////////////////////////////////////////////////////////////////////////////
+// Compares as std::less, but throws on worker threads once
+// failing_compare_fail is set.
+///////////////////////////////////////////////////////////////////////////////
+struct failing_compare {
+	bool operator()(uint64_t a, uint64_t b) const {
+		if (failing_compare_fail && std::this_thread::get_id() != failing_compare_thread)
+			throw std::runtime_error("Comparison failed");
+		return a < b;
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+// An exception thrown by a background merge is rethrown by the queue
+// operation waiting for the merge.
+///////////////////////////////////////////////////////////////////////////////
+bool background_exception_test(memory_size_type mmAvail, float blockFact, memory_size_type merges,
+							   stream_size_type items) {
+	failing_compare_thread = std::this_thread::get_id();
+	failing_compare_fail = true;
+	bool thrown = false;
+	{
+		ami::priority_queue<uint64_t, failing_compare> pq(mmAvail, blockFact, merges);
+		std::mt19937 rnd(42);
+		try {
+			for (stream_size_type i = 0; i < items; ++i) pq.push(rnd());
+			while (!pq.empty()) pq.pop();
+		} catch (std::runtime_error & e) {
+			log_debug() << "Caught: " << e.what() << std::endl;
+			thrown = true;
+		}
+	}
+	failing_compare_fail = false;
+	TEST_ENSURE(thrown, "exception of background merge not rethrown");
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv, 128)
 		.test(basic_test, "basic")
@@ -301,5 +533,32 @@ int main(int argc, char **argv) {
 			  "blockfact", 0.000244141f,
 			  "items", static_cast<stream_size_type>(5000),
 			  "iterations", static_cast<stream_size_type>(100000))
+		.test(batch_test, "batch",
+			  "mmavail", static_cast<memory_size_type>(4000000),
+			  "blockfact", 0.001f,
+			  "iterations", static_cast<stream_size_type>(20000))
+		.test(loser_tree_test, "loser_tree",
+			  "runs", static_cast<memory_size_type>(40),
+			  "iterations", static_cast<stream_size_type>(2000))
+		.test(overflow_heap_test, "overflow_heap",
+			  "maxsize", static_cast<memory_size_type>(1000),
+			  "heapsize", static_cast<memory_size_type>(16),
+			  "iterations", static_cast<stream_size_type>(200000))
+		.test(background_test, "background",
+			  "mmavail", static_cast<memory_size_type>(150000),
+			  "blockfact", 0.001f,
+			  "merges", static_cast<memory_size_type>(2),
+			  "items", static_cast<stream_size_type>(1000000))
+		.test(background_cyclic_test, "background_cyclic",
+			  "mmavail", static_cast<memory_size_type>(150000),
+			  "blockfact", 0.001f,
+			  "merges", static_cast<memory_size_type>(2),
+			  "items", static_cast<stream_size_type>(100000),
+			  "iterations", static_cast<stream_size_type>(1000000))
+		.test(background_exception_test, "background_exception",
+			  "mmavail", static_cast<memory_size_type>(150000),
+			  "blockfact", 0.001f,
+			  "merges", static_cast<memory_size_type>(2),
+			  "items", static_cast<stream_size_type>(1000000))
 		;
 }
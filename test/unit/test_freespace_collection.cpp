@@ -108,8 +108,104 @@ bool size_test(memory_size_type size, memory_size_type block_size) {
 	return true;
 }
 
+bool coalesce_test(memory_size_type size, memory_size_type block_size) {
+	temp_file file;
+	freespace_collection collection(file.path(), block_size);
+	std::vector<block_handle> handles;
+	for(memory_size_type i = 0; i < size; ++i)
+		handles.push_back(collection.alloc());
+
+	std::random_shuffle(handles.begin(), handles.end(), random_generator);
+	for(memory_size_type i = 0; i < size; ++i) {
+		collection.free(handles[i]);
+		// every free extent is followed by a used block
+		TEST_ENSURE(collection.free_extents() <= size - i - 1, "Adjacent free blocks were not merged");
+	}
+	TEST_ENSURE_EQUALITY(0, collection.size(), "The end of the file was not given back");
+	TEST_ENSURE_EQUALITY(0, collection.free_space(), "Free space left after freeing everything");
+	return true;
+}
+
+bool multiple_sizes_test(memory_size_type size, memory_size_type block_size) {
+	typedef std::vector<block_handle> handles_t;
+	temp_file file;
+	freespace_collection collection(file.path(), block_size);
+	handles_t handles;
+	stream_size_type used = 0;
+
+	for(memory_size_type i = 0; i < size; ++i) {
+		memory_size_type s = block_size * random(i, 1, 8);
+		block_handle handle = collection.alloc(s);
+		TEST_ENSURE_EQUALITY(s, handle.size, "The size of the returned handle is wrong");
+		for(handles_t::iterator j = handles.begin(); j != handles.end(); ++j)
+			TEST_ENSURE(!overlaps(handle, *j), "The returned handle overlaps with an existing handle");
+		handles.push_back(handle);
+		used += s;
+
+		// free every third block, so later blocks reuse the holes
+		if(i % 3 == 2) {
+			memory_size_type k = random(i, 0, handles.size());
+			collection.free(handles[k]);
+			used -= handles[k].size;
+			handles.erase(handles.begin() + k);
+		}
+		TEST_ENSURE_EQUALITY(collection.size(), used + collection.free_space(), "Space is lost");
+	}
+	return true;
+}
+
+bool persist_test(memory_size_type size, memory_size_type block_size) {
+	temp_file file;
+	std::vector<block_handle> handles;
+	stream_size_type end;
+	stream_size_type free_space;
+	{
+		freespace_collection collection(file.path(), block_size);
+		for(memory_size_type i = 0; i < size; ++i)
+			handles.push_back(collection.alloc());
+		for(memory_size_type i = 0; i < size; i += 2)
+			collection.free(handles[i]);
+		end = collection.size();
+		free_space = collection.free_space();
+	}
+
+	freespace_collection collection(file.path(), block_size);
+	TEST_ENSURE_EQUALITY(end, collection.size(), "The end of the file was not saved");
+	TEST_ENSURE_EQUALITY(free_space, collection.free_space(), "The free space was not saved");
+	for(memory_size_type i = 0; i < size; i += 2) {
+		block_handle handle = collection.alloc();
+		TEST_ENSURE(handle.position < end, "The saved free space was not reused");
+		for(memory_size_type j = 1; j < size; j += 2)
+			TEST_ENSURE(!overlaps(handle, handles[j]), "The returned handle overlaps with a saved handle");
+	}
+	TEST_ENSURE_EQUALITY(0, collection.free_space(), "Free space left after filling the holes");
+	return true;
+}
+
+bool near_test(memory_size_type size, memory_size_type block_size) {
+	temp_file file;
+	freespace_collection collection(file.path(), block_size);
+	std::vector<block_handle> handles;
+	for(memory_size_type i = 0; i < size; ++i)
+		handles.push_back(collection.alloc());
+
+	// free single blocks spread over the file
+	for(memory_size_type i = 1; i + 1 < size; i += 4)
+		collection.free(handles[i]);
+
+	for(memory_size_type i = 4; i + 1 < size; i += 8) {
+		block_handle handle = collection.alloc(block_size, handles[i].position);
+		TEST_ENSURE_EQUALITY(handles[i + 1].position, handle.position, "The adjacent free block was not used");
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
 	return tpie::tests(argc, argv)
 		.test(alloc_test, "alloc", "size", 1000, "block_size", 1024)
-		.test(size_test, "size", "size", 1000, "block_size", 1024);
+		.test(size_test, "size", "size", 1000, "block_size", 1024)
+		.test(coalesce_test, "coalesce", "size", 1000, "block_size", 1024)
+		.test(multiple_sizes_test, "multiple_sizes", "size", 1000, "block_size", 1024)
+		.test(persist_test, "persist", "size", 1000, "block_size", 1024)
+		.test(near_test, "near", "size", 1000, "block_size", 1024);
 }
\ No newline at end of file
@@ -19,9 +19,13 @@
 
 #include "common.h"
 #include <tpie/pipelining/merge_sorter.h>
+#include <tpie/pipelining/tag_sorter.h>
 #include <tpie/parallel_sort.h>
 #include <tpie/sysinfo.h>
+#include <tpie/tempname.h>
+#include <boost/filesystem.hpp>
 #include <random>
+#include <fstream>
 
 using namespace tpie;
 
@@ -151,6 +155,293 @@ bool tall_tree_test(size_t fanout, size_t height) {
 	return true;
 }
 
+struct combine_item_less {
+	bool operator()(const std::pair<size_t, size_t> & a, const std::pair<size_t, size_t> & b) const {
+		return a.first < b.first;
+	}
+};
+
+struct combine_item_sum {
+	std::pair<size_t, size_t> operator()(const std::pair<size_t, size_t> & a, const std::pair<size_t, size_t> & b) const {
+		return std::make_pair(a.first, a.second + b.second);
+	}
+};
+
+bool combine_test(size_t keys, size_t runLength, size_t fanout) {
+	typedef std::pair<size_t, size_t> item_t;
+	merge_sorter<item_t, false, combine_item_less, default_store, combine_item_sum> s;
+	s.set_parameters(runLength, fanout);
+	s.begin();
+	// Key i occurs i+1 times, in an order that spreads duplicates over runs.
+	const size_t copies = keys;
+	for (size_t c = 0; c < copies; ++c)
+		for (size_t i = keys; i--;)
+			if (c <= i) s.push(std::make_pair(i, static_cast<size_t>(1)));
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	size_t expectKey = 0;
+	while (s.can_pull()) {
+		item_t x = s.pull();
+		TEST_ENSURE_EQUALITY(expectKey, x.first, "Wrong key");
+		TEST_ENSURE_EQUALITY(x.first + 1, x.second, "Wrong combined count");
+		++expectKey;
+	}
+	TEST_ENSURE_EQUALITY(keys, expectKey, "Wrong number of keys");
+	return true;
+}
+
+bool limit_test(size_t items, size_t limit, size_t runLength, size_t fanout) {
+	std::mt19937 rng;
+	std::vector<size_t> input(items);
+	for (size_t i = 0; i < items; ++i) input[i] = rng();
+	merge_sorter<size_t, false> s;
+	s.set_parameters(runLength, fanout);
+	s.set_limit(limit);
+	s.begin();
+	for (size_t i = 0; i < items; ++i) s.push(input[i]);
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	std::sort(input.begin(), input.end());
+	size_t expected = std::min(items, limit);
+	size_t i = 0;
+	while (s.can_pull()) {
+		TEST_ENSURE(i < expected, "Too many items reported");
+		TEST_ENSURE_EQUALITY(input[i], s.pull(), "Wrong item reported");
+		++i;
+	}
+	TEST_ENSURE_EQUALITY(expected, i, "Wrong number of items reported");
+	return true;
+}
+
+bool limit_combine_test(size_t keys, size_t limit, size_t copies) {
+	typedef std::pair<size_t, size_t> item_t;
+	merge_sorter<item_t, false, combine_item_less, default_store, combine_item_sum> s;
+	s.set_parameters(keys, 4);
+	s.set_limit(limit);
+	s.begin();
+	// Every run holds every key, so the smallest keys of one run do not
+	// bound the smallest keys after combining.
+	for (size_t c = 0; c < copies; ++c)
+		for (size_t i = keys; i--;)
+			s.push(std::make_pair(i, static_cast<size_t>(1)));
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	size_t expectKey = 0;
+	while (s.can_pull()) {
+		item_t x = s.pull();
+		TEST_ENSURE_EQUALITY(expectKey, x.first, "Wrong key");
+		TEST_ENSURE_EQUALITY(copies, x.second, "Wrong combined count");
+		++expectKey;
+	}
+	TEST_ENSURE_EQUALITY(std::min(keys, limit), expectKey, "Wrong number of keys");
+	return true;
+}
+
+bool presorted_test(size_t segments) {
+	const memory_size_type runLength = 1024;
+	const size_t items = 100 * runLength;
+	const stream_size_type presortedBefore = get_sort_presorted_runs();
+	const stream_size_type extendedBefore = get_sort_extended_runs();
+	merge_sorter<size_t, false> s;
+	s.set_parameters(runLength, 4);
+	s.begin();
+	// Interleave `segments` sorted sequences in long consecutive segments.
+	const size_t segmentLength = items / segments;
+	for (size_t i = 0; i < segments; ++i)
+		for (size_t j = 0; j < segmentLength; ++j)
+			s.push(j * segments + i);
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	size_t expect = 0;
+	while (s.can_pull()) {
+		TEST_ENSURE_EQUALITY(expect, s.pull(), "Wrong item reported");
+		++expect;
+	}
+	TEST_ENSURE_EQUALITY(segmentLength * segments, expect, "Wrong number of items reported");
+	const stream_size_type presorted = get_sort_presorted_runs() - presortedBefore;
+	const stream_size_type extended = get_sort_extended_runs() - extendedBefore;
+	log_debug() << "Presorted run buffers: " << presorted << ", extended runs: " << extended << std::endl;
+	// Each run buffer that does not contain a segment boundary is presorted,
+	// and all but the first buffer of each segment extend the current run.
+	TEST_ENSURE(presorted + segments >= items / runLength, "Too few presorted run buffers detected");
+	TEST_ENSURE(extended + 2 * segments >= items / runLength, "Too few runs extended");
+	return true;
+}
+
+// A permutation of [0, items) in which no run buffer is presorted.
+size_t checkpoint_item(size_t i, size_t items) {
+	return (i * 7919) % items;
+}
+
+bool checkpoint_pull(merge_sorter<size_t, false> & s, size_t items, const std::string & manifest) {
+	size_t expect = 0;
+	while (s.can_pull()) {
+		TEST_ENSURE_EQUALITY(expect, s.pull(), "Wrong item reported");
+		++expect;
+	}
+	TEST_ENSURE_EQUALITY(items, expect, "Wrong number of items reported");
+	TEST_ENSURE(!boost::filesystem::exists(manifest), "Manifest not removed");
+	return true;
+}
+
+bool checkpoint_run_formation_test() {
+	const size_t items = 20000;
+	const memory_size_type runLength = 1000;
+	std::string manifest = tempname::tpie_name("checkpoint");
+	{
+		// Simulate a crash in phase 1.
+		merge_sorter<size_t, false> s;
+		s.set_parameters(runLength, 4);
+		s.set_checkpoint(manifest);
+		s.begin();
+		for (size_t i = 0; i < items / 2 + runLength / 2; ++i)
+			s.push(checkpoint_item(i, items));
+	}
+	merge_sorter<size_t, false> s;
+	TEST_ENSURE(s.resume(manifest), "Could not resume");
+	TEST_ENSURE(s.resumed_run_formation(), "Not resumed in phase 1");
+	TEST_ENSURE_EQUALITY(items / 2, s.resumed_item_count(), "Wrong number of items resumed");
+	for (size_t i = static_cast<size_t>(s.resumed_item_count()); i < items; ++i)
+		s.push(checkpoint_item(i, items));
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	return checkpoint_pull(s, items, manifest);
+}
+
+bool checkpoint_merge_test() {
+	const size_t items = 20000;
+	std::string manifest = tempname::tpie_name("checkpoint");
+	{
+		// Simulate a crash in the final merge.
+		merge_sorter<size_t, false> s;
+		s.set_parameters(1000, 4);
+		s.set_checkpoint(manifest);
+		s.begin();
+		for (size_t i = 0; i < items; ++i)
+			s.push(checkpoint_item(i, items));
+		s.end();
+		dummy_progress_indicator pi;
+		s.calc(pi);
+		for (size_t i = 0; i < items / 2; ++i)
+			s.pull();
+	}
+	merge_sorter<size_t, false> s;
+	TEST_ENSURE(s.resume(manifest), "Could not resume");
+	TEST_ENSURE(!s.resumed_run_formation(), "Resumed in phase 1");
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	return checkpoint_pull(s, items, manifest);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Checkpoints in phase 1 append to the manifest, so its size is linear in the
+// number of runs, and a partly written update at the end is ignored.
+///////////////////////////////////////////////////////////////////////////////
+bool checkpoint_append_test() {
+	const size_t items = 40000;
+	const memory_size_type runLength = 20;
+	std::string manifest = tempname::tpie_name("checkpoint");
+	{
+		merge_sorter<size_t, false> s;
+		s.set_parameters(runLength, 4);
+		s.set_checkpoint(manifest);
+		s.begin();
+		for (size_t i = 0; i < items / 2 + runLength / 2; ++i)
+			s.push(checkpoint_item(i, items));
+	}
+	const stream_size_type runs = items / 2 / runLength;
+	const stream_size_type size = boost::filesystem::file_size(manifest);
+	log_debug() << "Manifest of " << runs << " runs has " << size << " bytes" << std::endl;
+	TEST_ENSURE(size <= 4096 + 128 * runs, "Manifest is not linear in the number of runs");
+	{
+		// A partly written update.
+		std::ofstream out(manifest.c_str(), std::ios::binary | std::ios::app);
+		out.write("\1\0\0\0\0", 5);
+	}
+
+	merge_sorter<size_t, false> s;
+	TEST_ENSURE(s.resume(manifest), "Could not resume");
+	TEST_ENSURE(s.resumed_run_formation(), "Not resumed in phase 1");
+	TEST_ENSURE_EQUALITY(items / 2, s.resumed_item_count(), "Wrong number of items resumed");
+	for (size_t i = static_cast<size_t>(s.resumed_item_count()); i < items; ++i)
+		s.push(checkpoint_item(i, items));
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	return checkpoint_pull(s, items, manifest);
+}
+
+struct tag_sort_item {
+	size_t key;
+	size_t payload[15];
+};
+
+struct tag_sort_key {
+	size_t operator()(const tag_sort_item & x) const { return x.key; }
+};
+
+bool tag_sort_test(size_t items, size_t runLength, size_t fanout) {
+	typedef bits::key_pred<std::less<size_t>, tag_sort_key> pred_t;
+	pred_t pred((std::less<size_t>()), tag_sort_key());
+	tag_sorter<tag_sort_item, false, pred_t, tag_sort_key> s(pred);
+	s.set_parameters(runLength, fanout);
+	s.begin();
+	for (size_t i = 0; i < items; ++i) {
+		tag_sort_item x;
+		x.key = (i * 7919) % items;
+		for (size_t j = 0; j < 15; ++j) x.payload[j] = x.key * j;
+		s.push(x);
+	}
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	size_t expect = 0;
+	while (s.can_pull()) {
+		tag_sort_item x = s.pull();
+		TEST_ENSURE_EQUALITY(expect, x.key, "Wrong item reported");
+		TEST_ENSURE_EQUALITY(expect * 14, x.payload[14], "Wrong payload reported");
+		++expect;
+	}
+	TEST_ENSURE_EQUALITY(items, expect, "Wrong number of items reported");
+	return true;
+}
+
+bool tag_sort_memory_test(size_t items) {
+	typedef bits::key_pred<std::less<size_t>, tag_sort_key> pred_t;
+	typedef tag_sorter<tag_sort_item, false, pred_t, tag_sort_key> sorter_t;
+	TEST_ENSURE(sorter_t::maximum_memory_phase_3() < std::numeric_limits<memory_size_type>::max(),
+				"The final phase should have a memory limit");
+	pred_t pred((std::less<size_t>()), tag_sort_key());
+	sorter_t s(pred);
+	s.set_available_memory(64 * 1024 * 1024);
+	s.begin();
+	for (size_t i = 0; i < items; ++i) {
+		tag_sort_item x;
+		x.key = items - i;
+		s.push(x);
+	}
+	s.end();
+	dummy_progress_indicator pi;
+	s.calc(pi);
+	// the gather buffer only needs room for the items
+	memory_size_type batch = items * (sizeof(tag_sort_item) + sizeof(std::pair<stream_size_type, memory_size_type>));
+	TEST_ENSURE(s.actual_memory_phase_3() <= sorter_t::sorter_t::maximum_memory_phase_3()
+				+ file_stream<tag_sort_item>::memory_usage() + batch,
+				"The gather buffer is larger than the input");
+	size_t expect = 1;
+	while (s.can_pull()) {
+		TEST_ENSURE_EQUALITY(expect, s.pull().key, "Wrong item reported");
+		++expect;
+	}
+	TEST_ENSURE_EQUALITY(items + 1, expect, "Wrong number of items reported");
+	return true;
+}
+
 int main(int argc, char ** argv) {
 	tests t(argc, argv);
 	return
@@ -158,5 +449,16 @@ int main(int argc, char ** argv) {
 		.test(sort_upper_bound_test, "sort_upper_bound")
 		.test(temp_file_usage_test, "temp_file_usage")
 		.test(tall_tree_test, "tall_tree", "fanout", static_cast<size_t>(6), "height", static_cast<size_t>(1))
+		.test(limit_test, "limit_internal", "items", static_cast<size_t>(100000), "limit", static_cast<size_t>(100), "runlength", static_cast<size_t>(1024), "fanout", static_cast<size_t>(4))
+		.test(limit_test, "limit_external", "items", static_cast<size_t>(200000), "limit", static_cast<size_t>(5000), "runlength", static_cast<size_t>(1024), "fanout", static_cast<size_t>(4))
+		.test(limit_combine_test, "limit_combine", "keys", static_cast<size_t>(1024), "limit", static_cast<size_t>(600), "copies", static_cast<size_t>(8))
+		.test(presorted_test, "presorted", "segments", static_cast<size_t>(1))
+		.test(presorted_test, "presorted_segments", "segments", static_cast<size_t>(5))
+		.test(combine_test, "combine", "keys", static_cast<size_t>(500), "runlength", static_cast<size_t>(64), "fanout", static_cast<size_t>(4))
+		.test(checkpoint_run_formation_test, "checkpoint_run_formation")
+		.test(checkpoint_merge_test, "checkpoint_merge")
+		.test(checkpoint_append_test, "checkpoint_append")
+		.test(tag_sort_test, "tag_sort", "items", static_cast<size_t>(20000), "runlength", static_cast<size_t>(500), "fanout", static_cast<size_t>(4))
+		.test(tag_sort_memory_test, "tag_sort_memory", "items", static_cast<size_t>(100))
 		;
 }
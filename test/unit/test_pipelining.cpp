@@ -22,6 +22,7 @@
 #include <tpie/file_stream.h>
 #include <algorithm>
 #include <cmath>
+#include <random>
 #include <tpie/sysinfo.h>
 #include <tpie/pipelining/virtual.h>
 #include <tpie/progress_indicator_arrow.h>
@@ -432,6 +433,94 @@ bool sort_test_large() {
 	return sort_test(300*1024);
 }
 
+typedef std::pair<test_t, test_t> count_item;
+
+struct count_item_less {
+	bool operator()(const count_item & a, const count_item & b) const {
+		return a.first < b.first;
+	}
+};
+
+struct count_item_sum {
+	count_item operator()(const count_item & a, const count_item & b) const {
+		return count_item(a.first, a.second + b.second);
+	}
+};
+
+bool sort_combine_test() {
+	const test_t n = 100;
+	std::vector<count_item> input;
+	std::vector<count_item> expect;
+	std::vector<count_item> output;
+	for (test_t i = 0; i < n; ++i) {
+		for (test_t j = 0; j <= i; ++j) input.push_back(count_item(n-1-j, 1));
+	}
+	for (test_t v = 0; v < n; ++v) expect.push_back(count_item(v, v+1));
+	pipeline p = input_vector(input)
+		| sort_combine(count_item_less(), count_item_sum())
+		| output_vector(output);
+	p();
+	TEST_ENSURE(output == expect, "Wrong output of combining sort");
+	return true;
+}
+
+bool partial_sort_test() {
+	inputvector.resize(1000);
+	for (size_t i = 0; i < inputvector.size(); ++i) inputvector[i] = (i * 7919) % 1000;
+	expectvector.resize(10);
+	for (size_t i = 0; i < expectvector.size(); ++i) expectvector[i] = 999 - i;
+	pipeline p = input_vector(inputvector)
+		| partial_sort(10, std::greater<test_t>())
+		| output_vector(outputvector);
+	p();
+	return check_test_vectors();
+}
+
+struct tag_sort_record {
+	uint64_t key;
+	uint64_t payload[31];
+};
+
+struct tag_sort_record_key {
+	uint64_t operator()(const tag_sort_record & r) const { return r.key; }
+};
+
+struct tag_sort_identity {
+	test_t operator()(const test_t & x) const { return x; }
+};
+
+bool tag_sort_test() {
+	const size_t n = 1000;
+	std::vector<tag_sort_record> records(n);
+	for (size_t i = 0; i < n; ++i) {
+		records[i].key = (i * 7919) % n;
+		for (size_t j = 0; j < 31; ++j) records[i].payload[j] = records[i].key + j;
+	}
+	std::vector<tag_sort_record> sorted;
+	pipeline p = input_vector(records)
+		| tag_sort(tag_sort_record_key(), std::greater<uint64_t>())
+		| output_vector(sorted);
+	p();
+	TEST_ENSURE_EQUALITY(n, sorted.size(), "Wrong number of records");
+	for (size_t i = 0; i < n; ++i) {
+		TEST_ENSURE_EQUALITY(n - 1 - i, sorted[i].key, "Wrong record order");
+		TEST_ENSURE_EQUALITY(sorted[i].key + 30, sorted[i].payload[30], "Wrong record payload");
+	}
+
+	// Small items are sorted directly.
+	inputvector.resize(n);
+	expectvector.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		inputvector[i] = (i * 7919) % n;
+		expectvector[i] = i;
+	}
+	pipeline q = input_vector(inputvector)
+		| tag_sort(tag_sort_identity(), std::less<test_t>())
+		| output_vector(outputvector);
+	q();
+	return check_test_vectors();
+}
+
 // This tests that pipe_middle | pipe_middle -> pipe_middle,
 // and that pipe_middle | pipe_end -> pipe_end.
 // The other tests already test that pipe_begin | pipe_middle -> pipe_middle,
@@ -643,9 +732,9 @@ struct buffer_node_t : public node {
 
 typedef pipe_middle<factory<buffer_node_t> > buffer_node;
 
+template <typename test_t>
 struct merger_memory : public memory_test {
-	typedef int test_t;
-	typedef plain_store::specific<test_t> specific_store_t;
+	typedef typename plain_store::specific<test_t> specific_store_t;
 
 	size_t n;
 	array<file_stream<test_t> > inputs;
@@ -687,11 +776,51 @@ struct merger_memory : public memory_test {
 	}
 };
 
+template <typename test_t>
 bool merger_memory_test(size_t n) {
-	merger_memory m(n);
+	merger_memory<test_t> m(n);
 	return m();
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// Merge runs of many lengths, including empty runs and runs spanning several
+// blocks when the merger merges blocks with SIMD instructions.
+///////////////////////////////////////////////////////////////////////////////
+template <typename test_t>
+bool merger_runs_test(size_t n) {
+	typedef typename plain_store::specific<test_t> specific_store_t;
+	std::mt19937_64 prng(48);
+	for (size_t fanout = 1; fanout <= 16; fanout *= 4) {
+		array<file_stream<test_t> > inputs(fanout);
+		array<stream_size_type> runLengths(fanout);
+		std::vector<test_t> expect;
+		for (size_t i = 0; i < fanout; ++i) {
+			runLengths[i] = (i % 5 == 3) ? 0 : prng() % (n + 1);
+			// Some streams hold more items than the run.
+			size_t items = static_cast<size_t>(runLengths[i]) + ((i % 3 == 1) ? 10 : 0);
+			std::vector<test_t> run(items);
+			for (size_t j = 0; j < items; ++j) run[j] = static_cast<test_t>(prng() % (4 * n + 1));
+			std::sort(run.begin(), run.end());
+			expect.insert(expect.end(), run.begin(), run.begin() + static_cast<size_t>(runLengths[i]));
+			inputs[i].open();
+			for (size_t j = 0; j < items; ++j) inputs[i].write(run[j]);
+			inputs[i].seek(0);
+		}
+		std::sort(expect.begin(), expect.end());
+
+		specific_store_t store;
+		merger<specific_store_t, std::less<test_t> > m(std::less<test_t>(), store);
+		m.reset(inputs, runLengths);
+		for (size_t i = 0; i < expect.size(); ++i) {
+			TEST_ENSURE(m.can_pull(), "Merger ran out of items");
+			TEST_ENSURE_EQUALITY(expect[i], m.peek(), "Merger peeked the wrong item");
+			TEST_ENSURE_EQUALITY(expect[i], m.pull(), "Merger pulled the wrong item");
+		}
+		TEST_ENSURE(!m.can_pull(), "Merger pulled too many items");
+	}
+	return true;
+}
+
 struct my_item {
 	my_item() : v1(42), v2(9001) {}
 	short v1;
@@ -1926,6 +2055,105 @@ bool phase_priority_test() {
 	return true;
 }
 
+struct time_forward_key {
+	size_t operator()(size_t v) const {return v;}
+};
+
+struct time_forward_sum {
+	template <typename sender_t>
+	size_t operator()(size_t v, array_view<const size_t> inbox, sender_t & sender) const {
+		size_t value = 1;
+		for (size_t i = 0; i < inbox.size(); ++i) value += inbox[i];
+		sender.send(v + 1, value);
+		sender.send(2 * v + 1, value % 1000);
+		return value;
+	}
+};
+
+bool time_forward_test(size_t n) {
+	std::vector<size_t> vertices;
+	for (size_t i = 0; i < n; ++i)
+		if (i % 7 != 3) vertices.push_back(i);
+
+	// Every vertex sends its value to i+1 and 2i+1; messages to missing
+	// vertices are dropped.
+	std::vector<size_t> expected(2 * n + 2, 0);
+	std::vector<size_t> values;
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		size_t v = vertices[i];
+		size_t value = 1 + expected[v];
+		values.push_back(value);
+		expected[v + 1] += value;
+		expected[2 * v + 1] += value % 1000;
+	}
+
+	std::vector<size_t> output;
+	pipeline p = input_vector(vertices)
+		| time_forward<size_t, size_t>(time_forward_key(), time_forward_sum())
+		| output_vector(output);
+	p();
+
+	TEST_ENSURE(output == values, "Wrong values");
+	return true;
+}
+
+struct time_forward_backwards {
+	template <typename sender_t>
+	size_t operator()(size_t v, array_view<const size_t>, sender_t & sender) const {
+		sender.send(v, 0);
+		return v;
+	}
+};
+
+bool time_forward_past_test() {
+	std::vector<size_t> vertices(1, 42);
+	std::vector<size_t> output;
+	pipeline p = input_vector(vertices)
+		| time_forward<size_t, size_t>(time_forward_key(), time_forward_backwards())
+		| output_vector(output);
+	try {
+		p();
+	} catch (tpie::exception &) {
+		return true;
+	}
+	log_error() << "Sending to the current vertex did not throw" << std::endl;
+	return false;
+}
+
+struct time_forward_fan_in {
+	size_t fanIn;
+	template <typename sender_t>
+	size_t operator()(size_t v, array_view<const size_t> inbox, sender_t & sender) const {
+		if (v == 0) for (size_t i = 0; i < fanIn; ++i) sender.send(1, i);
+		return inbox.size();
+	}
+};
+
+bool time_forward_inbox_test() {
+	std::vector<size_t> vertices;
+	vertices.push_back(0);
+	vertices.push_back(1);
+	std::vector<size_t> output;
+	time_forward_fan_in full = {4};
+	pipeline p = input_vector(vertices)
+		| time_forward<size_t, size_t>(time_forward_key(), full, 4)
+		| output_vector(output);
+	p();
+	TEST_ENSURE_EQUALITY(4, output[1], "Wrong number of messages");
+
+	time_forward_fan_in overfull = {5};
+	output.clear();
+	pipeline q = input_vector(vertices)
+		| time_forward<size_t, size_t>(time_forward_key(), overfull, 4)
+		| output_vector(output);
+	try {
+		q();
+	} catch (tpie::exception &) {
+		return true;
+	}
+	log_error() << "Overfilling the inbox did not throw" << std::endl;
+	return false;
+}
 
 int main(int argc, char ** argv) {
 	return tpie::tests(argc, argv)
@@ -1940,13 +2168,19 @@ int main(int argc, char ** argv) {
 	.test(passive_reverse_test, "passive_reverse", "n", static_cast<size_t>(50000))
 	.test(internal_passive_reverse_test, "internal_passive_reverse", "n", static_cast<size_t>(50000))
 	.test(sort_test_trivial, "sorttrivial")
+	.test(sort_combine_test, "sort_combine")
+	.test(partial_sort_test, "partial_sort")
+	.test(tag_sort_test, "tag_sort")
 	.test(sort_test_small, "sort")
 	.test(sort_test_large, "sortbig")
 	.test(operator_test, "operators")
 	.test(uniq_test, "uniq")
 	.multi_test(memory_test_multi, "memory")
 	.test(fork_test, "fork")
-	.test(merger_memory_test, "merger_memory", "n", static_cast<size_t>(10))
+	.test(merger_memory_test<int>, "merger_memory", "n", static_cast<size_t>(10))
+	.test(merger_memory_test<uint64_t>, "merger_memory_uint64", "n", static_cast<size_t>(10))
+	.test(merger_runs_test<int>, "merger_runs", "n", static_cast<size_t>(3000))
+	.test(merger_runs_test<uint64_t>, "merger_runs_uint64", "n", static_cast<size_t>(3000))
 	.test(fetch_forward_test, "fetch_forward")
 	.test(bound_fetch_forward_test, "bound_fetch_forward")
 	.test(virtual_test, "virtual")
@@ -1968,5 +2202,8 @@ int main(int argc, char ** argv) {
 	.test(set_flush_priority_test, "set_flush_priority_test")
 	.test(phase_priority_test, "phase_priority_test")
 	.multi_test(datastructure_test_multi, "datastructures")
+	.test(time_forward_test, "time_forward", "n", static_cast<size_t>(100000))
+	.test(time_forward_inbox_test, "time_forward_inbox")
+	.test(time_forward_past_test, "time_forward_past")
 	;
 }
@@ -0,0 +1,121 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/serialization_priority_queue.h>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace tpie;
+
+std::string random_string(std::mt19937 & rng) {
+	std::string s(rng() % 200, ' ');
+	for (size_t i = 0; i < s.size(); ++i) s[i] = 'a' + rng() % 26;
+	return s;
+}
+
+// Push and pop strings of varying length, with enough data to form and
+// merge several runs, and compare against std::priority_queue.
+bool basic_test(size_t items, size_t mb) {
+	typedef std::priority_queue<std::string, std::vector<std::string>, std::greater<std::string> > reference_t;
+	serialization_priority_queue<std::string> pq(mb * 1024 * 1024);
+	reference_t reference;
+	std::mt19937 rng(42);
+
+	for (size_t round = 0; round < 2; ++round) {
+		for (size_t i = 0; i < items; ++i) {
+			std::string s = random_string(rng);
+			pq.push(s);
+			reference.push(s);
+			if (i % 3 == 0) {
+				TEST_ENSURE_EQUALITY(reference.top(), pq.top(), "Wrong top");
+				pq.pop();
+				reference.pop();
+			}
+		}
+		TEST_ENSURE_EQUALITY(reference.size(), pq.size(), "Wrong size");
+		while (reference.size() > items / 4) {
+			TEST_ENSURE_EQUALITY(reference.top(), pq.top(), "Wrong top");
+			pq.pop();
+			reference.pop();
+		}
+	}
+	while (!reference.empty()) {
+		TEST_ENSURE(!pq.empty(), "Queue should not be empty");
+		TEST_ENSURE_EQUALITY(reference.top(), pq.top(), "Wrong top");
+		pq.pop();
+		reference.pop();
+	}
+	TEST_ENSURE(pq.empty(), "Queue should be empty");
+	return true;
+}
+
+// Items that sort by a key but carry a variable-length payload.
+struct document {
+	uint64_t key;
+	std::vector<uint64_t> words;
+
+	bool operator<(const document & other) const {
+		return key < other.key;
+	}
+};
+
+template <typename D>
+void serialize(D & dst, const document & d) {
+	using tpie::serialize;
+	serialize(dst, d.key);
+	serialize(dst, d.words);
+}
+
+template <typename S>
+void unserialize(S & src, document & d) {
+	using tpie::unserialize;
+	unserialize(src, d.key);
+	unserialize(src, d.words);
+}
+
+bool user_type_test(size_t items) {
+	serialization_priority_queue<document> pq(serialization_priority_queue<document>::minimum_memory());
+	std::mt19937 rng(7);
+	for (size_t i = 0; i < items; ++i) {
+		document d;
+		d.key = rng();
+		d.words.resize(d.key % 100, d.key);
+		pq.push(d);
+	}
+	uint64_t previous = 0;
+	for (size_t i = 0; i < items; ++i) {
+		const document & d = pq.top();
+		TEST_ENSURE(previous <= d.key, "Items are not popped in order");
+		TEST_ENSURE_EQUALITY(d.key % 100, d.words.size(), "Wrong payload size");
+		TEST_ENSURE(d.words.empty() || d.words.back() == d.key, "Wrong payload");
+		previous = d.key;
+		pq.pop();
+	}
+	TEST_ENSURE(pq.empty(), "Queue should be empty");
+	return true;
+}
+
+int main(int argc, char ** argv) {
+	return tests(argc, argv)
+		.test(basic_test, "basic", "items", static_cast<size_t>(200000), "mb", static_cast<size_t>(12))
+		.test(user_type_test, "user_type", "items", static_cast<size_t>(100000));
+}
@@ -22,6 +22,8 @@
 #include <tpie/serialization_sorter.h>
 #include <tpie/sysinfo.h>
 #include <random>
+#include <atomic>
+#include <thread>
 
 using namespace tpie;
 
@@ -67,9 +69,109 @@ public:
 	};
 };
 
+///////////////////////////////////////////////////////////////////////////////
+// Form runs and merge groups of runs in jobs, within the memory limits of the
+// sequential sorter.
+///////////////////////////////////////////////////////////////////////////////
+bool parallel_test(memory_size_type workers, double mb) {
+	typedef use_serialization_sorter::test_t test_t;
+	const memory_size_type m1 = 20*1024*1024;
+	const memory_size_type m2 = 40*1024*1024;
+	const memory_size_type m3 = 7*1024*1024;
+	use_serialization_sorter::item_generator gen(static_cast<stream_size_type>(mb*1024*1024));
+	const stream_size_type items = gen.items();
+	relative_memory_usage m(0);
+	use_serialization_sorter::sorter s;
+	s.set_workers(workers);
+	s.set_available_memory(m1, m2, m3);
+
+	m.set_threshold(m1);
+	s.begin();
+	for (stream_size_type i = 0; i < items; ++i) {
+		s.push(gen());
+		if (!m.below()) return false;
+	}
+	s.end();
+	if (!m.below()) return false;
+
+	m.set_threshold(m2);
+	s.merge_runs();
+	if (!m.below()) return false;
+
+	m.set_threshold(m3);
+	test_t prev;
+	stream_size_type itemsRead = 0;
+	while (s.can_pull()) {
+		test_t read = s.pull();
+		if (!m.below()) return false;
+		TEST_ENSURE(!(read < prev), "Out of order");
+		prev = read;
+		++itemsRead;
+	}
+	TEST_ENSURE_EQUALITY(items, itemsRead, "Wrong number of items");
+	return true;
+}
+
+// When set, serializing an item on another thread than the test throws.
+std::atomic<bool> failing_item_fail;
+std::thread::id failing_item_thread;
+
+struct failing_item {
+	int value;
+	bool operator<(const failing_item & other) const {return value < other.value;}
+};
+
+template <typename D>
+void serialize(D & dst, const failing_item & item) {
+	if (failing_item_fail && std::this_thread::get_id() != failing_item_thread)
+		throw tpie::exception("Failed to serialize an item");
+	dst.write(reinterpret_cast<const char *>(&item.value), sizeof(item.value));
+}
+
+template <typename S>
+void unserialize(S & src, failing_item & item) {
+	src.read(reinterpret_cast<char *>(&item.value), sizeof(item.value));
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// An exception thrown in a run formation job (phase 1) or a merge job
+// (phase 2) is rethrown on the thread using the sorter.
+///////////////////////////////////////////////////////////////////////////////
+bool job_exception_test(memory_size_type workers, int phase) {
+	const stream_size_type items = 2000000;
+	failing_item_thread = std::this_thread::get_id();
+	failing_item_fail = (phase == 1);
+	serialization_sorter<failing_item> s;
+	s.set_workers(workers);
+	s.set_available_memory(8*1024*1024, 24*1024*1024, 12*1024*1024);
+	std::mt19937 rng(50);
+	bool thrown = false;
+	try {
+		s.begin();
+		for (stream_size_type i = 0; i < items; ++i) {
+			failing_item item;
+			item.value = static_cast<int>(rng());
+			s.push(item);
+		}
+		s.end();
+		TEST_ENSURE(phase != 1, "Phase 1 did not throw");
+		failing_item_fail = true;
+		s.merge_runs();
+	} catch (const tpie::exception & e) {
+		log_debug() << "Caught: " << e.what() << std::endl;
+		thrown = true;
+	}
+	failing_item_fail = false;
+	TEST_ENSURE(thrown, "The exception was not rethrown");
+	return true;
+}
+
 int main(int argc, char ** argv) {
 	tests t(argc, argv);
 	return
 		sort_tester<use_serialization_sorter>::add_all(t)
+		.test(parallel_test, "parallel", "workers", static_cast<memory_size_type>(4), "mb", 50.0)
+		.test(job_exception_test, "job_exception_run", "workers", static_cast<memory_size_type>(4), "phase", 1)
+		.test(job_exception_test, "job_exception_merge", "workers", static_cast<memory_size_type>(4), "phase", 2)
 		;
 }
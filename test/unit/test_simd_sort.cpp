@@ -0,0 +1,251 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include "common.h"
+#include <tpie/simd_sort.h>
+#include <tpie/parallel_sort.h>
+#include <random>
+#include <limits>
+#include <vector>
+#include <algorithm>
+
+using namespace tpie;
+
+template <typename T>
+T random_item(std::mt19937_64 & prng, T range) {
+	return static_cast<T>(prng() % range);
+}
+
+template <>
+double random_item<double>(std::mt19937_64 & prng, double range) {
+	return std::uniform_real_distribution<double>(-range, range)(prng);
+}
+
+template <typename T>
+bool check_sort(std::vector<T> v, const char * name) {
+	std::vector<T> expect(v);
+	std::sort(expect.begin(), expect.end());
+	simd_sort(v.data(), v.data() + v.size());
+	if (v != expect) {
+		tpie::log_error() << name << ": simd_sort of " << v.size() << " items differs from std::sort" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort random inputs of many sizes, also sizes that are not multiples of the
+// vector width and sizes spanning several blocks.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+bool random_test(size_t maxItems) {
+	tpie::log_info() << "SIMD kernels available: " << simd_sort_available<T>() << std::endl;
+	std::mt19937_64 prng(42);
+	for (size_t n = 0; n <= maxItems; n = (n < 64) ? n + 1 : n * 3 / 2 + 7) {
+		std::vector<T> v(n);
+		for (size_t i = 0; i < n; ++i) v[i] = random_item<T>(prng, T(1000000000));
+		if (!check_sort(v, "random")) return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sort inputs with few distinct values, including the largest value, which
+// the kernels use for padding.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+bool duplicates_test(size_t maxItems) {
+	std::mt19937_64 prng(43);
+	const T extremes[] = {std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest(), T(0)};
+	for (size_t n = 1; n <= maxItems; n = n * 2 + 3) {
+		std::vector<T> v(n);
+		for (size_t i = 0; i < n; ++i) {
+			if (prng() % 4 == 0) v[i] = extremes[prng() % 3];
+			else v[i] = random_item<T>(prng, T(5));
+		}
+		if (!check_sort(v, "duplicates")) return false;
+		std::fill(v.begin(), v.end(), std::numeric_limits<T>::max());
+		if (!check_sort(v, "equal")) return false;
+	}
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Sorted and reverse sorted inputs.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+bool presorted_test(size_t n) {
+	std::vector<T> v(n);
+	for (size_t i = 0; i < n; ++i) v[i] = T(i);
+	if (!check_sort(v, "sorted")) return false;
+	std::reverse(v.begin(), v.end());
+	if (!check_sort(v, "reverse")) return false;
+	return true;
+}
+
+template <typename T>
+bool parallel_test(size_t n) {
+	std::mt19937_64 prng(44);
+	std::vector<T> v(n);
+	for (size_t i = 0; i < n; ++i) v[i] = random_item<T>(prng, T(1000000000));
+	std::vector<T> expect(v);
+	std::sort(expect.begin(), expect.end());
+	parallel_sort(v.data(), v.data() + n, std::less<T>());
+	TEST_ENSURE(v == expect, "parallel_sort differs from std::sort");
+	return true;
+}
+
+template <typename T>
+std::vector<T> sorted_run(std::mt19937_64 & prng, size_t n) {
+	const T extremes[] = {std::numeric_limits<T>::max(), std::numeric_limits<T>::lowest()};
+	std::vector<T> v(n);
+	for (size_t i = 0; i < n; ++i) {
+		if (prng() % 16 == 0) v[i] = extremes[prng() % 2];
+		else v[i] = random_item<T>(prng, T(1000));
+	}
+	std::sort(v.begin(), v.end());
+	return v;
+}
+
+template <typename T, typename Merge>
+bool check_merge(const std::vector<T> & a, const std::vector<T> & b, Merge merge, const char * name) {
+	std::vector<T> expect(a.size() + b.size());
+	std::merge(a.begin(), a.end(), b.begin(), b.end(), expect.begin());
+	std::vector<T> out(a.size() + b.size());
+	merge(a.data(), a.size(), b.data(), b.size(), out.data());
+	if (out != expect) {
+		tpie::log_error() << name << ": merging " << a.size() << " and " << b.size()
+						  << " items differs from std::merge" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+template <typename T, typename Merge>
+bool merge_runs_test(size_t maxItems, Merge merge, const char * name) {
+	std::mt19937_64 prng(45);
+	for (size_t na = 0; na <= maxItems; na = (na < 16) ? na + 1 : na * 5 + 3) {
+		for (size_t nb = 0; nb <= maxItems; nb = (nb < 16) ? nb + 1 : nb * 5 + 3) {
+			if (!check_merge(sorted_run<T>(prng, na), sorted_run<T>(prng, nb), merge, name)) return false;
+		}
+	}
+	return true;
+}
+
+template <typename T>
+void merge_block(const T * a, size_t na, const T * b, size_t nb, T * out) {
+	bits::simd_merge_block(a, na, b, nb, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Merge sorted runs of all combinations of short lengths and some longer
+// ones, with a tree of two-way merges for up to 33 runs.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+bool merge_test(size_t maxItems) {
+	if (!simd_sort_available<T>()) {
+		tpie::log_info() << "SIMD kernels are not available; skipping" << std::endl;
+		return true;
+	}
+	if (!merge_runs_test<T>(maxItems, merge_block<T>, "simd_merge_block")) return false;
+
+	std::mt19937_64 prng(46);
+	for (size_t k = 1; k <= 33; k += 4) {
+		std::vector<std::vector<T> > runs(k);
+		std::vector<const T *> pointers(k);
+		std::vector<size_t> sizes(k);
+		std::vector<T> expect;
+		for (size_t i = 0; i < k; ++i) {
+			runs[i] = sorted_run<T>(prng, static_cast<size_t>(prng() % 100));
+			pointers[i] = runs[i].data();
+			sizes[i] = runs[i].size();
+			expect.insert(expect.end(), runs[i].begin(), runs[i].end());
+		}
+		std::sort(expect.begin(), expect.end());
+		std::vector<T> a(expect.size());
+		std::vector<T> b(expect.size());
+		T * out = bits::simd_merge_tree(pointers.data(), sizes.data(), k, a.data(), b.data());
+		TEST_ENSURE(std::equal(expect.begin(), expect.end(), out), "simd_merge_tree differs from std::sort");
+	}
+	return true;
+}
+
+template <typename T>
+bool all_tests(size_t n) {
+	return random_test<T>(n) && duplicates_test<T>(n) && presorted_test<T>(n) && parallel_test<T>(n)
+		&& merge_test<T>(n);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Key/value pairs have no kernels and are sorted by std::sort.
+///////////////////////////////////////////////////////////////////////////////
+bool pair_test(size_t n) {
+	typedef std::pair<uint64_t, uint64_t> item_t;
+	TEST_ENSURE(!simd_sort_available<item_t>(), "SIMD kernels claimed for pairs");
+	std::mt19937_64 prng(49);
+	std::vector<item_t> v(n);
+	for (size_t i = 0; i < n; ++i) v[i] = item_t(prng() % 1000, prng());
+	std::vector<item_t> expect(v);
+	std::sort(expect.begin(), expect.end());
+	simd_sort(v.data(), v.data() + n);
+	TEST_ENSURE(v == expect, "simd_sort of pairs differs from std::sort");
+	return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// The AVX2 and AVX-512 uint64_t kernels give the same results.
+///////////////////////////////////////////////////////////////////////////////
+bool avx512_test(size_t maxItems) {
+#ifdef TPIE_HAVE_SIMD_SORT
+	if (!bits::simd_sort_has_avx2() || !bits::simd_sort_has_avx512()) {
+		tpie::log_info() << "AVX-512 is not available; skipping" << std::endl;
+		return true;
+	}
+	std::mt19937_64 prng(47);
+	for (size_t n = 0; n <= maxItems; n = (n < 64) ? n + 1 : n * 3 / 2 + 7) {
+		std::vector<uint64_t> v(n);
+		for (size_t i = 0; i < n; ++i) v[i] = prng();
+		std::vector<uint64_t> avx2(v);
+		std::vector<uint64_t> avx512(v);
+		std::vector<uint64_t> tmp(bits::simd_sort_buffer_size(n));
+		// simd_sort_block is used for blocks of up to simd_sort_block_items.
+		size_t m = std::min(n, bits::simd_sort_block_items);
+		bits::simd_sort_block_avx2(avx2.data(), m, tmp.data());
+		bits::simd_sort_block_avx512(avx512.data(), m, tmp.data());
+		std::sort(v.begin(), v.begin() + m);
+		TEST_ENSURE(avx2 == v, "AVX2 kernel differs from std::sort");
+		TEST_ENSURE(avx512 == v, "AVX-512 kernel differs from std::sort");
+	}
+	return merge_runs_test<uint64_t>(maxItems, bits::simd_merge_block_avx2, "simd_merge_block_avx2")
+		&& merge_runs_test<uint64_t>(maxItems, bits::simd_merge_block_avx512, "simd_merge_block_avx512");
+#else
+	tpie::log_info() << "SIMD kernels are not compiled; skipping " << maxItems << std::endl;
+	return true;
+#endif
+}
+
+int main(int argc, char ** argv) {
+	return tpie::tests(argc, argv)
+		.test(all_tests<uint32_t>, "uint32", "n", static_cast<size_t>(100000))
+		.test(all_tests<uint64_t>, "uint64", "n", static_cast<size_t>(100000))
+		.test(all_tests<double>, "double", "n", static_cast<size_t>(100000))
+		.test(avx512_test, "avx512", "n", static_cast<size_t>(100000))
+		.test(pair_test, "pair", "n", static_cast<size_t>(100000))
+		;
+}
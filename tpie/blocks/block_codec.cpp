@@ -0,0 +1,175 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include <tpie/blocks/block_codec.h>
+#include <tpie/array.h>
+#include <tpie/exception.h>
+#include <tpie/tpie_assert.h>
+#include <algorithm>
+#include <cstring>
+
+namespace tpie {
+
+namespace blocks {
+
+namespace {
+
+void put_length(char *& dst, memory_size_type value, memory_size_type bytes) {
+	for(memory_size_type i = 0; i < bytes; ++i) *dst++ = static_cast<char>((value >> (8 * i)) & 0xFF);
+}
+
+memory_size_type get_length(const char *& src, memory_size_type bytes) {
+	memory_size_type value = 0;
+	for(memory_size_type i = 0; i < bytes; ++i)
+		value |= static_cast<memory_size_type>(static_cast<unsigned char>(*src++)) << (8 * i);
+	return value;
+}
+
+void corrupt() {
+	throw exception("Corrupt encoded block");
+}
+
+} // unnamed namespace
+
+record_codec::record_codec(memory_size_type headerSize, memory_size_type recordSize)
+	: m_headerSize(headerSize)
+	, m_recordSize(recordSize)
+	, m_lengthSize(recordSize < 256 ? 1 : 2)
+{
+	tp_assert(recordSize > 0 && recordSize < 65536, "the record size must be in [1, 65536)");
+}
+
+memory_size_type record_codec::max_encoded_size(memory_size_type size) const {
+	return sizeof(uint64_t) + size + (size / m_recordSize + 1) * 2 * m_lengthSize;
+}
+
+memory_size_type record_codec::encode(const char * src, memory_size_type size, char * dst) const {
+	char * out = dst;
+
+	// drop trailing zero bytes
+	memory_size_type used = size;
+	while(used > 0 && src[used - 1] == 0) --used;
+	put_length(out, used, sizeof(uint64_t));
+
+	memory_size_type header = std::min(used, m_headerSize);
+	std::memcpy(out, src, header);
+	out += header;
+
+	// the first record is compared to a record of zeros
+	array<char> zero(m_recordSize, 0);
+	const char * previous = zero.get();
+	memory_size_type i = header;
+	for(; i + m_recordSize <= used; i += m_recordSize) {
+		const char * record = src + i;
+		memory_size_type prefix = 0;
+		while(prefix < m_recordSize && record[prefix] == previous[prefix]) ++prefix;
+		memory_size_type suffix = 0;
+		while(suffix < m_recordSize - prefix
+			  && record[m_recordSize - 1 - suffix] == previous[m_recordSize - 1 - suffix]) ++suffix;
+		put_length(out, prefix, m_lengthSize);
+		put_length(out, suffix, m_lengthSize);
+		memory_size_type middle = m_recordSize - prefix - suffix;
+		std::memcpy(out, record + prefix, middle);
+		out += middle;
+		previous = record;
+	}
+
+	// a partial record at the end is stored as is
+	std::memcpy(out, src + i, used - i);
+	out += used - i;
+	return out - dst;
+}
+
+void record_codec::decode(const char * src, memory_size_type srcSize, char * dst, memory_size_type size) const {
+	const char * in = src;
+	const char * end = src + srcSize;
+	if(srcSize < sizeof(uint64_t)) corrupt();
+	memory_size_type used = get_length(in, sizeof(uint64_t));
+	if(used > size) corrupt();
+
+	memory_size_type header = std::min(used, m_headerSize);
+	if(static_cast<memory_size_type>(end - in) < header) corrupt();
+	std::memcpy(dst, in, header);
+	in += header;
+
+	array<char> zero(m_recordSize, 0);
+	const char * previous = zero.get();
+	memory_size_type i = header;
+	for(; i + m_recordSize <= used; i += m_recordSize) {
+		char * record = dst + i;
+		if(static_cast<memory_size_type>(end - in) < 2 * m_lengthSize) corrupt();
+		memory_size_type prefix = get_length(in, m_lengthSize);
+		memory_size_type suffix = get_length(in, m_lengthSize);
+		if(prefix + suffix > m_recordSize) corrupt();
+		memory_size_type middle = m_recordSize - prefix - suffix;
+		if(static_cast<memory_size_type>(end - in) < middle) corrupt();
+		std::memcpy(record, previous, prefix);
+		std::memcpy(record + prefix, in, middle);
+		std::memcpy(record + m_recordSize - suffix, previous + m_recordSize - suffix, suffix);
+		in += middle;
+		previous = record;
+	}
+
+	if(static_cast<memory_size_type>(end - in) < used - i) corrupt();
+	std::memcpy(dst + i, in, used - i);
+	std::memset(dst + used, 0, size - used);
+}
+
+scheme_codec::scheme_codec(const compression_scheme & scheme, std::shared_ptr<const block_codec> inner)
+	: m_scheme(scheme)
+	, m_inner(std::move(inner))
+{}
+
+memory_size_type scheme_codec::max_encoded_size(memory_size_type size) const {
+	memory_size_type innerSize = m_inner ? m_inner->max_encoded_size(size) : size;
+	return sizeof(uint64_t) + m_scheme.max_compressed_length(innerSize);
+}
+
+memory_size_type scheme_codec::encode(const char * src, memory_size_type size, char * dst) const {
+	array<char> buffer;
+	if(m_inner) {
+		buffer.resize(m_inner->max_encoded_size(size));
+		size = m_inner->encode(src, size, buffer.get());
+		src = buffer.get();
+	}
+	char * out = dst;
+	put_length(out, size, sizeof(uint64_t));
+	size_t compressed = 0;
+	m_scheme.compress(out, src, size, &compressed);
+	return sizeof(uint64_t) + compressed;
+}
+
+void scheme_codec::decode(const char * src, memory_size_type srcSize, char * dst, memory_size_type size) const {
+	const char * in = src;
+	if(srcSize < sizeof(uint64_t)) corrupt();
+	memory_size_type innerSize = get_length(in, sizeof(uint64_t));
+	srcSize -= sizeof(uint64_t);
+	if(!m_inner) {
+		if(innerSize != size || m_scheme.uncompressed_length(in, srcSize) != size) corrupt();
+		m_scheme.uncompress(dst, in, srcSize);
+		return;
+	}
+	if(m_scheme.uncompressed_length(in, srcSize) != innerSize) corrupt();
+	array<char> buffer(innerSize);
+	m_scheme.uncompress(buffer.get(), in, srcSize);
+	m_inner->decode(buffer.get(), innerSize, dst, size);
+}
+
+} // namespace blocks
+} // namespace tpie
@@ -0,0 +1,123 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino+=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file block_codec Encodings of blocks stored by a block collection
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_BLOCKS_BLOCK_CODEC_H
+#define _TPIE_BLOCKS_BLOCK_CODEC_H
+
+#include <tpie/tpie.h>
+#include <tpie/compressed/scheme.h>
+#include <memory>
+
+namespace tpie {
+
+namespace blocks {
+
+/**
+ * \brief Lossless encoding applied to blocks when they are written to disk
+ * and reversed when they are read.
+ */
+class block_codec {
+public:
+	virtual ~block_codec() {}
+
+	/**
+	 * \brief An upper bound on the encoded size of a block
+	 * \param size the size of the block
+	 */
+	virtual memory_size_type max_encoded_size(memory_size_type size) const = 0;
+
+	/**
+	 * \brief Encodes a block
+	 * \param src the content of the block
+	 * \param size the size of the block
+	 * \param dst a buffer of at least max_encoded_size(size) bytes
+	 * \return the number of bytes written to dst
+	 */
+	virtual memory_size_type encode(const char * src, memory_size_type size, char * dst) const = 0;
+
+	/**
+	 * \brief Decodes a block
+	 * \param src the encoded block
+	 * \param srcSize the number of encoded bytes
+	 * \param dst a buffer for the block
+	 * \param size the size of the block
+	 */
+	virtual void decode(const char * src, memory_size_type srcSize, char * dst, memory_size_type size) const = 0;
+};
+
+/**
+ * \brief Prefix and suffix compression of fixed-size records.
+ *
+ * The block is seen as a header followed by records of a fixed size, such
+ * as the count and values of a btree leaf. Every record is stored as the
+ * number of leading and trailing bytes it shares with the previous record,
+ * followed by the bytes in between. Sorted keys with common high-order
+ * parts, like composite keys or timestamps, are stored in a few bytes each
+ * whatever their byte order. Trailing zero bytes of the block are not
+ * stored.
+ */
+class record_codec : public block_codec {
+public:
+	/**
+	 * \param headerSize the number of bytes stored as is before the records
+	 * \param recordSize the size of a record, less than 65536
+	 */
+	record_codec(memory_size_type headerSize, memory_size_type recordSize);
+
+	memory_size_type max_encoded_size(memory_size_type size) const override;
+	memory_size_type encode(const char * src, memory_size_type size, char * dst) const override;
+	void decode(const char * src, memory_size_type srcSize, char * dst, memory_size_type size) const override;
+
+private:
+	memory_size_type m_headerSize;
+	memory_size_type m_recordSize;
+	// the number of bytes used to store a shared length
+	memory_size_type m_lengthSize;
+};
+
+/**
+ * \brief Compression of blocks with a compression_scheme, optionally after
+ * another codec.
+ */
+class scheme_codec : public block_codec {
+public:
+	/**
+	 * \param scheme the compression scheme
+	 * \param inner a codec applied before compressing, or null
+	 */
+	scheme_codec(const compression_scheme & scheme, std::shared_ptr<const block_codec> inner = nullptr);
+
+	memory_size_type max_encoded_size(memory_size_type size) const override;
+	memory_size_type encode(const char * src, memory_size_type size, char * dst) const override;
+	void decode(const char * src, memory_size_type srcSize, char * dst, memory_size_type size) const override;
+
+private:
+	const compression_scheme & m_scheme;
+	std::shared_ptr<const block_codec> m_inner;
+};
+
+} // blocks namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_BLOCKS_BLOCK_CODEC_H
@@ -18,16 +18,46 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 #include <tpie/tpie_assert.h>
+#include <tpie/exception.h>
 #include <tpie/blocks/block_collection.h>
+#include <tpie/array.h>
+#include <algorithm>
+#include <cstring>
 
 namespace tpie {
 
 namespace blocks {
 
+namespace {
+
+// an encoded block starts with its encoded length and the number of
+// overflow slots as 32-bit integers, followed by the overflow positions
+const memory_size_type encoded_header_size = 2 * sizeof(uint32_t);
+
+} // unnamed namespace
+
 block_collection::block_collection(std::string fileName, memory_size_type blockSize, bool writeable)
-	: m_collection(fileName + ".queue", blockSize)
+	: block_collection(fileName, blockSize, writeable, nullptr, blockSize)
+{}
+
+block_collection::block_collection(std::string fileName, memory_size_type blockSize, bool writeable,
+								   std::shared_ptr<const block_codec> codec, memory_size_type diskBlockSize)
+	: m_blockSize(blockSize)
+	, m_diskBlockSize(diskBlockSize)
+	, m_codec(std::move(codec))
+	, m_maxOverflow(0)
+	, m_collection(fileName + ".queue", diskBlockSize)
 	, m_writeable(writeable)
 {
+	if(m_codec) {
+		// the positions of the overflow slots of the largest encoding must
+		// fit in the first slot
+		if(diskBlockSize > encoded_header_size + 2 * sizeof(stream_size_type))
+			m_maxOverflow = overflow_count(m_codec->max_encoded_size(blockSize));
+		if(diskBlockSize <= encoded_header_size + 2 * sizeof(stream_size_type)
+		   || encoded_header_size + m_maxOverflow * sizeof(stream_size_type) > diskBlockSize)
+			throw invalid_argument_exception("block_collection: the disk block size is too small for the block size");
+	}
 	if(writeable) {
 		m_accessor.open_rw_new(fileName);
 		return;
@@ -42,13 +72,45 @@ block_collection::~block_collection() {
 
 block_handle block_collection::get_free_block() {
 	tp_assert(m_writeable, "get_free_block(): the block collection is read only");
+	block_handle h;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		h = m_collection.alloc();
+	}
+	return init_block(h);
+}
+
+block_handle block_collection::get_free_block(block_handle near) {
+	tp_assert(m_writeable, "get_free_block(): the block collection is read only");
+	block_handle h;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		h = m_collection.alloc(m_diskBlockSize, near.position);
+	}
+	return init_block(h);
+}
+
+block_handle block_collection::init_block(block_handle h) {
+	if(!m_codec) return h;
 
-	return m_collection.alloc();
+	// an empty header, so the slot has no overflow slots from an earlier use
+	char header[encoded_header_size] = {0};
+	m_accessor.write_at_i(static_cast<const void*>(header), encoded_header_size, h.position);
+	return block_handle(h.position, m_blockSize);
 }
 
 void block_collection::free_block(block_handle handle) {
 	tp_assert(m_writeable, "free_block(): the block collection is read only");
 
+	std::vector<stream_size_type> overflow;
+	if(m_codec) overflow = read_overflow(handle.position);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_codec) {
+		for(memory_size_type i = 0; i < overflow.size(); ++i)
+			m_collection.free(block_handle(overflow[i], m_diskBlockSize));
+		handle.size = m_diskBlockSize;
+	}
 	m_collection.free(handle);
 
 	if(m_accessor.file_size_i() > m_collection.size()) {
@@ -56,21 +118,158 @@ void block_collection::free_block(block_handle handle) {
 	}
 }
 
+stream_size_type block_collection::collection_size() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_collection.size();
+}
+
 void block_collection::read_block(block_handle handle, block & b) {
-	tp_assert(handle.position + handle.size <= m_collection.size(), "the content of the given handle has not been written to disk");
+	if(m_codec) {
+		read_encoded(handle, b);
+		return;
+	}
 
-	b.resize(handle.size);
+	tp_assert(handle.position + handle.size <= collection_size(), "the content of the given handle has not been written to disk");
 
-	m_accessor.seek_i(handle.position);
-	m_accessor.read_i(static_cast<void*>(b.get()), handle.size);
+	if(b.size() != handle.size)
+		b.resize(handle.size);
+
+	m_accessor.read_at_i(static_cast<void*>(b.get()), handle.size, handle.position);
 }
 
 void block_collection::write_block(block_handle handle, const block & b) {
 	tp_assert(m_writeable, "write_block(): the block collection is read only.");
 	tp_assert(handle.size >= b.size(), "the given block is not large enough.");
 
-	m_accessor.seek_i(handle.position);
-	m_accessor.write_i(static_cast<const void*>(b.get()), b.size());
+	if(m_codec) {
+		write_encoded(handle, b);
+		return;
+	}
+
+	m_accessor.write_at_i(static_cast<const void*>(b.get()), b.size(), handle.position);
+}
+
+std::vector<stream_size_type> block_collection::read_overflow(stream_size_type position) {
+	uint32_t header[2];
+	m_accessor.read_at_i(static_cast<void*>(header), encoded_header_size, position);
+	if(header[1] > m_maxOverflow)
+		throw invalid_file_exception("block_collection: corrupt block header");
+	std::vector<stream_size_type> overflow(header[1]);
+	if(!overflow.empty())
+		m_accessor.read_at_i(static_cast<void*>(&overflow[0]), overflow.size() * sizeof(stream_size_type),
+							 position + encoded_header_size);
+	return overflow;
+}
+
+void block_collection::read_slots(const stream_size_type * positions, memory_size_type count,
+								  char * data, memory_size_type bytes) {
+	for(memory_size_type i = 0; i < count && bytes > 0;) {
+		memory_size_type j = i + 1;
+		while(j < count && positions[j] == positions[j-1] + m_diskBlockSize) ++j;
+		memory_size_type n = std::min(bytes, (j - i) * m_diskBlockSize);
+		m_accessor.read_at_i(static_cast<void*>(data), n, positions[i]);
+		data += n;
+		bytes -= n;
+		i = j;
+	}
+}
+
+void block_collection::write_slots(const stream_size_type * positions, memory_size_type count,
+								   const char * data, memory_size_type bytes) {
+	for(memory_size_type i = 0; i < count && bytes > 0;) {
+		memory_size_type j = i + 1;
+		while(j < count && positions[j] == positions[j-1] + m_diskBlockSize) ++j;
+		memory_size_type n = std::min(bytes, (j - i) * m_diskBlockSize);
+		m_accessor.write_at_i(static_cast<const void*>(data), n, positions[i]);
+		data += n;
+		bytes -= n;
+		i = j;
+	}
+}
+
+void block_collection::read_encoded(block_handle handle, block & b) {
+	tp_assert(handle.position + m_diskBlockSize <= collection_size(), "the content of the given handle has not been written to disk");
+
+	if(b.size() != handle.size)
+		b.resize(handle.size);
+
+	array<char> slot(m_diskBlockSize);
+	m_accessor.read_at_i(static_cast<void*>(slot.get()), m_diskBlockSize, handle.position);
+
+	uint32_t header[2];
+	std::memcpy(header, slot.get(), encoded_header_size);
+	memory_size_type length = header[0];
+	if(length == 0) { // never written
+		std::fill(b.begin(), b.end(), 0);
+		return;
+	}
+	if(header[1] > m_maxOverflow || header[1] != overflow_count(length))
+		throw invalid_file_exception("block_collection: corrupt block header");
+	std::vector<stream_size_type> overflow(header[1]);
+	memory_size_type offset = encoded_header_size + overflow.size() * sizeof(stream_size_type);
+	if(!overflow.empty())
+		std::memcpy(&overflow[0], slot.get() + encoded_header_size, overflow.size() * sizeof(stream_size_type));
+
+	memory_size_type n = std::min(length, m_diskBlockSize - offset);
+	array<char> encoded(n + overflow.size() * m_diskBlockSize);
+	std::memcpy(encoded.get(), slot.get() + offset, n);
+	if(!overflow.empty())
+		read_slots(&overflow[0], overflow.size(), encoded.get() + n, length - n);
+	m_codec->decode(encoded.get(), length, b.get(), b.size());
+}
+
+memory_size_type block_collection::overflow_count(memory_size_type length) const {
+	// each overflow slot adds a slot minus the room for its position
+	memory_size_type room = m_diskBlockSize - encoded_header_size;
+	memory_size_type net = m_diskBlockSize - sizeof(stream_size_type);
+	return length <= room ? 0 : (length - room + net - 1) / net;
+}
+
+void block_collection::write_encoded(block_handle handle, const block & b) {
+	array<char> encoded(m_codec->max_encoded_size(b.size()));
+	memory_size_type length = m_codec->encode(b.get(), b.size(), encoded.get());
+
+	memory_size_type count = overflow_count(length);
+
+	// the overflow slots are kept in one extent, so they are read with one
+	// request, and the extent is placed right after the block if possible,
+	// so the block and its overflow are written with one request
+	std::vector<stream_size_type> overflow = read_overflow(handle.position);
+	bool adjacent = true;
+	for(memory_size_type i = 1; i < overflow.size(); ++i)
+		if(overflow[i] != overflow[i-1] + m_diskBlockSize) adjacent = false;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if(adjacent && overflow.size() >= count) {
+		while(overflow.size() > count) {
+			m_collection.free(block_handle(overflow.back(), m_diskBlockSize));
+			overflow.pop_back();
+		}
+	} else {
+		for(memory_size_type i = 0; i < overflow.size(); ++i)
+			m_collection.free(block_handle(overflow[i], m_diskBlockSize));
+		stream_size_type position =
+			m_collection.alloc(count * m_diskBlockSize, handle.position + m_diskBlockSize).position;
+		overflow.resize(count);
+		for(memory_size_type i = 0; i < count; ++i)
+			overflow[i] = position + i * m_diskBlockSize;
+	}
+	lock.unlock();
+
+	std::vector<stream_size_type> positions(1, handle.position);
+	positions.insert(positions.end(), overflow.begin(), overflow.end());
+	array<char> slots(positions.size() * m_diskBlockSize, 0);
+	uint32_t header[2] = {static_cast<uint32_t>(length), static_cast<uint32_t>(count)};
+	std::memcpy(slots.get(), header, encoded_header_size);
+	memory_size_type offset = encoded_header_size;
+	if(count) std::memcpy(slots.get() + offset, &overflow[0], count * sizeof(stream_size_type));
+	offset += count * sizeof(stream_size_type);
+	memory_size_type n = std::min(length, m_diskBlockSize - offset);
+	std::memcpy(slots.get() + offset, encoded.get(), n);
+	std::memcpy(slots.get() + m_diskBlockSize, encoded.get() + n, length - n);
+
+	// the first slot is written in full, and the overflow slots up to the
+	// end of the encoding
+	write_slots(&positions[0], positions.size(), slots.get(), m_diskBlockSize + length - n);
 }
 
 } // namespace blocks
@@ -28,6 +28,10 @@
 #include <tpie/file_accessor/file_accessor.h>
 #include <tpie/blocks/block.h>
 #include <tpie/blocks/freespace_collection.h>
+#include <tpie/blocks/block_codec.h>
+#include <memory>
+#include <mutex>
+#include <vector>
 
 namespace tpie {
 
@@ -35,6 +39,10 @@ namespace blocks {
 
 /**
  * \brief A class to manage writing and reading of block to disk.
+ *
+ * Blocks are read and written at their position without a shared file
+ * position, and the free space is guarded by a lock, so different blocks
+ * may be allocated, freed, read and written from several threads at once.
  */
 class block_collection {
 public:
@@ -46,6 +54,28 @@ public:
 	 */
 	block_collection(std::string fileName, memory_size_type blockSize, bool writeable);
 
+	/**
+	 * \brief Create a block collection that encodes blocks on disk
+	 *
+	 * Each block is stored in a slot of diskBlockSize bytes. If the encoded
+	 * block does not fit in the slot, the rest is stored in overflow slots
+	 * that are listed at the start of the first slot. The overflow slots of
+	 * a block are allocated as one extent, right after the block if there is
+	 * room, so they are read with one request. The handle of a block never
+	 * changes, however large its encoding gets.
+	 *
+	 * Throws invalid_argument_exception if diskBlockSize is too small to
+	 * list the overflow slots of the largest encoding of a block.
+	 *
+	 * \param fileName the file in which blocks are saved
+	 * \param blockSize the size of the blocks
+	 * \param writeable indicates whether the collection is writeable
+	 * \param codec the encoding of blocks on disk
+	 * \param diskBlockSize the size of a slot on disk
+	 */
+	block_collection(std::string fileName, memory_size_type blockSize, bool writeable,
+					 std::shared_ptr<const block_codec> codec, memory_size_type diskBlockSize);
+
 	~block_collection();
 
 	block_collection(const block_collection &) = delete;
@@ -56,6 +86,13 @@ public:
 	 */
 	block_handle get_free_block();
 
+	/**
+	 * \brief Allocates a new block, close to the given block if possible
+	 * \param near a block that is likely to be read together with the new one
+	 * \return the handle of the new block
+	 */
+	block_handle get_free_block(block_handle near);
+
 	/**
 	 * \brief frees a block
 	 * \param handle the handle of the block to be freed
@@ -76,7 +113,38 @@ public:
 	 */
 	void write_block(block_handle handle, const block & b);
 private:
+	// the size of the file in use
+	stream_size_type collection_size();
+
+	// prepare a newly allocated slot and return the handle of its block
+	block_handle init_block(block_handle h);
+
+	// the positions of the overflow slots of an encoded block
+	std::vector<stream_size_type> read_overflow(stream_size_type position);
+
+	// read or write bytes of consecutive memory from or to the slots at
+	// the given positions, with one request for each run of adjacent slots
+	void read_slots(const stream_size_type * positions, memory_size_type count,
+					char * data, memory_size_type bytes);
+
+	void write_slots(const stream_size_type * positions, memory_size_type count,
+					 const char * data, memory_size_type bytes);
+
+	// the number of overflow slots of an encoding of the given length
+	memory_size_type overflow_count(memory_size_type length) const;
+
+	void read_encoded(block_handle handle, block & b);
+
+	void write_encoded(block_handle handle, const block & b);
+
+	memory_size_type m_blockSize;
+	memory_size_type m_diskBlockSize;
+	std::shared_ptr<const block_codec> m_codec;
+	// the most overflow slots of a block
+	memory_size_type m_maxOverflow;
 	bits::freespace_collection m_collection;
+	// guards m_collection
+	std::mutex m_mutex;
 	tpie::file_accessor::raw_file_accessor m_accessor;
 
 	bool m_writeable;
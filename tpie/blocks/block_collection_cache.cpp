@@ -18,118 +18,374 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 #include <tpie/blocks/block_collection_cache.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
 
 namespace tpie {
 
 namespace blocks {
 
+namespace bits {
+
+/**
+ * \brief Reads blocks on a background thread for
+ * block_collection_cache::prefetch().
+ *
+ * Blocks are read and decoded through the block collection, whose reads
+ * are positional and so may run alongside the reads and writes of the
+ * cache. A block that is written or freed while it is being read ahead is
+ * marked stale, and its content is thrown away when the read finishes.
+ */
+class block_prefetcher {
+public:
+	block_prefetcher(block_collection & collection, memory_size_type maxPending)
+		: m_collection(collection)
+		, m_maxPending(maxPending)
+		, m_stop(false)
+		, m_thread([this]() {run();})
+	{}
+
+	~block_prefetcher() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_cond.notify_all();
+		m_thread.join();
+	}
+
+	void request(block_handle handle) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(m_entries.count(handle.position)) return;
+			if(m_entries.size() >= m_maxPending && !drop_unused()) return;
+			entry_t & e = m_entries[handle.position];
+			e.handle = handle;
+			e.state = queued;
+			e.stale = false;
+			m_queue.push_back(handle.position);
+		}
+		m_cond.notify_all();
+	}
+
+	// move the prefetched content of a block into b, waiting if it is being
+	// read; returns false if the caller must read the block itself
+	bool take(block_handle handle, block & b) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		entry_map_t::iterator i = m_entries.find(handle.position);
+		if(i == m_entries.end()) return false;
+		while(i->second.state == reading) {
+			m_cond.wait(lock);
+			i = m_entries.find(handle.position);
+		}
+		bool ok = i->second.state == done && !i->second.stale
+			&& i->second.data.size() == handle.size;
+		if(ok) b.swap(i->second.data);
+		m_entries.erase(i);
+		return ok;
+	}
+
+	// the block is about to change on disk or in the cache
+	void invalidate(stream_size_type position) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		entry_map_t::iterator i = m_entries.find(position);
+		if(i == m_entries.end()) return;
+		if(i->second.state == reading)
+			i->second.stale = true;
+		else
+			m_entries.erase(i);
+	}
+
+private:
+	enum state_t {queued, reading, done};
+
+	struct entry_t {
+		block_handle handle;
+		block data;
+		state_t state;
+		bool stale;
+	};
+
+	typedef std::map<stream_size_type, entry_t> entry_map_t;
+
+	// forget a block that was read ahead but never used
+	bool drop_unused() {
+		for(entry_map_t::iterator i = m_entries.begin(); i != m_entries.end(); ++i) {
+			if(i->second.state == done) {
+				m_entries.erase(i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void run() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		for(;;) {
+			while(!m_stop && m_queue.empty()) m_cond.wait(lock);
+			if(m_stop) return;
+			stream_size_type position = m_queue.front();
+			m_queue.pop_front();
+			entry_map_t::iterator i = m_entries.find(position);
+			if(i == m_entries.end() || i->second.state != queued) continue;
+			i->second.state = reading;
+			block_handle handle = i->second.handle;
+			lock.unlock();
+
+			block data;
+			bool ok = true;
+			try {
+				m_collection.read_block(handle, data);
+			} catch(const std::exception &) {
+				// leave it to read_block() to report the error
+				ok = false;
+			}
+
+			lock.lock();
+			i = m_entries.find(position);
+			i->second.data.swap(data);
+			i->second.state = done;
+			i->second.stale = i->second.stale || !ok;
+			m_cond.notify_all();
+		}
+	}
+
+	block_collection & m_collection;
+	memory_size_type m_maxPending;
+	bool m_stop;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<stream_size_type> m_queue;
+	entry_map_t m_entries;
+	std::thread m_thread;
+};
+
+} // namespace bits
+
+const memory_size_type block_collection_cache::no_slot;
+const memory_size_type block_collection_cache::write_batch_size;
+
 block_collection_cache::block_collection_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize, bool writeable)
-	: m_collection(fileName, blockSize, writeable)
-	, m_curSize(0)
-	, m_maxSize(maxSize)
-	, m_blockSize(blockSize)
+	: block_collection_cache(fileName, blockSize, maxSize, writeable, nullptr, blockSize)
 {}
 
+block_collection_cache::block_collection_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize, bool writeable,
+											   std::shared_ptr<const block_codec> codec, memory_size_type diskBlockSize)
+	: m_collection(fileName, blockSize, writeable, codec, diskBlockSize)
+	, m_maxSize(std::max<memory_size_type>(maxSize, 1))
+	, m_blockSize(blockSize)
+	, m_slots(m_maxSize)
+	, m_slotCount(0)
+	, m_hand(0)
+{
+	m_recent[0] = m_recent[1] = no_slot;
+
+	// keep the load factor of the hash table at most one half
+	memory_size_type indexSize = 8;
+	while(indexSize < 2 * m_maxSize) indexSize *= 2;
+	m_index.resize(indexSize, no_slot);
+	m_indexMask = indexSize - 1;
+}
+
 block_collection_cache::~block_collection_cache() {
+	m_prefetcher.reset();
 	// write the content of the cache to disk
-	block_map_t::iterator end = m_blockMap.end();
-
-	for(block_map_t::iterator i = m_blockMap.begin(); i != end; ++i) {
-		if(i->second.dirty) {
-			m_collection.write_block(i->first, *i->second.pointer);
-		}
-		tpie_delete(i->second.pointer);
-	}
+	flush();
 }
 
 block_handle block_collection_cache::get_free_block() {
-	block_handle h = m_collection.get_free_block();
-	block * cache_b = tpie_new<block>(m_blockSize);
-	add_to_cache(h, cache_b, true);
+	return add_free_block(m_collection.get_free_block());
+}
+
+block_handle block_collection_cache::get_free_block(block_handle near) {
+	return add_free_block(m_collection.get_free_block(near));
+}
+
+block_handle block_collection_cache::add_free_block(block_handle h) {
+	if(m_prefetcher) m_prefetcher->invalidate(h.position);
+	memory_size_type s = acquire_slot();
+	slot_t & slot = m_slots[s];
+	if(slot.data.size() != m_blockSize)
+		slot.data.resize(m_blockSize);
+	slot.handle = h;
+	slot.used = true;
+	slot.dirty = true;
+	slot.referenced = true;
+	insert_index(s);
+	touch(s);
 	return h;
 }
 
 void block_collection_cache::free_block(block_handle handle) {
 	tp_assert(handle.size == m_blockSize, "the size of the handle is not correct")
-	tp_assert(m_curSize > 0, "the current size of the cache is 0");
 
-	block_map_t::iterator i = m_blockMap.find(handle);
+	if(m_prefetcher) m_prefetcher->invalidate(handle.position);
+	memory_size_type s = find(handle.position);
 
-	if(i != m_blockMap.end()) {
-		m_blockList.erase(i->second.iterator);
-		tpie_delete(i->second.pointer);
-		--m_curSize;
-		m_blockMap.erase(i);
+	if(s != no_slot) {
+		erase_index(s);
+		slot_t & slot = m_slots[s];
+		slot.used = false;
+		slot.dirty = false;
+		slot.referenced = false;
+		if(m_recent[0] == s) m_recent[0] = no_slot;
+		if(m_recent[1] == s) m_recent[1] = no_slot;
+		m_freeSlots.push_back(s);
 	}
 
 	m_collection.free_block(handle);
 }
 
-void block_collection_cache::prepare_cache() {
-	if(m_curSize < m_maxSize)
-		return;
+block * block_collection_cache::read_block(block_handle handle) {
+	memory_size_type s = find(handle.position);
+
+	if(s != no_slot) { // the block is already in the cache
+		touch(s);
+		return &m_slots[s].data;
+	}
 
-	// write the last accessed block to disk
-	block_handle handle = m_blockList.front();
-	m_blockList.pop_front();
+	// the block isn't in the cache
+	s = acquire_slot();
+	slot_t & slot = m_slots[s];
+	if(!m_prefetcher || !m_prefetcher->take(handle, slot.data))
+		m_collection.read_block(handle, slot.data);
+	slot.handle = handle;
+	slot.used = true;
+	slot.dirty = false;
+	slot.referenced = true;
+	insert_index(s);
+	touch(s);
 
-	block_map_t::iterator i = m_blockMap.find(handle);
-	if(i->second.dirty)
-		m_collection.write_block(i->first, *(i->second.pointer));
-	tpie_delete(i->second.pointer);
-	--m_curSize;
-	m_blockMap.erase(i);
+	return &slot.data;
 }
 
-void block_collection_cache::add_to_cache(block_handle handle, block * b, bool dirty) {
-	m_blockList.push_back(handle);
-	block_list_t::iterator list_pos = m_blockList.end();
-	--list_pos;
+void block_collection_cache::write_block(block_handle handle) {
+	memory_size_type s = find(handle.position);
 
-	m_blockMap[handle] = block_information_t(b, list_pos, dirty);
-	++m_curSize;
-}
+	tp_assert(s != no_slot, "the given handle does not exist in the cache.");
 
-block * block_collection_cache::read_block(block_handle handle) {
-	block_map_t::iterator i = m_blockMap.find(handle);
+	m_slots[s].dirty = true;
+	touch(s);
+}
 
-	if(i != m_blockMap.end()) { // the block is already in the cache
-		// update the block list to reflect that the block was accessed
-		m_blockList.erase(i->second.iterator);
-		m_blockList.push_back(i->first);
+void block_collection_cache::flush() {
+	std::vector<memory_size_type> dirty;
+	for(memory_size_type i = 0; i < m_slotCount; ++i)
+		if(m_slots[i].used && m_slots[i].dirty) dirty.push_back(i);
+	write_slots(dirty);
+}
 
-		block_list_t::iterator j = m_blockList.end();
-		--j;
+void block_collection_cache::prefetch(block_handle handle) {
+	if(find(handle.position) != no_slot) return;
+	if(!m_prefetcher)
+		m_prefetcher.reset(tpie_new<bits::block_prefetcher>(
+			m_collection, std::max<memory_size_type>(m_maxSize / 4, 1)));
+	m_prefetcher->request(handle);
+}
 
-		i->second.iterator = j;
+memory_size_type block_collection_cache::bucket(stream_size_type position) const {
+	// Fibonacci hashing; positions are multiples of the block size, so the
+	// low bits alone would cluster
+	return static_cast<memory_size_type>((position * 0x9E3779B97F4A7C15ull) >> 32) & m_indexMask;
+}
 
-		// return the block content from cache
-		return i->second.pointer;
+memory_size_type block_collection_cache::find(stream_size_type position) const {
+	for(memory_size_type i = bucket(position); ; i = (i + 1) & m_indexMask) {
+		memory_size_type s = m_index[i];
+		if(s == no_slot || m_slots[s].handle.position == position) return s;
 	}
+}
 
-	// the block isn't in the cache
-	prepare_cache(); // make space in the cache for the new block
+void block_collection_cache::insert_index(memory_size_type slot) {
+	memory_size_type i = bucket(m_slots[slot].handle.position);
+	while(m_index[i] != no_slot) i = (i + 1) & m_indexMask;
+	m_index[i] = slot;
+}
 
-	block * cache_b = tpie_new<block>();
-	m_collection.read_block(handle, *cache_b);
-	add_to_cache(handle, cache_b, false);
+void block_collection_cache::erase_index(memory_size_type slot) {
+	memory_size_type i = bucket(m_slots[slot].handle.position);
+	while(m_index[i] != slot) i = (i + 1) & m_indexMask;
+	m_index[i] = no_slot;
 
-	return cache_b;
+	// shift back the following entries of the probe sequence so that no
+	// tombstones are needed
+	for(memory_size_type j = (i + 1) & m_indexMask; m_index[j] != no_slot; j = (j + 1) & m_indexMask) {
+		memory_size_type home = bucket(m_slots[m_index[j]].handle.position);
+		// the entry may stay if its home bucket lies cyclically in (i, j]
+		if(((j - home) & m_indexMask) < ((j - i) & m_indexMask)) continue;
+		m_index[i] = m_index[j];
+		m_index[j] = no_slot;
+		i = j;
+	}
 }
 
-void block_collection_cache::write_block(block_handle handle) {
-	block_map_t::iterator i = m_blockMap.find(handle);
+memory_size_type block_collection_cache::acquire_slot() {
+	if(!m_freeSlots.empty()) {
+		memory_size_type s = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		return s;
+	}
+	if(m_slotCount < m_maxSize)
+		return m_slotCount++;
+	return evict();
+}
+
+memory_size_type block_collection_cache::evict() {
+	for(;;) {
+		memory_size_type s = m_hand;
+		m_hand = (m_hand + 1) % m_slotCount;
+		slot_t & slot = m_slots[s];
+		if(!slot.used) continue;
+		if(m_slotCount > 2 && (s == m_recent[0] || s == m_recent[1])) continue;
+		if(slot.referenced) {
+			slot.referenced = false;
+			continue;
+		}
 
-	tp_assert(i != m_blockMap.end(), "the given handle does not exist in the cache.");
+		if(slot.dirty) write_back(s);
+		erase_index(s);
+		slot.used = false;
+		if(m_recent[0] == s) m_recent[0] = no_slot;
+		if(m_recent[1] == s) m_recent[1] = no_slot;
+		return s;
+	}
+}
 
-	m_blockList.erase(i->second.iterator);
-	m_blockList.push_back(handle);
+void block_collection_cache::write_back(memory_size_type victim) {
+	std::vector<memory_size_type> dirty;
+	dirty.push_back(victim);
+
+	// the unreferenced dirty blocks after the hand are evicted next
+	memory_size_type n = std::min(write_batch_size, m_slotCount);
+	for(memory_size_type k = 0, s = m_hand; k < n; ++k, s = (s + 1) % m_slotCount) {
+		const slot_t & slot = m_slots[s];
+		if(s != victim && slot.used && slot.dirty && !slot.referenced)
+			dirty.push_back(s);
+	}
+	write_slots(dirty);
+}
 
-	block_list_t::iterator j = m_blockList.end();
-	--j;
+void block_collection_cache::write_slots(std::vector<memory_size_type> & slots) {
+	std::sort(slots.begin(), slots.end(), [this](memory_size_type a, memory_size_type b) {
+		return m_slots[a].handle.position < m_slots[b].handle.position;
+	});
+	for(memory_size_type s: slots) {
+		if(m_prefetcher) m_prefetcher->invalidate(m_slots[s].handle.position);
+		m_collection.write_block(m_slots[s].handle, m_slots[s].data);
+		m_slots[s].dirty = false;
+	}
+}
 
-	i->second.iterator = j;
-	i->second.dirty = true;
+void block_collection_cache::touch(memory_size_type slot) {
+	m_slots[slot].referenced = true;
+	if(m_recent[0] != slot) {
+		m_recent[1] = m_recent[0];
+		m_recent[0] = slot;
+	}
 }
 
 } // namespace blocks
@@ -25,46 +25,53 @@
 #define _TPIE_BLOCKS_BLOCK_COLLECTION_CACHE_H
 
 #include <tpie/tpie.h>
+#include <tpie/memory.h>
 #include <tpie/tpie_assert.h>
 #include <tpie/file_accessor/file_accessor.h>
 #include <tpie/blocks/block.h>
 #include <tpie/blocks/block_collection.h>
-#include <list>
-#include <map>
+#include <tpie/array.h>
+#include <limits>
+#include <vector>
 
 namespace tpie {
 
 namespace blocks {
 
+namespace bits {
+class block_prefetcher;
+} // namespace bits
+
 /**
  * \brief A class to manage writing and reading of block to disk. 
  * Blocks are stored in an internal cache with a static size.
+ *
+ * Cached blocks are found through an open addressing hash table on the
+ * block position and are evicted with the CLOCK policy. The two most
+ * recently accessed blocks are never evicted, so a caller may hold on to
+ * the pointers of two blocks while it works on both. When a dirty block is
+ * evicted, it is written back together with the other dirty blocks that
+ * are next in line for eviction, sorted by their position on disk.
+ *
+ * Blocks may be read ahead of time with prefetch(), which reads and decodes
+ * them on a background thread.
  */
 class block_collection_cache {
 private:
-	struct position_comparator {
-		bool operator()(const block_handle & a, const block_handle & b) const {
-			return a.position < b.position;
-		}
-	};
-
-	typedef std::list<block_handle> block_list_t;
+	static const memory_size_type no_slot = std::numeric_limits<memory_size_type>::max();
 
-	struct block_information_t {
-		block_information_t() {}
+	// the maximal number of blocks written back at a time on eviction
+	static const memory_size_type write_batch_size = 32;
 
-		block_information_t(block * pointer, block_list_t::iterator iterator, bool dirty)
-			: pointer(pointer)
-			, iterator(iterator)
-			, dirty(dirty)
-		{}
+	struct slot_t {
+		slot_t() : used(false), dirty(false), referenced(false) {}
 
-		block * pointer;
-		block_list_t::iterator iterator;
+		block data;
+		block_handle handle;
+		bool used;
 		bool dirty;
+		bool referenced;
 	};
-
-	typedef std::map<block_handle, block_information_t, position_comparator> block_map_t;
 public:
 	/**
 	 * \brief Create a block collection
@@ -75,6 +82,21 @@ public:
 	 */
 	block_collection_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize, bool writeable);
 
+	/**
+	 * \brief Create a block collection that encodes blocks on disk
+	 *
+	 * See the corresponding block_collection constructor.
+	 *
+	 * \param fileName the file in which blocks are saved
+	 * \param blockSize the size of blocks constructed
+	 * \param maxSize the size of the cache given in number of blocks
+	 * \param writeable indicates whether the collection is writeable
+	 * \param codec the encoding of blocks on disk
+	 * \param diskBlockSize the size of a slot on disk
+	 */
+	block_collection_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize, bool writeable,
+						   std::shared_ptr<const block_codec> codec, memory_size_type diskBlockSize);
+
 	~block_collection_cache();
 
 
@@ -84,18 +106,19 @@ public:
 	 */
 	block_handle get_free_block();
 
+	/**
+	 * \brief Allocates a new block, close to the given block if possible
+	 * \param near a block that is likely to be read together with the new one
+	 * \return the handle of the new block
+	 */
+	block_handle get_free_block(block_handle near);
+
 	/**
 	 * \brief frees a block
 	 * \param handle the handle of the block to be freed
 	 */
 	void free_block(block_handle handle);
 
-private:
-	// make space for a new block in the cache
-	void prepare_cache();
-
-	void add_to_cache(block_handle handle, block * b, bool dirty);
-public:
 	/**
 	 * \brief Reads the content of a block from disk
 	 * \param handle the handle of the block to read
@@ -110,13 +133,64 @@ public:
 	 */
 	void write_block(block_handle handle);
 
+	/**
+	 * \brief Writes all dirty blocks in the cache to disk
+	 */
+	void flush();
+
+	/**
+	 * \brief Starts reading a block in the background, if it is not in the
+	 * cache, so that a later read_block() does not wait for the disk.
+	 *
+	 * At most a quarter of the cache size of blocks are read ahead at a
+	 * time, and further requests are ignored.
+	 * \param handle the handle of the block that will be read soon
+	 */
+	void prefetch(block_handle handle);
+
 private:
+	// put a newly allocated block in the cache
+	block_handle add_free_block(block_handle h);
+
+	// the home bucket of a block position in the hash table
+	memory_size_type bucket(stream_size_type position) const;
+
+	// the slot holding the block at the given position, or no_slot
+	memory_size_type find(stream_size_type position) const;
+
+	void insert_index(memory_size_type slot);
+
+	void erase_index(memory_size_type slot);
+
+	// get an unused slot, evicting a block if the cache is full
+	memory_size_type acquire_slot();
+
+	// pick a block to evict using the CLOCK policy
+	memory_size_type evict();
+
+	// write back the given dirty slot along with dirty slots near the hand
+	void write_back(memory_size_type victim);
+
+	// write the given dirty slots sorted by their position
+	void write_slots(std::vector<memory_size_type> & slots);
+
+	void touch(memory_size_type slot);
+
 	block_collection m_collection;
-	block_list_t m_blockList;
-	block_map_t m_blockMap;
-	memory_size_type m_curSize;
 	memory_size_type m_maxSize;
 	memory_size_type m_blockSize;
+
+	array<slot_t> m_slots;
+	memory_size_type m_slotCount;
+	std::vector<memory_size_type, allocator<memory_size_type> > m_freeSlots;
+	memory_size_type m_hand;
+	memory_size_type m_recent[2];
+
+	array<memory_size_type> m_index;
+	memory_size_type m_indexMask;
+
+	// started on the first call to prefetch()
+	tpie::unique_ptr<bits::block_prefetcher> m_prefetcher;
 };
 
 } // blocks namespace
@@ -0,0 +1,156 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include <tpie/blocks/freespace_collection.h>
+#include <tpie/tpie_assert.h>
+#include <limits>
+
+namespace tpie {
+
+namespace blocks {
+
+namespace bits {
+
+freespace_collection::freespace_collection(const std::string & path, memory_size_type blockSize)
+	: m_free(path)
+	, m_end(0)
+	, m_freeSpace(0)
+	, m_blockSize(blockSize)
+{
+	if(m_free.empty()) return;
+	m_end = m_free.pop().position;
+
+	// collections saved before extents were merged hold single blocks, so
+	// every saved block is freed again to merge it with its neighbours
+	while(!m_free.empty())
+		free(m_free.pop());
+}
+
+freespace_collection::~freespace_collection() {
+	for(extent_map::iterator i = m_extents.begin(); i != m_extents.end(); ++i)
+		m_free.push(block_handle(i->first, i->second));
+	m_free.push(block_handle(m_end, std::numeric_limits<stream_size_type>::max()));
+}
+
+void freespace_collection::free(block_handle handle) {
+	stream_size_type position = handle.position;
+	stream_size_type size = handle.size;
+	tp_assert(position + size <= m_end, "the freed block is not in the collection");
+
+	extent_map::iterator next = m_extents.lower_bound(position);
+	tp_assert(next == m_extents.end() || position + size <= next->first, "the block is already free");
+	if(next != m_extents.end() && next->first == position + size) {
+		size += next->second;
+		extent_map::iterator i = next++;
+		erase_extent(i);
+	}
+	if(next != m_extents.begin()) {
+		extent_map::iterator previous = next;
+		--previous;
+		tp_assert(previous->first + previous->second <= position, "the block is already free");
+		if(previous->first + previous->second == position) {
+			position = previous->first;
+			size += previous->second;
+			erase_extent(previous);
+		}
+	}
+
+	if(position + size == m_end) {
+		// give the end of the file back
+		m_end = position;
+		return;
+	}
+	insert_extent(position, size);
+}
+
+block_handle freespace_collection::alloc(memory_size_type size) {
+	size_set::iterator i = m_bySize.lower_bound(size_position(size, 0));
+	if(i != m_bySize.end())
+		return take(m_extents.find(i->second), i->second, size);
+
+	block_handle h(m_end, size);
+	m_end += size;
+	return h;
+}
+
+block_handle freespace_collection::alloc(memory_size_type size, stream_size_type near) {
+	stream_size_type distance = near_distance * m_blockSize;
+	stream_size_type best = std::numeric_limits<stream_size_type>::max();
+	extent_map::iterator bestExtent = m_extents.end();
+	stream_size_type bestPosition = 0;
+
+	// the first free extent after the position, used from its start
+	extent_map::iterator next = m_extents.lower_bound(near);
+	if(next != m_extents.end() && next->second >= size && next->first - near <= distance) {
+		best = next->first - near;
+		bestExtent = next;
+		bestPosition = next->first;
+	}
+
+	// the last free extent before it, used from its end
+	if(next != m_extents.begin()) {
+		extent_map::iterator previous = next;
+		--previous;
+		stream_size_type end = previous->first + previous->second;
+		stream_size_type gap = end <= near ? near - end : 0;
+		if(previous->second >= size && gap <= distance && gap < best) {
+			bestExtent = previous;
+			bestPosition = end - size;
+		}
+	}
+
+	if(bestExtent == m_extents.end()) {
+		// the end of the file may be close too
+		if(m_end >= near && m_end - near <= distance) {
+			block_handle h(m_end, size);
+			m_end += size;
+			return h;
+		}
+		return alloc(size);
+	}
+	return take(bestExtent, bestPosition, size);
+}
+
+void freespace_collection::insert_extent(stream_size_type position, stream_size_type size) {
+	m_extents.insert(std::make_pair(position, size));
+	m_bySize.insert(size_position(size, position));
+	m_freeSpace += size;
+}
+
+void freespace_collection::erase_extent(extent_map::iterator i) {
+	m_bySize.erase(size_position(i->second, i->first));
+	m_freeSpace -= i->second;
+	m_extents.erase(i);
+}
+
+block_handle freespace_collection::take(extent_map::iterator i, stream_size_type position, memory_size_type size) {
+	stream_size_type start = i->first;
+	stream_size_type end = i->first + i->second;
+	tp_assert(start <= position && position + size <= end, "the block is not in the extent");
+	erase_extent(i);
+	if(start < position) insert_extent(start, position - start);
+	if(position + size < end) insert_extent(position + size, end - position - size);
+	return block_handle(position, size);
+}
+
+} // bits namespace
+
+} // blocks namespace
+
+} // tpie namespace
@@ -25,10 +25,13 @@
 #define _TPIE_BLOCKS_FREESPACE_COLLECTION_H
 
 #include <tpie/tpie.h>
-#include <tpie/tpie_assert.h>
+#include <tpie/memory.h>
 #include <tpie/blocks/block.h>
 #include <tpie/stack.h>
-#include <limits>
+#include <functional>
+#include <map>
+#include <set>
+#include <utility>
 
 namespace tpie {
 
@@ -36,44 +39,104 @@ namespace blocks {
 
 namespace bits {
 
+/**
+ * \brief Allocation of space in a file of blocks
+ *
+ * The free space is kept as extents of adjacent free bytes. A freed block
+ * is merged with the free extents next to it, and free space at the end of
+ * the file is given back, so size() shrinks. A block of any size is
+ * allocated from the smallest free extent that is large enough, at its
+ * lowest address, or at the end of the file if no extent is large enough.
+ * Given the position of a related block, such as the sibling of a new
+ * btree node, a free extent close to it is preferred, so blocks that are
+ * read together tend to be adjacent on disk.
+ *
+ * The free extents are kept in memory and saved in a stack in the given
+ * file when the collection is destroyed. The top element of the stack is
+ * an infinitely large block representing the end of the file.
+ */
 class freespace_collection {
-private:
-	tpie::stack<block_handle> m_free;
-	stream_size_type m_end;
-	memory_size_type m_blockSize;
 public:
-	freespace_collection(const std::string & path, const memory_size_type blockSize) 
-	: m_free(path)
-	, m_end(0)
-	, m_blockSize(blockSize)
-	{
-		if(m_free.size() > 0) { // when closed the top element of the stacked is an infinitely large block representing the end of the file
-			m_end = m_free.pop().position;
-		}
+	/**
+	 * \brief Open or create a collection
+	 * \param path the file in which the free extents are saved
+	 * \param blockSize the size of the blocks returned by alloc()
+	 */
+	freespace_collection(const std::string & path, memory_size_type blockSize);
+
+	~freespace_collection();
+
+	/**
+	 * \brief Mark a block as free
+	 * \param handle a block returned by alloc()
+	 */
+	void free(block_handle handle);
+
+	/**
+	 * \brief Allocate a block of the default block size
+	 */
+	block_handle alloc() {
+		return alloc(m_blockSize);
 	}
 
-	~freespace_collection() {
-		// when closed the top element of the stacked is an infinitely large block representing the end of the file
-		m_free.push(block_handle(m_end, std::numeric_limits<stream_size_type>::max()));
+	/**
+	 * \brief Allocate a block of the given size
+	 */
+	block_handle alloc(memory_size_type size);
+
+	/**
+	 * \brief Allocate a block of the given size, close to a position if
+	 * there is free space within near_distance blocks of it
+	 */
+	block_handle alloc(memory_size_type size, stream_size_type near);
+
+	/**
+	 * \brief The size of the used part of the file
+	 */
+	stream_size_type size() const {
+		return m_end;
 	}
 
-	void free(block_handle handle) {
-		tp_assert(handle.size == m_blockSize, "the size of the given handle is incorrect");
-		m_free.push(handle);
+	/**
+	 * \brief The number of free bytes before size()
+	 */
+	stream_size_type free_space() const {
+		return m_freeSpace;
 	}
 
-	block_handle alloc() {
-		if(!m_free.empty())
-			return m_free.pop();
-
-		block_handle h(m_end, m_blockSize);
-		m_end += m_blockSize;
-		return h;
+	/**
+	 * \brief The number of free extents before size()
+	 */
+	memory_size_type free_extents() const {
+		return m_extents.size();
 	}
 
-	stream_size_type size() {
-		return m_end;
-	}
+	/**
+	 * \brief How far from the position given to alloc() free space is
+	 * searched, in blocks of the default size
+	 */
+	static const memory_size_type near_distance = 16;
+
+private:
+	typedef std::map<stream_size_type, stream_size_type, std::less<stream_size_type>,
+					 allocator<std::pair<const stream_size_type, stream_size_type> > > extent_map;
+	typedef std::pair<stream_size_type, stream_size_type> size_position;
+	typedef std::set<size_position, std::less<size_position>, allocator<size_position> > size_set;
+
+	void insert_extent(stream_size_type position, stream_size_type size);
+	void erase_extent(extent_map::iterator i);
+
+	// allocate [position, position + size) from the extent i
+	block_handle take(extent_map::iterator i, stream_size_type position, memory_size_type size);
+
+	tpie::stack<block_handle> m_free;
+	// the free extents by position, with their sizes
+	extent_map m_extents;
+	// the free extents by size and position, to find the best fit
+	size_set m_bySize;
+	stream_size_type m_end;
+	stream_size_type m_freeSpace;
+	memory_size_type m_blockSize;
 };
 
 } // bits namespace
@@ -0,0 +1,296 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#include <tpie/blocks/sharded_block_cache.h>
+#include <tpie/job.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+namespace tpie {
+
+namespace blocks {
+
+namespace {
+
+std::atomic<stream_size_type> next_cache_id(1);
+
+struct pinned_block_t {
+	pinned_block_t() : cache(0), position(0) {}
+
+	stream_size_type cache;
+	stream_size_type position;
+	sharded_block_cache::block_ptr data;
+};
+
+struct pin_ring_t;
+
+// the pin rings of all threads, so a cache can release its blocks from
+// every ring when it is destroyed
+struct pin_ring_registry_t {
+	std::mutex mutex;
+	std::vector<pin_ring_t *> rings;
+};
+
+pin_ring_registry_t & pin_ring_registry() {
+	// never destroyed, as rings of other threads may outlive static objects
+	static pin_ring_registry_t * registry = new pin_ring_registry_t();
+	return *registry;
+}
+
+// the blocks most recently pinned by read_block() in this thread
+struct pin_ring_t {
+	pin_ring_t() : next(0) {
+		pin_ring_registry_t & r = pin_ring_registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.rings.push_back(this);
+	}
+
+	~pin_ring_t() {
+		pin_ring_registry_t & r = pin_ring_registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.rings.erase(std::find(r.rings.begin(), r.rings.end(), this));
+	}
+
+	// taken by the owning thread while it uses the ring and by a cache
+	// releasing its blocks, so it is rarely contended
+	std::mutex mutex;
+	pinned_block_t pins[sharded_block_cache::pinned_per_thread];
+	memory_size_type next;
+
+	void release(stream_size_type cache, stream_size_type position) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for(memory_size_type i = 0; i < sharded_block_cache::pinned_per_thread; ++i) {
+			if(pins[i].cache == cache && pins[i].position == position) {
+				pins[i] = pinned_block_t();
+			}
+		}
+	}
+
+	void release(stream_size_type cache) {
+		std::lock_guard<std::mutex> lock(mutex);
+		for(memory_size_type i = 0; i < sharded_block_cache::pinned_per_thread; ++i) {
+			if(pins[i].cache == cache) pins[i] = pinned_block_t();
+		}
+	}
+};
+
+thread_local pin_ring_t pin_ring;
+
+// release the blocks of a cache from the pin rings of all threads
+void release_all(stream_size_type cache) {
+	pin_ring_registry_t & r = pin_ring_registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	for(memory_size_type i = 0; i < r.rings.size(); ++i) r.rings[i]->release(cache);
+}
+
+} // unnamed namespace
+
+const memory_size_type sharded_block_cache::pinned_per_thread;
+
+sharded_block_cache::sharded_block_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize,
+										 bool writeable, memory_size_type shards)
+	: sharded_block_cache(fileName, blockSize, maxSize, writeable, nullptr, blockSize, shards)
+{}
+
+sharded_block_cache::sharded_block_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize,
+										 bool writeable, std::shared_ptr<const block_codec> codec,
+										 memory_size_type diskBlockSize, memory_size_type shards)
+	: m_collection(fileName, blockSize, writeable, codec, diskBlockSize)
+	, m_blockSize(blockSize)
+	, m_id(next_cache_id++)
+{
+	if(shards == 0) shards = 4 * default_worker_count();
+	shards = std::max<memory_size_type>(shards, 1);
+	m_shardSize = std::max<memory_size_type>((maxSize + shards - 1) / shards, 2);
+	for(memory_size_type i = 0; i < shards; ++i) {
+		m_shards.push_back(tpie::unique_ptr<shard_t>(tpie_new<shard_t>()));
+		m_shards.back()->hand = 0;
+	}
+}
+
+sharded_block_cache::~sharded_block_cache() {
+	// write the content of the cache to disk
+	flush();
+	release_all(m_id);
+}
+
+block_handle sharded_block_cache::get_free_block() {
+	return add_free_block(m_collection.get_free_block());
+}
+
+block_handle sharded_block_cache::get_free_block(block_handle near) {
+	return add_free_block(m_collection.get_free_block(near));
+}
+
+block_handle sharded_block_cache::add_free_block(block_handle h) {
+	block_ptr b = allocate_block();
+	shard_t & s = shard(h.position);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	insert(s, h, std::move(b), true);
+	return h;
+}
+
+void sharded_block_cache::free_block(block_handle handle) {
+	tp_assert(handle.size == m_blockSize, "the size of the handle is not correct")
+
+	pin_ring.release(m_id, handle.position);
+	{
+		shard_t & s = shard(handle.position);
+		std::lock_guard<std::mutex> lock(s.mutex);
+		entry_map_t::iterator i = s.entries.find(handle.position);
+		if(i != s.entries.end()) erase(s, i);
+	}
+
+	m_collection.free_block(handle);
+}
+
+sharded_block_cache::block_ptr sharded_block_cache::pin(block_handle handle) {
+	shard_t & s = shard(handle.position);
+	{
+		std::lock_guard<std::mutex> lock(s.mutex);
+		entry_map_t::iterator i = s.entries.find(handle.position);
+		if(i != s.entries.end()) { // the block is already in the cache
+			i->second.referenced = true;
+			return i->second.data;
+		}
+	}
+
+	// read the block without holding the shard lock, so misses in this
+	// and other shards are read at the same time
+	block_ptr b = allocate_block();
+	m_collection.read_block(handle, *b);
+
+	std::lock_guard<std::mutex> lock(s.mutex);
+	entry_map_t::iterator i = s.entries.find(handle.position);
+	if(i != s.entries.end()) { // another thread read the block meanwhile
+		i->second.referenced = true;
+		return i->second.data;
+	}
+	return insert(s, handle, std::move(b), false).data;
+}
+
+block * sharded_block_cache::read_block(block_handle handle) {
+	pin_ring_t & ring = pin_ring;
+	{
+		std::lock_guard<std::mutex> lock(ring.mutex);
+		for(memory_size_type i = 0; i < pinned_per_thread; ++i) {
+			const pinned_block_t & p = ring.pins[i];
+			if(p.cache == m_id && p.position == handle.position) return p.data.get();
+		}
+	}
+
+	// pin the block without holding the ring lock, as it may be read
+	block_ptr data = pin(handle);
+	std::lock_guard<std::mutex> lock(ring.mutex);
+	pinned_block_t & p = ring.pins[ring.next];
+	ring.next = (ring.next + 1) % pinned_per_thread;
+	p.data = std::move(data);
+	p.cache = m_id;
+	p.position = handle.position;
+	return p.data.get();
+}
+
+void sharded_block_cache::write_block(block_handle handle) {
+	shard_t & s = shard(handle.position);
+	std::lock_guard<std::mutex> lock(s.mutex);
+	entry_map_t::iterator i = s.entries.find(handle.position);
+
+	tp_assert(i != s.entries.end(), "the given handle does not exist in the cache.");
+
+	i->second.dirty = true;
+	i->second.referenced = true;
+}
+
+void sharded_block_cache::flush() {
+	std::vector<std::pair<block_handle, block_ptr> > dirty;
+	for(memory_size_type j = 0; j < m_shards.size(); ++j) {
+		shard_t & s = *m_shards[j];
+		std::lock_guard<std::mutex> lock(s.mutex);
+		for(entry_map_t::iterator i = s.entries.begin(); i != s.entries.end(); ++i) {
+			if(!i->second.dirty) continue;
+			dirty.push_back(std::make_pair(i->second.handle, i->second.data));
+			i->second.dirty = false;
+		}
+	}
+
+	std::sort(dirty.begin(), dirty.end(),
+			  [](const std::pair<block_handle, block_ptr> & a, const std::pair<block_handle, block_ptr> & b) {
+				  return a.first.position < b.first.position;
+			  });
+	for(memory_size_type i = 0; i < dirty.size(); ++i)
+		m_collection.write_block(dirty[i].first, *dirty[i].second);
+}
+
+sharded_block_cache::shard_t & sharded_block_cache::shard(stream_size_type position) {
+	// positions are multiples of the block size, so mix the bits
+	return *m_shards[((position * 0x9E3779B97F4A7C15ull) >> 32) % m_shards.size()];
+}
+
+sharded_block_cache::entry_t & sharded_block_cache::insert(shard_t & s, block_handle handle, block_ptr data, bool dirty) {
+	// CLOCK eviction, skipping pinned blocks; give up after two rounds
+	// if everything is pinned
+	for(memory_size_type k = 0; k < 2 * s.ring.size() && s.entries.size() >= m_shardSize; ++k) {
+		if(s.hand >= s.ring.size()) s.hand = 0;
+		entry_map_t::iterator i = s.entries.find(s.ring[s.hand]);
+		entry_t & e = i->second;
+		if(e.data.use_count() > 1) {
+			++s.hand;
+			continue;
+		}
+		if(e.referenced) {
+			e.referenced = false;
+			++s.hand;
+			continue;
+		}
+		if(e.dirty) {
+			// the block stays in the shard until it is written, so a miss
+			// on it cannot read it from disk before that
+			m_collection.write_block(e.handle, *e.data);
+		}
+		// the last block of the ring takes the place of the evicted block
+		erase(s, i);
+	}
+
+	s.ring.push_back(handle.position);
+	entry_t & e = s.entries[handle.position];
+	e.data = std::move(data);
+	e.handle = handle;
+	e.ring = s.ring.size() - 1;
+	e.dirty = dirty;
+	e.referenced = true;
+	return e;
+}
+
+void sharded_block_cache::erase(shard_t & s, entry_map_t::iterator i) {
+	memory_size_type r = i->second.ring;
+	stream_size_type last = s.ring.back();
+	s.ring[r] = last;
+	s.entries.find(last)->second.ring = r;
+	s.ring.pop_back();
+	s.entries.erase(i);
+}
+
+sharded_block_cache::block_ptr sharded_block_cache::allocate_block() {
+	return std::allocate_shared<block>(allocator<block>(), m_blockSize);
+}
+
+} // namespace blocks
+} // namespace tpie
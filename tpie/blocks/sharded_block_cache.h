@@ -0,0 +1,218 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino+=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file sharded_block_cache Thread-safe cache of a block collection
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_BLOCKS_SHARDED_BLOCK_CACHE_H
+#define _TPIE_BLOCKS_SHARDED_BLOCK_CACHE_H
+
+#include <tpie/tpie.h>
+#include <tpie/memory.h>
+#include <tpie/tpie_assert.h>
+#include <tpie/blocks/block.h>
+#include <tpie/blocks/block_collection.h>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace tpie {
+
+namespace blocks {
+
+/**
+ * \brief A cache of a block collection that may be used from several
+ * threads at once.
+ *
+ * The blocks are divided between a number of shards by their position,
+ * and each shard has its own lock, hash table and CLOCK hand, so threads
+ * reading different blocks rarely wait for each other. Blocks are read and
+ * written at their position in the file, without a shared file position,
+ * so misses in different shards are read at the same time. A shard is
+ * unlocked while a missing block is read.
+ *
+ * A block is pinned for as long as a block_ptr to it exists. Pinned blocks
+ * are never evicted, so the cache may temporarily hold more blocks than its
+ * size if many blocks are pinned.
+ *
+ * read_block() offers the interface of block_collection_cache. It pins the
+ * block in a small per-thread ring of recently read blocks, so the returned
+ * pointer stays valid until the calling thread has read pinned_per_thread
+ * other blocks. Blocks found in the ring are returned without locking a
+ * shard. When the cache is destroyed, its blocks are released from the
+ * rings of all threads.
+ *
+ * Concurrent reads are safe. Allocating, freeing and writing blocks is
+ * thread-safe as far as the cache is concerned, but the caller must make
+ * sure that no other thread reads a block while it is being changed, and
+ * a block that is freed must not be pinned by another thread.
+ */
+class sharded_block_cache {
+public:
+	/**
+	 * \brief A pinned block
+	 */
+	typedef std::shared_ptr<block> block_ptr;
+
+	/**
+	 * \brief The number of blocks each thread keeps pinned in read_block()
+	 */
+	static const memory_size_type pinned_per_thread = 8;
+
+	/**
+	 * \brief Create a block collection
+	 * \param fileName the file in which blocks are saved
+	 * \param blockSize the size of blocks constructed
+	 * \param maxSize the size of the cache given in number of blocks
+	 * \param writeable indicates whether the collection is writeable
+	 * \param shards the number of shards, or zero to use four times
+	 * the number of worker threads
+	 */
+	sharded_block_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize,
+						bool writeable, memory_size_type shards = 0);
+
+	/**
+	 * \brief Create a block collection that encodes blocks on disk
+	 *
+	 * See the corresponding block_collection constructor.
+	 *
+	 * \param fileName the file in which blocks are saved
+	 * \param blockSize the size of blocks constructed
+	 * \param maxSize the size of the cache given in number of blocks
+	 * \param writeable indicates whether the collection is writeable
+	 * \param codec the encoding of blocks on disk
+	 * \param diskBlockSize the size of a slot on disk
+	 * \param shards the number of shards, or zero to use four times
+	 * the number of worker threads
+	 */
+	sharded_block_cache(std::string fileName, memory_size_type blockSize, memory_size_type maxSize,
+						bool writeable, std::shared_ptr<const block_codec> codec,
+						memory_size_type diskBlockSize, memory_size_type shards = 0);
+
+	~sharded_block_cache();
+
+	sharded_block_cache(const sharded_block_cache &) = delete;
+	sharded_block_cache & operator=(const sharded_block_cache &) = delete;
+
+	/**
+	 * \brief Allocates a new block
+	 * \return the handle of the new block
+	 */
+	block_handle get_free_block();
+
+	/**
+	 * \brief Allocates a new block, close to the given block if possible
+	 * \param near a block that is likely to be read together with the new one
+	 * \return the handle of the new block
+	 */
+	block_handle get_free_block(block_handle near);
+
+	/**
+	 * \brief frees a block
+	 * \param handle the handle of the block to be freed
+	 */
+	void free_block(block_handle handle);
+
+	/**
+	 * \brief Reads a block and pins it until the returned pointer is
+	 * destroyed
+	 * \param handle the handle of the block to read
+	 */
+	block_ptr pin(block_handle handle);
+
+	/**
+	 * \brief Reads the content of a block from disk
+	 * \param handle the handle of the block to read
+	 * \return a pointer to the block with the given handle, valid until
+	 * the calling thread has read pinned_per_thread other blocks
+	 */
+	block * read_block(block_handle handle);
+
+	/**
+	 * \brief Marks a block as changed, so it is written to disk
+	 * \param handle the handle of the block to write
+	 * \pre the block is pinned
+	 */
+	void write_block(block_handle handle);
+
+	/**
+	 * \brief Writes all dirty blocks in the cache to disk
+	 */
+	void flush();
+
+	/**
+	 * \brief Accepted for compatibility with block_collection_cache; the
+	 * sharded cache does not read blocks ahead of time
+	 */
+	void prefetch(block_handle) {}
+
+	/**
+	 * \brief The number of shards
+	 */
+	memory_size_type shards() const {return m_shards.size();}
+
+private:
+	struct entry_t {
+		block_ptr data;
+		block_handle handle;
+		// position of the block in the CLOCK ring of the shard
+		memory_size_type ring;
+		bool dirty;
+		bool referenced;
+	};
+
+	typedef std::unordered_map<stream_size_type, entry_t, std::hash<stream_size_type>,
+							   std::equal_to<stream_size_type>,
+							   allocator<std::pair<const stream_size_type, entry_t> > > entry_map_t;
+
+	struct shard_t {
+		std::mutex mutex;
+		entry_map_t entries;
+		std::vector<stream_size_type, allocator<stream_size_type> > ring;
+		memory_size_type hand;
+	};
+
+	shard_t & shard(stream_size_type position);
+
+	// insert a block into a locked shard, evicting blocks if it is full
+	entry_t & insert(shard_t & s, block_handle handle, block_ptr data, bool dirty);
+
+	// remove a block from a locked shard
+	void erase(shard_t & s, entry_map_t::iterator i);
+
+	block_ptr allocate_block();
+
+	// put a newly allocated block in the cache
+	block_handle add_free_block(block_handle h);
+
+	block_collection m_collection;
+	memory_size_type m_blockSize;
+	memory_size_type m_shardSize;
+	std::vector<tpie::unique_ptr<shard_t> > m_shards;
+	// identifies the cache in the per-thread rings, as addresses are reused
+	stream_size_type m_id;
+};
+
+} // blocks namespace
+
+}  //  tpie namespace
+
+#endif // _TPIE_BLOCKS_SHARDED_BLOCK_CACHE_H
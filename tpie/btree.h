@@ -25,5 +25,6 @@
 #include <tpie/btree/external_store.h>
 #include <tpie/btree/btree.h>
 #include <tpie/btree/btree_builder.h>
+#include <tpie/btree/serialization_btree.h>
 
 #endif //__TPIE_BTREE_H__
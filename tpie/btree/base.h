@@ -21,6 +21,7 @@
 #define _TPIE_BTREE_BASE_H_
 #include <tpie/portability.h>
 #include <functional>
+#include <type_traits>
 namespace tpie {
 
 /**
@@ -57,6 +58,17 @@ struct default_comp {
 	}
 };
 
+/**
+ * \brief Whether comparing keys of type K with C is the built-in < of an
+ * arithmetic type, so that nodes can be searched without calling C
+ */
+template <typename C, typename K>
+struct is_arithmetic_comp : std::integral_constant<
+	bool,
+	std::is_arithmetic<K>::value
+	&& (std::is_same<C, default_comp>::value
+		|| std::is_same<C, std::less<K> >::value)> {};
+
 struct empty_key {};
 
 struct no_key {
@@ -64,6 +76,11 @@ struct no_key {
 	empty_key operator()(const T &) const noexcept {return empty_key{};};
 };
 
+namespace blocks {
+class block_collection_cache;
+class sharded_block_cache;
+} //namespace blocks
+
 namespace bbits {
 template <int i>
 struct int_opt {static const int O=i;};
@@ -71,6 +88,9 @@ struct int_opt {static const int O=i;};
 static const int f_internal = 1;
 static const int f_static = 2;
 static const int f_unordered = 4;
+static const int f_concurrent = 8;
+static const int f_compressed = 16;
+static const int f_buffered = 32;
 
 } //namespace bbits
 
@@ -98,6 +118,31 @@ using btree_dynamic = bbits::int_opt<0>;
 using btree_unordered = bbits::int_opt<bbits::f_unordered>;
 using btree_ordered = bbits::int_opt<0>;
 
+/**
+ * \brief Store the nodes of an external btree in a sharded_block_cache, so
+ * that several threads may call find, lower_bound, upper_bound and iterate
+ * at the same time, as long as no thread modifies the tree
+ */
+using btree_concurrent = bbits::int_opt<bbits::f_concurrent>;
+using btree_single_threaded = bbits::int_opt<0>;
+
+/**
+ * \brief Store the nodes of an external btree compressed on disk. Nodes hold
+ * several blocks worth of items in memory, and each item is stored by the
+ * bytes it does not share with the previous item in the node.
+ */
+using btree_compressed = bbits::int_opt<bbits::f_compressed>;
+using btree_uncompressed = bbits::int_opt<0>;
+
+/**
+ * \brief Make the btree a B^epsilon-tree: inserts are kept in buffers of the
+ * internal nodes and passed down a level at a time in batches, and applied
+ * to the leaves when they reach the lowest level or the tree is queried.
+ * See tree::flush().
+ */
+using btree_buffered = bbits::int_opt<bbits::f_buffered>;
+using btree_unbuffered = bbits::int_opt<0>;
+
 namespace bbits {
 
 template <int O_, int a_, int b_, typename C_, typename K_, typename A_>
@@ -190,7 +235,7 @@ class builder;
 template <typename T, typename A, std::size_t a, std::size_t b>
 class internal_store;
 
-template <typename T, typename A, std::size_t a, std::size_t b>
+template <typename T, typename A, std::size_t a, std::size_t b, typename C, bool compressed>
 class external_store;
 
 struct enab {};
@@ -210,6 +255,9 @@ public:
 	static const bool is_internal = O::O & bbits::f_internal;
 	static const bool is_static = O::O & bbits::f_static;
 	static const bool is_ordered = ! (O::O & bbits::f_unordered);
+	static const bool is_concurrent = O::O & bbits::f_concurrent;
+	static const bool is_compressed = O::O & bbits::f_compressed;
+	static const bool is_buffered = O::O & bbits::f_buffered;
 
 	typedef typename std::conditional<
 		is_ordered,
@@ -259,7 +307,12 @@ public:
 	typedef typename std::conditional<
 		is_internal,
 		bbits::internal_store<value_type, combined_augment, O::a, O::b>,
-		bbits::external_store<value_type, combined_augment, O::a, O::b> >::type store_type;
+		bbits::external_store<value_type, combined_augment, O::a, O::b,
+							  typename std::conditional<
+								  is_concurrent,
+								  blocks::sharded_block_cache,
+								  blocks::block_collection_cache>::type,
+							  is_compressed> >::type store_type;
 	
 	typedef typename store_type::internal_type internal_type;
 	typedef typename store_type::leaf_type leaf_type;
@@ -276,6 +329,11 @@ public:
 		return m_augmenter.m_key_extract(v);
 	}
 
+	template <typename C>
+	static const key_type & content_key(const C & content) {
+		return static_cast<const key_augment*>(&content.augment)->key;
+	}
+
 	key_type min_key(internal_type v) const {
 		return min_key(v, 0);
 	}
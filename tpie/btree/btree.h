@@ -23,8 +23,13 @@
 #include <tpie/portability.h>
 #include <tpie/btree/base.h>
 #include <tpie/btree/node.h>
+#include <tpie/memory.h>
+#include <algorithm>
 
 #include <cstddef>
+#include <map>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace tpie {
@@ -42,6 +47,10 @@ public:
 	static const bool is_internal = state_type::is_internal;
 	static const bool is_static = state_type::is_static;
 	static const bool is_ordered = state_type::is_ordered;
+	static const bool is_buffered = state_type::is_buffered;
+
+	static_assert(!is_buffered || (is_ordered && !state_type::is_concurrent),
+				  "A buffered btree must be ordered and cannot be concurrent");
 	
 	typedef typename state_type::augmenter_type augmenter_type;
 
@@ -106,17 +115,62 @@ private:
 		internal_type n = m_state.store().get_root_internal();
 		for (size_t i=2;; ++i) {
 			path.push_back(n);
-			for (size_t j=0; ; ++j) {
- 				if (j+1 == m_state.store().count(n) ||
-					(upper_bound
-					 ? m_comp(k, m_state.min_key(n, j+1))
-					 : !m_comp(m_state.min_key(n, j+1), k))) {
-					if (i == m_state.store().height()) return m_state.store().get_child_leaf(n, j);
-					n = m_state.store().get_child_internal(n, j);
-					break;
-				}
-			}
+			size_t j = child_index<upper_bound>(n, k);
+			if (i == m_state.store().height()) return m_state.store().get_child_leaf(n, j);
+			n = m_state.store().get_child_internal(n, j);
+		}
+	}
+
+	// Nodes with at most this many separators are searched by a linear scan
+	static const size_t linear_search_size = 16;
+
+	/**
+	 * \brief The index of the child of n to descend into for k: the first
+	 * child whose next separator is not less than k, or greater than k when
+	 * upper_bound
+	 */
+	template <bool upper_bound, typename K>
+	size_t child_index(internal_type n, const K & k) const {
+		return child_index<upper_bound>(n, k, std::integral_constant<
+			bool,
+			is_arithmetic_comp<comp_type, key_type>::value && std::is_same<K, key_type>::value>());
+	}
+
+	template <bool upper_bound, typename K>
+	size_t child_index(internal_type n, const K & k, std::false_type) const {
+		for (size_t j=0; ; ++j) {
+			if (j+1 == m_state.store().count(n) ||
+				(upper_bound
+				 ? m_comp(k, m_state.min_key(n, j+1))
+				 : !m_comp(m_state.min_key(n, j+1), k)))
+				return j;
+		}
+	}
+
+	// Arithmetic keys: count the separators before k without branching on
+	// the comparisons, reading the node once
+	template <bool upper_bound, typename K>
+	size_t child_index(internal_type n, const K & k, std::true_type) const {
+		size_t z;
+		auto first = m_state.store().contents(n, z) + 1;
+		size_t len = z - 1;
+		if (len <= linear_search_size) {
+			size_t j = 0;
+			for (size_t i = 0; i < len; ++i) j += before<upper_bound>(state_type::content_key(first[i]), k);
+			return j;
+		}
+		auto base = first;
+		while (len > 1) {
+			size_t half = len / 2;
+			base += before<upper_bound>(state_type::content_key(base[half]), k) ? half : 0;
+			len -= half;
 		}
+		return (base - first) + before<upper_bound>(state_type::content_key(*base), k);
+	}
+
+	template <bool upper_bound>
+	static bool before(const key_type & separator, const key_type & k) {
+		return upper_bound ? !(k < separator) : separator < k;
 	}
 
 	void augment(leaf_type l, internal_type p) {
@@ -182,6 +236,38 @@ private:
 		return p2;
 	}
 
+	/**
+	 * \brief Insert the child c at index i of n
+	 */
+	template <typename CT>
+	void insert_child(internal_type n, size_t i, CT c) {
+		size_t z = m_state.store().count(n);
+		for (size_t j = z; j > i; --j)
+			m_state.store().move(n, j-1, n, j);
+		m_state.store().set(n, i, c);
+		m_state.store().set_count(n, z+1);
+		augment(c, n);
+	}
+
+	/**
+	 * \brief Split the full node p and insert c right after its child left
+	 *
+	 * The new sibling of a split node is placed by position rather than by
+	 * key, since its minimum key may equal that of the next child when keys
+	 * are duplicated.
+	 */
+	template <typename CT>
+	internal_type split_and_insert_after(CT left, CT c, internal_type p) {
+		size_t i = m_state.store().index(left, p) + 1;
+		size_t left_size = max_size(p)/2;
+		internal_type p2 = split(p);
+		if (i <= left_size)
+			insert_child(p, i, c);
+		else
+			insert_child(p2, i - left_size, c);
+		return p2;
+	}
+
 	void augment_path(leaf_type) {
 		//NOOP
 	}
@@ -264,6 +350,7 @@ public:
 	 * \brief Returns an iterator pointing to the beginning of the tree
 	 */
 	iterator begin() const {
+		flush_buffer();
 		iterator i(&m_state);
 		i.goto_begin();
 		return i;
@@ -273,6 +360,7 @@ public:
 	 * \brief Returns an iterator pointing to the end of the tree
 	 */
 	iterator end() const {
+		flush_buffer();
 		iterator i(&m_state);
 		i.goto_end();
 		return i;
@@ -280,9 +368,293 @@ public:
 
 	/**
 	 * \brief Insert given value into the btree
+	 *
+	 * In a buffered tree the value is added to the buffer of the root, and
+	 * the buffer is flushed to the children of the root when it is full.
 	 */
 	template <typename X=enab>
 	void insert(value_type v, enable<X, !is_static> =enab()) {
+		m_state.store().check_writeable();
+		if (!is_buffered) {
+			insert_direct(v);
+			return;
+		}
+		m_buffer.push_back(v);
+		if (m_buffer.size() >= buffer_size()) flush_root();
+	}
+
+	/**
+	 * \brief Apply all buffered inserts to the tree
+	 *
+	 * A buffered tree is a B^epsilon-tree: every internal node has a buffer
+	 * of inserts bound for its subtree. The buffer of the root is kept in
+	 * memory and holds buffer_size() inserts. The buffers of the other
+	 * internal nodes are stored in node_buffer_blocks() leaf blocks of the
+	 * store. A full buffer is sorted and flushed one level down: the inserts
+	 * are appended to the buffers of the children, or added to the leaves
+	 * below the lowest internal nodes in runs, so a leaf and its path are
+	 * written once per run rather than once per insert. A child whose
+	 * buffer fills up is flushed in turn. As a flush moves several blocks
+	 * worth of inserts to each child, an insert costs a fraction of a block
+	 * transfer on each level instead of a random read of its leaf.
+	 *
+	 * This applies the buffers of all nodes, from the root down level by
+	 * level. Lookups, iteration and root() do so first, so a buffered tree
+	 * gives the same results and augmentations as an unbuffered one.
+	 */
+	void flush() {
+		flush(std::integral_constant<bool, is_buffered>());
+	}
+
+	/**
+	 * \brief Set the number of inserts kept in the buffer of the root of a
+	 * buffered tree
+	 *
+	 * The default is the number of items in a full leaf times the fanout
+	 * of a full internal node, but no more than a quarter of the memory
+	 * available from the memory manager.
+	 */
+	void set_buffer_size(memory_size_type items) {
+		m_bufferSize = std::max<memory_size_type>(items, 1);
+		if (m_buffer.size() >= m_bufferSize) flush_root();
+	}
+
+	/**
+	 * \brief The number of inserts kept in the buffer of the root of a
+	 * buffered tree
+	 */
+	memory_size_type buffer_size() const {
+		if (m_bufferSize != 0) return m_bufferSize;
+		memory_size_type items = m_state.store().max_leaf_size() * m_state.store().max_internal_size();
+		// the buffer already holds memory; the rest is left for sorting and
+		// for the node cache
+		memory_size_type fits = get_memory_manager().available() / 4 / sizeof(value_type);
+		return std::max<memory_size_type>(std::min(items, fits), 1);
+	}
+
+	/**
+	 * \brief The number of leaf blocks in the buffer of an internal node
+	 * below the root
+	 *
+	 * This is the square root of the fanout of an internal node, so a
+	 * flush moves about the square root of a block worth of inserts to each
+	 * child, while the buffers take no more room than the leaves.
+	 */
+	memory_size_type node_buffer_blocks() const {
+		memory_size_type fanout = m_state.store().max_internal_size();
+		memory_size_type blocks = 1;
+		while ((blocks + 1) * (blocks + 1) <= fanout) ++blocks;
+		return blocks;
+	}
+
+private:
+	typedef std::vector<value_type, allocator<value_type> > buffer_type;
+
+	/**
+	 * \brief The buffer of an internal node below the root: the inserts
+	 * bound for its subtree in the order they arrived, stored in leaf
+	 * blocks of the store
+	 */
+	struct node_buffer {
+		// the level of the node; leaves are at level 0
+		size_t level;
+		std::vector<leaf_type> blocks;
+		size_t items;
+	};
+
+	typedef std::map<stream_size_type, node_buffer, std::less<stream_size_type>,
+					 allocator<std::pair<const stream_size_type, node_buffer> > > buffer_map;
+
+	void flush(std::true_type) {
+		flush_root();
+		if (m_nodeBuffers.empty()) return;
+
+		// A flush only adds to the buffers of lower levels, and nodes split
+		// off during a flush have empty buffers, so every buffer is empty
+		// once each level has been flushed from the top
+		for (size_t level = m_state.store().height() - 2; level != 0; --level) {
+			std::vector<stream_size_type> ids;
+			for (typename buffer_map::iterator i = m_nodeBuffers.begin(); i != m_nodeBuffers.end(); ++i)
+				if (i->second.level == level) ids.push_back(i->first);
+			for (size_t j = 0; j < ids.size(); ++j) {
+				typename buffer_map::iterator i = m_nodeBuffers.find(ids[j]);
+				if (i != m_nodeBuffers.end()) flush_node(i);
+			}
+		}
+		tp_assert(m_nodeBuffers.empty() && m_nodeBuffered == 0, "Buffers left after flush");
+	}
+
+	void flush(std::false_type) {}
+
+	void sort_buffer(buffer_type & items) const {
+		std::stable_sort(items.begin(), items.end(), [this](const value_type & a, const value_type & b) {
+				return m_comp(m_state.min_key(a), m_state.min_key(b));
+			});
+	}
+
+	/**
+	 * \brief Flush the buffer of the root to the level below it
+	 */
+	void flush_root() {
+		if (m_buffer.empty()) return;
+		buffer_type items;
+		items.swap(m_buffer);
+		sort_buffer(items);
+		if (m_state.store().height() <= 2) {
+			for (size_t i = 0; i < items.size(); ) i = insert_run(items, i);
+			return;
+		}
+		flush_level(m_state.store().height() - 1, items);
+	}
+
+	/**
+	 * \brief Flush the buffer of an internal node below the root to the
+	 * level below it
+	 */
+	void flush_node(typename buffer_map::iterator i) {
+		size_t level = i->second.level;
+		buffer_type items;
+		for (size_t b = 0; b < i->second.blocks.size(); ++b) {
+			leaf_type l = i->second.blocks[b];
+			size_t z = m_state.store().count(l);
+			for (size_t j = 0; j < z; ++j) items.push_back(m_state.store().get(l, j));
+			m_state.store().destroy(l);
+		}
+		m_nodeBuffered -= i->second.items;
+		m_nodeBuffers.erase(i);
+		sort_buffer(items);
+		flush_level(level, items);
+	}
+
+	/**
+	 * \brief Pass sorted inserts from nodes at the given level to their
+	 * children
+	 *
+	 * The inserts are added to the leaves below nodes at level 1, and
+	 * appended to the buffers of the children otherwise. The node of each
+	 * run of inserts is found from the root, as the nodes on the way may
+	 * have been split by the previous runs.
+	 */
+	void flush_level(size_t level, const buffer_type & items) {
+		if (level == 1) {
+			for (size_t i = 0; i < items.size(); ) i = insert_run(items, i);
+			return;
+		}
+		for (size_t i = 0; i < items.size(); ) {
+			std::vector<internal_type> path;
+			bool bounded = false;
+			key_type upper = key_type();
+			size_t j = descend(m_state.min_key(items[i]), level, path, bounded, upper);
+			size_t e = i + 1;
+			while (e != items.size() && (!bounded || !m_comp(upper, m_state.min_key(items[e])))) ++e;
+
+			internal_type child = m_state.store().get_child_internal(path.back(), j);
+			typename buffer_map::iterator b = append_buffer(child, level - 1, items.begin() + i, items.begin() + e);
+			if (b->second.items >= node_buffer_blocks() * m_state.store().max_leaf_size()) flush_node(b);
+			i = e;
+		}
+	}
+
+	/**
+	 * \brief Append inserts to the buffer of an internal node at the given
+	 * level
+	 */
+	template <typename IT>
+	typename buffer_map::iterator append_buffer(internal_type n, size_t level, IT first, IT last) {
+		typename buffer_map::iterator i = m_nodeBuffers.find(m_state.store().id(n));
+		if (i == m_nodeBuffers.end()) {
+			node_buffer b;
+			b.level = level;
+			b.items = 0;
+			i = m_nodeBuffers.insert(std::make_pair(m_state.store().id(n), b)).first;
+		}
+		node_buffer & b = i->second;
+		size_t leafSize = m_state.store().max_leaf_size();
+		while (first != last) {
+			if (b.blocks.empty() || m_state.store().count(b.blocks.back()) == leafSize)
+				b.blocks.push_back(b.blocks.empty()
+								   ? m_state.store().create_leaf()
+								   : m_state.store().create(b.blocks.back()));
+			leaf_type l = b.blocks.back();
+			size_t z = m_state.store().count(l);
+			size_t n = std::min<size_t>(leafSize - z, last - first);
+			for (size_t j = 0; j < n; ++j) m_state.store().set(l, z + j, *first++);
+			m_state.store().set_count(l, z + n);
+			b.items += n;
+			m_nodeBuffered += n;
+		}
+		return i;
+	}
+
+	/**
+	 * \brief Descend from the root to the node at the given level whose
+	 * subtree holds k
+	 *
+	 * \param path Set to the nodes from the root to that node
+	 * \param upper Set to the least separator after the chosen child, which
+	 * is not less than any key that belongs below it, if bounded is set
+	 * \return The index of the child of the node to descend into for k
+	 */
+	size_t descend(const key_type & k, size_t level, std::vector<internal_type> & path,
+				   bool & bounded, key_type & upper) const {
+		path.clear();
+		internal_type n = m_state.store().get_root_internal();
+		for (size_t l = m_state.store().height() - 1; ; --l) {
+			path.push_back(n);
+			size_t j = child_index<false>(n, k);
+			if (j + 1 != m_state.store().count(n)) {
+				bounded = true;
+				upper = m_state.min_key(n, j + 1);
+			}
+			if (l == level) return j;
+			n = m_state.store().get_child_internal(n, j);
+		}
+	}
+
+	/**
+	 * \brief Insert the sorted items from i on that belong in the leaf of
+	 * item i, while the leaf has room
+	 * \return the index of the first item not inserted
+	 */
+	size_t insert_run(const buffer_type & items, size_t i) {
+		if (m_state.store().height() == 0) {
+			insert_direct(items[i]);
+			return i + 1;
+		}
+
+		// Find the leaf of the first item, and the least separator after
+		// it, which is not less than any key that belongs in the leaf
+		std::vector<internal_type> path;
+		leaf_type l;
+		bool bounded = false;
+		key_type upper = key_type();
+		if (m_state.store().height() == 1) {
+			l = m_state.store().get_root_leaf();
+		} else {
+			size_t j = descend(m_state.min_key(items[i]), 1, path, bounded, upper);
+			l = m_state.store().get_child_leaf(path.back(), j);
+		}
+
+		// A full leaf is split by an ordinary insert
+		if (m_state.store().count(l) == m_state.store().max_leaf_size()) {
+			insert_direct(items[i]);
+			return i + 1;
+		}
+
+		size_t first = i;
+		while (i != items.size() &&
+			   m_state.store().count(l) != m_state.store().max_leaf_size() &&
+			   (!bounded || !m_comp(upper, m_state.min_key(items[i])))) {
+			insert_part(l, items[i]);
+			++i;
+		}
+		m_state.store().set_size(m_state.store().size() + (i - first));
+		if (!path.empty()) augment(l, path.back());
+		augment_path(path);
+		return i;
+	}
+
+	void insert_direct(value_type v) {
 		m_state.store().set_size(m_state.store().size() + 1);
 
 		// Handle the special case of the empty tree
@@ -331,25 +703,25 @@ public:
 		
 		//If there is room in the parent to insert the extra leave
 		if (m_state.store().count(p) != m_state.store().max_internal_size()) {
-			insert_part(p, l2);
+			insert_child(p, m_state.store().index(l, p) + 1, l2);
 			augment_path(path);
 			return;
 		}
 
 		path.pop_back();
-		internal_type n2 = split_and_insert(l2, p);
+		internal_type n2 = split_and_insert_after(l, l2, p);
 		internal_type n1 = p;
 		
 		while (!path.empty()) {
 			internal_type p = path.back();
 			augment(n1, p);
 			if (m_state.store().count(p) != m_state.store().max_internal_size()) {
-				insert_part(p, n2);
+				insert_child(p, m_state.store().index(n1, p) + 1, n2);
 				augment_path(path);
 				return;
 			}
 			path.pop_back();
-			n2 = split_and_insert(n2, p);
+			n2 = split_and_insert_after(n1, n2, p);
 			n1 = p;
 
 		}
@@ -367,11 +739,18 @@ public:
 		augment_path(path);
 	}
 
+	// queries see the buffered inserts; the logical content is unchanged
+	void flush_buffer() const {
+		if (!m_buffer.empty() || m_nodeBuffered != 0) const_cast<tree *>(this)->flush();
+	}
+
+public:
 	/**
 	 * \brief Return an iterator to the first item with the given key
 	 */
 	template <typename K, typename X=enab>
 	iterator find(K v, enable<X, is_ordered> =enab()) const {
+		flush_buffer();
 		iterator itr(&m_state);
 
 		if(m_state.store().height() == 0) {
@@ -403,6 +782,7 @@ public:
 	 */
 	template <typename K, typename X=enab>
 	iterator lower_bound(K v, enable<X, is_ordered> =enab()) const {
+		flush_buffer();
 		iterator itr(&m_state);
 		if (m_state.store().height() == 0) {
 			itr.goto_end();
@@ -429,6 +809,7 @@ public:
 	 */
 	template <typename K, typename X=enab>
 	iterator upper_bound(K v, enable<X, is_ordered> =enab()) const {
+		flush_buffer();
 		iterator itr(&m_state);
 		if (m_state.store().height() == 0) {
 			itr.goto_end();
@@ -449,11 +830,217 @@ public:
 		return ++itr;
 	}
 
+	/**
+	 * \brief Return iterators to the first element that is "not less" than
+	 * lo and to the first element that is "not less" than hi.
+	 *
+	 * Incrementing the first iterator reads the next leaves of the range
+	 * ahead of time, so a long range scan over an external tree does not
+	 * wait for the disk at every leaf.
+	 *
+	 * \param prefetch The number of leaves to read ahead
+	 */
+	template <typename K, typename X=enab>
+	std::pair<iterator, iterator> range(K lo, K hi, size_t prefetch=8, enable<X, is_ordered> =enab()) const {
+		iterator first = lower_bound(lo);
+		iterator last = lower_bound(hi);
+		if (m_state.store().height() != 0) first.set_prefetch(prefetch, last.m_leaf);
+		return std::make_pair(first, last);
+	}
+
+	/**
+	 * \brief Lower bound lookups of keys given in increasing order
+	 *
+	 * The cursor remembers the path to the leaf of the previous key. The
+	 * next key is first looked for in that leaf, and otherwise the cursor
+	 * only goes up as far as a node known to cover the key before going
+	 * down again, so nearby keys share the upper part of their paths and
+	 * the nodes on it are not read again.
+	 *
+	 * The cursor is invalidated by changes to the tree.
+	 */
+	class sorted_lookup {
+	public:
+		/**
+		 * \brief Return an iterator to the first item that is "not less"
+		 * than the given key
+		 * \pre k is "not less" than the previous key given
+		 */
+		template <typename K>
+		iterator lower_bound(K k) {
+			const store_type & store = m_tree->m_state.store();
+			iterator itr(&m_tree->m_state);
+			if (store.height() == 0) {
+				itr.goto_end();
+				return itr;
+			}
+
+			if (!m_started) {
+				m_started = true;
+				descend(k, 0);
+			} else if (!scan_leaf(k)) {
+				// go up until a node has a separator that is not less than k
+				size_t level = m_path.size();
+				while (level > 0) {
+					internal_type n = m_path[level - 1];
+					if (!m_tree->m_comp(m_tree->m_state.min_key(n, store.count(n) - 1), k)) break;
+					--level;
+				}
+				descend(k, level == 0 ? 0 : level - 1);
+			}
+
+			if (m_index < store.count(m_leaf)) {
+				itr.goto_item(m_path, m_leaf, m_index);
+				return itr;
+			}
+			// every item in the leaf is less than k
+			itr.goto_item(m_path, m_leaf, m_index - 1);
+			return ++itr;
+		}
+
+		/**
+		 * \brief Return an iterator to the first item with the given key,
+		 * or end()
+		 * \pre k is "not less" than the previous key given
+		 */
+		template <typename K>
+		iterator find(K k) {
+			iterator itr = lower_bound(k);
+			if (itr == m_end || m_tree->m_comp(k, m_tree->m_state.min_key(*itr))) return m_end;
+			return itr;
+		}
+
+		/**
+		 * \brief Return iterators to the first item with the given key and
+		 * to the first item after it with a greater key
+		 * \pre k is "not less" than the previous key given
+		 */
+		template <typename K>
+		std::pair<iterator, iterator> equal_range(K k) {
+			iterator first = lower_bound(k);
+			iterator last = first;
+			while (last != m_end && !m_tree->m_comp(k, m_tree->m_state.min_key(*last))) ++last;
+			return std::make_pair(first, last);
+		}
+
+	private:
+		sorted_lookup(const tree * t, size_t prefetch)
+			: m_tree(t)
+			, m_prefetch(prefetch)
+			, m_started(false)
+			, m_end(t->end()) {}
+
+		// advance within the current leaf, returning false if every item
+		// is less than k
+		template <typename K>
+		bool scan_leaf(K k) {
+			const store_type & store = m_tree->m_state.store();
+			size_t z = store.count(m_leaf);
+			while (m_index < z && m_tree->m_comp(m_tree->m_state.min_key(m_leaf, m_index), k)) ++m_index;
+			return m_index < z;
+		}
+
+		// find the leaf of k below the node at the given level of the path,
+		// starting from the children chosen for the previous key
+		template <typename K>
+		void descend(K k, size_t level) {
+			const store_type & store = m_tree->m_state.store();
+			if (store.height() == 1) {
+				m_leaf = store.get_root_leaf();
+				m_index = 0;
+				scan_leaf(k);
+				return;
+			}
+			if (m_path.empty()) {
+				m_path.push_back(store.get_root_internal());
+				m_child.push_back(0);
+			}
+			m_path.resize(level + 1);
+			m_child.resize(level + 1);
+			while (true) {
+				internal_type n = m_path.back();
+				size_t z = store.count(n);
+				size_t j = m_child.back();
+				while (j + 1 < z && m_tree->m_comp(m_tree->m_state.min_key(n, j + 1), k)) ++j;
+				m_child.back() = j;
+				if (m_path.size() + 1 == store.height()) {
+					m_leaf = store.get_child_leaf(n, j);
+					for (size_t i = 1; i <= m_prefetch && j + i < z; ++i)
+						store.prefetch_child(n, j + i);
+					break;
+				}
+				m_path.push_back(store.get_child_internal(n, j));
+				m_child.push_back(0);
+			}
+			m_index = 0;
+			scan_leaf(k);
+		}
+
+		const tree * m_tree;
+		size_t m_prefetch;
+		bool m_started;
+		iterator m_end;
+		std::vector<internal_type> m_path;
+		// the index of the chosen child in each node of the path
+		std::vector<size_t> m_child;
+		leaf_type m_leaf;
+		size_t m_index;
+
+		friend class tree;
+	};
+
+	/**
+	 * \brief Return a cursor for lower bound lookups of keys in increasing
+	 * order
+	 *
+	 * \param prefetch The number of leaves to read ahead after the leaf of
+	 * a key, for keys that are close together
+	 */
+	template <typename X=enab>
+	sorted_lookup sorted_lookups(size_t prefetch=0, enable<X, is_ordered> =enab()) const {
+		return sorted_lookup(this, prefetch);
+	}
+
+	/**
+	 * \brief Write lower_bound(k) for every key k of a sorted range to out
+	 *
+	 * The keys must be in increasing order. Nearby keys share the upper part
+	 * of their root paths, see sorted_lookup.
+	 *
+	 * \param prefetch The number of leaves to read ahead after the leaf of
+	 * a key
+	 * \return The output iterator after the last iterator written
+	 */
+	template <typename IT, typename OUT, typename X=enab>
+	OUT lower_bound_many(IT first, IT last, OUT out, size_t prefetch=0, enable<X, is_ordered> =enab()) const {
+		sorted_lookup cursor = sorted_lookups(prefetch);
+		for (; first != last; ++first) *out++ = cursor.lower_bound(*first);
+		return out;
+	}
+
+	/**
+	 * \brief Write find(k) for every key k of a sorted range to out
+	 *
+	 * The keys must be in increasing order, see lower_bound_many.
+	 *
+	 * \return The output iterator after the last iterator written
+	 */
+	template <typename IT, typename OUT, typename X=enab>
+	OUT find_many(IT first, IT last, OUT out, size_t prefetch=0, enable<X, is_ordered> =enab()) const {
+		sorted_lookup cursor = sorted_lookups(prefetch);
+		for (; first != last; ++first) *out++ = cursor.find(*first);
+		return out;
+	}
+
 	/**
 	 * \brief remove item at iterator
 	 */
 	template <typename X=enab>
 	void erase(const iterator & itr, enable<X, !is_static> =enab()) {
+		m_state.store().check_writeable();
+		// the query that returned itr flushed the buffers, and flushing the
+		// root buffer again would have invalidated itr
+		tp_assert(m_nodeBuffered == 0, "The iterator is invalid");
 		std::vector<internal_type> path=itr.m_path;
 		leaf_type l = itr.m_leaf;
 
@@ -543,6 +1130,7 @@ public:
 	 */
 	template <typename X=enab>
 	size_type erase(key_type v, enable<X, !is_static && is_ordered> =enab()) {
+		m_state.store().check_writeable();
 		size_type count = 0;
 		iterator i = find(v);
 		while(i != end()) {
@@ -554,11 +1142,30 @@ public:
 		return count;
 	}
 
+	/**
+	 * \brief Return a read-only tree with the current content of this tree
+	 *
+	 * The snapshot keeps its content while this tree is changed: nodes it
+	 * can see are copied before they are changed, and the copies are freed
+	 * when the last snapshot that reads them is destroyed. Changing the
+	 * snapshot throws an exception. The tree and its snapshots share a
+	 * block cache, so they must be used from one thread at a time.
+	 */
+	template <typename X=enab>
+	tree snapshot(enable<X, !is_internal> =enab()) {
+		flush();
+		return tree(state_type(m_state.store().snapshot(),
+							   m_state.m_augmenter.m_augmenter,
+							   m_state.m_augmenter.m_key_extract),
+					m_comp);
+	}
+
 	/**
 	 * \brief Return the root node
 	 * \pre !empty()
 	 */
 	node_type root() const {
+		flush_buffer();
 		if (m_state.store().height() == 1) return node_type(&m_state, m_state.store().get_root_leaf());
 		return node_type(&m_state, m_state.store().get_root_internal());
 	}
@@ -567,23 +1174,31 @@ public:
 	 * \brief Return the number of elements in the tree	
 	 */
 	size_type size() const throw() {
-		return m_state.store().size();
+		return m_state.store().size() + m_buffer.size() + m_nodeBuffered;
 	}
 
 	/**
 	 * \brief Check if the tree is empty
 	 */
 	bool empty() const throw() {
-		return m_state.store().size() == 0;
+		return size() == 0;
 	}
 	
 	/**
-	 * Construct a btree with the given storage
+	 * Construct a btree stored in the given file
+	 *
+	 * \param blockSize The size in bytes of a node, or zero to use the block
+	 * size of an existing tree or the default block size.
+	 * \param cacheSize The number of nodes kept in memory, or zero to derive
+	 * it from the memory manager.
 	 */
 	template <typename X=enab>
-	explicit tree(std::string path, comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(), enable<X, !is_internal> =enab() ): 
-		m_state(store_type(path), std::move(augmenter), keyextract_type()),
-		m_comp(comp) {}
+	explicit tree(std::string path, comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(),
+				  memory_size_type blockSize=0, memory_size_type cacheSize=0, enable<X, !is_internal> =enab() ): 
+		m_state(store_type(path, blockSize, cacheSize), std::move(augmenter), keyextract_type()),
+		m_comp(comp),
+		m_bufferSize(0),
+		m_nodeBuffered(0) {}
 
 	/**
 	 * Construct a btree with the given storage
@@ -591,17 +1206,38 @@ public:
 	template <typename X=enab>
 	explicit tree(comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(), enable<X, is_internal> =enab() ): 
 		m_state(store_type(), std::move(augmenter), keyextract_type()),
-		m_comp(comp) {}
+		m_comp(comp),
+		m_bufferSize(0),
+		m_nodeBuffered(0) {}
+
+	tree(const tree &) = default;
+	tree(tree &&) = default;
+	tree & operator=(const tree &) = default;
+	tree & operator=(tree &&) = default;
+
+	~tree() {
+		// inserts into an external tree must reach the disk
+		flush();
+	}
 	
 	friend class bbits::builder<T, O>;
 	
 private:
 	explicit tree(state_type state, comp_type comp):
 		m_state(std::move(state)),
-		m_comp(comp) {}
+		m_comp(comp),
+		m_bufferSize(0),
+		m_nodeBuffered(0) {}
 
 	state_type m_state;
 	comp_type m_comp;
+	// the buffer of the root
+	mutable buffer_type m_buffer;
+	memory_size_type m_bufferSize;
+	// the buffers of the other internal nodes, by the id of the node
+	buffer_map m_nodeBuffers;
+	// the number of inserts in m_nodeBuffers
+	size_t m_nodeBuffered;
 };
 
 } //namespace bbits
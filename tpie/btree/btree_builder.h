@@ -23,7 +23,10 @@
 #include <tpie/portability.h>
 #include <tpie/btree/base.h>
 #include <tpie/btree/node.h>
+#include <tpie/array.h>
+#include <tpie/file_stream.h>
 
+#include <algorithm>
 #include <cstddef>
 #include <deque>
 #include <vector>
@@ -82,12 +85,8 @@ private:
         leaf_summary leaf;
         leaf.leaf = m_state.store().create_leaf();
 
-        m_state.store().set_count(leaf.leaf, size);
-
-        for(size_t i = 0; i < size; ++i) {
-            m_state.store().set(leaf.leaf, i, m_items.front());
-            m_items.pop_front();
-        }
+        m_state.store().set_values(leaf.leaf, m_items.begin(), size);
+        m_items.erase(m_items.begin(), m_items.begin() + size);
 
 		leaf.augment = m_state.m_augmenter(node_type(&m_state, leaf.leaf));
 
@@ -132,36 +131,43 @@ private:
         m_internal_nodes[level+1].push_back(internal);
     }
 
+	/**
+	* \brief The number of children of a node with the given bounds that
+	* matches the fill factor.
+	*/
+	size_t desired_size(size_t minSize, size_t maxSize) const {
+		if (m_fillFactor == 0)
+			return is_static ? maxSize : (minSize + maxSize) / 2;
+		size_t size = static_cast<size_t>(m_fillFactor * maxSize + 0.5);
+		return std::min(std::max(size, minSize), maxSize);
+	}
+
 	/**
 	* \brief The desired number of children for each leaf node.
 	*/
-    static constexpr size_t desired_leaf_size() noexcept {
-        return is_static
-			? S::max_leaf_size()
-			: ((S::min_leaf_size() + S::max_leaf_size()) / 2);
+    size_t desired_leaf_size() const {
+        return desired_size(m_state.store().min_leaf_size(), m_state.store().max_leaf_size());
     }
 
 	/**
 	* \brief The maximum number of items to be kept in memory.
 	*/
-    static constexpr size_t leaf_tipping_point() noexcept {
-        return desired_leaf_size() + S::min_leaf_size();
+    size_t leaf_tipping_point() const {
+        return desired_leaf_size() + m_state.store().min_leaf_size();
     }
 
 	/**
 	* \brief The desired number of children for each internal node.
 	*/
-    static constexpr size_t desired_internal_size() noexcept {
-        return is_static
-			? S::max_internal_size()
-			: ((S::min_internal_size() + S::max_internal_size()) / 2);
+    size_t desired_internal_size() const {
+        return desired_size(m_state.store().min_internal_size(), m_state.store().max_internal_size());
     }
 
 	/**
 	* \brief The maximum number of children to be kept in memory at each level.
 	*/
-    static constexpr size_t internal_tipping_point() noexcept {
-        return desired_internal_size() + S::min_internal_size();
+    size_t internal_tipping_point() const {
+        return desired_internal_size() + m_state.store().min_internal_size();
     }
 
 	/**
@@ -186,30 +192,72 @@ public:
 	* \brief Construct a btree builder with the given storage
 	*/
 	template <typename X=enab>
-	explicit builder(std::string path, comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(), enable<X, !is_internal> =enab() )
-        : m_state(store_type(path), std::move(augmenter), typename state_type::keyextract_type())
+	explicit builder(std::string path, comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(),
+					 memory_size_type blockSize=0, memory_size_type cacheSize=0, enable<X, !is_internal> =enab() )
+        : m_state(store_type(path, blockSize, cacheSize), std::move(augmenter), typename state_type::keyextract_type())
         , m_comp(comp)
+        , m_size(0)
+        , m_fillFactor(0)
     {}
 
 	template <typename X=enab>
 	explicit builder(comp_type comp=comp_type(), augmenter_type augmenter=augmenter_type(), enable<X, is_internal> =enab() )
 		: m_state(store_type(), std::move(augmenter), typename state_type::keyextract_type())
         , m_comp(comp)
+        , m_size(0)
+        , m_fillFactor(0)
     {}
 
+	/**
+	* \brief Set how full the nodes of the tree are made, as a fraction of
+	* the maximal fanout. A fill factor of one gives the smallest tree, while
+	* a lower fill factor leaves room for inserting items without splitting
+	* nodes. The fanout is never less than the minimal fanout. The default is
+	* full nodes for a static tree and half way between the minimal and
+	* maximal fanout otherwise.
+	* \pre No items have been pushed.
+	*/
+	void set_fill_factor(double fillFactor) {
+		tp_assert(fillFactor > 0 && fillFactor <= 1, "The fill factor must be in (0, 1]");
+		tp_assert(m_size == 0, "The fill factor must be set before pushing items");
+		m_fillFactor = fillFactor;
+	}
+
 	/**
 	* \brief Push a value to the builder. Values are expected to be received in order
 	* \param v The value to be pushed
 	*/
     void push(value_type v) {
         m_items.push_back(v);
-        m_state.store().set_size(m_state.store().size() + 1); //TODO we should just set the size in the end
+        ++m_size;
 
         // try to construct nodes from items if possible
         if(m_items.size() < leaf_tipping_point()) return;
 		extract_nodes();
     }
 
+	/**
+	* \brief Push the remaining items of a sorted stream to the builder.
+	* The items are read in batches, and the leaves are written in the order
+	* they are filled, so that bulk loading a sorted stream is limited by
+	* the speed of the disk.
+	* \param in The stream to read items from
+	*/
+	void push(file_stream<value_type> & in) {
+		const memory_size_type batch = std::max<memory_size_type>(leaf_tipping_point(), 1024);
+		array<value_type> buffer(batch);
+		while (in.can_read()) {
+			memory_size_type n = static_cast<memory_size_type>(
+				std::min<stream_size_type>(batch, in.size() - in.offset()));
+			in.read(buffer.begin(), buffer.begin() + n);
+			for (memory_size_type i = 0; i < n; ++i) {
+				m_items.push_back(buffer[i]);
+				if (m_items.size() >= leaf_tipping_point()) extract_nodes();
+			}
+			m_size += n;
+		}
+	}
+
 	/**
 	* \brief Constructs and returns a btree from the value that was pushed to the builder. The btree builder should not be used again after this point.
 	*/
@@ -218,7 +266,7 @@ public:
 
         // construct one or two leaves if neccesary
         if(m_items.size() > 0) {
-            if(m_items.size() > S::max_leaf_size()) // construct two leaves if necessary
+            if(m_items.size() > m_state.store().max_leaf_size()) // construct two leaves if necessary
                 construct_leaf(m_items.size()/2);
             construct_leaf(m_items.size()); // construct a leaf with the remaining items
         }
@@ -226,9 +274,9 @@ public:
         // if there already exists internal nodes and there are leaves left: construct a new internal node(since there is guaranteed to be atleast S::min_internal_size leaves)
         // if there do not exist internal nodes, then only construct an internal node if there is more than one leaf
         if((m_internal_nodes.size() == 0 && m_leaves.size() > 1) || (m_internal_nodes.size() > 0 && m_leaves.size() > 0)) {
-            if(m_leaves.size() > 2*S::max_internal_size() ) // construct two nodes if necessary
+            if(m_leaves.size() > 2*m_state.store().max_internal_size() ) // construct two nodes if necessary
                 construct_internal_from_leaves(m_leaves.size()/3);
-            if(m_leaves.size() > S::max_internal_size()) // construct two nodes if necessary
+            if(m_leaves.size() > m_state.store().max_internal_size()) // construct two nodes if necessary
                 construct_internal_from_leaves(m_leaves.size()/2);
             construct_internal_from_leaves(m_leaves.size()); // construct a node from the remaining leaves
         }
@@ -238,14 +286,16 @@ public:
             // if there do not exist internal nodes at a higher level, then only construct an internal nodes at that level if there are more than one node at this level.
             if((m_internal_nodes.size() == i+1 && m_internal_nodes[i].size() > 1)
                 || (m_internal_nodes.size() > i+1 && m_internal_nodes[i].size() > 0)) {
-                if(m_internal_nodes[i].size() > 2*S::max_internal_size())
+                if(m_internal_nodes[i].size() > 2*m_state.store().max_internal_size())
                     construct_internal_from_internal(m_internal_nodes[i].size()/3, i);
-                if(m_internal_nodes[i].size() > S::max_internal_size())
+                if(m_internal_nodes[i].size() > m_state.store().max_internal_size())
                     construct_internal_from_internal(m_internal_nodes[i].size()/2, i);
                 construct_internal_from_internal(m_internal_nodes[i].size(), i);
             }
         }
 
+        m_state.store().set_size(m_size);
+
         // find the root and set it as such
 
         if(m_internal_nodes.size() == 0 && m_leaves.size() == 0) // no items were pushed
@@ -268,6 +318,8 @@ private:
 
 	state_type m_state;
     comp_type m_comp;
+	size_type m_size;
+	double m_fillFactor;
 };
 
 } //namespace bbits
@@ -24,7 +24,12 @@
 #include <tpie/btree/base.h>
 #include <tpie/tpie_assert.h>
 #include <tpie/blocks/block_collection_cache.h>
+#include <tpie/blocks/sharded_block_cache.h>
 #include <tpie/btree/external_store_base.h>
+#include <tpie/exception.h>
+#include <tpie/memory.h>
+#include <algorithm>
+#include <iterator>
 #include <memory>
 
 #include <cstddef>
@@ -38,11 +43,18 @@ namespace bbits {
  * 
  * \tparam T the type of value stored
  * \tparam A the type of augmentation
+ * \tparam C the type of block cache, either block_collection_cache or
+ * sharded_block_cache
+ * \tparam compressed whether nodes are compressed on disk. A compressed
+ * node is compressed_node_factor() blocks in memory and is stored in as
+ * many blocks as its compressed content needs.
  */
 template <typename T,
 		  typename A,
 		  std::size_t fanout_a,
-		  std::size_t fanout_b>
+		  std::size_t fanout_b,
+		  typename C,
+		  bool compressed>
 class external_store : public external_store_base {
 public:
 	/**
@@ -57,8 +69,35 @@ public:
 
 	typedef size_t size_type;
 
-	static constexpr memory_size_type cacheSize() {return 32;}
-	static constexpr memory_size_type blockSize() {return 7000;}
+	/**
+	 * \brief The block size used when none is given and the tree is new.
+	 */
+	static constexpr memory_size_type default_block_size() {return 7000;}
+
+	/**
+	 * \brief The smallest number of blocks kept in the cache.
+	 */
+	static constexpr memory_size_type minimum_cache_size() {return 32;}
+
+	/**
+	 * \brief The number of blocks in the memory of a compressed node.
+	 */
+	static constexpr memory_size_type compressed_node_factor() {return compressed ? 4 : 1;}
+
+	/**
+	 * \brief The size in bytes of a block on disk.
+	 */
+	memory_size_type blockSize() const {return m_blockSize;}
+
+	/**
+	 * \brief The size in bytes of a node in memory.
+	 */
+	memory_size_type nodeSize() const {return m_blockSize * compressed_node_factor();}
+
+	/**
+	 * \brief The number of nodes kept in the cache.
+	 */
+	memory_size_type cacheSize() const {return m_cacheSize;}
 	
 	struct internal_content {
 		blocks::block_handle handle;
@@ -108,39 +147,115 @@ public:
 	};
 
 	/**
-	 * \brief Construct a new empty btree storage
+	 * \brief Construct a new empty btree storage, or open the one stored
+	 * in the given file.
+	 *
+	 * \param path The file in which the tree is stored.
+	 * \param blockSize The size in bytes of a block on disk. If zero, the
+	 * block size of an existing tree is used, or default_block_size() for a
+	 * new tree.
+	 * \param cacheSize The number of nodes to keep in memory. If zero, a
+	 * sixteenth of the available memory is used, but at least
+	 * minimum_cache_size() nodes. The cache is charged to the memory manager.
 	 */
-	explicit external_store(const std::string & path)
+	explicit external_store(const std::string & path,
+							memory_size_type blockSize = 0,
+							memory_size_type cacheSize = 0)
 	: external_store_base(path)
+	, m_isSnapshot(false)
 	{
-		m_collection = std::make_shared<blocks::block_collection_cache>(
-			path, blockSize(), cacheSize(), true);
-	}
+		// the root handle carries the size of a node in memory
+		memory_size_type rootBlockSize = m_root.size / compressed_node_factor();
+		if (m_root.size != 0 && blockSize != 0 && blockSize != rootBlockSize)
+			throw exception("The btree was created with a different block size");
+		if (blockSize == 0)
+			blockSize = m_root.size != 0 ? rootBlockSize : default_block_size();
+		if (blockSize < sizeof(memory_size_type) + 2 * std::max(sizeof(T), sizeof(internal_content)))
+			throw exception("The btree block size is too small");
+		m_blockSize = blockSize;
+		if (cacheSize == 0)
+			cacheSize = std::max(minimum_cache_size(),
+								 get_memory_manager().available() / 16 / nodeSize());
+		m_cacheSize = cacheSize;
+		if (compressed) {
+			std::shared_ptr<const blocks::block_codec> codec
+				= std::make_shared<blocks::record_codec>(sizeof(memory_size_type), sizeof(T));
+#ifdef TPIE_HAS_SNAPPY
+			codec = std::make_shared<blocks::scheme_codec>(get_compression_scheme_snappy(), codec);
+#endif
+			m_collection = std::make_shared<C>(
+				path, nodeSize(), m_cacheSize, true, codec, m_blockSize);
+		} else
+			m_collection = std::make_shared<C>(
+				path, m_blockSize, m_cacheSize, true);
+	}
+
+	external_store(external_store && o)
+		: external_store_base(std::move(o))
+		, m_blockSize(o.m_blockSize)
+		, m_cacheSize(o.m_cacheSize)
+		, m_collection(std::move(o.m_collection))
+		, m_snapshots(std::move(o.m_snapshots))
+		, m_isSnapshot(o.m_isSnapshot)
+		, m_version(o.m_version)
+	{}
 
 	~external_store() {
+		if (m_isSnapshot && m_snapshots) release_snapshot();
+		// a snapshot may keep the cache open, but the nodes must be written
+		// before the tree information is appended to the file
+		if (!m_isSnapshot && m_collection) m_collection->flush();
+		// freeing the blocks of the snapshots may shrink the file, so the
+		// tree information is written after the last snapshot is released
+		if (!m_isSnapshot && m_snapshots && !m_snapshots->versions.empty())
+			m_snapshots->closed.reset(tpie_new<external_store_base>(std::move(static_cast<external_store_base &>(*this))));
 		m_collection.reset();
 	}
 
-	static constexpr size_t min_internal_size() {
+	/**
+	 * \brief Return a read-only store of the current content of the tree
+	 *
+	 * Until the returned store is destroyed, the nodes it can see are copied
+	 * before they are changed or freed, so it keeps seeing the tree as it
+	 * is now.
+	 */
+	external_store snapshot() {
+		if (m_isSnapshot) throw exception("Cannot take a snapshot of a btree snapshot");
+		if (!m_snapshots) m_snapshots = std::make_shared<snapshot_registry>();
+		m_snapshots->versions.push_back(snapshot_registry::version());
+		// the new snapshot can see every block of the tree
+		m_snapshots->fresh.clear();
+		return external_store(*this, std::prev(m_snapshots->versions.end()));
+	}
+
+	/**
+	 * \brief Throw an exception if the store is a read-only snapshot
+	 */
+	void check_writeable() const {
+		if (m_isSnapshot) throw exception("A btree snapshot is read-only");
+	}
+
+	size_t min_internal_size() const {
 		return fanout_a?fanout_a:(max_internal_size() + 3) / 4;
 	}
 
-	static constexpr size_t max_internal_size() {
-		return fanout_b?fanout_b:(blockSize() - sizeof(memory_size_type)) / sizeof(internal_content);
+	size_t max_internal_size() const {
+		return fanout_b?fanout_b:(nodeSize() - sizeof(memory_size_type)) / sizeof(internal_content);
 	}
 
-	static constexpr size_t min_leaf_size() {
+	size_t min_leaf_size() const {
 		return fanout_a?fanout_a:(max_leaf_size() + 3) / 4;
 	}
 
-	static constexpr size_t max_leaf_size() {
-		return fanout_b?fanout_b:(blockSize() - sizeof(memory_size_type)) / sizeof(T);
+	size_t max_leaf_size() const {
+		return fanout_b?fanout_b:(nodeSize() - sizeof(memory_size_type)) / sizeof(T);
 	}
 	
 	void move(internal_type src, size_t src_i,
 			  internal_type dst, size_t dst_i) {
-		blocks::block * srcBlock = m_collection->read_block(src.handle);
-		blocks::block * dstBlock = m_collection->read_block(dst.handle);
+		prepare_write(dst.handle);
+		blocks::block * srcBlock = read(src.handle);
+		blocks::block * dstBlock = read(dst.handle);
 
 		internal srcInter(srcBlock);
 		internal dstInter(dstBlock);
@@ -153,8 +268,9 @@ public:
 
 	void move(leaf_type src, size_t src_i,
 			  leaf_type dst, size_t dst_i) {
-		blocks::block * srcBlock = m_collection->read_block(src.handle);
-		blocks::block * dstBlock = m_collection->read_block(dst.handle);
+		prepare_write(dst.handle);
+		blocks::block * srcBlock = read(src.handle);
+		blocks::block * dstBlock = read(dst.handle);
 
 		leaf srcInter(srcBlock);
 		leaf dstInter(dstBlock);
@@ -166,7 +282,8 @@ public:
 	}
 
 	void set(leaf_type dst, size_t dst_i, T c) {
-		blocks::block * dstBlock = m_collection->read_block(dst.handle);
+		prepare_write(dst.handle);
+		blocks::block * dstBlock = read(dst.handle);
 		leaf dstInter(dstBlock);
 
 		dstInter.values[dst_i] = c;
@@ -174,8 +291,21 @@ public:
 		m_collection->write_block(dst.handle);
 	}
 		
+	template <typename IT>
+	void set_values(leaf_type dst, IT first, size_t count) {
+		prepare_write(dst.handle);
+		blocks::block * dstBlock = read(dst.handle);
+		leaf dstInter(dstBlock);
+
+		*(dstInter.count) = count;
+		std::copy(first, first + count, dstInter.values);
+
+		m_collection->write_block(dst.handle);
+	}
+
 	void set(internal_type node, size_t i, internal_type c) {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		prepare_write(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		nodeInter.values[i].handle = c.handle;
@@ -184,7 +314,8 @@ public:
 	}
 
 	void set(internal_type node, size_t i, leaf_type c) {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		prepare_write(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		nodeInter.values[i].handle = c.handle;
@@ -193,28 +324,28 @@ public:
 	}
 
 	const T & get(leaf_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		leaf nodeInter(nodeBlock);
 
 		return nodeInter.values[i];
 	}
 
 	size_t count(internal_type node) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		return *(nodeInter.count);
 	}
 
 	size_t count(leaf_type node) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		leaf nodeInter(nodeBlock);
 
 		return *(nodeInter.count);
 	}
 
 	size_t count_child_leaf(internal_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		leaf_type wrap(nodeInter.values[i].handle);
@@ -222,7 +353,7 @@ public:
 	}
 
 	size_t count_child_internal(internal_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		internal_type wrap(nodeInter.values[i].handle);
@@ -230,55 +361,50 @@ public:
 	}
 
 	void set_count(internal_type node, size_t i) {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		prepare_write(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		*(nodeInter.count) = i;
+		clear_tail(nodeBlock, reinterpret_cast<char *>(nodeInter.values + i));
 
 		m_collection->write_block(node.handle);
 	}
 
 	void set_count(leaf_type node, size_t i) {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		prepare_write(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		leaf nodeInter(nodeBlock);
 
 		*(nodeInter.count) = i;
+		clear_tail(nodeBlock, reinterpret_cast<char *>(nodeInter.values + i));
 
 		m_collection->write_block(node.handle);
 	}
 
 	leaf_type create_leaf() {
-		blocks::block_handle h = m_collection->get_free_block();
-		blocks::block * b = m_collection->read_block(h);
-		leaf l(b);
-		(*l.count) = 0;
-		m_collection->write_block(h);
-		return leaf_type(h);
+		return init_leaf(create_block());
 	}
 
-	leaf_type create(leaf_type) {
-		return create_leaf();
+	// the new sibling is placed next to the node on disk if possible
+	leaf_type create(leaf_type sibling) {
+		return init_leaf(create_block(sibling.handle));
 	}
 
 	internal_type create_internal() {
-		blocks::block_handle h = m_collection->get_free_block();
-		blocks::block * b = m_collection->read_block(h);
-		internal i(b);
-		(*i.count) = 0;
-		m_collection->write_block(h);
-		return internal_type(h);
+		return init_internal(create_block());
 	}
 
-	internal_type create(internal_type) {
-		return create_internal();
+	internal_type create(internal_type sibling) {
+		return init_internal(create_block(sibling.handle));
 	}
 
 	void destroy(internal_type node) {
-		m_collection->free_block(node.handle);
+		destroy_block(node.handle);
 	}
 
 	void destroy(leaf_type node) {
-		m_collection->free_block(node.handle);
+		destroy_block(node.handle);
 	}
 
 	void set_root(internal_type node) {
@@ -298,21 +424,45 @@ public:
 	}
 
 	internal_type get_child_internal(internal_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal dstInter(nodeBlock);
 
 		return internal_type(dstInter.values[i].handle);
 	}
 
 	leaf_type get_child_leaf(internal_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal dstInter(nodeBlock);
 
 		return leaf_type(dstInter.values[i].handle);
 	}
 
+	/**
+	 * \brief The children of an internal node with their augmentations,
+	 * valid until another node is read
+	 */
+	const internal_content * contents(internal_type node, size_t & count) const {
+		blocks::block * nodeBlock = read(node.handle);
+		internal nodeInter(nodeBlock);
+
+		count = *(nodeInter.count);
+		return nodeInter.values;
+	}
+
+	void prefetch_child(internal_type node, size_t i) const {
+		blocks::block * nodeBlock = read(node.handle);
+		internal nodeInter(nodeBlock);
+
+		m_collection->prefetch(resolve(nodeInter.values[i].handle));
+	}
+
+	// identifies a node while it exists
+	stream_size_type id(internal_type node) const {
+		return node.handle.position;
+	}
+
 	size_t index(leaf_type child, internal_type node) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal dstInter(nodeBlock);
 
 		for (size_t i=0; i < *(dstInter.count); ++i)
@@ -322,7 +472,7 @@ public:
 	}
 
 	size_t index(internal_type child, internal_type node) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal dstInter(nodeBlock);
 
 		for (size_t i=0; i < *(dstInter.count); ++i)
@@ -332,7 +482,8 @@ public:
 	}
 	
 	void set_augment(blocks::block_handle child, internal_type node, augment_type augment) {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		prepare_write(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		for (size_t i=0; i < *(nodeInter.count); ++i)
@@ -358,7 +509,7 @@ public:
 	}
 
 	const augment_type & augment(internal_type node, size_t i) const {
-		blocks::block * nodeBlock = m_collection->read_block(node.handle);
+		blocks::block * nodeBlock = read(node.handle);
 		internal nodeInter(nodeBlock);
 
 		return nodeInter.values[i].augment;
@@ -380,13 +531,139 @@ public:
 		m_size = size;
 	}
 
-	std::shared_ptr<blocks::block_collection_cache> m_collection;
+	// construct a snapshot of the given store
+	external_store(const external_store & o, snapshot_registry::version_list::iterator version)
+		: external_store_base()
+		, m_blockSize(o.m_blockSize)
+		, m_cacheSize(o.m_cacheSize)
+		, m_collection(o.m_collection)
+		, m_snapshots(o.m_snapshots)
+		, m_isSnapshot(true)
+		, m_version(version)
+	{
+		m_root = o.m_root;
+		m_height = o.m_height;
+		m_size = o.m_size;
+	}
+
+	// the block holding the content of a node as this store sees it
+	blocks::block_handle resolve(blocks::block_handle h) const {
+		if (!m_isSnapshot) return h;
+		auto i = m_version->preserved.find(h.position);
+		return i == m_version->preserved.end() ? h : i->second;
+	}
+
+	blocks::block * read(blocks::block_handle h) const {
+		return m_collection->read_block(resolve(h));
+	}
+
+	// copy a node that a snapshot can see before it is changed
+	void prepare_write(blocks::block_handle h) {
+		check_writeable();
+		if (!m_snapshots || m_snapshots->versions.empty()) return;
+		if (!m_snapshots->fresh.insert(h.position).second) return;
+
+		blocks::block content(*m_collection->read_block(h));
+		blocks::block_handle copy = m_collection->get_free_block();
+		blocks::block * b = m_collection->read_block(copy);
+		std::copy(content.begin(), content.end(), b->begin());
+		m_collection->write_block(copy);
+		keep(h, copy);
+	}
+
+	// let every snapshot that has not kept h read its content from copy
+	void keep(blocks::block_handle h, blocks::block_handle copy) {
+		size_t users = 0;
+		for (auto & v: m_snapshots->versions)
+			if (v.preserved.insert(std::make_pair(h.position, copy)).second) ++users;
+		if (users == 0) {
+			m_collection->free_block(copy);
+			return;
+		}
+		m_snapshots->users[copy.position] += users;
+	}
+
+	blocks::block_handle create_block() {
+		check_writeable();
+		return add_block(m_collection->get_free_block());
+	}
+
+	blocks::block_handle create_block(blocks::block_handle near) {
+		check_writeable();
+		return add_block(m_collection->get_free_block(near));
+	}
+
+	blocks::block_handle add_block(blocks::block_handle h) {
+		if (m_snapshots && !m_snapshots->versions.empty())
+			m_snapshots->fresh.insert(h.position);
+		return h;
+	}
+
+	leaf_type init_leaf(blocks::block_handle h) {
+		blocks::block * b = read(h);
+		leaf l(b);
+		(*l.count) = 0;
+		clear_tail(b, reinterpret_cast<char *>(l.values));
+		m_collection->write_block(h);
+		return leaf_type(h);
+	}
+
+	internal_type init_internal(blocks::block_handle h) {
+		blocks::block * b = read(h);
+		internal i(b);
+		(*i.count) = 0;
+		clear_tail(b, reinterpret_cast<char *>(i.values));
+		m_collection->write_block(h);
+		return internal_type(h);
+	}
+
+	void destroy_block(blocks::block_handle h) {
+		check_writeable();
+		if (m_snapshots && !m_snapshots->versions.empty()) {
+			bool fresh = m_snapshots->fresh.erase(h.position);
+			if (!fresh) {
+				// the snapshots read the block where it is
+				keep(h, h);
+				return;
+			}
+		}
+		m_collection->free_block(h);
+	}
+
+	// free the blocks that only this snapshot kept
+	void release_snapshot() {
+		for (auto & p: m_version->preserved) {
+			auto u = m_snapshots->users.find(p.second.position);
+			if (--u->second != 0) continue;
+			m_snapshots->users.erase(u);
+			m_collection->free_block(p.second);
+		}
+		m_snapshots->versions.erase(m_version);
+		if (m_snapshots->versions.empty()) {
+			m_snapshots->fresh.clear();
+			m_snapshots->closed.reset();
+		}
+	}
+
+	// zero the unused end of a compressed node, so it is not stored
+	void clear_tail(blocks::block * b, char * end) {
+		if (!compressed) return;
+		std::fill(end, b->get() + b->size(), 0);
+	}
+
+	memory_size_type m_blockSize;
+	memory_size_type m_cacheSize;
+	std::shared_ptr<C> m_collection;
+	// shared by the tree and its snapshots
+	std::shared_ptr<snapshot_registry> m_snapshots;
+	bool m_isSnapshot;
+	snapshot_registry::version_list::iterator m_version;
 
 	template <typename>
-	friend class btree_node;
+	friend class ::tpie::btree_node;
 
 	template <typename>
-	friend class btree_iterator;
+	friend class ::tpie::btree_iterator;
 
 	template <typename, typename>
 	friend class bbits::tree_state;
@@ -46,7 +46,24 @@ external_store_base::external_store_base(const std::string & path)
 	}
 }
 
+external_store_base::external_store_base()
+: m_root()
+, m_height(0)
+, m_size(0)
+{}
+
+external_store_base::external_store_base(external_store_base && o)
+: m_root(o.m_root)
+, m_path(std::move(o.m_path))
+, m_height(o.m_height)
+, m_size(o.m_size)
+{
+	// only the last owner writes the tree information
+	o.m_path.clear();
+}
+
 external_store_base::~external_store_base() {
+	if (m_path.empty()) return;
 	tpie::file_accessor::raw_file_accessor m_accessor;
 	m_accessor.try_open_rw(m_path);
 	stream_size_type size = sizeof(size_t) * 2 + sizeof(blocks::block_handle);
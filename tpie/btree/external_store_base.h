@@ -25,7 +25,11 @@
 #include <tpie/tpie_assert.h>
 #include <tpie/blocks/block_collection_cache.h>
 
+#include <tpie/memory.h>
 #include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace tpie {
 namespace bbits {
@@ -38,15 +42,60 @@ public:
 	 */
 	external_store_base(const std::string & path);
 
+	external_store_base(external_store_base && o);
+
 	~external_store_base();
 
 protected:
+	/**
+	 * \brief Construct the storage of a snapshot, which is not saved
+	 */
+	external_store_base();
+
 	blocks::block_handle m_root;	
 	std::string m_path;
 	size_t m_height;
 	size_t m_size;
 };
 
+/**
+ * \brief The blocks kept for the snapshots of an external btree store.
+ *
+ * The tree keeps the handles of its nodes when a node changes. Instead, the
+ * content of a node that a snapshot can see is copied to a new block the
+ * first time it changes or is freed, and the snapshot reads the copy.
+ */
+struct snapshot_registry {
+	typedef std::unordered_map<stream_size_type, size_t, std::hash<stream_size_type>,
+							   std::equal_to<stream_size_type>,
+							   allocator<std::pair<const stream_size_type, size_t> > > count_map;
+
+	struct version {
+		typedef std::unordered_map<stream_size_type, blocks::block_handle, std::hash<stream_size_type>,
+								   std::equal_to<stream_size_type>,
+								   allocator<std::pair<const stream_size_type, blocks::block_handle> > > block_map;
+		// the kept copy of every block changed or freed since the snapshot
+		block_map preserved;
+	};
+
+	typedef std::list<version, allocator<version> > version_list;
+
+	// the live snapshots, oldest first
+	version_list versions;
+
+	// the number of snapshots that read each kept copy
+	count_map users;
+
+	// the blocks that no snapshot needs kept, because they were created or
+	// already copied after the newest snapshot was taken
+	std::unordered_set<stream_size_type, std::hash<stream_size_type>,
+					   std::equal_to<stream_size_type>, allocator<stream_size_type> > fresh;
+
+	// the tree information of a closed tree, written when the last snapshot
+	// has freed its blocks
+	tpie::unique_ptr<external_store_base> closed;
+};
+
 } //namespace bbits
 } //namespace tpie
 #endif /*_TPIE_BTREE_EXTERNAL_STORE_BASE_H_*/
@@ -23,7 +23,9 @@
 #include <tpie/portability.h>
 #include <tpie/btree/base.h>
 #include <tpie/tpie_assert.h>
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 
 namespace tpie {
 namespace bbits {
@@ -122,6 +124,8 @@ private:
 		m_root = nullptr;
 	}
 	
+	void check_writeable() const {}
+
 	static constexpr size_t min_internal_size() {return a;}
 	static constexpr size_t max_internal_size() {return b;}
 
@@ -142,6 +146,12 @@ private:
 		dst->values[dst_i] = c;
 	}
 		
+	template <typename IT>
+	void set_values(leaf_type dst, IT first, size_t count) {
+		dst->count = count;
+		std::copy(first, first + count, dst->values);
+	}
+
 	void set(internal_type node, size_t i, internal_type c) {
 		node->values[i].ptr = c;
 	}
@@ -205,6 +215,19 @@ private:
 		return static_cast<leaf_type>(node->values[i].ptr);
 	}
 
+	const internal_content * contents(internal_type node, size_t & count) const {
+		count = node->count;
+		return node->values;
+	}
+
+	// all nodes are in memory, so there is nothing to read ahead
+	void prefetch_child(internal_type, size_t) const {}
+
+	// identifies a node while it exists
+	stream_size_type id(internal_type node) const {
+		return reinterpret_cast<std::uintptr_t>(node);
+	}
+
 	size_t index(void * child, internal_type node) const {
 		for (size_t i=0; i < node->count; ++i)
 			if (node->values[i].ptr == child) return i;
@@ -242,10 +265,10 @@ private:
 	size_t m_size;
 
 	template <typename>
-	friend class btree_node;
+	friend class ::tpie::btree_node;
 
 	template <typename>
-	friend class btree_iterator;
+	friend class ::tpie::btree_iterator;
 
 	template <typename, typename>
 	friend class bbits::tree;
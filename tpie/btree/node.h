@@ -235,10 +235,68 @@ private:
 	size_t m_index;
 	leaf_type m_leaf;
 
+	// the number of leaves to read ahead, or zero
+	size_t m_prefetch;
+	// the last leaf to read ahead
+	leaf_type m_prefetchEnd;
+
 	template <typename, typename>
 	friend class bbits::tree;
 
-	btree_iterator(const state_type * state): m_state(state) {}
+	btree_iterator(const state_type * state): m_state(state), m_prefetch(0) {}
+
+	void set_prefetch(size_t leaves, leaf_type end) {
+		m_prefetch = leaves;
+		m_prefetchEnd = end;
+		if (m_prefetch) prefetch();
+	}
+
+	/**
+	 * \brief Ask the store to read the next leaves ahead of time, using the
+	 * child handles of the parent. When the leaves to read run past the
+	 * parent, the next parents are read and their first leaves are read
+	 * ahead, so the window keeps covering leaves across parents.
+	 */
+	void prefetch() const {
+		if (m_path.empty() || m_leaf == m_prefetchEnd) return;
+		const store_type & store = m_state->store();
+		internal_type parent = m_path.back();
+		size_t left = m_prefetch;
+		if (!prefetch_children(parent, store.index(m_leaf, parent) + 1, left)) return;
+		std::vector<internal_type> path(m_path);
+		while (left != 0 && next_parent(path)) {
+			if (!prefetch_children(path.back(), 0, left)) return;
+		}
+	}
+
+	// read ahead the leaves of parent from index i, at most left of them;
+	// return false when the last leaf to read ahead was reached
+	bool prefetch_children(internal_type parent, size_t i, size_t & left) const {
+		const store_type & store = m_state->store();
+		size_t count = store.count(parent);
+		for (; i < count && left != 0; ++i, --left) {
+			store.prefetch_child(parent, i);
+			if (store.get_child_leaf(parent, i) == m_prefetchEnd) return false;
+		}
+		return true;
+	}
+
+	// replace the last node of path by the next node on the same level
+	bool next_parent(std::vector<internal_type> & path) const {
+		const store_type & store = m_state->store();
+		size_t up = 0;
+		while (path.size() >= 2) {
+			internal_type n = path.back();
+			path.pop_back();
+			++up;
+			size_t k = store.index(n, path.back());
+			if (k + 1 == store.count(path.back())) continue;
+			path.push_back(store.get_child_internal(path.back(), k + 1));
+			for (; up > 1; --up) path.push_back(store.get_child_internal(path.back(), 0));
+			return true;
+		}
+		return false;
+	}
 
 	void goto_item(const std::vector<internal_type> & p, leaf_type l, size_t i) {
 		m_path = p;
@@ -294,7 +352,7 @@ private:
 
 
 public:
-	btree_iterator(): m_index(0), m_leaf() {}
+	btree_iterator(): m_index(0), m_leaf(), m_prefetch(0) {}
 
 	const value_type & dereference() const {
 		return m_state->store().get(m_leaf, m_index);
@@ -361,6 +419,7 @@ public:
 		}
 		m_leaf = m_state->store().get_child_leaf(m_path.back(), i);
 		m_index = 0;
+		if (m_prefetch) prefetch();
 	}
 
 };
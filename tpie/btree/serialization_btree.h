@@ -0,0 +1,541 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino+=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file serialization_btree.h  External btree mapping keys to serialized
+/// values of any length.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_BTREE_SERIALIZATION_BTREE_H_
+#define _TPIE_BTREE_SERIALIZATION_BTREE_H_
+
+#include <tpie/portability.h>
+#include <tpie/memory.h>
+#include <tpie/serialization2.h>
+#include <tpie/blocks/block.h>
+#include <tpie/blocks/block_collection.h>
+#include <tpie/btree/base.h>
+#include <tpie/btree/external_store.h>
+#include <tpie/btree/btree.h>
+#include <tpie/stack.h>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+namespace tpie {
+namespace bbits {
+
+/**
+ * \brief A leaf entry of a serialization_btree
+ *
+ * The first inline_size bytes of the serialized value are stored in the
+ * entry. The rest is stored in a record of a shared page if it fits in a
+ * page, and in a chain of overflow pages starting at overflow otherwise.
+ */
+template <typename K, memory_size_type inline_size>
+struct serialized_entry {
+	K key;
+	// the number of bytes of the serialized value
+	memory_size_type length;
+	// the position of the shared page or the first overflow page, if
+	// length > inline_size
+	stream_size_type overflow;
+	// the record in the shared page
+	memory_size_type record;
+	char data[inline_size];
+};
+
+template <typename K, memory_size_type inline_size>
+struct serialized_entry_key {
+	K operator()(const serialized_entry<K, inline_size> & e) const {return e.key;}
+};
+
+/**
+ * \brief A shared page with free space, as saved when the pages are closed
+ */
+struct serialized_shared_page {
+	stream_size_type position;
+	memory_size_type free;
+};
+
+/**
+ * \brief Pages holding the serialized values that do not fit in the leaves
+ *
+ * A value whose remaining bytes fit in a page is stored as a record in a
+ * shared page. A shared page starts with the number of records and the
+ * start of the record data, followed by the offset and length of each
+ * record. The record data is packed at the end of the page, and the page
+ * is compacted when a record does not fit in the gap. A record is put in
+ * the fullest page it fits in, and a page is freed when its last record is
+ * removed. The shared pages with free space are kept in memory and saved
+ * in the file path + ".pages" when the pages are closed.
+ *
+ * A larger value gets a chain of overflow pages of its own. An overflow
+ * page starts with the position of the next page of the value, followed
+ * by payload_size bytes of the value.
+ */
+template <typename E, memory_size_type inline_size>
+class serialized_pages {
+public:
+	static const memory_size_type page_size = 4096;
+	static const memory_size_type payload_size = page_size - sizeof(stream_size_type);
+
+	serialized_pages(const std::string & path)
+		: m_collection(path, page_size, true)
+		, m_saved(path + ".pages")
+	{
+		while (!m_saved.empty()) {
+			serialized_shared_page p = m_saved.pop();
+			set_free(p.position, p.free);
+		}
+	}
+
+	~serialized_pages() {
+		for (typename page_map::iterator i = m_shared.begin(); i != m_shared.end(); ++i) {
+			serialized_shared_page p = {i->first, i->second};
+			m_saved.push(p);
+		}
+	}
+
+	/**
+	 * \brief Whether the value of an entry is stored in a shared page
+	 */
+	static bool shared(const E & entry) {
+		return entry.length > inline_size && entry.length - inline_size <= payload_size;
+	}
+
+	/**
+	 * \brief Serialize a value into an entry and its pages
+	 */
+	class writer {
+	public:
+		writer(serialized_pages & pages, E & entry)
+			: m_pages(pages), m_entry(entry), m_offset(0), m_page(page_size, 0), m_chained(false) {}
+
+		void write(const char * s, memory_size_type n) {
+			while (n > 0) {
+				memory_size_type count;
+				if (m_offset < inline_size) {
+					count = std::min(n, inline_size - m_offset);
+					std::memcpy(m_entry.data + m_offset, s, count);
+				} else {
+					memory_size_type offset = (m_offset - inline_size) % payload_size;
+					if (offset == 0 && m_offset > inline_size) next_page();
+					count = std::min(n, payload_size - offset);
+					std::memcpy(m_page.get() + sizeof(stream_size_type) + offset, s, count);
+				}
+				s += count;
+				n -= count;
+				m_offset += count;
+			}
+		}
+
+		/**
+		 * \brief Write the last page and record the length in the entry
+		 */
+		void close() {
+			m_entry.length = m_offset;
+			if (m_chained)
+				m_pages.m_collection.write_block(m_handle, m_page);
+			else if (m_offset > inline_size)
+				m_pages.insert_record(m_entry, m_page.get() + sizeof(stream_size_type), m_offset - inline_size);
+		}
+
+	private:
+		// the value does not fit in a shared page, so the full page starts
+		// or continues a chain of pages of its own
+		void next_page() {
+			if (!m_chained) {
+				m_handle = m_pages.m_collection.get_free_block();
+				m_entry.overflow = m_handle.position;
+				m_chained = true;
+			}
+			blocks::block_handle h = m_pages.m_collection.get_free_block(m_handle);
+			*reinterpret_cast<stream_size_type *>(m_page.get()) = h.position;
+			m_pages.m_collection.write_block(m_handle, m_page);
+			std::fill(m_page.begin(), m_page.end(), 0);
+			m_handle = h;
+		}
+
+		serialized_pages & m_pages;
+		E & m_entry;
+		memory_size_type m_offset;
+		blocks::block m_page;
+		blocks::block_handle m_handle;
+		bool m_chained;
+	};
+
+	/**
+	 * \brief Read a serialized value from an entry and its pages
+	 */
+	class reader {
+	public:
+		reader(serialized_pages & pages, const E & entry)
+			: m_pages(pages), m_entry(entry), m_offset(0), m_page(page_size), m_data(nullptr) {}
+
+		void read(char * s, memory_size_type n) {
+			if (m_offset + n > m_entry.length)
+				throw exception("Read past the end of a serialized btree value");
+			while (n > 0) {
+				memory_size_type count;
+				if (m_offset < inline_size) {
+					count = std::min(n, inline_size - m_offset);
+					std::memcpy(s, m_entry.data + m_offset, count);
+				} else {
+					memory_size_type offset = (m_offset - inline_size) % payload_size;
+					if (offset == 0) next_page();
+					count = std::min(n, payload_size - offset);
+					std::memcpy(s, m_data + offset, count);
+				}
+				s += count;
+				n -= count;
+				m_offset += count;
+			}
+		}
+
+	private:
+		void next_page() {
+			if (m_offset == inline_size && shared(m_entry)) {
+				m_pages.m_collection.read_block(blocks::block_handle(m_entry.overflow, page_size), m_page);
+				m_data = m_page.get() + get(m_page, record_offset(m_entry.record));
+				return;
+			}
+			stream_size_type position = m_offset == inline_size
+				? m_entry.overflow
+				: *reinterpret_cast<const stream_size_type *>(m_page.get());
+			m_pages.m_collection.read_block(blocks::block_handle(position, page_size), m_page);
+			m_data = m_page.get() + sizeof(stream_size_type);
+		}
+
+		serialized_pages & m_pages;
+		const E & m_entry;
+		memory_size_type m_offset;
+		blocks::block m_page;
+		const char * m_data;
+	};
+
+	/**
+	 * \brief Free the pages or the record of an entry
+	 */
+	void free(const E & entry) {
+		if (entry.length <= inline_size) return;
+		if (shared(entry)) {
+			remove_record(entry.overflow, entry.record);
+			return;
+		}
+		memory_size_type count = (entry.length - inline_size + payload_size - 1) / payload_size;
+		blocks::block page(page_size);
+		stream_size_type position = entry.overflow;
+		for (memory_size_type i = 0; i < count; ++i) {
+			blocks::block_handle h(position, page_size);
+			if (i + 1 < count) {
+				m_collection.read_block(h, page);
+				position = *reinterpret_cast<const stream_size_type *>(page.get());
+			}
+			m_collection.free_block(h);
+		}
+	}
+
+private:
+	// a shared page starts with the number of records and the start of the
+	// record data, followed by the offset and length of each record; a
+	// removed record has length zero
+	static const memory_size_type header_size = 2 * sizeof(uint16_t);
+	static const memory_size_type record_size = 2 * sizeof(uint16_t);
+
+	static_assert(header_size + record_size + payload_size <= page_size,
+				  "a value that does not need overflow pages must fit in an empty shared page");
+
+	static memory_size_type record_offset(memory_size_type r) {return header_size + r * record_size;}
+
+	static memory_size_type get(const blocks::block & page, memory_size_type offset) {
+		uint16_t v;
+		std::memcpy(&v, page.get() + offset, sizeof(v));
+		return v;
+	}
+
+	static void set(blocks::block & page, memory_size_type offset, memory_size_type value) {
+		uint16_t v = static_cast<uint16_t>(value);
+		std::memcpy(page.get() + offset, &v, sizeof(v));
+	}
+
+	// the number of bytes not used by the header, the records and their data
+	static memory_size_type page_free(const blocks::block & page) {
+		memory_size_type count = get(page, 0);
+		memory_size_type used = record_offset(count);
+		for (memory_size_type r = 0; r < count; ++r)
+			used += get(page, record_offset(r) + sizeof(uint16_t));
+		return page_size - used;
+	}
+
+	// move the record data to the end of the page, and return its start
+	static memory_size_type compact(blocks::block & page) {
+		blocks::block copy(page);
+		memory_size_type count = get(page, 0);
+		memory_size_type start = page_size;
+		for (memory_size_type r = 0; r < count; ++r) {
+			memory_size_type length = get(page, record_offset(r) + sizeof(uint16_t));
+			if (length == 0) continue;
+			start -= length;
+			std::memcpy(page.get() + start, copy.get() + get(page, record_offset(r)), length);
+			set(page, record_offset(r), start);
+		}
+		set(page, sizeof(uint16_t), start);
+		return start;
+	}
+
+	void insert_record(E & entry, const char * data, memory_size_type n) {
+		blocks::block page(page_size, 0);
+		blocks::block_handle h;
+		// the fullest page with room for the data and a new record
+		typename free_set::iterator i = m_byFree.lower_bound(free_position(n + record_size, 0));
+		if (i != m_byFree.end()) {
+			h = blocks::block_handle(i->second, page_size);
+			m_collection.read_block(h, page);
+		} else {
+			h = m_collection.get_free_block();
+			set(page, 0, 0);
+			set(page, sizeof(uint16_t), page_size);
+		}
+
+		memory_size_type count = get(page, 0);
+		memory_size_type r = 0;
+		while (r < count && get(page, record_offset(r) + sizeof(uint16_t)) != 0) ++r;
+		count = std::max(count, r + 1);
+		memory_size_type start = get(page, sizeof(uint16_t));
+		if (start < record_offset(count) + n) start = compact(page);
+		start -= n;
+		std::memcpy(page.get() + start, data, n);
+		set(page, record_offset(r), start);
+		set(page, record_offset(r) + sizeof(uint16_t), n);
+		set(page, 0, count);
+		set(page, sizeof(uint16_t), start);
+
+		m_collection.write_block(h, page);
+		set_free(h.position, page_free(page));
+		entry.overflow = h.position;
+		entry.record = r;
+	}
+
+	void remove_record(stream_size_type position, memory_size_type r) {
+		blocks::block page(page_size);
+		blocks::block_handle h(position, page_size);
+		m_collection.read_block(h, page);
+		set(page, record_offset(r), 0);
+		set(page, record_offset(r) + sizeof(uint16_t), 0);
+		memory_size_type count = get(page, 0);
+		while (count > 0 && get(page, record_offset(count - 1) + sizeof(uint16_t)) == 0) --count;
+		set(page, 0, count);
+
+		if (count == 0) {
+			set_free(position, 0);
+			m_collection.free_block(h);
+			return;
+		}
+		m_collection.write_block(h, page);
+		set_free(position, page_free(page));
+	}
+
+	// track the free space of a shared page; pages too full for another
+	// record are not tracked
+	void set_free(stream_size_type position, memory_size_type free) {
+		typename page_map::iterator i = m_shared.find(position);
+		if (i != m_shared.end()) {
+			m_byFree.erase(free_position(i->second, i->first));
+			m_shared.erase(i);
+		}
+		if (free <= record_size) return;
+		m_shared.insert(std::make_pair(position, free));
+		m_byFree.insert(free_position(free, position));
+	}
+
+	typedef std::map<stream_size_type, memory_size_type, std::less<stream_size_type>,
+					 allocator<std::pair<const stream_size_type, memory_size_type> > > page_map;
+	typedef std::pair<memory_size_type, stream_size_type> free_position;
+	typedef std::set<free_position, std::less<free_position>, allocator<free_position> > free_set;
+
+	blocks::block_collection m_collection;
+	tpie::stack<serialized_shared_page> m_saved;
+	// the shared pages with free space by position, with their free space
+	page_map m_shared;
+	// the shared pages with free space by free space and position
+	free_set m_byFree;
+};
+
+} //namespace bbits
+
+/**
+ * \brief External btree mapping keys to values of any length
+ *
+ * Values are stored with tpie::serialize and read with tpie::unserialize,
+ * like in serialization_sorter. The first inline_size bytes of a value are
+ * stored next to its key in the leaf, so small values are read with the
+ * leaf. The rest is stored in the file path + ".values": packed with the
+ * rest of other values in shared pages if it fits in a page, and in a chain
+ * of overflow pages of its own otherwise.
+ *
+ * \tparam K the type of keys, which must be trivially copyable
+ * \tparam V the type of values
+ * \tparam comp_t the ordering of keys
+ * \tparam inline_size the number of bytes of a value stored in the leaf
+ */
+template <typename K, typename V, typename comp_t=std::less<K>, memory_size_type inline_size=32>
+class serialization_btree {
+	typedef bbits::serialized_entry<K, inline_size> entry_type;
+	typedef bbits::serialized_pages<entry_type, inline_size> pages_type;
+	typedef btree<entry_type, btree_external,
+				  btree_key<bbits::serialized_entry_key<K, inline_size> >,
+				  btree_comp<comp_t> > tree_type;
+	typedef typename tree_type::iterator tree_iterator;
+
+public:
+	typedef K key_type;
+	typedef V value_type;
+	typedef typename tree_type::size_type size_type;
+
+	/**
+	 * \brief Iterator over the keys in order
+	 */
+	class iterator {
+	public:
+		iterator() : m_tree(nullptr) {}
+
+		/**
+		 * \brief The key at the iterator
+		 */
+		const K & key() const {return m_itr->key;}
+
+		/**
+		 * \brief Read the value at the iterator
+		 */
+		V value() const {
+			V v;
+			m_tree->read(*m_itr, v);
+			return v;
+		}
+
+		iterator & operator++() {++m_itr; return *this;}
+		iterator & operator--() {--m_itr; return *this;}
+		bool operator==(const iterator & o) const {return m_itr == o.m_itr;}
+		bool operator!=(const iterator & o) const {return m_itr != o.m_itr;}
+
+	private:
+		iterator(const serialization_btree * tree, tree_iterator itr) : m_tree(tree), m_itr(itr) {}
+
+		const serialization_btree * m_tree;
+		tree_iterator m_itr;
+
+		friend class serialization_btree;
+	};
+
+	/**
+	 * \brief Open or create a tree stored in the given file
+	 *
+	 * \param blockSize The size in bytes of a node, or zero to use the block
+	 * size of an existing tree or the default block size.
+	 * \param cacheSize The number of nodes kept in memory, or zero to derive
+	 * it from the memory manager.
+	 */
+	explicit serialization_btree(std::string path, comp_t comp=comp_t(),
+								 memory_size_type blockSize=0, memory_size_type cacheSize=0)
+		: m_tree(path, comp, empty_augmenter(), blockSize, cacheSize)
+		, m_pages(tpie_new<pages_type>(path + ".values")) {}
+
+	/**
+	 * \brief Insert a key and value, replacing the value of the key if it is
+	 * already in the tree
+	 * \return true if the key was not in the tree
+	 */
+	bool insert(const K & k, const V & v) {
+		bool replaced = erase(k);
+		entry_type e = entry_type();
+		e.key = k;
+		typename pages_type::writer w(*m_pages, e);
+		using tpie::serialize;
+		serialize(w, v);
+		w.close();
+		m_tree.insert(e);
+		return !replaced;
+	}
+
+	/**
+	 * \brief Read the value of a key
+	 * \return false if the key is not in the tree
+	 */
+	bool find(const K & k, V & v) const {
+		tree_iterator i = m_tree.find(k);
+		if (i == m_tree.end()) return false;
+		read(*i, v);
+		return true;
+	}
+
+	/**
+	 * \brief Return an iterator to the given key, or end() if it is not in
+	 * the tree
+	 */
+	iterator find(const K & k) const {return iterator(this, m_tree.find(k));}
+
+	/**
+	 * \brief Return an iterator to the first key not less than k
+	 */
+	iterator lower_bound(const K & k) const {return iterator(this, m_tree.lower_bound(k));}
+
+	/**
+	 * \brief Return an iterator to the first key greater than k
+	 */
+	iterator upper_bound(const K & k) const {return iterator(this, m_tree.upper_bound(k));}
+
+	iterator begin() const {return iterator(this, m_tree.begin());}
+	iterator end() const {return iterator(this, m_tree.end());}
+
+	/**
+	 * \brief Remove a key and its value
+	 * \return true if the key was in the tree
+	 */
+	bool erase(const K & k) {
+		tree_iterator i = m_tree.find(k);
+		if (i == m_tree.end()) return false;
+		m_pages->free(*i);
+		m_tree.erase(i);
+		return true;
+	}
+
+	/**
+	 * \brief The number of keys in the tree
+	 */
+	size_type size() const {return m_tree.size();}
+
+	bool empty() const {return m_tree.empty();}
+
+private:
+	void read(const entry_type & e, V & v) const {
+		typename pages_type::reader r(*m_pages, e);
+		using tpie::unserialize;
+		unserialize(r, v);
+	}
+
+	tree_type m_tree;
+	tpie::unique_ptr<pages_type> m_pages;
+};
+
+} //namespace tpie
+#endif /*_TPIE_BTREE_SERIALIZATION_BTREE_H_*/
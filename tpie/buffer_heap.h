@@ -0,0 +1,361 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file buffer_heap.h External memory priority queue with decrease-key and
+/// erase.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_BUFFER_HEAP_H_
+#define _TPIE_BUFFER_HEAP_H_
+
+#include <tpie/tpie.h>
+#include <tpie/array.h>
+#include <tpie/memory.h>
+#include <tpie/tempname.h>
+#include <tpie/file_stream.h>
+#include <tpie/sort.h>
+#include <tpie/progress_indicator_null.h>
+#include <tpie/pq_loser_tree.h>
+#include <tpie/blocks/block_collection.h>
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace tpie {
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A sequence of items stored in the blocks of a block_collection.
+///////////////////////////////////////////////////////////////////////////////
+struct buffer_heap_run {
+	buffer_heap_run() : size(0) {}
+
+	std::vector<blocks::block_handle> blocks;
+	stream_size_type size;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sequential reader of a buffer_heap_run.
+///
+/// When consuming, every block is freed as soon as it has been read, so
+/// that the blocks of the run being written can reuse them.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class buffer_heap_reader {
+public:
+	buffer_heap_reader()
+		: m_collection(nullptr)
+		, m_run(nullptr)
+		, m_items(0)
+		, m_index(0)
+		, m_next(0)
+		, m_left(0)
+		, m_consume(false)
+	{
+	}
+
+	void open(blocks::block_collection & collection, const buffer_heap_run & run,
+			  memory_size_type blockSize, bool consume) {
+		m_collection = &collection;
+		m_run = &run;
+		m_items = blockSize / sizeof(T);
+		m_index = m_items;
+		m_next = 0;
+		m_left = run.size;
+		m_consume = consume;
+		fetch();
+	}
+
+	bool can_read() const {
+		return m_left > 0;
+	}
+
+	const T & peek() const {
+		return reinterpret_cast<const T *>(m_block.get())[m_index];
+	}
+
+	T read() {
+		T x = peek();
+		++m_index;
+		--m_left;
+		fetch();
+		return x;
+	}
+
+private:
+	void fetch() {
+		if (m_left == 0 || m_index < m_items) return;
+		blocks::block_handle handle = m_run->blocks[m_next++];
+		m_collection->read_block(handle, m_block);
+		if (m_consume) m_collection->free_block(handle);
+		m_index = 0;
+	}
+
+	blocks::block_collection * m_collection;
+	const buffer_heap_run * m_run;
+	blocks::block m_block;
+	memory_size_type m_items;
+	memory_size_type m_index;
+	memory_size_type m_next;
+	stream_size_type m_left;
+	bool m_consume;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Appends items to a buffer_heap_run.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class buffer_heap_writer {
+public:
+	buffer_heap_writer(blocks::block_collection & collection, buffer_heap_run & run,
+					   memory_size_type blockSize)
+		: m_collection(collection)
+		, m_run(run)
+		, m_block(blockSize)
+		, m_items(blockSize / sizeof(T))
+		, m_index(0)
+	{
+	}
+
+	void push(const T & x) {
+		reinterpret_cast<T *>(m_block.get())[m_index++] = x;
+		++m_run.size;
+		if (m_index == m_items) flush();
+	}
+
+	void finish() {
+		if (m_index > 0) flush();
+	}
+
+private:
+	void flush() {
+		blocks::block_handle handle = m_collection.get_free_block();
+		m_collection.write_block(handle, m_block);
+		m_run.blocks.push_back(handle);
+		m_index = 0;
+	}
+
+	blocks::block_collection & m_collection;
+	buffer_heap_run & m_run;
+	blocks::block m_block;
+	memory_size_type m_items;
+	memory_size_type m_index;
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \class buffer_heap
+///
+/// \brief External memory priority queue of keys supporting decrease_key()
+/// and erase() without knowing the current priority of the key.
+///
+/// The queue is a buffer heap (Chowdhury and Ramachandran). Level 0 holds
+/// the smallest elements in internal memory and applies operations
+/// directly. Below it are levels of geometrically increasing capacity, each
+/// holding a run of elements sorted by key and a list of runs of buffered
+/// updates, stored in the blocks of a blocks::block_collection. Updates
+/// that do not concern the elements of a level are passed on to the next
+/// level when the buffer of the level fills up, and elements are moved up
+/// a level at a time when a level runs empty. Every element in a level has
+/// a priority that is at most the priority of every element and pending
+/// update below it. This gives O((1/B) log(N/M)) amortized I/Os per
+/// operation.
+///
+/// Keys are ordered by std::less and must, like the priorities, be
+/// trivially copyable.
+///
+/// \tparam Key The type of keys.
+/// \tparam Priority The type of priorities.
+/// \tparam Comparator Strict weak ordering on priorities.
+///////////////////////////////////////////////////////////////////////////////
+template <typename Key, typename Priority, typename Comparator = std::less<Priority> >
+class buffer_heap {
+public:
+	typedef Key key_type;
+	typedef Priority priority_type;
+	typedef std::pair<Key, Priority> value_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Constructor.
+	///
+	/// \param mm_avail Maximum main memory used by the queue.
+	/// \param blockSize Size in bytes of the blocks written to disk.
+	/// \param comp Comparator on priorities.
+	///////////////////////////////////////////////////////////////////////////
+	buffer_heap(memory_size_type mm_avail,
+				memory_size_type blockSize = default_block_size(),
+				Comparator comp = Comparator());
+
+	~buffer_heap();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Insert the key with the given priority, or lower its priority
+	/// to the given one if the key is already in the queue.
+	///////////////////////////////////////////////////////////////////////////
+	void decrease_key(const Key & key, const Priority & priority);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Same as decrease_key().
+	///////////////////////////////////////////////////////////////////////////
+	void push(const Key & key, const Priority & priority) {
+		decrease_key(key, priority);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the key from the queue if it is present.
+	///////////////////////////////////////////////////////////////////////////
+	void erase(const Key & key);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the keys in the range [first, last) from the queue.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename IT>
+	void erase(IT first, IT last) {
+		for (; first != last; ++first) erase(*first);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the key with the smallest priority and its priority.
+	///
+	/// May apply buffered updates and move elements up from disk.
+	///////////////////////////////////////////////////////////////////////////
+	value_type top();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the key with the smallest priority.
+	///////////////////////////////////////////////////////////////////////////
+	void pop();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return true if the queue contains no keys.
+	///
+	/// May apply buffered updates and move elements up from disk.
+	///////////////////////////////////////////////////////////////////////////
+	bool empty();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Default size of the blocks written to disk.
+	///////////////////////////////////////////////////////////////////////////
+	static memory_size_type default_block_size() {
+		return 64*1024;
+	}
+
+private:
+	enum update_kind {
+		DECREASE,
+		ERASE
+	};
+
+	struct element_type {
+		Key key;
+		Priority priority;
+	};
+
+	struct update_type {
+		Key key;
+		Priority priority;
+		stream_size_type time;
+		char kind;
+	};
+
+	struct level_type {
+		level_type() : updateCount(0), capacity(0), maximum() {}
+
+		bits::buffer_heap_run elements;
+		std::vector<bits::buffer_heap_run> updates;
+		stream_size_type updateCount;
+		stream_size_type capacity;
+		Priority maximum;
+	};
+
+	// Orders updates by key and then by time.
+	struct update_comparator {
+		bool operator()(const update_type & a, const update_type & b) const {
+			if (std::less<Key>()(a.key, b.key)) return true;
+			if (std::less<Key>()(b.key, a.key)) return false;
+			return a.time < b.time;
+		}
+	};
+
+	// Orders (priority, key) pairs, so that ties are broken consistently.
+	struct order_comparator {
+		order_comparator(Comparator c) : comp(c) {}
+
+		bool operator()(const std::pair<Priority, Key> & a, const std::pair<Priority, Key> & b) const {
+			if (comp(a.first, b.first)) return true;
+			if (comp(b.first, a.first)) return false;
+			return std::less<Key>()(a.second, b.second);
+		}
+
+		Comparator comp;
+	};
+
+	typedef std::map<Key, Priority, std::less<Key>,
+		allocator<std::pair<const Key, Priority> > > index_type;
+	typedef std::set<std::pair<Priority, Key>, order_comparator,
+		allocator<std::pair<Priority, Key> > > order_type;
+
+	void insert0(const Key & key, const Priority & priority);
+	void remove0(typename index_type::iterator i);
+	void overflow0();
+	void forward(const Key & key, const Priority & priority, update_kind kind);
+	void flush_buffer();
+	bool below_empty(memory_size_type level) const;
+	bool should_apply(memory_size_type level) const;
+	void apply(memory_size_type level);
+	void merge_updates(memory_size_type level);
+	void overflow(memory_size_type level);
+	void refill(memory_size_type level);
+	std::pair<Priority, Key> select(const bits::buffer_heap_run & run, memory_size_type rank);
+	void ensure_level(memory_size_type level);
+
+	Comparator m_comp;
+	order_comparator m_orderComp;
+	memory_size_type m_blockSize;
+	memory_size_type m_fanout;
+	memory_size_type m_selectLimit;
+	stream_size_type m_time;
+
+	// Level 0
+	index_type m_index;
+	order_type m_order;
+	memory_size_type m_capacity0;
+
+	// Updates forwarded from level 0 that have not yet been written to disk
+	array<update_type> m_buffer;
+	memory_size_type m_bufferSize;
+
+	// Levels 1 and below; m_levels[0] is unused
+	std::vector<level_type> m_levels;
+
+	temp_file m_file;
+	temp_file m_freespaceFile;
+	tpie::unique_ptr<blocks::block_collection> m_collection;
+};
+
+#include "buffer_heap.inl"
+
+} // namespace tpie
+
+#endif // _TPIE_BUFFER_HEAP_H_
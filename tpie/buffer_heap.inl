@@ -0,0 +1,422 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino+=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+template <typename Key, typename Priority, typename Comparator>
+buffer_heap<Key, Priority, Comparator>::buffer_heap(memory_size_type mm_avail,
+													memory_size_type blockSize,
+													Comparator comp)
+	: m_comp(comp)
+	, m_orderComp(comp)
+	, m_blockSize(blockSize)
+	, m_time(0)
+	, m_order(m_orderComp)
+	, m_bufferSize(0)
+{
+	tp_assert(blockSize >= sizeof(update_type), "buffer_heap: Block size too small");
+
+	// A quarter of the memory goes to level 0, a quarter to the update
+	// buffer and the rest to the blocks used when merging runs.
+	const memory_size_type elementMemory = 2 * (sizeof(std::pair<Key, Priority>) + 4 * sizeof(void *));
+	m_capacity0 = std::max<memory_size_type>(mm_avail / 4 / elementMemory, 16);
+	m_buffer.resize(std::max<memory_size_type>(mm_avail / 4 / sizeof(update_type), 16));
+	m_fanout = std::max<memory_size_type>(mm_avail / 2 / blockSize, 6) - 3;
+	m_selectLimit = mm_avail / 2 / sizeof(std::pair<Priority, Key>);
+
+	m_levels.resize(1);
+	m_levels[0].capacity = m_capacity0;
+
+	m_freespaceFile.set_path(m_file.path() + ".queue");
+	m_collection.reset(tpie_new<blocks::block_collection>(m_file.path(), blockSize, true));
+}
+
+template <typename Key, typename Priority, typename Comparator>
+buffer_heap<Key, Priority, Comparator>::~buffer_heap() {
+	m_collection.reset();
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::decrease_key(const Key & key, const Priority & priority) {
+	typename index_type::iterator i = m_index.find(key);
+	if (i != m_index.end()) {
+		if (m_comp(priority, i->second)) {
+			m_order.erase(std::make_pair(i->second, key));
+			i->second = priority;
+			m_order.insert(std::make_pair(priority, key));
+		}
+		return;
+	}
+
+	const bool keepAll = below_empty(0);
+	if (keepAll || (!m_order.empty() && !m_comp(m_order.rbegin()->first, priority))) {
+		// An element of the key below level 0 has a priority of at least
+		// the maximum of level 0, so it can simply be erased.
+		if (!keepAll) forward(key, priority, ERASE);
+		insert0(key, priority);
+		if (m_index.size() > m_capacity0) overflow0();
+	} else {
+		forward(key, priority, DECREASE);
+	}
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::erase(const Key & key) {
+	typename index_type::iterator i = m_index.find(key);
+	if (i != m_index.end())
+		remove0(i);
+	else if (!below_empty(0))
+		forward(key, Priority(), ERASE);
+}
+
+template <typename Key, typename Priority, typename Comparator>
+typename buffer_heap<Key, Priority, Comparator>::value_type
+buffer_heap<Key, Priority, Comparator>::top() {
+	if (m_order.empty()) refill(0);
+	tp_assert(!m_order.empty(), "top() on an empty buffer_heap");
+	return value_type(m_order.begin()->second, m_order.begin()->first);
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::pop() {
+	if (m_order.empty()) refill(0);
+	tp_assert(!m_order.empty(), "pop() on an empty buffer_heap");
+	remove0(m_index.find(m_order.begin()->second));
+}
+
+template <typename Key, typename Priority, typename Comparator>
+bool buffer_heap<Key, Priority, Comparator>::empty() {
+	if (m_order.empty()) refill(0);
+	return m_order.empty();
+}
+
+///////////////////////////////////////
+// Private
+///////////////////////////////////////
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::insert0(const Key & key, const Priority & priority) {
+	m_index.insert(std::make_pair(key, priority));
+	m_order.insert(std::make_pair(priority, key));
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::remove0(typename index_type::iterator i) {
+	m_order.erase(std::make_pair(i->second, i->first));
+	m_index.erase(i);
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::overflow0() {
+	while (m_index.size() > m_capacity0 / 2) {
+		typename order_type::iterator j = m_order.end();
+		--j;
+		std::pair<Priority, Key> x = *j;
+		m_order.erase(j);
+		m_index.erase(x.second);
+		forward(x.second, x.first, DECREASE);
+	}
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::forward(const Key & key, const Priority & priority, update_kind kind) {
+	update_type & u = m_buffer[m_bufferSize++];
+	u.key = key;
+	u.priority = priority;
+	u.time = m_time++;
+	u.kind = kind;
+	if (m_bufferSize == m_buffer.size()) {
+		flush_buffer();
+		if (should_apply(1)) apply(1);
+	}
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::flush_buffer() {
+	if (m_bufferSize == 0) return;
+	std::sort(m_buffer.begin(), m_buffer.begin() + m_bufferSize, update_comparator());
+
+	ensure_level(1);
+	level_type & l = m_levels[1];
+	l.updates.push_back(bits::buffer_heap_run());
+	bits::buffer_heap_writer<update_type> out(*m_collection, l.updates.back(), m_blockSize);
+	for (memory_size_type i = 0; i < m_bufferSize; ++i) out.push(m_buffer[i]);
+	out.finish();
+	l.updateCount += m_bufferSize;
+	m_bufferSize = 0;
+}
+
+template <typename Key, typename Priority, typename Comparator>
+bool buffer_heap<Key, Priority, Comparator>::below_empty(memory_size_type level) const {
+	if (level == 0 && m_bufferSize > 0) return false;
+	for (memory_size_type i = level + 1; i < m_levels.size(); ++i) {
+		if (m_levels[i].elements.size > 0 || !m_levels[i].updates.empty()) return false;
+	}
+	return true;
+}
+
+template <typename Key, typename Priority, typename Comparator>
+bool buffer_heap<Key, Priority, Comparator>::should_apply(memory_size_type level) const {
+	if (level >= m_levels.size()) return false;
+	const level_type & l = m_levels[level];
+	// A merge adds at most two runs to the next level, so this keeps the
+	// number of runs merged at once within the fanout.
+	return l.updateCount >= l.capacity || l.updates.size() + 1 >= m_fanout;
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::apply(memory_size_type level) {
+	do {
+		merge_updates(level);
+		++level;
+	} while (should_apply(level));
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::merge_updates(memory_size_type level) {
+	ensure_level(level + 1);
+	level_type & l = m_levels[level];
+	level_type & next = m_levels[level + 1];
+
+	// If the levels below are empty, every element stays on this level.
+	// Otherwise an update that does not concern an element of this level
+	// stays only if it does not exceed the current maximum.
+	const bool keepAll = below_empty(level);
+	const bool hasThreshold = l.elements.size > 0;
+	const Priority threshold = l.maximum;
+
+	std::vector<bits::buffer_heap_run> updates;
+	updates.swap(l.updates);
+	l.updateCount = 0;
+	bits::buffer_heap_run elements;
+	std::swap(elements, l.elements);
+	bits::buffer_heap_run forwarded;
+
+	{
+		array<bits::buffer_heap_reader<update_type> > readers(updates.size());
+		pq_loser_tree<update_type, update_comparator> merger(std::max<memory_size_type>(updates.size(), 1));
+		for (memory_size_type i = 0; i < updates.size(); ++i) {
+			readers[i].open(*m_collection, updates[i], m_blockSize, true);
+			if (readers[i].can_read()) merger.push(readers[i].read(), i);
+		}
+
+		bits::buffer_heap_reader<element_type> in;
+		in.open(*m_collection, elements, m_blockSize, true);
+		bits::buffer_heap_writer<element_type> out(*m_collection, l.elements, m_blockSize);
+		bits::buffer_heap_writer<update_type> down(*m_collection, forwarded, m_blockSize);
+		bool hasMaximum = false;
+
+		while (in.can_read() || !merger.empty()) {
+			Key key;
+			if (merger.empty() || (in.can_read() && !std::less<Key>()(merger.top().key, in.peek().key)))
+				key = in.peek().key;
+			else
+				key = merger.top().key;
+
+			bool present = false;
+			Priority priority = Priority();
+			if (in.can_read() && !std::less<Key>()(key, in.peek().key)) {
+				present = true;
+				priority = in.read().priority;
+			}
+
+			// The updates of the key to pass on are reduced to at most an
+			// erase followed by a decrease.
+			bool forwardErase = false;
+			bool forwardDecrease = false;
+			update_type erase = update_type();
+			update_type decrease = update_type();
+
+			while (!merger.empty() && !std::less<Key>()(key, merger.top().key)) {
+				update_type u = merger.top();
+				memory_size_type run = merger.top_run();
+				if (readers[run].can_read())
+					merger.pop_and_push(readers[run].read(), run);
+				else
+					merger.pop();
+
+				if (u.kind == ERASE) {
+					if (present) {
+						present = false;
+					} else if (!keepAll) {
+						forwardErase = true;
+						erase = u;
+						forwardDecrease = false;
+					}
+				} else if (present) {
+					if (m_comp(u.priority, priority)) priority = u.priority;
+				} else if (keepAll || (hasThreshold && !m_comp(threshold, u.priority))) {
+					present = true;
+					priority = u.priority;
+					if (!keepAll) {
+						forwardErase = true;
+						erase = u;
+						erase.kind = ERASE;
+						forwardDecrease = false;
+					}
+				} else if (forwardDecrease) {
+					if (m_comp(u.priority, decrease.priority)) decrease.priority = u.priority;
+					decrease.time = u.time;
+				} else {
+					forwardDecrease = true;
+					decrease = u;
+				}
+			}
+
+			if (present) {
+				element_type e;
+				e.key = key;
+				e.priority = priority;
+				out.push(e);
+				if (!hasMaximum || m_comp(l.maximum, priority)) {
+					l.maximum = priority;
+					hasMaximum = true;
+				}
+			}
+			if (forwardErase) down.push(erase);
+			if (forwardDecrease) down.push(decrease);
+		}
+		out.finish();
+		down.finish();
+	}
+
+	if (forwarded.size > 0) {
+		next.updateCount += forwarded.size;
+		next.updates.push_back(forwarded);
+	}
+	if (l.elements.size > l.capacity) overflow(level);
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::overflow(memory_size_type level) {
+	level_type & l = m_levels[level];
+	level_type & next = m_levels[level + 1];
+
+	const std::pair<Priority, Key> cutoff = select(l.elements, l.capacity / 2);
+	bits::buffer_heap_run elements;
+	std::swap(elements, l.elements);
+	bits::buffer_heap_run moved;
+	{
+		bits::buffer_heap_reader<element_type> in;
+		in.open(*m_collection, elements, m_blockSize, true);
+		bits::buffer_heap_writer<element_type> out(*m_collection, l.elements, m_blockSize);
+		bits::buffer_heap_writer<update_type> down(*m_collection, moved, m_blockSize);
+		while (in.can_read()) {
+			element_type e = in.read();
+			if (m_orderComp(cutoff, std::make_pair(e.priority, e.key))) {
+				update_type u;
+				u.key = e.key;
+				u.priority = e.priority;
+				u.time = m_time++;
+				u.kind = DECREASE;
+				down.push(u);
+			} else {
+				out.push(e);
+			}
+		}
+		out.finish();
+		down.finish();
+	}
+	l.maximum = cutoff.first;
+	next.updateCount += moved.size;
+	next.updates.push_back(moved);
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::refill(memory_size_type level) {
+	const memory_size_type below = level + 1;
+	if (level == 0) flush_buffer();
+	if (below >= m_levels.size()) return;
+	if (!m_levels[below].updates.empty()) apply(below);
+	if (m_levels[below].elements.size == 0) {
+		refill(below);
+		if (m_levels[below].elements.size == 0) return;
+	}
+
+	level_type & from = m_levels[below];
+	const memory_size_type count = std::max<memory_size_type>(m_levels[level].capacity / 2, 1);
+	const bool all = from.elements.size <= count;
+	std::pair<Priority, Key> cutoff;
+	if (!all) cutoff = select(from.elements, count);
+
+	bits::buffer_heap_run elements;
+	std::swap(elements, from.elements);
+	bits::buffer_heap_reader<element_type> in;
+	in.open(*m_collection, elements, m_blockSize, true);
+	bits::buffer_heap_writer<element_type> out(*m_collection, from.elements, m_blockSize);
+	if (level == 0) {
+		while (in.can_read()) {
+			element_type e = in.read();
+			if (all || !m_orderComp(cutoff, std::make_pair(e.priority, e.key)))
+				insert0(e.key, e.priority);
+			else
+				out.push(e);
+		}
+	} else {
+		level_type & to = m_levels[level];
+		bits::buffer_heap_writer<element_type> up(*m_collection, to.elements, m_blockSize);
+		while (in.can_read()) {
+			element_type e = in.read();
+			if (all || !m_orderComp(cutoff, std::make_pair(e.priority, e.key)))
+				up.push(e);
+			else
+				out.push(e);
+		}
+		up.finish();
+		to.maximum = all ? from.maximum : cutoff.first;
+	}
+	out.finish();
+}
+
+template <typename Key, typename Priority, typename Comparator>
+std::pair<Priority, Key>
+buffer_heap<Key, Priority, Comparator>::select(const bits::buffer_heap_run & run, memory_size_type rank) {
+	tp_assert(rank > 0 && rank <= run.size, "select(): rank out of range");
+	bits::buffer_heap_reader<element_type> in;
+	in.open(*m_collection, run, m_blockSize, false);
+
+	if (run.size <= m_selectLimit) {
+		array<std::pair<Priority, Key> > items(static_cast<memory_size_type>(run.size));
+		for (memory_size_type i = 0; i < items.size(); ++i) {
+			element_type e = in.read();
+			items[i] = std::make_pair(e.priority, e.key);
+		}
+		std::nth_element(items.begin(), items.begin() + (rank - 1), items.end(), m_orderComp);
+		return items[rank - 1];
+	}
+
+	temp_file tmp;
+	file_stream<std::pair<Priority, Key> > items;
+	items.open(tmp);
+	while (in.can_read()) {
+		element_type e = in.read();
+		items.write(std::make_pair(e.priority, e.key));
+	}
+	progress_indicator_null pi;
+	sort(items, m_orderComp, pi);
+	items.seek(rank - 1);
+	return items.read();
+}
+
+template <typename Key, typename Priority, typename Comparator>
+void buffer_heap<Key, Priority, Comparator>::ensure_level(memory_size_type level) {
+	while (m_levels.size() <= level) {
+		level_type l;
+		l.capacity = 2 * m_levels.back().capacity;
+		m_levels.push_back(l);
+	}
+}
@@ -8,6 +8,7 @@
 
 #cmakedefine TPIE_DEPRECATED_WARNINGS
 #cmakedefine TPIE_PARALLEL_SORT
+#cmakedefine TPIE_HAVE_SIMD_SORT
 
 #if defined (TPIE_HAVE_UNISTD_H)
 #include <unistd.h>
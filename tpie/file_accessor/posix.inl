@@ -98,6 +98,31 @@ inline void posix::seek_i(stream_size_type size) {
 	if (::lseek(m_fd, size, SEEK_SET) == -1) throw_errno();
 }
 
+inline void posix::read_at_i(void * data, memory_size_type size, stream_size_type offset) {
+	memory_offset_type bytesRead = ::pread(m_fd, data, size, offset);
+	if (bytesRead == -1)
+		throw_errno();
+	if (bytesRead != static_cast<memory_offset_type>(size)) {
+		std::stringstream ss;
+		ss << "Wrong number of bytes read: Expected " << size << " but got " << bytesRead;
+		throw io_exception(ss.str());
+	}
+	increment_bytes_read(size);
+}
+
+inline void posix::write_at_i(const void * data, memory_size_type size, stream_size_type offset) {
+	do {
+		ssize_t res = ::pwrite(m_fd, data, size, offset);
+		if(res == -1) {
+			throw_errno();
+		}
+		data = static_cast<const char*>(data) + res;
+		size -= res;
+		offset += res;
+		increment_bytes_written(res);
+	} while(size != 0);
+}
+
 inline stream_size_type posix::file_size_i() {
 	struct stat buf;
 	if (::fstat(m_fd, &buf) == -1) throw_errno();
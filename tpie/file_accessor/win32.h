@@ -55,6 +55,18 @@ public:
 	inline void read_i(void * data, memory_size_type size);
 	inline void write_i(const void * data, memory_size_type size);
 	inline void seek_i(stream_size_type offset);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Read at the given offset without using the file position, so
+	/// several threads may read and write different parts of the file at once.
+	///////////////////////////////////////////////////////////////////////////
+	inline void read_at_i(void * data, memory_size_type size, stream_size_type offset);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Write at the given offset without using the file position.
+	///////////////////////////////////////////////////////////////////////////
+	inline void write_at_i(const void * data, memory_size_type size, stream_size_type offset);
+
 	inline stream_size_type file_size_i();
 	inline void close_i();
 	inline void truncate_i(stream_size_type bytes);
@@ -36,9 +36,31 @@
 #include <tpie/internal_queue.h>
 #include <tpie/job.h>
 #include <tpie/config.h>
+#include <tpie/simd_sort.h>
 
 namespace tpie {
 
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sequential sort used by parallel_sort.
+///////////////////////////////////////////////////////////////////////////////
+template <typename iterator_type, typename comp_type>
+void sequential_sort(iterator_type a, iterator_type b, comp_type comp) {
+	std::sort(a, b, comp);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sorting primitive types in ascending order uses SIMD instructions
+/// when available.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void sequential_sort(T * a, T * b, std::less<T>) {
+	tpie::simd_sort(a, b);
+}
+
+} // namespace bits
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief A simple parallel sort implementation with progress tracking.
 /// The partition step is sequential, as a parallel partition only speeds up
@@ -203,7 +225,7 @@ public:
 				children.push_back(j);
 				a = pivot+1;
 			}
-			std::sort(a, b, comp);
+			bits::sequential_sort(a, b, comp);
 			add_progress(sortWork(b - a));
 		}
 
@@ -251,7 +273,7 @@ public:
 		if (progress.pi) progress.pi->init(progress.total_work_estimate);
 
 		if (static_cast<size_t>(b - a) < min_size) {
-			std::sort(a, b, comp);
+			bits::sequential_sort(a, b, comp);
 			if (progress.pi) progress.pi->done();
 			return;
 		}
@@ -300,7 +322,7 @@ void parallel_sort(iterator_type a,
 	s(a,b,comp);
 #else
 	pi.init(1);
-	std::sort(a,b,comp);
+	bits::sequential_sort(a, b, comp);
 	pi.done();
 #endif
 }
@@ -320,7 +342,7 @@ void parallel_sort(iterator_type a,
 	parallel_sort_impl<iterator_type, comp_type, false> s(0);
 	s(a,b,comp);
 #else
-	std::sort(a, b, comp);
+	bits::sequential_sort(a, b, comp);
 #endif
 }
 
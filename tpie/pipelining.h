@@ -53,5 +53,6 @@
 #include <tpie/pipelining/uniq.h>
 #include <tpie/pipelining/parallel.h>
 #include <tpie/pipelining/map.h>
+#include <tpie/pipelining/time_forward.h>
 
 #endif
@@ -0,0 +1,136 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+// 
+// This file is part of TPIE.
+// 
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+// 
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+// 
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_PIPELINING_BTREE_H__
+#define __TPIE_PIPELINING_BTREE_H__
+
+#include <tpie/btree/btree.h>
+#include <tpie/btree/btree_builder.h>
+#include <tpie/memory.h>
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+
+namespace tpie {
+
+namespace pipelining {
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \class btree_output_t
+///
+/// Terminator pushing items to a btree builder.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename O>
+class btree_output_t : public node {
+public:
+	typedef T item_type;
+	typedef bbits::builder<T, O> builder_type;
+
+	btree_output_t(builder_type & builder) : m_builder(builder) {
+		set_name("Build btree", PRIORITY_INSIGNIFICANT);
+	}
+
+	void push(const T & item) {
+		m_builder.push(item);
+	}
+private:
+	builder_type & m_builder;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \class btree_lookup_t
+///
+/// Pushes the items of a btree with the keys pushed to it.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename O>
+class btree_lookup_t {
+public:
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef bbits::tree<T, O> tree_type;
+		typedef typename tree_type::key_type item_type;
+		typedef typename tree_type::sorted_lookup cursor_type;
+
+		type(dest_t dest, const tree_type & tree, size_t prefetch)
+			: m_tree(tree)
+			, m_prefetch(prefetch)
+			, dest(std::move(dest))
+		{
+			add_push_destination(this->dest);
+			set_name("Look up in btree", PRIORITY_INSIGNIFICANT);
+		}
+
+		void begin() override {
+			m_cursor.reset(tpie_new<cursor_type>(m_tree.sorted_lookups(m_prefetch)));
+		}
+
+		void push(const item_type & key) {
+			std::pair<typename tree_type::iterator, typename tree_type::iterator> r = m_cursor->equal_range(key);
+			for (; r.first != r.second; ++r.first) dest.push(*r.first);
+		}
+
+		void end() override {
+			m_cursor.reset();
+		}
+	private:
+		const tree_type & m_tree;
+		size_t m_prefetch;
+		tpie::unique_ptr<cursor_type> m_cursor;
+		dest_t dest;
+	};
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A pipelining node that looks up the keys pushed to it in a btree,
+/// and pushes every item of the tree with that key, like a merge join.
+///
+/// The keys must arrive in increasing order, and the tree must not change
+/// while the pipeline runs. Nearby keys are found without going back to the
+/// root, see tree::sorted_lookup.
+/// \param tree The tree to look up keys in
+/// \param prefetch The number of leaves to read ahead after the leaf of a key
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename O>
+inline pipe_middle<tempfactory<bits::btree_lookup_t<T, O>, const bbits::tree<T, O> &, size_t> >
+btree_lookup(const bbits::tree<T, O> & tree, size_t prefetch = 0) {
+	return tempfactory<bits::btree_lookup_t<T, O>, const bbits::tree<T, O> &, size_t>(tree, prefetch);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A pipelining node that pushes the items to a btree builder. The
+/// items must arrive in sorted order, and build() must be called on the
+/// builder after the pipeline has run.
+/// \param builder The builder that items should be pushed to
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename O>
+inline pipe_end<termfactory<bits::btree_output_t<T, O>, bbits::builder<T, O> &> >
+btree_output(bbits::builder<T, O> & builder) {
+	return termfactory<bits::btree_output_t<T, O>, bbits::builder<T, O> &>(builder);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_BTREE_H__
@@ -18,6 +18,9 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 #include <tpie/pipelining/merge_sorter.h>
+#include <tpie/serialization2.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
 
 namespace tpie {
 
@@ -34,7 +37,7 @@ run_positions::~run_positions() {
 
 /*static*/ memory_size_type run_positions::memory_usage() {
 	return sizeof(run_positions)
-		+ 2 * file_stream<stream_position>::memory_usage();
+		+ 2 * file_stream<run_extent>::memory_usage();
 }
 
 void run_positions::open() {
@@ -45,17 +48,23 @@ void run_positions::open() {
 	m_open = true;
 	m_final = m_evacuated = false;
 	m_finalExtraSet = false;
-	m_finalExtra = stream_position();
+	m_finalExtra = run_extent();
 	m_finalPositions.resize(0);
 }
 
+void run_positions::open(memory_size_type mergeLevel) {
+	open();
+	m_levels = mergeLevel + 1;
+	m_positions[mergeLevel % 2].truncate(0);
+}
+
 void run_positions::close() {
 	if (m_open) {
 		m_positions[0].close();
 		m_positions[1].close();
 		m_open = m_final = m_evacuated = false;
 		m_finalExtraSet = false;
-		m_finalExtra = stream_position();
+		m_finalExtra = run_extent();
 		m_finalPositions.resize(0);
 	}
 }
@@ -120,7 +129,7 @@ void run_positions::final_level(memory_size_type fanout) {
 		throw exception("final_level: m_open == false");
 
 	m_final = true;
-	file_stream<stream_position> & s = m_positions[m_levels % 2];
+	file_stream<run_extent> & s = m_positions[m_levels % 2];
 	if (fanout > s.size() - s.offset()) {
 		log_debug() << "Decrease final level fanout from " << fanout << " to ";
 		fanout = static_cast<memory_size_type>(s.size() - s.offset());
@@ -132,7 +141,7 @@ void run_positions::final_level(memory_size_type fanout) {
 	m_positions[1].close();
 }
 
-void run_positions::set_position(memory_size_type mergeLevel, memory_size_type runNumber, stream_position pos) {
+void run_positions::set_position(memory_size_type mergeLevel, memory_size_type runNumber, run_extent pos) {
 	if (!m_open) open();
 
 	if (mergeLevel+1 != m_levels) {
@@ -144,7 +153,7 @@ void run_positions::set_position(memory_size_type mergeLevel, memory_size_type r
 		m_finalExtraSet = true;
 		return;
 	}
-	file_stream<stream_position> & s = m_positions[mergeLevel % 2];
+	file_stream<run_extent> & s = m_positions[mergeLevel % 2];
 	memory_size_type & expectedRunNumber = m_runs[mergeLevel % 2];
 	if (runNumber != expectedRunNumber) {
 		throw exception("set_position: Wrong run number");
@@ -153,7 +162,7 @@ void run_positions::set_position(memory_size_type mergeLevel, memory_size_type r
 	s.write(pos);
 }
 
-stream_position run_positions::get_position(memory_size_type mergeLevel, memory_size_type runNumber) {
+run_extent run_positions::get_position(memory_size_type mergeLevel, memory_size_type runNumber) {
 	if (!m_open) throw exception("get_position: !open");
 
 	if (m_final && mergeLevel+1 == m_levels) {
@@ -169,7 +178,7 @@ stream_position run_positions::get_position(memory_size_type mergeLevel, memory_
 	if (m_final) {
 		return m_finalPositions[runNumber];
 	}
-	file_stream<stream_position> & s = m_positions[mergeLevel % 2];
+	file_stream<run_extent> & s = m_positions[mergeLevel % 2];
 	memory_size_type & expectedRunNumber = m_runs[mergeLevel % 2];
 	if (runNumber != expectedRunNumber) {
 		throw exception("get_position: Wrong run number");
@@ -181,6 +190,127 @@ stream_position run_positions::get_position(memory_size_type mergeLevel, memory_
 }
 
 
+namespace {
+
+const uint64_t sort_manifest_magic = 0x54504945534f5254ull; // "TPIESORT"
+// Version 2 appends updates after the runs; see sort_manifest::append.
+const uint64_t sort_manifest_version = 2;
+const uint64_t sort_manifest_update_end = 0x5550444154454e44ull; // "UPDATEND"
+
+} // unnamed namespace
+
+void sort_manifest::save(const std::string & path) const {
+	std::string tmpPath = path + ".tmp";
+	{
+		std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) throw exception("Could not write sort checkpoint " + tmpPath);
+		serialize(out, sort_manifest_magic);
+		serialize(out, sort_manifest_version);
+		serialize(out, runFormation);
+		serialize(out, itemSize);
+		serialize(out, params);
+		serialize(out, itemCount);
+		serialize(out, pushCount);
+		serialize(out, limit);
+		serialize(out, mergeLevel);
+		serialize(out, static_cast<uint64_t>(runFiles.size()));
+		for (size_t i = 0; i < runFiles.size(); ++i)
+			serialize(out, runFiles[i]);
+		serialize(out, runs);
+		out.close();
+		if (!out) throw exception("Could not write sort checkpoint " + tmpPath);
+	}
+	// Replace the previous manifest only when the new one is complete.
+	boost::filesystem::rename(tmpPath, path);
+}
+
+void sort_manifest::append(const std::string & path, memory_size_type first,
+						   const run_extent * updated, memory_size_type count, bool complete) const {
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::app);
+	if (!out) throw exception("Could not write sort checkpoint " + path);
+	serialize(out, runFormation);
+	serialize(out, mergeLevel);
+	serialize(out, complete);
+	serialize(out, itemCount);
+	serialize(out, pushCount);
+	serialize(out, static_cast<uint64_t>(first));
+	serialize(out, static_cast<uint64_t>(count));
+	for (memory_size_type i = 0; i < count; ++i)
+		serialize(out, updated[i]);
+	serialize(out, sort_manifest_update_end);
+	out.close();
+	if (!out) throw exception("Could not write sort checkpoint " + path);
+}
+
+bool sort_manifest::load(const std::string & path) {
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in) return false;
+	uint64_t magic = 0, version = 0;
+	unserialize(in, magic);
+	unserialize(in, version);
+	if (magic != sort_manifest_magic || version == 0 || version > sort_manifest_version)
+		throw exception("Not a sort checkpoint: " + path);
+	unserialize(in, runFormation);
+	unserialize(in, itemSize);
+	unserialize(in, params);
+	unserialize(in, itemCount);
+	unserialize(in, pushCount);
+	unserialize(in, limit);
+	unserialize(in, mergeLevel);
+	uint64_t fileCount = 0;
+	unserialize(in, fileCount);
+	if (!in) throw exception("Truncated sort checkpoint: " + path);
+	runFiles.resize(static_cast<size_t>(fileCount));
+	for (size_t i = 0; i < runFiles.size(); ++i)
+		unserialize(in, runFiles[i]);
+	unserialize(in, runs);
+	if (!in) throw exception("Truncated sort checkpoint: " + path);
+
+	// Apply the appended updates. Updates of a later merge level are
+	// collected until the level is complete. An update that was only partly
+	// written when the process stopped is ignored.
+	std::vector<run_extent> nextRuns;
+	while (in.peek() != std::char_traits<char>::eof()) {
+		bool updateRunFormation = false, complete = false;
+		memory_size_type updateLevel = 0;
+		stream_size_type updateItemCount = 0, updatePushCount = 0;
+		uint64_t first = 0, count = 0, end = 0;
+		unserialize(in, updateRunFormation);
+		unserialize(in, updateLevel);
+		unserialize(in, complete);
+		unserialize(in, updateItemCount);
+		unserialize(in, updatePushCount);
+		unserialize(in, first);
+		unserialize(in, count);
+		if (!in || count > 2 * params.fanout) break;
+		std::vector<run_extent> updated(static_cast<size_t>(count));
+		for (size_t i = 0; i < updated.size(); ++i) unserialize(in, updated[i]);
+		unserialize(in, end);
+		if (!in || end != sort_manifest_update_end) break;
+
+		std::vector<run_extent> & target = (updateLevel == mergeLevel) ? runs : nextRuns;
+		if (first > target.size()) break;
+		target.resize(static_cast<size_t>(first));
+		target.insert(target.end(), updated.begin(), updated.end());
+		if (updateLevel != mergeLevel && complete) {
+			runs.swap(nextRuns);
+			nextRuns.clear();
+			mergeLevel = updateLevel;
+		}
+		if (updateLevel == mergeLevel) {
+			runFormation = updateRunFormation;
+			itemCount = updateItemCount;
+			pushCount = updatePushCount;
+		}
+	}
+	return true;
+}
+
+/*static*/ void sort_manifest::remove(const std::string & path) {
+	boost::system::error_code ec;
+	boost::filesystem::remove(path, ec);
+}
+
 } // namespace bits
 
 } // namespace tpie
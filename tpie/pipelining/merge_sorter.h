@@ -28,14 +28,32 @@
 #include <tpie/dummy_progress.h>
 #include <tpie/array_view.h>
 #include <tpie/parallel_sort.h>
+#include <tpie/internal_priority_queue.h>
+#include <tpie/util.h>
+#include <tpie/stats.h>
+#include <string>
+#include <vector>
 
 namespace tpie {
 
 namespace bits {
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Start position and item count of a sorted run.
+///////////////////////////////////////////////////////////////////////////////
+struct run_extent {
+	stream_position position;
+	stream_size_type items;
+
+	static const bool is_trivially_serializable = true;
+};
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief  Class to maintain the positions where sorted runs start.
 ///
+/// Along with each position, the number of items in the run is stored, since
+/// runs may be shorter than the run length when equal items are combined.
+///
 /// The run_positions object has the following states:
 /// * closed
 /// * open
@@ -73,6 +91,13 @@ public:
 	///////////////////////////////////////////////////////////////////////////
 	void open();
 
+	///////////////////////////////////////////////////////////////////////////
+	/// Switch from `closed` to `open` state with merge tree depth
+	/// mergeLevel+1, such that the positions in mergeLevel may be set.
+	/// Used when resuming a sort from a checkpoint.
+	///////////////////////////////////////////////////////////////////////////
+	void open(memory_size_type mergeLevel);
+
 	///////////////////////////////////////////////////////////////////////////
 	/// Switch from any state to `closed` state.
 	///////////////////////////////////////////////////////////////////////////
@@ -99,14 +124,14 @@ public:
 	void final_level(memory_size_type fanout);
 
 	///////////////////////////////////////////////////////////////////////////
-	/// Store a stream position - see class docstring.
+	/// Store a stream position and run length - see class docstring.
 	///////////////////////////////////////////////////////////////////////////
-	void set_position(memory_size_type mergeLevel, memory_size_type runNumber, stream_position pos);
+	void set_position(memory_size_type mergeLevel, memory_size_type runNumber, run_extent pos);
 
 	///////////////////////////////////////////////////////////////////////////
-	/// Fetch a stream position - see class docstring.
+	/// Fetch a stream position and run length - see class docstring.
 	///////////////////////////////////////////////////////////////////////////
-	stream_position get_position(memory_size_type mergeLevel, memory_size_type runNumber);
+	run_extent get_position(memory_size_type mergeLevel, memory_size_type runNumber);
 
 private:
 	/** Object state: Whether we are open. */
@@ -122,14 +147,148 @@ private:
 	memory_size_type m_runs[2];
 	temp_file m_positionsFile[2];
 	stream_position m_positionsPosition[2];
-	file_stream<stream_position> m_positions[2];
+	file_stream<run_extent> m_positions[2];
 
 	/** If final: the stream positions in mergeLevel = d-2. */
-	array<stream_position> m_finalPositions;
+	array<run_extent> m_finalPositions;
 	/** If final: Whether the (d-1, 0)-position is stored. */
 	bool m_finalExtraSet;
 	/** If finalExtraSet: The (d-1, 0)-position. */
-	stream_position m_finalExtra;
+	run_extent m_finalExtra;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Persistent description of the runs of a merge sort, written by
+/// merge_sorter::set_checkpoint and read by merge_sorter::resume.
+///
+/// The manifest describes a single merge level: The paths of the run files,
+/// and the position and length of each run in the level.
+/// Runs written later are appended to the manifest by append(), so the
+/// manifest is not rewritten for each run.
+///////////////////////////////////////////////////////////////////////////////
+struct sort_manifest {
+	/** Whether the manifest was written while forming runs. */
+	bool runFormation;
+	/** Size of the items in the run files. */
+	memory_size_type itemSize;
+	sort_parameters params;
+	/** Number of items pushed to the sorter and not discarded. */
+	stream_size_type itemCount;
+	/** Number of items pushed to the sorter. */
+	stream_size_type pushCount;
+	stream_size_type limit;
+	/** The merge level containing the runs. */
+	memory_size_type mergeLevel;
+	/** Paths of the 2*fanout run files. */
+	std::vector<std::string> runFiles;
+	/** Position and length of each run in mergeLevel. */
+	std::vector<run_extent> runs;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Write the manifest to the given path, replacing any existing
+	/// manifest atomically.
+	///////////////////////////////////////////////////////////////////////////
+	void save(const std::string & path) const;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Append an update to the manifest at the given path: The runs
+	/// from number first in mergeLevel are replaced by the count runs in
+	/// updated, and runFormation, itemCount and pushCount are replaced.
+	///
+	/// If mergeLevel is a later level than the one saved, the runs of that
+	/// level replace the saved runs in the update where complete is true.
+	/// The runs and runFiles members are not used.
+	///////////////////////////////////////////////////////////////////////////
+	void append(const std::string & path, memory_size_type first,
+				const run_extent * updated, memory_size_type count, bool complete) const;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Read the manifest from the given path and apply the updates
+	/// appended to it.
+	/// \returns  False if there is no such file.
+	///////////////////////////////////////////////////////////////////////////
+	bool load(const std::string & path);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Delete the manifest at the given path, if any.
+	///////////////////////////////////////////////////////////////////////////
+	static void remove(const std::string & path);
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Combine function type indicating that equal items are not
+/// combined. This is the default for merge_sorter.
+///////////////////////////////////////////////////////////////////////////////
+struct no_combine {};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Helper for merge_sorter applying an associative combine function
+/// to items that compare equal under the sort predicate.
+///
+/// combine_t must provide `element_type operator()(const element_type &,
+/// const element_type &)` returning the combination of its two arguments.
+///////////////////////////////////////////////////////////////////////////////
+template <typename specific_store_t, typename pred_t, typename combine_t>
+class sort_combiner {
+	typedef typename specific_store_t::store_type store_type;
+	typedef typename specific_store_t::element_type element_type;
+public:
+	static const bool enabled = true;
+
+	sort_combiner(pred_t pred, combine_t combine, specific_store_t store)
+		: m_pred(pred), m_combine(combine), m_store(store) {}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Given lhs <= rhs, return true if they should be combined.
+	///////////////////////////////////////////////////////////////////////////
+	bool equal(const store_type & lhs, const store_type & rhs) {
+		return !m_pred(specific_store_t::store_as_element(lhs),
+					   specific_store_t::store_as_element(rhs));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Combine rhs into lhs.
+	///////////////////////////////////////////////////////////////////////////
+	void combine(store_type & lhs, store_type && rhs) {
+		element_type a = m_store.store_to_element(std::move(lhs));
+		element_type b = m_store.store_to_element(std::move(rhs));
+		lhs = m_store.element_to_store(m_combine(a, b));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief  Combine runs of equal items in the sorted range [items,
+	/// items+n) in place.
+	/// \returns  The number of items remaining.
+	///////////////////////////////////////////////////////////////////////////
+	memory_size_type combine_sorted(store_type * items, memory_size_type n) {
+		if (n == 0) return 0;
+		memory_size_type out = 0;
+		for (memory_size_type i = 1; i < n; ++i) {
+			if (equal(items[out], items[i]))
+				combine(items[out], std::move(items[i]));
+			else if (++out != i)
+				items[out] = std::move(items[i]);
+		}
+		return out + 1;
+	}
+
+private:
+	pred_t m_pred;
+	combine_t m_combine;
+	specific_store_t m_store;
+};
+
+template <typename specific_store_t, typename pred_t>
+class sort_combiner<specific_store_t, pred_t, no_combine> {
+	typedef typename specific_store_t::store_type store_type;
+public:
+	static const bool enabled = false;
+
+	sort_combiner(pred_t, no_combine, specific_store_t) {}
+
+	bool equal(const store_type &, const store_type &) { return false; }
+	void combine(store_type &, store_type &&) {}
+	memory_size_type combine_sorted(store_type *, memory_size_type n) { return n; }
 };
 
 } // namespace bits
@@ -145,8 +304,40 @@ private:
 /// of a single run, we are in "report internal" mode, meaning we do not write
 /// anything to disk. This causes phase 2 to be a no-op and phase 3 to be a
 /// simple array traversal.
+///
+/// If a combine function is given, items that compare equal are combined into
+/// one when a run is formed and at every merge level, so only one item per
+/// distinct key is reported. While combining keeps the run buffer less than
+/// half full, run formation continues in the same buffer instead of writing a
+/// run to disk.
+///
+/// If a limit is set with set_limit(), only the given number of smallest
+/// items are reported (a partial sort). When the limit is at most half the run
+/// length, no runs are written to disk. Otherwise, every written run
+/// contributes samples to an upper bound on the limit'th smallest item, and
+/// pushed items above this threshold are discarded right away.
+///
+/// Run formation detects input that is already sorted: A full run buffer
+/// whose items were pushed in order is not sorted again, and a sorted run
+/// buffer whose smallest item is no less than the last item written is
+/// appended to the previous run instead of starting a new one. Thus sorted
+/// input, or input consisting of a few sorted segments, results in a single
+/// or a few runs that need little or no merging. The number of times this
+/// happens is reported by get_sort_presorted_runs() and
+/// get_sort_extended_runs() in tpie/stats.h.
+///
+/// If a checkpoint path is given with set_checkpoint(), the sorter keeps its
+/// run files on disk and writes a manifest to that path whenever a run has
+/// been written in phase 1, when phase 1 ends, and whenever a merge level has
+/// been completed in phase 2. The manifest is written once, and each
+/// checkpoint after that only appends the runs written since the previous
+/// one. If the process dies before all items are
+/// pulled, a new merge_sorter of the same type may resume() from the
+/// manifest instead of starting over. When the last item has been pulled,
+/// the manifest and the run files are deleted.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, bool UseProgress, typename pred_t = std::less<T>, typename store_t=default_store>
+template <typename T, bool UseProgress, typename pred_t = std::less<T>, typename store_t=default_store,
+		  typename combine_t = bits::no_combine>
 class merge_sorter {
 private:
 	typedef typename store_t::template element_type<T>::type TT;
@@ -163,7 +354,13 @@ public:
 
 	static const memory_size_type maximumFanout = 250; // arbitrary. TODO: run experiments to find threshold
 
-	inline merge_sorter(pred_t pred = pred_t(), store_t store = store_t())
+	/** Maximal number of samples kept to compute the threshold when a limit is set. */
+	static const memory_size_type maximumLimitSamples = 1024;
+
+	/** Runs reserved for the runs written between two checkpoints. */
+	static const memory_size_type checkpointRunsReserved = 4;
+
+	inline merge_sorter(pred_t pred = pred_t(), store_t store = store_t(), combine_t combine = combine_t())
 		: m_bucketPtr(new memory_bucket())
  		, m_bucket(memory_bucket_ref(m_bucketPtr.get()))
 		, m_state(stParameters)
@@ -171,7 +368,12 @@ public:
 		, m_parametersSet(false)
 		, m_store(store.template get_specific<element_type>())
 		, m_merger(pred, m_store, m_bucket)
+		, m_combiner(pred, combine, m_store)
 		, m_currentRunItems(m_bucket)
+		, m_checkpointRuns(allocator<bits::run_extent>(m_bucket))
+		, m_checkpointSaved(false)
+		, m_limit(std::numeric_limits<stream_size_type>::max())
+		, m_limitSamples(0, binary_argument_swap<pred_t>(pred), m_bucket)
 		, pred(pred)
 		, m_evacuated(false)
 		, m_finalMergeInitialized(false)
@@ -239,6 +441,99 @@ public:
 		maybe_calculate_parameters();
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Only report the `limit` smallest items.
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_limit(stream_size_type limit) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		m_limit = limit;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Keep the run files and write a manifest to the given path as the
+	/// sort progresses, such that the sort can be resumed by another process.
+	/// See the class documentation.
+	///////////////////////////////////////////////////////////////////////////
+	inline void set_checkpoint(const std::string & manifestPath) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		m_checkpointPath = manifestPath;
+		m_checkpointRuns.reserve(checkpointRunsReserved);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Resume a sort from the manifest written by a merge_sorter of the
+	/// same type given the same checkpoint path. Call this instead of begin().
+	///
+	/// If the manifest was written in phase 1, the sorter is in phase 1 and
+	/// resumed_run_formation() returns true; the caller must skip the first
+	/// resumed_item_count() input items, push the rest and call end().
+	/// Otherwise, the sorter is ready for calc().
+	/// \returns False if there is no manifest at the given path.
+	///////////////////////////////////////////////////////////////////////////
+	inline bool resume(const std::string & manifestPath) {
+		tp_assert(m_state == stParameters, "Merge sorting already begun");
+		bits::sort_manifest m;
+		if (!m.load(manifestPath)) return false;
+		if (m.itemSize != sizeof(element_type))
+			throw exception("Sort checkpoint has the wrong item size");
+		if (m.runFiles.size() != m.params.fanout*2)
+			throw exception("Sort checkpoint has the wrong number of run files");
+		log_debug() << "Resume merge sort from " << m.runs.size() << " runs in merge level "
+			<< m.mergeLevel << std::endl;
+
+		p = m.params;
+		m_parametersSet = true;
+		m_limit = m.limit;
+		m_itemCount = m.itemCount;
+		m_pushCount = m.pushCount;
+		m_runFiles.resize(p.fanout*2);
+		for (memory_size_type i = 0; i < m_runFiles.size(); ++i)
+			m_runFiles[i].set_path(m.runFiles[i], true);
+
+		m_runPositions.open(m.mergeLevel);
+		m_checkpointRuns.clear();
+		for (memory_size_type i = 0; i < m.runs.size(); ++i)
+			close_run_file_write(m.mergeLevel, i, m.runs[i].position, m.runs[i].items);
+		// Rewrite the manifest, which may end with a partly written update.
+		m_checkpointPath = manifestPath;
+		m_checkpointRuns.reserve(checkpointRunsReserved);
+		m.save(m_checkpointPath);
+		m_checkpointSaved = true;
+		m_checkpointLevel = m.mergeLevel;
+		m_checkpointSavedRuns = m.runs.size();
+		m_checkpointSavedPending = false;
+		m_finishedRuns = m.runs.size();
+		m_resumeLevel = m.mergeLevel;
+		m_runPending = false;
+		m_currentRunItemCount = 0;
+		m_currentRunSorted = true;
+
+		if (m.runFormation) {
+			initialize_run_formation();
+			m_state = stRunFormation;
+		} else {
+			m_reportInternal = false;
+			m_itemsPulled = 0;
+			m_state = stMerge;
+		}
+		return true;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Whether resume() left the sorter in phase 1.
+	///////////////////////////////////////////////////////////////////////////
+	inline bool resumed_run_formation() const {
+		return m_state == stRunFormation;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The number of items pushed before the checkpoint that resume()
+	/// read was written.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type resumed_item_count() const {
+		return m_pushCount;
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Initiate phase 1: Formation of input runs.
 	///////////////////////////////////////////////////////////////////////////
@@ -246,36 +541,72 @@ public:
 		tp_assert(m_state == stParameters, "Merge sorting already begun");
 		if (!m_parametersSet) throw merge_sort_not_ready();
 		log_debug() << "Start forming input runs" << std::endl;
-		m_currentRunItems = array<store_type>(0, allocator<store_type>(m_bucket));
-		m_currentRunItems.resize((size_t)p.runLength);
 		m_runFiles.resize(p.fanout*2);
 		m_currentRunItemCount = 0;
+		m_currentRunSorted = true;
 		m_finishedRuns = 0;
+		m_resumeLevel = 0;
+		m_runPending = false;
 		m_state = stRunFormation;
 		m_itemCount = 0;
+		m_pushCount = 0;
+		m_checkpointRuns.clear();
+		m_checkpointSaved = false;
+		initialize_run_formation();
 	}
 
+private:
+	inline void initialize_run_formation() {
+		m_currentRunItems = array<store_type>(0, allocator<store_type>(m_bucket));
+		m_currentRunItems.resize((size_t)p.runLength);
+		// Samples of different runs may be combined into one item, so they do
+		// not bound the m_limit smallest items when combining.
+		if (!m_combiner.enabled && m_limit != std::numeric_limits<stream_size_type>::max()
+			&& m_limit > p.runLength / 2) {
+			// Keep the smallest samples in a heap with the largest on top.
+			// The i'th sample of a run is its (i*m_limitSampleStride)'th item,
+			// so once the heap is full, at least m_limit items are no greater
+			// than the top.
+			m_limitSampleStride = (m_limit + maximumLimitSamples - 1) / maximumLimitSamples;
+			m_limitSamples.resize(static_cast<memory_size_type>((m_limit + m_limitSampleStride - 1) / m_limitSampleStride));
+		}
+	}
+
+public:
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Push item to merge sorter during phase 1.
 	///////////////////////////////////////////////////////////////////////////
 	inline void push(item_type && item) {
 		tp_assert(m_state == stRunFormation, "Wrong phase");
-		if (m_currentRunItemCount >= p.runLength) {
-			sort_current_run();
-			empty_current_run();
-		}
+		if (m_currentRunItemCount >= p.runLength) flush_current_run();
+		++m_pushCount;
 		m_currentRunItems[m_currentRunItemCount] = m_store.outer_to_store(std::move(item));
+		if (above_limit_threshold(m_currentRunItems[m_currentRunItemCount])) {
+			discard_items(m_currentRunItemCount, m_currentRunItemCount+1);
+			return;
+		}
+		if (m_currentRunSorted && m_currentRunItemCount > 0
+			&& bits::store_pred<pred_t, specific_store_t>(pred)(m_currentRunItems[m_currentRunItemCount],
+																m_currentRunItems[m_currentRunItemCount-1]))
+			m_currentRunSorted = false;
 		++m_currentRunItemCount;
 		++m_itemCount;
 	}
 	
 	inline void push(const item_type & item) {
 		tp_assert(m_state == stRunFormation, "Wrong phase");
-		if (m_currentRunItemCount >= p.runLength) {
-			sort_current_run();
-			empty_current_run();
-		}
+		if (m_currentRunItemCount >= p.runLength) flush_current_run();
+		++m_pushCount;
 		m_currentRunItems[m_currentRunItemCount] = m_store.outer_to_store(item);
+		if (above_limit_threshold(m_currentRunItems[m_currentRunItemCount])) {
+			discard_items(m_currentRunItemCount, m_currentRunItemCount+1);
+			return;
+		}
+		if (m_currentRunSorted && m_currentRunItemCount > 0
+			&& bits::store_pred<pred_t, specific_store_t>(pred)(m_currentRunItems[m_currentRunItemCount],
+																m_currentRunItems[m_currentRunItemCount-1]))
+			m_currentRunSorted = false;
 		++m_currentRunItemCount;
 		++m_itemCount;
 	}
@@ -318,10 +649,14 @@ public:
 
 		} else {
 			m_reportInternal = false;
+			m_itemsPulled = 0;
 			empty_current_run();
+			finish_pending_run();
 			m_currentRunItems.resize(0);
+			if (!m_checkpointPath.empty()) write_checkpoint(false, 0);
 			log_debug() << "Got " << m_finishedRuns << " runs. External reporting mode." << std::endl;
 		}
+		m_limitSamples.resize(0);
 		m_state = stMerge;
 	}
 
@@ -348,6 +683,7 @@ public:
 			m_reportInternal = false;
 			memory_size_type runCount = (m_currentRunItemCount > 0) ? 1 : 0;
 			empty_current_run();
+			finish_pending_run();
 			m_currentRunItems.resize(0);
 			initialize_final_merger(0, runCount);
 		} else if (m_state == stMerge) {
@@ -375,22 +711,156 @@ private:
 	///////////////////////////////////////////////////////////////////////////
 
 	inline void sort_current_run() {
-		parallel_sort(m_currentRunItems.begin(), m_currentRunItems.begin()+m_currentRunItemCount, 
-					  bits::store_pred<pred_t, specific_store_t>(pred));
+		typedef typename array<store_type>::iterator it_t;
+		it_t begin = m_currentRunItems.begin();
+		bits::store_pred<pred_t, specific_store_t> store_pred(pred);
+		if (m_currentRunSorted) {
+			// The items were pushed in sorted order.
+		} else if (!m_combiner.enabled && m_limit < m_currentRunItemCount) {
+			// Only the m_limit smallest items can be reported.
+			memory_size_type limit = static_cast<memory_size_type>(m_limit);
+			std::nth_element(begin, begin+limit, begin+m_currentRunItemCount, store_pred);
+			discard_items(limit, m_currentRunItemCount);
+			m_currentRunItemCount = limit;
+			sort_run_items(limit);
+		} else {
+			sort_run_items(m_currentRunItemCount);
+		}
+		m_currentRunSorted = true;
+		m_currentRunItemCount = m_combiner.combine_sorted(m_currentRunItems.get(), m_currentRunItemCount);
+		if (m_limit < m_currentRunItemCount) {
+			discard_items(static_cast<memory_size_type>(m_limit), m_currentRunItemCount);
+			m_currentRunItemCount = static_cast<memory_size_type>(m_limit);
+		}
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sort the first n items of the run buffer.
+	///////////////////////////////////////////////////////////////////////////
+	inline void sort_run_items(memory_size_type n) {
+		// Items stored as themselves and ordered by std::less are sorted
+		// through plain pointers, so parallel_sort may use SIMD kernels.
+		typedef std::integral_constant<bool,
+			std::is_same<store_type, element_type>::value
+			&& std::is_same<pred_t, std::less<element_type> >::value> plain_less;
+		sort_run_items(n, plain_less());
+	}
+
+	inline void sort_run_items(memory_size_type n, std::true_type) {
+		parallel_sort(m_currentRunItems.get(), m_currentRunItems.get()+n, std::less<store_type>());
+	}
+
+	inline void sort_run_items(memory_size_type n, std::false_type) {
+		typename array<store_type>::iterator begin = m_currentRunItems.begin();
+		parallel_sort(begin, begin+n, bits::store_pred<pred_t, specific_store_t>(pred));
+	}
+
+	// Called when the run buffer is full.
+	// postcondition: m_currentRunItemCount < p.runLength
+	inline void flush_current_run() {
+		if (m_currentRunSorted) increment_sort_presorted_runs(1);
+		sort_current_run();
+		// If combining or the limit freed up at least half of the buffer,
+		// keep filling it.
+		if (m_currentRunItemCount <= p.runLength / 2) return;
+		add_limit_samples();
+		empty_current_run();
+		if (!m_checkpointPath.empty()) write_checkpoint(true, 0);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Destroy the items in the run buffer in the range [from, to).
+	///////////////////////////////////////////////////////////////////////////
+	inline void discard_items(memory_size_type from, memory_size_type to) {
+		for (memory_size_type i = from; i < to; ++i)
+			m_store.store_to_element(std::move(m_currentRunItems[i]));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return true if the item cannot be among the m_limit smallest
+	/// items according to the samples of the runs written so far.
+	///////////////////////////////////////////////////////////////////////////
+	inline bool above_limit_threshold(const store_type & item) {
+		return m_limitSamples.size() > 0
+			&& m_limitSamples.size() == m_limitSamples.get_array().size()
+			&& pred(m_limitSamples.top(), specific_store_t::store_as_element(item));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sample the sorted run buffer before it is written to disk, and
+	/// drop the items above the new threshold.
+	///////////////////////////////////////////////////////////////////////////
+	inline void add_limit_samples() {
+		memory_size_type capacity = m_limitSamples.get_array().size();
+		if (capacity == 0) return;
+		for (memory_size_type i = m_limitSampleStride; i <= m_currentRunItemCount; i += m_limitSampleStride) {
+			const element_type & x = specific_store_t::store_as_element(m_currentRunItems[i-1]);
+			if (m_limitSamples.size() < capacity) {
+				m_limitSamples.push(x);
+			} else if (pred(x, m_limitSamples.top())) {
+				m_limitSamples.pop_and_push(x);
+			} else {
+				break;
+			}
+		}
+		memory_size_type n = m_currentRunItemCount;
+		while (n > 0 && above_limit_threshold(m_currentRunItems[n-1])) --n;
+		discard_items(n, m_currentRunItemCount);
+		m_currentRunItemCount = n;
+	}
+
+	// Precondition: The run buffer is sorted.
 	// postcondition: m_currentRunItemCount = 0
 	inline void empty_current_run() {
-		if (m_finishedRuns < 10)
-			log_debug() << "Write " << m_currentRunItemCount << " items to run file " << m_finishedRuns << std::endl;
-		else if (m_finishedRuns == 10)
-			log_debug() << "..." << std::endl;
 		file_stream<element_type> fs;
-		open_run_file_write(fs, 0, m_finishedRuns);
+		if (m_runPending && m_currentRunItemCount > 0
+			&& !pred(specific_store_t::store_as_element(m_currentRunItems[0]), m_lastRunItem)) {
+			// The items continue the previous run, so extend that run.
+			if (m_finishedRuns <= 10)
+				log_debug() << "Append " << m_currentRunItemCount << " items to run " << m_finishedRuns-1 << std::endl;
+			memory_size_type idx = run_file_index(0, static_cast<memory_size_type>(m_finishedRuns-1));
+			fs.open(m_runFiles[idx], access_read_write, 0, access_sequential, compression_normal);
+			fs.seek(0, file_stream_base::end);
+			increment_sort_extended_runs(1);
+		} else {
+			finish_pending_run();
+			if (m_finishedRuns < 10)
+				log_debug() << "Write " << m_currentRunItemCount << " items to run file " << m_finishedRuns << std::endl;
+			else if (m_finishedRuns == 10)
+				log_debug() << "..." << std::endl;
+			m_pendingRun.position = open_run_file_write(fs, 0, static_cast<memory_size_type>(m_finishedRuns));
+			m_pendingRun.items = 0;
+			m_runPending = true;
+			++m_finishedRuns;
+		}
+		if (m_currentRunItemCount > 0)
+			m_lastRunItem = specific_store_t::store_as_element(m_currentRunItems[m_currentRunItemCount-1]);
 		for (memory_size_type i = 0; i < m_currentRunItemCount; ++i)
 			fs.write(m_store.store_to_element(std::move(m_currentRunItems[i])));
+		m_pendingRun.items += m_currentRunItemCount;
 		m_currentRunItemCount = 0;
-		++m_finishedRuns;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Record the last run written in phase 1, which may have been
+	/// extended by empty_current_run.
+	///////////////////////////////////////////////////////////////////////////
+	inline void finish_pending_run() {
+		if (!m_runPending) return;
+		close_run_file_write(0, static_cast<memory_size_type>(m_finishedRuns-1),
+							 m_pendingRun.position, m_pendingRun.items);
+		m_runPending = false;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Fetch the next item from m_merger, combining it with any
+	/// following items that compare equal.
+	///////////////////////////////////////////////////////////////////////////
+	inline store_type pull_merged() {
+		store_type el = m_merger.pull();
+		while (m_combiner.enabled && m_merger.can_pull() && m_combiner.equal(el, m_merger.peek()))
+			m_combiner.combine(el, m_merger.pull());
+		return el;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -403,12 +873,12 @@ private:
 
 		// Open files and seek to the first item in the run.
 		array<file_stream<element_type> > in(runCount);
+		array<stream_size_type> runLengths(runCount);
 		for (memory_size_type i = 0; i < runCount; ++i) {
-			open_run_file_read(in[i], mergeLevel, runNumber+i);
+			runLengths[i] = open_run_file_read(in[i], mergeLevel, runNumber+i);
 		}
-		stream_size_type runLength = calculate_run_length(p.runLength, p.fanout, mergeLevel);
 		// Pass file streams with correct stream offsets to the merger
-		m_merger.reset(in, runLength);
+		m_merger.reset(in, runLengths);
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -446,15 +916,15 @@ public:
 		m_runPositions.unevacuate();
 		if (m_finalMergeSpecialRunNumber != std::numeric_limits<memory_size_type>::max()) {
 			array<file_stream<element_type> > in(p.finalFanout);
+			array<stream_size_type> runLengths(p.finalFanout);
 			for (memory_size_type i = 0; i < p.finalFanout-1; ++i) {
-				open_run_file_read(in[i], m_finalMergeLevel, i);
+				runLengths[i] = open_run_file_read(in[i], m_finalMergeLevel, i);
 				log_debug() << "Run " << i << " is at offset " << in[i].offset() << " and has size " << in[i].size() << std::endl;
 			}
-			open_run_file_read(in[p.finalFanout-1], m_finalMergeLevel+1, m_finalMergeSpecialRunNumber);
+			runLengths[p.finalFanout-1] = open_run_file_read(in[p.finalFanout-1], m_finalMergeLevel+1, m_finalMergeSpecialRunNumber);
 			log_debug() << "Special large run is at offset " << in[p.finalFanout-1].offset() << " and has size " << in[p.finalFanout-1].size() << std::endl;
-			stream_size_type runLength = calculate_run_length(p.runLength, p.fanout, m_finalMergeLevel+1);
-			log_debug() << "Run length " << runLength << std::endl;
-			m_merger.reset(in, runLength);
+			log_debug() << "Run length " << runLengths[p.finalFanout-1] << std::endl;
+			m_merger.reset(in, runLengths);
 		} else {
 			initialize_merger(m_finalMergeLevel, 0, m_finalRunCount);
 		}
@@ -462,17 +932,6 @@ public:
 	}
 
 private:
-	///////////////////////////////////////////////////////////////////////////
-	/// initialize_merger helper.
-	///////////////////////////////////////////////////////////////////////////
-	static inline stream_size_type calculate_run_length(stream_size_type initialRunLength, memory_size_type fanout, memory_size_type mergeLevel) {
-		stream_size_type runLength = initialRunLength;
-		for (memory_size_type i = 0; i < mergeLevel; ++i) {
-			runLength *= fanout;
-		}
-		return runLength;
-	}
-
 	///////////////////////////////////////////////////////////////////////////
 	/// Merge the runNumber'th to the (runNumber+runCount)'th in mergeLevel
 	/// into mergeLevel+1.
@@ -483,11 +942,15 @@ private:
 		initialize_merger(mergeLevel, runNumber, runCount);
 		file_stream<element_type> out;
 		memory_size_type nextRunNumber = runNumber/p.fanout;
-		open_run_file_write(out, mergeLevel+1, nextRunNumber);
-		while (m_merger.can_pull()) {
+		stream_position start = open_run_file_write(out, mergeLevel+1, nextRunNumber);
+		stream_size_type items = 0;
+		while (m_merger.can_pull() && items < m_limit) {
 			pi.step();
-			out.write(m_store.store_to_element(m_merger.pull()));
+			out.write(m_store.store_to_element(pull_merged()));
+			++items;
 		}
+		m_merger.reset();
+		close_run_file_write(mergeLevel+1, nextRunNumber, start, items);
 		return nextRunNumber;
 	}
 
@@ -502,8 +965,8 @@ private:
 											  log(static_cast<float>(p.fanout))));
 		pi.init(item_count()*treeHeight);
 
-		memory_size_type mergeLevel = 0;
-		memory_size_type runCount = m_finishedRuns;
+		memory_size_type mergeLevel = m_resumeLevel;
+		memory_size_type runCount = static_cast<memory_size_type>(m_finishedRuns);
 		while (runCount > p.fanout) {
 			log_debug() << "Merge " << runCount << " runs in merge level " << mergeLevel << '\n';
 			m_runPositions.next_level();
@@ -518,9 +981,11 @@ private:
 
 				merge_runs(mergeLevel, i, n, pi);
 				++newRunCount;
+				if (!m_checkpointPath.empty()) write_checkpoint(false, mergeLevel+1, false);
 			}
 			++mergeLevel;
 			runCount = newRunCount;
+			if (!m_checkpointPath.empty()) write_checkpoint(false, mergeLevel);
 		}
 		log_debug() << "Final merge level " << mergeLevel << " has " << runCount << " runs" << std::endl;
 		initialize_final_merger(mergeLevel, runCount);
@@ -539,7 +1004,7 @@ public:
 		if (m_reportInternal) return m_itemsPulled < m_currentRunItemCount;
 		else {
 			if (m_evacuated) reinitialize_final_merger();
-			return m_merger.can_pull();
+			return m_itemsPulled < m_limit && m_merger.can_pull();
 		}
 	}
 
@@ -555,7 +1020,10 @@ public:
 		} else {
 			if (m_evacuated) reinitialize_final_merger();
 			m_runPositions.close();
-			return m_store.store_to_outer(m_merger.pull());
+			store_type el = pull_merged();
+			if (++m_itemsPulled == m_limit) m_merger.reset();
+			if (!m_checkpointPath.empty() && !can_pull()) remove_checkpoint();
+			return m_store.store_to_outer(std::move(el));
 		}
 	}
 
@@ -563,11 +1031,19 @@ public:
 		return m_itemCount;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Upper bound on the number of items reported in phase 3.
+	///////////////////////////////////////////////////////////////////////////
+	inline stream_size_type output_item_count() {
+		return std::min(m_itemCount, m_limit);
+	}
+
 	static memory_size_type memory_usage_phase_1(const sort_parameters & params) {
 		return params.runLength * item_size
 			+ bits::run_positions::memory_usage()
 			+ file_stream<element_type>::memory_usage()
-			+ 2*params.fanout*sizeof(temp_file);
+			+ 2*params.fanout*sizeof(temp_file)
+			+ checkpointRunsReserved*sizeof(bits::run_extent); // m_checkpointRuns
 	}
 
 	static memory_size_type minimum_memory_phase_1() {
@@ -663,7 +1139,8 @@ private:
 		// Fanout: unbounded
 
 		memory_size_type streamMemory = file_stream<element_type>::memory_usage();
-		memory_size_type tempFileMemory = 2*p.fanout*sizeof(temp_file);
+		memory_size_type tempFileMemory = 2*p.fanout*sizeof(temp_file)
+			+ checkpointRunsReserved*sizeof(bits::run_extent); // and m_checkpointRuns
 
 		log_debug() << "Phase 1: " << p.memoryPhase1 << " b available memory; " << streamMemory << " b for a single stream; " << tempFileMemory << " b for temp_files\n";
 		memory_size_type min_m1 = 128*1024 / item_size + bits::run_positions::memory_usage() + streamMemory + tempFileMemory;
@@ -731,7 +1208,8 @@ private:
 		return merger<specific_store_t, pred_t>::memory_usage(fanout) // accounts for the `fanout' open streams
 			+ bits::run_positions::memory_usage()
 			+ file_stream<element_type>::memory_usage() // output stream
-			+ 2*sizeof(temp_file); // merge_sorter::m_runFiles
+			+ 2*sizeof(temp_file) // merge_sorter::m_runFiles
+			+ checkpointRunsReserved*sizeof(bits::run_extent); // m_checkpointRuns
 	}
 
 public:
@@ -784,26 +1262,104 @@ private:
 
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Open a new run file and seek to the end.
+	/// \returns The position where the run starts.
 	///////////////////////////////////////////////////////////////////////////
-	void open_run_file_write(file_stream<element_type> & fs, memory_size_type mergeLevel, memory_size_type runNumber) {
+	stream_position open_run_file_write(file_stream<element_type> & fs, memory_size_type mergeLevel, memory_size_type runNumber) {
 		// see run_file_index comment about runNumber
 
 		memory_size_type idx = run_file_index(mergeLevel, runNumber);
-		if (runNumber < p.fanout) m_runFiles[idx].free();
+		bool fresh = runNumber < p.fanout;
+		// The checkpoint manifest refers to the run files by path,
+		// so reuse the file instead of replacing it.
+		if (fresh && m_checkpointPath.empty()) m_runFiles[idx].free();
 		fs.open(m_runFiles[idx], access_read_write, 0, access_sequential, compression_normal);
+		if (fresh && !m_checkpointPath.empty()) fs.truncate(0);
 		fs.seek(0, file_stream_base::end);
-		m_runPositions.set_position(mergeLevel, runNumber, fs.get_position());
+		return fs.get_position();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Record the position and length of a run that has been written.
+	///////////////////////////////////////////////////////////////////////////
+	void close_run_file_write(memory_size_type mergeLevel, memory_size_type runNumber, stream_position start, stream_size_type items) {
+		bits::run_extent e;
+		e.position = start;
+		e.items = items;
+		m_runPositions.set_position(mergeLevel, runNumber, e);
+		if (!m_checkpointPath.empty()) m_checkpointRuns.push_back(e);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Add the runs written since the last checkpoint to the manifest.
+	/// complete is true when all runs in the given merge level have been
+	/// written, and the sort can be resumed from that level.
+	///
+	/// The first checkpoint saves the manifest, and later ones append to it.
+	///////////////////////////////////////////////////////////////////////////
+	void write_checkpoint(bool runFormation, memory_size_type mergeLevel, bool complete = true) {
+		bits::sort_manifest m;
+		m.runFormation = runFormation;
+		m.itemSize = sizeof(element_type);
+		m.params = p;
+		m.itemCount = m_itemCount;
+		m.pushCount = m_pushCount;
+		m.limit = m_limit;
+		m.mergeLevel = mergeLevel;
+		if (m_runPending) m_checkpointRuns.push_back(m_pendingRun);
+
+		if (!m_checkpointSaved) {
+			tp_assert(mergeLevel == 0 && complete, "The first checkpoint is not in run formation");
+			for (memory_size_type i = 0; i < m_runFiles.size(); ++i) {
+				m_runFiles[i].set_persistent(true);
+				m.runFiles.push_back(m_runFiles[i].path());
+			}
+			m.runs.assign(m_checkpointRuns.begin(), m_checkpointRuns.end());
+			m.save(m_checkpointPath);
+			m_checkpointSaved = true;
+			m_checkpointLevel = mergeLevel;
+			m_checkpointSavedRuns = 0;
+			m_checkpointSavedPending = false;
+		} else {
+			if (mergeLevel != m_checkpointLevel) {
+				m_checkpointLevel = mergeLevel;
+				m_checkpointSavedRuns = 0;
+				m_checkpointSavedPending = false;
+			}
+			// A run that was pending in the last checkpoint is written again.
+			memory_size_type first = m_checkpointSavedRuns - (m_checkpointSavedPending ? 1 : 0);
+			m.append(m_checkpointPath, first, m_checkpointRuns.data(), m_checkpointRuns.size(), complete);
+			m_checkpointSavedRuns = first;
+		}
+		m_checkpointSavedRuns += m_checkpointRuns.size();
+		m_checkpointSavedPending = m_runPending;
+		m_checkpointRuns.clear();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Delete the manifest and let the run files be deleted when they
+	/// are no longer used.
+	///////////////////////////////////////////////////////////////////////////
+	void remove_checkpoint() {
+		for (memory_size_type i = 0; i < m_runFiles.size(); ++i)
+			m_runFiles[i].set_persistent(false);
+		bits::sort_manifest::remove(m_checkpointPath);
+		m_checkpointPath.clear();
+		m_checkpointRuns.clear();
+		m_checkpointSaved = false;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Open an existing run file and seek to the correct offset.
+	/// \returns The number of items in the run.
 	///////////////////////////////////////////////////////////////////////////
-	void open_run_file_read(file_stream<element_type> & fs, memory_size_type mergeLevel, memory_size_type runNumber) {
+	stream_size_type open_run_file_read(file_stream<element_type> & fs, memory_size_type mergeLevel, memory_size_type runNumber) {
 		// see run_file_index comment about runNumber
 
 		memory_size_type idx = run_file_index(mergeLevel, runNumber);
 		fs.open(m_runFiles[idx], access_read, 0, access_sequential, compression_normal);
-		fs.set_position(m_runPositions.get_position(mergeLevel, runNumber));
+		bits::run_extent e = m_runPositions.get_position(mergeLevel, runNumber);
+		fs.set_position(e.position);
+		return e.items;
 	}
 
 	enum state_type {
@@ -826,13 +1382,16 @@ private:
 
 	specific_store_t m_store;
 	merger<specific_store_t, pred_t> m_merger;
+	bits::sort_combiner<specific_store_t, pred_t, combine_t> m_combiner;
 
 	bits::run_positions m_runPositions;
 
 	// Number of runs already written to disk.
+	// When resumed from a checkpoint, the number of runs in m_resumeLevel.
 	// On 32-bit systems, we could in principle support more than 2^32 finished runs,
 	// but keeping this as a memory_size_type is nicer when doing the actual merges.
 	stream_size_type m_finishedRuns;
+	memory_size_type m_resumeLevel;
 
 	// current run buffer. size 0 before begin(), size runLength after begin().
 	array<store_type> m_currentRunItems;
@@ -841,14 +1400,47 @@ private:
 	// Used to index into m_currentRunItems, so memory_size_type.
 	memory_size_type m_currentRunItemCount;
 
+	// Whether the items in the current run buffer are in sorted order.
+	bool m_currentRunSorted;
+
+	// Whether the last run written in phase 1 may still be extended,
+	// in which case its position is not yet stored in m_runPositions.
+	bool m_runPending;
+	bits::run_extent m_pendingRun;
+	// If m_runPending: The last item of the last run.
+	element_type m_lastRunItem;
+
 	bool m_reportInternal;
 
-	// When doing internal reporting: the number of items already reported
-	// Used in comparison with m_currentRunItemCount
-	memory_size_type m_itemsPulled;
+	// The number of items already reported.
+	// When doing internal reporting: Used in comparison with m_currentRunItemCount
+	stream_size_type m_itemsPulled;
 
 	stream_size_type m_itemCount;
 
+	// Number of items pushed, including discarded items.
+	stream_size_type m_pushCount;
+
+	// Manifest path given to set_checkpoint(), or empty.
+	std::string m_checkpointPath;
+	// If checkpointing: The runs written since the last checkpoint.
+	// This is at most a few runs, since each checkpoint clears it.
+	std::vector<bits::run_extent, allocator<bits::run_extent> > m_checkpointRuns;
+	// Whether the manifest has been saved, so checkpoints append to it.
+	bool m_checkpointSaved;
+	// If m_checkpointSaved: The merge level of the last checkpoint and the
+	// number of runs of that level in the manifest, the last of which was
+	// pending if m_checkpointSavedPending.
+	memory_size_type m_checkpointLevel;
+	memory_size_type m_checkpointSavedRuns;
+	bool m_checkpointSavedPending;
+
+	// Maximum number of items to report; see set_limit().
+	stream_size_type m_limit;
+	// Samples of the written runs; see begin().
+	internal_priority_queue<element_type, binary_argument_swap<pred_t> > m_limitSamples;
+	stream_size_type m_limitSampleStride;
+
 	pred_t pred;
 	bool m_evacuated;
 	bool m_finalMergeInitialized;
@@ -859,6 +1451,20 @@ private:
 	tpie::pipelining::node * m_owning_node;
 };
 
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Selects the sorter implementation used by the pipelining sort nodes
+/// for the given item type, predicate, store and combine function.
+/// See tpie/pipelining/tag_sorter.h for a specialization.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t, typename store_t, typename combine_t>
+struct sorter_selector {
+	typedef merge_sorter<T, true, pred_t, store_t, combine_t> type;
+};
+
+} // namespace bits
+
 } // namespace tpie
 
 #endif // __TPIE_PIPELINING_MERGE_SORTER_H__
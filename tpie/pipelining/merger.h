@@ -25,8 +25,20 @@
 #include <tpie/file_stream.h>
 #include <tpie/tpie_assert.h>
 #include <tpie/pipelining/store.h>
+#include <tpie/simd_sort.h>
 namespace tpie {
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Merges sorted runs from file streams.
+///
+/// Usually, the next item of each run is kept in a heap. Primitive items
+/// stored as themselves and ordered by std::less are merged a block at a
+/// time with SIMD instructions when available: a block of up to block_items
+/// items is buffered from each run. All buffered items that are no greater
+/// than the smallest last buffered item of a run are then merged by a tree of
+/// two-way SIMD merges, and the blocks emptied are refilled.
+/// Other items, including key/value pairs, are merged by the heap.
+///////////////////////////////////////////////////////////////////////////////
 template <typename specific_store_t, typename pred_t>
 class merger {
 private:
@@ -34,27 +46,61 @@ private:
 	typedef typename specific_store_t::element_type element_type;
 
 	typedef bits::store_pred<pred_t, specific_store_t> store_pred_t;
+
+	typedef std::integral_constant<bool,
+		std::is_same<store_type, element_type>::value
+		&& std::is_same<pred_t, std::less<element_type> >::value
+		&& bits::simd_sort_traits<element_type>::supported> block_merge_t;
 public:
+	/** Items buffered from each run when merging blocks. */
+	static const memory_size_type block_items = 1024;
+
 	inline merger(pred_t pred, specific_store_t store,
 				  memory_bucket_ref bucket = memory_bucket_ref())
 		: pq(0, predwrap(store_pred_t(pred)), bucket)
 		, in(bucket)
-		, itemsRead(bucket)
-		, m_store(store) {
+		, itemsLeft(bucket)
+		, m_store(store)
+		, m_blockMerge(false)
+		, m_blocks(bucket)
+		, m_blockBegin(bucket)
+		, m_blockEnd(bucket)
+		, m_runs(bucket)
+		, m_runSizes(bucket)
+		, m_merged(bucket)
+		, m_mergeBuffer(bucket)
+		, m_output(0)
+		, m_outputBegin(0)
+		, m_outputEnd(0) {
 	}
 
-	inline bool can_pull() {
+	inline bool can_pull() const {
+		if (m_blockMerge) return m_outputBegin != m_outputEnd;
 		return !pq.empty();
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Peek at the next item to be returned by pull().
+	///////////////////////////////////////////////////////////////////////////
+	inline const store_type & peek() const {
+		tp_assert(can_pull(), "peek() while !can_pull()");
+		if (m_blockMerge) return m_output[m_outputBegin];
+		return pq.top().first;
+	}
+
  	inline store_type pull() {
 		tp_assert(can_pull(), "pull() while !can_pull()");
+		if (m_blockMerge) {
+			store_type el = std::move(m_output[m_outputBegin++]);
+			if (m_outputBegin == m_outputEnd) merge_blocks(block_merge_t());
+			return el;
+		}
 		store_type el = std::move(pq.top().first);
 		size_t i = pq.top().second;
-		if (in[i].can_read() && itemsRead[i] < runLength) {
+		if (in[i].can_read() && itemsLeft[i] > 0) {
 			pq.pop_and_push(
 				std::make_pair(m_store.element_to_store(in[i].read()), i));
-			++itemsRead[i];
+			--itemsLeft[i];
 		} else {
 			pq.pop();
 		}
@@ -67,7 +113,17 @@ public:
 	inline void reset() {
 		in.resize(0);
 		pq.resize(0);
-		itemsRead.resize(0);
+		itemsLeft.resize(0);
+		m_blockMerge = false;
+		m_blocks.resize(0);
+		m_blockBegin.resize(0);
+		m_blockEnd.resize(0);
+		m_runs.resize(0);
+		m_runSizes.resize(0);
+		m_merged.resize(0);
+		m_mergeBuffer.resize(0);
+		m_output = 0;
+		m_outputBegin = m_outputEnd = 0;
 	}
 
 	// Initialize merger with given sorted input runs. Each file stream is
@@ -76,17 +132,23 @@ public:
 	// occurs earlier).
 	// Precondition: !can_pull()
 	void reset(array<file_stream<element_type> > & inputs, stream_size_type runLength) {
-		this->runLength = runLength;
 		tp_assert(pq.empty(), "Reset before we are done");
 		in.swap(inputs);
-		pq.resize(in.size());
-		for (size_t i = 0; i < in.size(); ++i) {
-			pq.unsafe_push(
-				std::make_pair(
-					m_store.element_to_store(in[i].read()), i));
-		}
-		pq.make_safe();
-		itemsRead.resize(in.size(), 1);
+		itemsLeft.resize(in.size(), runLength);
+		fill(block_merge_t());
+	}
+
+	// Initialize merger with given sorted input runs of individual lengths.
+	// runLengths[i] items are read from inputs[i] (unless end of stream
+	// occurs earlier). Empty runs are skipped.
+	// Precondition: !can_pull()
+	void reset(array<file_stream<element_type> > & inputs, const array<stream_size_type> & runLengths) {
+		tp_assert(pq.empty(), "Reset before we are done");
+		tp_assert(inputs.size() == runLengths.size(), "Wrong number of run lengths");
+		in.swap(inputs);
+		itemsLeft.resize(in.size());
+		std::copy(runLengths.begin(), runLengths.end(), itemsLeft.begin());
+		fill(block_merge_t());
 	}
 
 	inline static memory_size_type memory_usage(memory_size_type fanout) {
@@ -97,8 +159,9 @@ public:
 			+ static_cast<memory_size_type>(array<file_stream<element_type> >::memory_usage(fanout)) // in
 			- fanout*sizeof(file_stream<element_type>) // in file_streams
 			+ fanout*file_stream<element_type>::memory_usage() // in file_streams
-			- sizeof(array<size_t>) // itemsRead
-			+ static_cast<memory_size_type>(array<size_t>::memory_usage(fanout)) // itemsRead
+			- sizeof(array<stream_size_type>) // itemsLeft
+			+ static_cast<memory_size_type>(array<stream_size_type>::memory_usage(fanout)) // itemsLeft
+			+ block_memory_usage(fanout, block_merge_t())
 			;
 	}
 
@@ -123,11 +186,126 @@ public:
 	};
 
 private:
+	// memory_usage() helper: The heap memory used when merging blocks.
+	static memory_size_type block_memory_usage(memory_size_type fanout, std::true_type) {
+		return 3 * fanout * block_items * sizeof(store_type) // m_blocks, m_merged, m_mergeBuffer
+			+ 2 * fanout * sizeof(memory_size_type) // m_blockBegin, m_blockEnd
+			+ fanout * sizeof(const store_type *) // m_runs
+			+ fanout * sizeof(size_t); // m_runSizes
+	}
+
+	static memory_size_type block_memory_usage(memory_size_type, std::false_type) {
+		return 0;
+	}
+
+	// reset() helper: Merge blocks if the items have SIMD kernels.
+	void fill(std::true_type) {
+		if (!bits::simd_sort_traits<element_type>::available()) {
+			fill_heap();
+			return;
+		}
+		m_blockMerge = true;
+		memory_size_type k = in.size();
+		m_blocks.resize(k * block_items);
+		m_blockBegin.resize(k);
+		m_blockEnd.resize(k);
+		m_runs.resize(k);
+		m_runSizes.resize(k);
+		m_merged.resize(k * block_items);
+		m_mergeBuffer.resize(k * block_items);
+		for (memory_size_type i = 0; i < k; ++i) fill_block(i);
+		merge_blocks(std::true_type());
+	}
+
+	void fill(std::false_type) {
+		fill_heap();
+	}
+
+	// Read up to block_items items of run i into its block.
+	void fill_block(memory_size_type i) {
+		store_type * block = m_blocks.get() + i * block_items;
+		memory_size_type n = 0;
+		while (n < block_items && itemsLeft[i] > 0 && in[i].can_read()) {
+			block[n++] = m_store.element_to_store(in[i].read());
+			--itemsLeft[i];
+		}
+		m_blockBegin[i] = 0;
+		m_blockEnd[i] = n;
+	}
+
+	// Merge the buffered items that can be output before reading more,
+	// and refill the blocks that become empty.
+	void merge_blocks(std::true_type) {
+		memory_size_type k = in.size();
+		const store_type * bound = 0;
+		for (memory_size_type i = 0; i < k; ++i) {
+			if (m_blockBegin[i] == m_blockEnd[i]) continue;
+			const store_type * last = m_blocks.get() + i * block_items + m_blockEnd[i] - 1;
+			if (bound == 0 || *last < *bound) bound = last;
+		}
+		if (bound == 0) {
+			reset();
+			return;
+		}
+		const store_type least = *bound;
+		size_t runs = 0;
+		for (memory_size_type i = 0; i < k; ++i) {
+			const store_type * block = m_blocks.get() + i * block_items;
+			const store_type * end = std::upper_bound(block + m_blockBegin[i], block + m_blockEnd[i], least);
+			if (end == block + m_blockBegin[i]) continue;
+			m_runs[runs] = block + m_blockBegin[i];
+			m_runSizes[runs] = static_cast<size_t>(end - m_runs[runs]);
+			m_blockBegin[i] = static_cast<memory_size_type>(end - block);
+			++runs;
+		}
+		memory_size_type n = 0;
+		for (size_t i = 0; i < runs; ++i) n += m_runSizes[i];
+		m_output = bits::simd_merge_tree(m_runs.get(), m_runSizes.get(), runs,
+										 m_merged.get(), m_mergeBuffer.get());
+		m_outputBegin = 0;
+		m_outputEnd = n;
+		for (memory_size_type i = 0; i < k; ++i)
+			if (m_blockBegin[i] == m_blockEnd[i]) fill_block(i);
+	}
+
+	void merge_blocks(std::false_type) {
+	}
+
+	// reset() helper: Push the first item of each non-empty run.
+	void fill_heap() {
+		pq.resize(in.size());
+		for (size_t i = 0; i < in.size(); ++i) {
+			if (itemsLeft[i] == 0 || !in[i].can_read()) continue;
+			pq.unsafe_push(
+				std::make_pair(
+					m_store.element_to_store(in[i].read()), i));
+			--itemsLeft[i];
+		}
+		pq.make_safe();
+	}
+
 	internal_priority_queue<std::pair<store_type, size_t>, predwrap> pq;
 	array<file_stream<element_type> > in;
-	array<stream_size_type> itemsRead;
-	stream_size_type runLength;
+	array<stream_size_type> itemsLeft;
 	specific_store_t m_store;
+
+	// Whether the runs are merged a block at a time.
+	bool m_blockMerge;
+	// The buffered items of run i are m_blocks[i*block_items + m_blockBegin[i]]
+	// up to m_blocks[i*block_items + m_blockEnd[i]].
+	array<store_type> m_blocks;
+	array<memory_size_type> m_blockBegin;
+	array<memory_size_type> m_blockEnd;
+	// Scratch space for the merge tree.
+	array<const store_type *> m_runs;
+	array<size_t> m_runSizes;
+	array<store_type> m_merged;
+	array<store_type> m_mergeBuffer;
+	// The merged items not yet pulled are m_output[m_outputBegin] up to
+	// m_output[m_outputEnd], where m_output is m_merged or m_mergeBuffer.
+	store_type * m_output;
+	memory_size_type m_outputBegin;
+	memory_size_type m_outputEnd;
 };
 
 } // namespace tpie
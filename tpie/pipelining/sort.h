@@ -24,6 +24,7 @@
 #include <tpie/pipelining/pipe_base.h>
 #include <tpie/pipelining/factory_base.h>
 #include <tpie/pipelining/merge_sorter.h>
+#include <tpie/pipelining/tag_sorter.h>
 #include <tpie/parallel_sort.h>
 #include <tpie/file_stream.h>
 #include <tpie/tempname.h>
@@ -37,13 +38,13 @@ namespace pipelining {
 
 namespace bits {
 
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class sort_calc_t;
 
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class sort_input_t;
 
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class sort_output_base : public node {
 	// node has virtual dtor
 public:
@@ -51,7 +52,7 @@ public:
 	typedef T item_type;
 	
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<T, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<T, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 
@@ -60,8 +61,8 @@ public:
 	}
 
 	virtual void propagate() override {
-		set_steps(m_sorter->item_count());
-		forward("items", static_cast<stream_size_type>(m_sorter->item_count()));
+		set_steps(m_sorter->output_item_count());
+		forward("items", static_cast<stream_size_type>(m_sorter->output_item_count()));
 		memory_size_type memory_usage = m_sorter->actual_memory_phase_3();
 		set_minimum_memory(memory_usage);
 		set_maximum_memory(memory_usage);
@@ -95,19 +96,19 @@ protected:
 /// \tparam pred_t   The less-than predicate.
 /// \tparam dest_t   Destination node type.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
-class sort_pull_output_t : public sort_output_base<T, pred_t, store_t> {
+template <typename T, typename pred_t, typename store_t, typename combine_t>
+class sort_pull_output_t : public sort_output_base<T, pred_t, store_t, combine_t> {
 public:
 	/** Type of items sorted. */
 	typedef T item_type;
 	
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<item_type, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<item_type, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 
 	sort_pull_output_t(sorterptr sorter)
-		: sort_output_base<T, pred_t, store_t>(sorter)
+		: sort_output_base<T, pred_t, store_t, combine_t>(sorter)
 	{
 		this->set_minimum_memory(sorter_t::minimum_memory_phase_3());
 		this->set_maximum_memory(sorter_t::maximum_memory_phase_3());
@@ -150,16 +151,16 @@ public:
 /// \tparam pred_t   The less-than predicate.
 /// \tparam dest_t   Destination node type.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename pred_t, typename dest_t, typename store_t>
-class sort_output_t : public sort_output_base<typename push_type<dest_t>::type, pred_t, store_t> {
+template <typename pred_t, typename dest_t, typename store_t, typename combine_t>
+class sort_output_t : public sort_output_base<typename push_type<dest_t>::type, pred_t, store_t, combine_t> {
 public:
 	/** Type of items sorted. */
 	typedef typename push_type<dest_t>::type item_type;
 	
 	/** Base class */
-	typedef sort_output_base<item_type, pred_t, store_t> p_t;
+	typedef sort_output_base<item_type, pred_t, store_t, combine_t> p_t;
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<item_type, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<item_type, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 
@@ -200,18 +201,18 @@ private:
 /// \tparam T        The type of items sorted
 /// \tparam pred_t   The less-than predicate
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class sort_calc_t : public node {
 public:
 	/** Type of items sorted. */
 	typedef T item_type;
 	
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<item_type, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<item_type, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 
-	typedef sort_output_base<T, pred_t, store_t> Output;
+	typedef sort_output_base<T, pred_t, store_t, combine_t> Output;
 
 	sort_calc_t(sort_calc_t && other) = default;
 
@@ -293,18 +294,18 @@ private:
 /// \tparam T        The type of items sorted
 /// \tparam pred_t   The less-than predicate
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class sort_input_t : public node {
 public:
 	/** Type of items sorted. */
 	typedef T item_type;
 	
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<item_type, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<item_type, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 
-	inline sort_input_t(sort_calc_t<T, pred_t, store_t> dest)
+	inline sort_input_t(sort_calc_t<T, pred_t, store_t, combine_t> dest)
 		: m_sorter(dest.get_sorter())
 		, m_propagate_called(false)
 		, dest(std::move(dest))
@@ -362,10 +363,10 @@ private:
 	sorterptr m_sorter;
 	std::weak_ptr<typename sorterptr::element_type> m_weakSorter;
 	bool m_propagate_called;
-	sort_calc_t<T, pred_t, store_t> dest;
+	sort_calc_t<T, pred_t, store_t, combine_t> dest;
 };
 
-template <typename child_t, typename store_t>
+template <typename child_t, typename store_t, typename combine_t = tpie::bits::no_combine>
 class sort_factory_base : public factory_base {
 	const child_t & self() const { return *static_cast<const child_t *>(this); }
 public:
@@ -377,7 +378,7 @@ public:
 		typedef typename store_t::template element_type<item_type>::type element_type;
 	public:
 		typedef typename child_t::template predicate<element_type>::type pred_type;
-		typedef sort_input_t<item_type, pred_type, store_t> type;
+		typedef sort_input_t<item_type, pred_type, store_t, combine_t> type;
 	};
 	
 	template <typename dest_t>
@@ -386,24 +387,40 @@ public:
 		typedef typename store_t::template element_type<item_type>::type element_type;
 		typedef typename constructed<dest_t>::pred_type pred_type;
 
-		sort_output_t<pred_type, dest_t, store_t> output(
+		typedef typename tpie::bits::sorter_selector<item_type, pred_type, store_t, combine_t>::type sorter_t;
+		std::shared_ptr<sorter_t> sorter = std::make_shared<sorter_t>(
+			self().template get_pred<element_type>(), 
+			m_store,
+			m_combine);
+		self().configure_sorter(*sorter);
+		sort_output_t<pred_type, dest_t, store_t, combine_t> output(
 			std::move(dest),
-			std::make_shared<merge_sorter<item_type, true, pred_type, store_t> > (
-				self().template get_pred<element_type>(), 
-				m_store));
+			sorter);
 		this->init_sub_node(output);
-		sort_calc_t<item_type, pred_type, store_t> calc(std::move(output));
+		sort_calc_t<item_type, pred_type, store_t, combine_t> calc(std::move(output));
 		this->init_sub_node(calc);
-		sort_input_t<item_type, pred_type, store_t> input(std::move(calc));
+		sort_input_t<item_type, pred_type, store_t, combine_t> input(std::move(calc));
 		this->init_sub_node(input);
 
 		return std::move(input);
 	}
 
-	sort_factory_base(store_t store): m_store(store) {}
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Hook for subclasses to set up the sorter before it is used.
+	///////////////////////////////////////////////////////////////////////////
+	template <typename sorter_t>
+	void configure_sorter(sorter_t &) const {
+		// Do nothing.
+	}
+
+	sort_factory_base(store_t store, combine_t combine = combine_t())
+		: m_store(store)
+		, m_combine(combine)
+	{
+	}
 private:
 	store_t m_store;
-
+	combine_t m_combine;
 };
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -455,6 +472,94 @@ private:
 	pred_t pred;
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort factory using the given predicate as comparator and combining
+/// items that compare equal using the given combine function.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t, typename combine_t>
+class combine_sort_factory : public sort_factory_base<combine_sort_factory<pred_t, combine_t>, default_store, combine_t> {
+public:
+	template <typename Dummy>
+	class predicate {
+	public:
+		typedef pred_t type;
+	};
+
+	combine_sort_factory(const pred_t & p, const combine_t & combine)
+		: sort_factory_base<combine_sort_factory<pred_t, combine_t>, default_store, combine_t>(default_store(), combine)
+		, pred(p)
+	{
+	}
+
+	template <typename T>
+	pred_t get_pred() const {
+		return pred;
+	}
+private:
+	pred_t pred;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort factory using the given predicate as comparator that only
+/// reports the k smallest items.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+class partial_sort_factory : public sort_factory_base<partial_sort_factory<pred_t>, default_store> {
+public:
+	template <typename Dummy>
+	class predicate {
+	public:
+		typedef pred_t type;
+	};
+
+	partial_sort_factory(stream_size_type k, const pred_t & p)
+		: sort_factory_base<partial_sort_factory<pred_t>, default_store>(default_store())
+		, k(k)
+		, pred(p)
+	{
+	}
+
+	template <typename T>
+	pred_t get_pred() const {
+		return pred;
+	}
+
+	template <typename sorter_t>
+	void configure_sorter(sorter_t & sorter) const {
+		sorter.set_limit(k);
+	}
+private:
+	stream_size_type k;
+	pred_t pred;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort factory comparing the keys extracted by key_extract_t with the
+/// given predicate, using tag sort for large items.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t, typename key_extract_t>
+class tag_sort_factory : public sort_factory_base<tag_sort_factory<pred_t, key_extract_t>, tag_store<key_extract_t> > {
+public:
+	template <typename Dummy>
+	class predicate {
+	public:
+		typedef tpie::bits::key_pred<pred_t, key_extract_t> type;
+	};
+
+	tag_sort_factory(const key_extract_t & keyExtract, const pred_t & p)
+		: sort_factory_base<tag_sort_factory<pred_t, key_extract_t>, tag_store<key_extract_t> >(tag_store<key_extract_t>())
+		, pred(p, keyExtract)
+	{
+	}
+
+	template <typename T>
+	tpie::bits::key_pred<pred_t, key_extract_t> get_pred() const {
+		return pred;
+	}
+private:
+	tpie::bits::key_pred<pred_t, key_extract_t> pred;
+};
+
 } // namespace bits
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -498,7 +603,56 @@ sort(const pred_t & p, store_t store) {
 	return pipe_middle<fact>(fact(p, store)).name("Sort");
 }
 
-template <typename T, typename pred_t=std::less<T>, typename store_t=default_store>
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining sorter using the given predicate that combines items
+/// comparing equal into one using the given associative combine function.
+///
+/// combine is called as `combine(a, b)` on two items that compare equal and
+/// must return their combination. Combining is done both while forming runs
+/// and at every merge level, so when there are many duplicates, much less
+/// data is written to disk than with sort() followed by a reduction.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t, typename combine_t>
+inline pipe_middle<bits::combine_sort_factory<pred_t, combine_t> >
+sort_combine(const pred_t & p, const combine_t & combine) {
+	typedef bits::combine_sort_factory<pred_t, combine_t> fact;
+	return pipe_middle<fact>(fact(p, combine)).name("Sort");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining node that outputs the k smallest items according to the
+/// given predicate in sorted order.
+///
+/// When k items fit within the memory of the run formation phase, the input is
+/// reduced in memory and nothing is written to disk. Otherwise, the sorted runs
+/// written to disk are sampled to bound the k'th smallest item, and items above
+/// the bound are discarded without being written.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t>
+inline pipe_middle<bits::partial_sort_factory<pred_t> >
+partial_sort(stream_size_type k, const pred_t & p) {
+	typedef bits::partial_sort_factory<pred_t> fact;
+	return pipe_middle<fact>(fact(k, p)).name("Partial sort");
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Pipelining sorter ordering items by the keys returned by keyExtract
+/// according to the given key predicate.
+///
+/// When items are large compared to their keys (see tag_sorter), only
+/// (key, offset) tags are sorted, and the items are written to disk once and
+/// gathered in sorted order after the tags have been merged. Otherwise, this
+/// is equivalent to sort() with a predicate comparing keys.
+///////////////////////////////////////////////////////////////////////////////
+template <typename key_extract_t, typename pred_t>
+inline pipe_middle<bits::tag_sort_factory<pred_t, key_extract_t> >
+tag_sort(const key_extract_t & keyExtract, const pred_t & p) {
+	typedef bits::tag_sort_factory<pred_t, key_extract_t> fact;
+	return pipe_middle<fact>(fact(keyExtract, p)).name("Tag sort");
+}
+
+template <typename T, typename pred_t=std::less<T>, typename store_t=default_store,
+		  typename combine_t=tpie::bits::no_combine>
 class passive_sorter;
 
 namespace bits {
@@ -506,13 +660,13 @@ namespace bits {
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Factory for the passive sorter input node.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class passive_sorter_factory_input : public factory_base {
 public:
-	typedef sort_calc_t<T, pred_t, store_t> calc_t;
-	typedef sort_input_t<T, pred_t, store_t> input_t;
+	typedef sort_calc_t<T, pred_t, store_t, combine_t> calc_t;
+	typedef sort_input_t<T, pred_t, store_t, combine_t> input_t;
 	typedef input_t constructed_type;
-	typedef merge_sorter<T, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<T, pred_t, store_t, combine_t>::type sorter_t;
 	typedef typename sorter_t::ptr sorterptr;
 	
 	passive_sorter_factory_input(sorterptr sorter, node_token calc_token)
@@ -535,12 +689,12 @@ private:
 ///////////////////////////////////////////////////////////////////////////////
 /// \brief Factory for the passive sorter output node.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class passive_sorter_factory_output : public factory_base {
 public:
-	typedef merge_sorter<T, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<T, pred_t, store_t, combine_t>::type sorter_t;
 	typedef typename sorter_t::ptr sorterptr;
-	typedef bits::sort_pull_output_t<T, pred_t, store_t> constructed_type;
+	typedef bits::sort_pull_output_t<T, pred_t, store_t, combine_t> constructed_type;
 	
 	passive_sorter_factory_output(sorterptr sorter, node_token calc_token)
 		: m_sorter(sorter)
@@ -567,22 +721,25 @@ private:
 /// \tparam T The type of item to sort
 /// \tparam pred_t The predicate (e.g. std::less<T>) indicating the predicate
 /// on which to order an item before another.
+/// \tparam combine_t Optional combine function applied to items that compare
+/// equal; see sort_combine.
 ///////////////////////////////////////////////////////////////////////////////
-template <typename T, typename pred_t, typename store_t>
+template <typename T, typename pred_t, typename store_t, typename combine_t>
 class passive_sorter {
 public:
 	/** Type of items sorted. */
 	typedef T item_type;
 	/** Type of the merge sort implementation used. */
-	typedef merge_sorter<item_type, true, pred_t, store_t> sorter_t;
+	typedef typename tpie::bits::sorter_selector<item_type, pred_t, store_t, combine_t>::type sorter_t;
 	/** Smart pointer to sorter_t. */
 	typedef typename sorter_t::ptr sorterptr;
 	/** Type of pipe sorter output. */
-	typedef bits::sort_pull_output_t<item_type, pred_t, store_t> output_t;
+	typedef bits::sort_pull_output_t<item_type, pred_t, store_t, combine_t> output_t;
 
 	passive_sorter(pred_t pred = pred_t(),
-				   store_t store = store_t())
-		: m_sorterInput(std::make_shared<sorter_t>(pred, store))
+				   store_t store = store_t(),
+				   combine_t combine = combine_t())
+		: m_sorterInput(std::make_shared<sorter_t>(pred, store, combine))
 		, m_sorterOutput(m_sorterInput)
 		{}
 
@@ -591,15 +748,15 @@ public:
 	passive_sorter(passive_sorter && ) = default;
 	passive_sorter & operator=(passive_sorter &&) = default;
 	
-	typedef pipe_end<bits::passive_sorter_factory_input<item_type, pred_t, store_t> > input_pipe_t;
-	typedef pullpipe_begin<bits::passive_sorter_factory_output<item_type, pred_t, store_t> > output_pipe_t;
+	typedef pipe_end<bits::passive_sorter_factory_input<item_type, pred_t, store_t, combine_t> > input_pipe_t;
+	typedef pullpipe_begin<bits::passive_sorter_factory_output<item_type, pred_t, store_t, combine_t> > output_pipe_t;
 	
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Get the input push node.
 	///////////////////////////////////////////////////////////////////////////
 	input_pipe_t input() {
 		tp_assert(m_sorterInput, "Output called more then once");
-		auto ret = bits::passive_sorter_factory_input<item_type, pred_t, store_t>(
+		auto ret = bits::passive_sorter_factory_input<item_type, pred_t, store_t, combine_t>(
 			std::move(m_sorterInput), m_calc_token);
 		return std::move(ret);
 	}
@@ -609,7 +766,7 @@ public:
 	///////////////////////////////////////////////////////////////////////////
 	output_pipe_t output() {
 		tp_assert(m_sorterOutput, "Output called more then once");
-		auto ret =  bits::passive_sorter_factory_output<item_type, pred_t, store_t>(
+		auto ret =  bits::passive_sorter_factory_output<item_type, pred_t, store_t, combine_t>(
 			std::move(m_sorterOutput), m_calc_token);
 		return std::move(ret);
 	}
@@ -229,6 +229,47 @@ struct dynamic_store {
 };
 
 
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Predicate comparing items by the keys extracted with key_extract_t
+/// using the key predicate pred_t.
+///////////////////////////////////////////////////////////////////////////////
+template <typename pred_t, typename key_extract_t>
+class key_pred {
+public:
+	key_pred(pred_t pred, key_extract_t keyExtract)
+		: pred(pred), keyExtract(keyExtract) {}
+
+	template <typename T>
+	bool operator()(const T & lhs, const T & rhs) const {
+		return pred(keyExtract(lhs), keyExtract(rhs));
+	}
+
+	template <typename key_t>
+	bool compare_keys(const key_t & lhs, const key_t & rhs) const {
+		return pred(lhs, rhs);
+	}
+
+	const key_extract_t & key_extract() const {return keyExtract;}
+private:
+	pred_t pred;
+	key_extract_t keyExtract;
+};
+
+} //namespace bits
+
+/**
+ * \brief Tag sort store strategy.
+ *
+ * We sort elements of type T, compared by a bits::key_pred on the keys returned
+ * by key_extract_t. If sizeof(T) is large compared to the key, the sort nodes
+ * sort (key, offset) tags and gather the elements afterwards; see tag_sorter.
+ * Otherwise, the elements are stored as in plain_store.
+ */
+template <typename key_extract_t>
+struct tag_store: public plain_store {};
+
 typedef dynamic_store default_store;
 
 } //namespace tpie
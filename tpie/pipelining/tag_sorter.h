@@ -0,0 +1,342 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+#ifndef __TPIE_PIPELINING_TAG_SORTER_H__
+#define __TPIE_PIPELINING_TAG_SORTER_H__
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file tag_sorter.h  Sorting large items by (key, offset) tags.
+///////////////////////////////////////////////////////////////////////////////
+
+#include <tpie/pipelining/merge_sorter.h>
+#include <tpie/pipelining/store.h>
+#include <tpie/file_stream.h>
+#include <tpie/tempname.h>
+#include <type_traits>
+
+namespace tpie {
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Key of an item along with the offset of the item in the record file
+/// of a tag_sorter.
+///////////////////////////////////////////////////////////////////////////////
+template <typename key_t>
+struct sort_tag {
+	key_t key;
+	stream_size_type offset;
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Predicate on sort_tag comparing the keys.
+///////////////////////////////////////////////////////////////////////////////
+template <typename key_pred_t, typename key_t>
+class sort_tag_pred {
+public:
+	sort_tag_pred(key_pred_t pred): pred(pred) {}
+
+	bool operator()(const sort_tag<key_t> & lhs, const sort_tag<key_t> & rhs) const {
+		return pred.compare_keys(lhs.key, rhs.key);
+	}
+private:
+	key_pred_t pred;
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sorter for items that are large compared to their keys.
+///
+/// Instead of moving whole items through run formation and every merge level,
+/// the items are written once to a record file in the order they are pushed,
+/// and only (key, offset) tags are sorted by a merge_sorter. The sorted items
+/// are then gathered in batches: The tags of a batch are ordered by offset,
+/// the items are read in a single forward pass over the record file, and the
+/// batch is reported in key order. The batch size is determined by the memory
+/// of the final phase.
+///
+/// The interface matches merge_sorter, so the pipelining sort nodes can use
+/// either. bits::sorter_selector picks tag_sorter for tag_store when sizeof(T)
+/// is at least tagSortFactor times the size of a tag.
+///
+/// \tparam pred_t  A bits::key_pred comparing keys of items.
+/// \tparam key_extract_t  Functor returning the key of an item.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, bool UseProgress, typename pred_t, typename key_extract_t>
+class tag_sorter {
+public:
+	typedef std::shared_ptr<tag_sorter> ptr;
+	typedef progress_types<UseProgress> Progress;
+	typedef T item_type;
+	typedef typename std::decay<typename std::result_of<key_extract_t(const T &)>::type>::type key_type;
+	typedef bits::sort_tag<key_type> tag_type;
+	typedef bits::sort_tag_pred<pred_t, key_type> tag_pred_type;
+	typedef merge_sorter<tag_type, UseProgress, tag_pred_type, plain_store> sorter_t;
+
+	/** Minimal ratio between the item size and the tag size for which tag_store uses tag sort. */
+	static const memory_size_type tagSortFactor = 4;
+
+	/** Maximal memory of the gather buffer in the final phase. */
+	static const memory_size_type maxBatchMemory = 128 * 1024 * 1024;
+
+	tag_sorter(pred_t pred = pred_t(),
+			   tag_store<key_extract_t> = tag_store<key_extract_t>(),
+			   bits::no_combine = bits::no_combine())
+		: m_sorter(tag_pred_type(pred))
+		, m_keyExtract(pred.key_extract())
+		, m_batchSize(0)
+		, m_batchItems(0)
+		, m_batchPulled(0)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set run length and fanout of the tag sort and the gather batch
+	/// size manually (for testing purposes).
+	///////////////////////////////////////////////////////////////////////////
+	void set_parameters(memory_size_type runLength, memory_size_type fanout) {
+		m_sorter.set_parameters(runLength, fanout);
+		m_batchSize = runLength;
+	}
+
+	void set_available_memory(memory_size_type m) {
+		set_available_memory(m, m, m);
+	}
+
+	void set_available_memory(memory_size_type m1, memory_size_type m2, memory_size_type m3) {
+		m_sorter.set_available_memory(phase_1_sorter_memory(m1), m2, phase_3_sorter_memory(m3));
+		m_batchSize = batch_size(m3);
+	}
+
+	void set_phase_1_memory(memory_size_type m1) {
+		m_sorter.set_phase_1_memory(phase_1_sorter_memory(m1));
+	}
+
+	void set_phase_2_memory(memory_size_type m2) {
+		m_sorter.set_phase_2_memory(m2);
+	}
+
+	void set_phase_3_memory(memory_size_type m3) {
+		m_sorter.set_phase_3_memory(phase_3_sorter_memory(m3));
+		m_batchSize = batch_size(m3);
+	}
+
+	void set_items(stream_size_type n) {
+		m_sorter.set_items(n);
+	}
+
+	void set_owner(tpie::pipelining::node * n) {
+		m_sorter.set_owner(n);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Initiate phase 1: Writing items and forming runs of tags.
+	///////////////////////////////////////////////////////////////////////////
+	void begin() {
+		m_records.open(m_recordsFile, access_read_write, 0, access_sequential, compression_none);
+		m_sorter.begin();
+	}
+
+	void push(const item_type & item) {
+		tag_type tag;
+		tag.key = m_keyExtract(item);
+		tag.offset = m_records.offset();
+		m_records.write(item);
+		m_sorter.push(tag);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief End phase 1.
+	///////////////////////////////////////////////////////////////////////////
+	void end() {
+		m_records.close();
+		m_sorter.end();
+		cap_batch_size();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Perform phase 2: Merging runs of tags.
+	///////////////////////////////////////////////////////////////////////////
+	void calc(typename Progress::base & pi) {
+		m_sorter.calc(pi);
+	}
+
+	void evacuate() {
+		m_sorter.evacuate();
+	}
+
+	void evacuate_before_merging() {
+		m_sorter.evacuate_before_merging();
+	}
+
+	void evacuate_before_reporting() {
+		m_sorter.evacuate_before_reporting();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief In phase 3, return true if there are more items.
+	///////////////////////////////////////////////////////////////////////////
+	bool can_pull() {
+		return m_batchPulled < m_batchItems || m_sorter.can_pull();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief In phase 3, fetch the next item.
+	///////////////////////////////////////////////////////////////////////////
+	item_type pull() {
+		if (m_batchPulled == m_batchItems) gather_batch();
+		item_type item = std::move(m_batch[m_batchPulled++]);
+		if (m_batchPulled == m_batchItems && !m_sorter.can_pull()) {
+			m_batch.resize(0);
+			m_batchOffsets.resize(0);
+			m_records.close();
+		}
+		return item;
+	}
+
+	stream_size_type item_count() {
+		return m_sorter.item_count();
+	}
+
+	stream_size_type output_item_count() {
+		return m_sorter.output_item_count();
+	}
+
+	static memory_size_type minimum_memory_phase_1() {
+		return sorter_t::minimum_memory_phase_1() + file_stream<item_type>::memory_usage();
+	}
+
+	static memory_size_type minimum_memory_phase_2() {
+		return sorter_t::minimum_memory_phase_2();
+	}
+
+	static memory_size_type minimum_memory_phase_3() {
+		return sorter_t::minimum_memory_phase_3() + file_stream<item_type>::memory_usage()
+			+ batch_item_memory();
+	}
+
+	static memory_size_type maximum_memory_phase_3() {
+		// Additional memory gives larger gather batches, up to maxBatchMemory.
+		return sorter_t::maximum_memory_phase_3() + file_stream<item_type>::memory_usage()
+			+ maxBatchMemory;
+	}
+
+	memory_size_type actual_memory_phase_3() {
+		return m_sorter.actual_memory_phase_3() + file_stream<item_type>::memory_usage()
+			+ m_batchSize * batch_item_memory();
+	}
+
+private:
+	typedef std::pair<stream_size_type, memory_size_type> batch_offset_type;
+
+	static memory_size_type batch_item_memory() {
+		return sizeof(item_type) + sizeof(batch_offset_type);
+	}
+
+	static memory_size_type phase_1_sorter_memory(memory_size_type m1) {
+		memory_size_type streamMemory = file_stream<item_type>::memory_usage();
+		return (m1 > streamMemory) ? m1 - streamMemory : 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Split the phase 3 memory between the final merge of the tags
+	/// and the gather buffer.
+	///////////////////////////////////////////////////////////////////////////
+	static memory_size_type phase_3_sorter_memory(memory_size_type m3) {
+		return std::max(sorter_t::minimum_memory_phase_3(),
+						std::min(sorter_t::maximum_memory_phase_3(), m3 / 2));
+	}
+
+	static memory_size_type batch_size(memory_size_type m3) {
+		memory_size_type used = phase_3_sorter_memory(m3) + file_stream<item_type>::memory_usage();
+		if (m3 < used + batch_item_memory()) return 1;
+		memory_size_type limit = maxBatchMemory;
+		return std::min(m3 - used, limit) / batch_item_memory();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief A batch never needs to hold more than all the items.
+	///////////////////////////////////////////////////////////////////////////
+	void cap_batch_size() {
+		stream_size_type items = std::max<stream_size_type>(m_sorter.item_count(), 1);
+		if (m_batchSize > items) m_batchSize = static_cast<memory_size_type>(items);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Pull the next batch of tags and read the corresponding items
+	/// from the record file in offset order.
+	///////////////////////////////////////////////////////////////////////////
+	void gather_batch() {
+		if (m_batch.size() == 0) {
+			cap_batch_size();
+			m_batch.resize(m_batchSize);
+			m_batchOffsets.resize(m_batchSize);
+			m_records.open(m_recordsFile, access_read, 0, access_random, compression_none);
+		}
+		m_batchItems = 0;
+		m_batchPulled = 0;
+		while (m_batchItems < m_batchSize && m_sorter.can_pull()) {
+			m_batchOffsets[m_batchItems] = batch_offset_type(m_sorter.pull().offset, m_batchItems);
+			++m_batchItems;
+		}
+		std::sort(m_batchOffsets.begin(), m_batchOffsets.begin() + m_batchItems);
+		for (memory_size_type i = 0; i < m_batchItems; ++i) {
+			if (m_records.offset() != m_batchOffsets[i].first)
+				m_records.seek(m_batchOffsets[i].first);
+			m_batch[m_batchOffsets[i].second] = m_records.read();
+		}
+	}
+
+	sorter_t m_sorter;
+	key_extract_t m_keyExtract;
+
+	temp_file m_recordsFile;
+	file_stream<item_type> m_records;
+
+	// Maximum number of items gathered at a time.
+	memory_size_type m_batchSize;
+	// The items of the current batch in key order.
+	array<item_type> m_batch;
+	// Offsets and batch indices of the current batch in offset order.
+	array<batch_offset_type> m_batchOffsets;
+	memory_size_type m_batchItems;
+	memory_size_type m_batchPulled;
+};
+
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Use tag_sorter for tag_store when items are large compared to
+/// their tags, and merge_sorter otherwise.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t, typename key_extract_t>
+struct sorter_selector<T, key_pred<pred_t, key_extract_t>, tag_store<key_extract_t>, no_combine> {
+	typedef tag_sorter<T, true, key_pred<pred_t, key_extract_t>, key_extract_t> tag_sorter_t;
+	typedef merge_sorter<T, true, key_pred<pred_t, key_extract_t>, tag_store<key_extract_t>, no_combine> merge_sorter_t;
+	typedef typename std::conditional<
+		(sizeof(T) >= tag_sorter_t::tagSortFactor * sizeof(typename tag_sorter_t::tag_type)),
+		tag_sorter_t, merge_sorter_t>::type type;
+};
+
+} // namespace bits
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_TAG_SORTER_H__
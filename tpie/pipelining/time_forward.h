@@ -0,0 +1,232 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file time_forward.h  Time-forward processing of topologically ordered
+/// vertices.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_PIPELINING_TIME_FORWARD_H__
+#define __TPIE_PIPELINING_TIME_FORWARD_H__
+
+#include <tpie/pipelining/node.h>
+#include <tpie/pipelining/pipe_base.h>
+#include <tpie/pipelining/factory_helpers.h>
+#include <tpie/priority_queue.h>
+#include <tpie/array.h>
+#include <tpie/array_view.h>
+#include <tpie/memory.h>
+#include <type_traits>
+
+namespace tpie {
+
+namespace pipelining {
+
+namespace bits {
+
+template <typename key_t, typename message_t>
+struct time_forward_item {
+	key_t target;
+	message_t message;
+};
+
+template <typename key_t, typename message_t>
+struct time_forward_item_less {
+	bool operator()(const time_forward_item<key_t, message_t> & a,
+					const time_forward_item<key_t, message_t> & b) const {
+		return std::less<key_t>()(a.target, b.target);
+	}
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sends messages to vertices that come later in a time_forward node.
+///////////////////////////////////////////////////////////////////////////////
+template <typename key_t, typename message_t>
+class time_forward_sender {
+public:
+	typedef bits::time_forward_item<key_t, message_t> item_type;
+	typedef tpie::priority_queue<item_type, bits::time_forward_item_less<key_t, message_t> > queue_type;
+
+	time_forward_sender(queue_type & queue, const key_t & current)
+		: m_queue(queue)
+		, m_current(current)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Send a message to the vertex with the given key, which must be
+	/// greater than the key of the current vertex.
+	///////////////////////////////////////////////////////////////////////////
+	void send(const key_t & target, const message_t & message) {
+		if (!std::less<key_t>()(m_current, target))
+			throw exception("time_forward: Message sent to a vertex that is not in the future");
+		item_type item;
+		item.target = target;
+		item.message = message;
+		m_queue.push(item);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief The key of the vertex being processed.
+	///////////////////////////////////////////////////////////////////////////
+	const key_t & current() const {
+		return m_current;
+	}
+
+private:
+	queue_type & m_queue;
+	const key_t & m_current;
+};
+
+namespace bits {
+
+template <typename vertex_t, typename message_t, typename K, typename F>
+class time_forward_t {
+public:
+	typedef typename std::decay<typename std::result_of<K(const vertex_t &)>::type>::type key_t;
+
+	template <typename dest_t>
+	class type : public node {
+	public:
+		typedef vertex_t item_type;
+		typedef time_forward_sender<key_t, message_t> sender_type;
+
+		type(dest_t dest, const K & key, const F & functor, memory_size_type maxMessages)
+			: m_key(key)
+			, m_functor(functor)
+			, m_current()
+			, m_started(false)
+			, m_maxMessages(maxMessages)
+			, dest(std::move(dest))
+		{
+			add_push_destination(this->dest);
+			set_name("Time forward", PRIORITY_SIGNIFICANT);
+			set_minimum_memory(minimum_memory(maxMessages));
+			set_memory_fraction(1.0);
+			set_plot_options(PLOT_BUFFERED);
+		}
+
+		void begin() override {
+			// The inbox is allocated up front; the queue gets the rest.
+			m_inbox.resize(m_maxMessages);
+			memory_size_type inboxMemory = array<message_t>::memory_usage(m_maxMessages);
+			memory_size_type available = get_available_memory();
+			memory_size_type queueMemory = available > inboxMemory ? available - inboxMemory : 0;
+			m_queue.reset(tpie_new<typename sender_type::queue_type>(queueMemory));
+			m_sender.reset(tpie_new<sender_type>(*m_queue, m_current));
+			m_started = false;
+		}
+
+		void push(const item_type & vertex) {
+			key_t key = m_key(vertex);
+			if (m_started && std::less<key_t>()(key, m_current))
+				throw exception("time_forward: Vertices are not in increasing order");
+			m_current = key;
+			m_started = true;
+
+			// Messages to keys that did not occur in the input are dropped.
+			memory_size_type messages = 0;
+			while (!m_queue->empty()) {
+				const time_forward_item<key_t, message_t> & top = m_queue->top();
+				if (std::less<key_t>()(key, top.target)) break;
+				if (!std::less<key_t>()(top.target, key)) {
+					if (messages == m_maxMessages)
+						throw exception("time_forward: More messages to a vertex than the inbox holds");
+					m_inbox[messages++] = top.message;
+				}
+				m_queue->pop();
+			}
+
+			array_view<const message_t> inbox(m_inbox.get(), messages);
+			dest.push(m_functor(vertex, inbox, *m_sender));
+		}
+
+		void end() override {
+			m_sender.reset();
+			m_queue.reset();
+			m_inbox.resize(0);
+		}
+
+		///////////////////////////////////////////////////////////////////////
+		/// \brief Memory needed by the priority queue for a typical block
+		/// size and by an inbox of the given number of messages.
+		///////////////////////////////////////////////////////////////////////
+		static memory_size_type minimum_memory(memory_size_type maxMessages) {
+			return 32 * file_stream<time_forward_item<key_t, message_t> >::memory_usage(0.0625)
+				+ array<message_t>::memory_usage(maxMessages);
+		}
+
+	private:
+		K m_key;
+		F m_functor;
+		key_t m_current;
+		bool m_started;
+		memory_size_type m_maxMessages;
+		tpie::unique_ptr<typename sender_type::queue_type> m_queue;
+		tpie::unique_ptr<sender_type> m_sender;
+		array<message_t> m_inbox;
+		dest_t dest;
+	};
+};
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Time-forward processing of a directed acyclic graph.
+///
+/// The input is a stream of vertices ordered by their key. Each vertex is
+/// passed to the functor together with the messages that earlier vertices
+/// sent to its key, and the functor returns the item to push to the next
+/// node. The messages are kept in an external priority_queue keyed by the
+/// target, which is given the memory that the pipeline assigns to this node.
+///
+/// The functor is called as
+/// \code
+/// f(const vertex_t & vertex,
+///   tpie::array_view<const message_t> messages,
+///   tpie::pipelining::time_forward_sender<key_t, message_t> & sender)
+/// \endcode
+/// and may call sender.send(target, message) for targets greater than the
+/// key of the vertex. The messages to a vertex are delivered in no
+/// particular order, and messages to keys that do not occur in the input
+/// are dropped.
+///
+/// The messages to a vertex are collected in an inbox of at most maxMessages
+/// messages, which is allocated from the memory of the node. A vertex
+/// receiving more messages throws an exception.
+///
+/// \tparam vertex_t The type of vertices.
+/// \tparam message_t The type of messages.
+/// \param key Functor returning the key of a vertex.
+/// \param functor The functor processing a vertex.
+/// \param maxMessages The most messages delivered to one vertex.
+///////////////////////////////////////////////////////////////////////////////
+template <typename vertex_t, typename message_t, typename K, typename F>
+pipe_middle<tempfactory<bits::time_forward_t<vertex_t, message_t, K, F>, K, F, memory_size_type> >
+time_forward(const K & key, const F & functor, memory_size_type maxMessages = 1024) {
+	return tempfactory<bits::time_forward_t<vertex_t, message_t, K, F>, K, F, memory_size_type>(key, functor, maxMessages);
+}
+
+} // namespace pipelining
+
+} // namespace tpie
+
+#endif // __TPIE_PIPELINING_TIME_FORWARD_H__
@@ -0,0 +1,138 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file pq_loser_tree.h Priority queue loser tree.
+/// \sa \ref priority_queue.h
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TPIE_PQ_LOSER_TREE_H_
+#define _TPIE_PQ_LOSER_TREE_H_
+
+#include <tpie/array.h>
+#include <cassert>
+
+namespace tpie {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \class pq_loser_tree
+///
+/// \brief Loser tree for k-way merging of sorted runs.
+///
+/// Has the same interface as pq_merge_heap, but replacing the top element
+/// only compares it against the losers on the path from its leaf to the
+/// root, which is a single pass over log k entries laid out contiguously in
+/// memory. All elements must be pushed before the first call to top(),
+/// top_run(), pop() or pop_and_push(), and pop_and_push() must be given the
+/// run of the top element.
+///////////////////////////////////////////////////////////////////////////////
+template<typename T, typename Comparator = std::less<T> >
+class pq_loser_tree {
+public:
+	typedef memory_size_type run_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Constructor.
+	///
+	/// \param elements Maximum number of runs.
+	/// \param c Comparator.
+	///////////////////////////////////////////////////////////////////////////
+	pq_loser_tree(memory_size_type elements, Comparator c = Comparator());
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Insert the first element of a run.
+	///
+	/// \param x The item.
+	/// \param run Where it comes from.
+	///////////////////////////////////////////////////////////////////////////
+	void push(const T & x, run_type run);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the top element, whose run is exhausted.
+	///////////////////////////////////////////////////////////////////////////
+	void pop();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Replace the top element by the next element of its run.
+	///
+	/// \param x The item.
+	/// \param run Where it comes from; must be top_run().
+	///////////////////////////////////////////////////////////////////////////
+	void pop_and_push(const T & x, run_type run);
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief See what's on the top of the loser tree.
+	///
+	/// \return Top element.
+	///////////////////////////////////////////////////////////////////////////
+	const T & top();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return top element run number.
+	///
+	/// \return Top element run number.
+	///////////////////////////////////////////////////////////////////////////
+	run_type top_run();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Returns the number of runs that are not exhausted.
+	///
+	/// \return Tree size.
+	///////////////////////////////////////////////////////////////////////////
+	memory_size_type size() const {return m_size;}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return true if all runs are exhausted, otherwise false.
+	///////////////////////////////////////////////////////////////////////////
+	bool empty() const {return m_size == 0;}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove all runs, so that new runs may be pushed.
+	///////////////////////////////////////////////////////////////////////////
+	void clear();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Memory used by a loser tree on the given number of runs.
+	///////////////////////////////////////////////////////////////////////////
+	static memory_size_type memory_usage(memory_size_type elements);
+
+private:
+	static memory_size_type leaf_count(memory_size_type elements);
+	bool beats(memory_size_type a, memory_size_type b) const;
+	memory_size_type build(memory_size_type node);
+	void replay(memory_size_type leaf);
+	void ensure_built();
+
+	Comparator comp_;
+	array<T> m_items;
+	array<run_type> m_runs;
+	array<char> m_live;
+	/** m_tree[0] is the winning leaf, m_tree[n] the losing leaf at node n. */
+	array<memory_size_type> m_tree;
+	memory_size_type m_leaves;
+	memory_size_type m_capacity;
+	memory_size_type m_size;
+	bool m_built;
+};
+
+#include "pq_loser_tree.inl"
+
+} // namespace tpie
+
+#endif // _TPIE_PQ_LOSER_TREE_H_
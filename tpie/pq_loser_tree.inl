@@ -0,0 +1,143 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; c-file-style: "stroustrup"; -*-
+// vi:set ts=4 sts=4 sw=4 noet cino+=(0 :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+template <typename T, typename Comparator>
+pq_loser_tree<T, Comparator>::pq_loser_tree(memory_size_type elements, Comparator c)
+	: comp_(c)
+	, m_items(elements)
+	, m_runs(elements)
+	, m_live(elements)
+	, m_tree(leaf_count(elements))
+	, m_leaves(0)
+	, m_capacity(leaf_count(elements))
+	, m_size(0)
+	, m_built(false)
+{
+}
+
+template <typename T, typename Comparator>
+void pq_loser_tree<T, Comparator>::push(const T & x, run_type run) {
+	assert(m_leaves < m_items.size());
+	m_items[m_leaves] = x;
+	m_runs[m_leaves] = run;
+	m_live[m_leaves] = true;
+	++m_leaves;
+	++m_size;
+	m_built = false;
+}
+
+template <typename T, typename Comparator>
+void pq_loser_tree<T, Comparator>::pop() {
+	ensure_built();
+	assert(m_size > 0);
+	memory_size_type leaf = m_tree[0];
+	m_live[leaf] = false;
+	--m_size;
+	replay(leaf);
+}
+
+template <typename T, typename Comparator>
+void pq_loser_tree<T, Comparator>::pop_and_push(const T & x, run_type run) {
+	ensure_built();
+	assert(m_size > 0);
+	memory_size_type leaf = m_tree[0];
+	assert(m_runs[leaf] == run);
+	m_items[leaf] = x;
+	m_runs[leaf] = run;
+	replay(leaf);
+}
+
+template <typename T, typename Comparator>
+const T & pq_loser_tree<T, Comparator>::top() {
+	ensure_built();
+	assert(m_size > 0);
+	return m_items[m_tree[0]];
+}
+
+template <typename T, typename Comparator>
+typename pq_loser_tree<T, Comparator>::run_type
+pq_loser_tree<T, Comparator>::top_run() {
+	ensure_built();
+	assert(m_size > 0);
+	return m_runs[m_tree[0]];
+}
+
+template <typename T, typename Comparator>
+void pq_loser_tree<T, Comparator>::clear() {
+	m_leaves = 0;
+	m_size = 0;
+	m_built = false;
+}
+
+template <typename T, typename Comparator>
+memory_size_type pq_loser_tree<T, Comparator>::memory_usage(memory_size_type elements) {
+	return sizeof(pq_loser_tree)
+		+ array<T>::memory_usage(elements)
+		+ array<run_type>::memory_usage(elements)
+		+ array<char>::memory_usage(elements)
+		+ array<memory_size_type>::memory_usage(leaf_count(elements));
+}
+
+///////////////////////////////////////
+// Private
+///////////////////////////////////////
+
+template <typename T, typename Comparator>
+memory_size_type pq_loser_tree<T, Comparator>::leaf_count(memory_size_type elements) {
+	memory_size_type n = 1;
+	while (n < elements) n *= 2;
+	return n;
+}
+
+template <typename T, typename Comparator>
+inline bool pq_loser_tree<T, Comparator>::beats(memory_size_type a, memory_size_type b) const {
+	// Leaves beyond m_leaves and exhausted runs lose to everything.
+	if (a >= m_leaves || !m_live[a]) return false;
+	if (b >= m_leaves || !m_live[b]) return true;
+	return !comp_(m_items[b], m_items[a]);
+}
+
+template <typename T, typename Comparator>
+memory_size_type pq_loser_tree<T, Comparator>::build(memory_size_type node) {
+	if (node >= m_capacity) return node - m_capacity;
+	memory_size_type a = build(2*node);
+	memory_size_type b = build(2*node+1);
+	if (beats(a, b)) {
+		m_tree[node] = b;
+		return a;
+	}
+	m_tree[node] = a;
+	return b;
+}
+
+template <typename T, typename Comparator>
+inline void pq_loser_tree<T, Comparator>::replay(memory_size_type leaf) {
+	memory_size_type winner = leaf;
+	for (memory_size_type node = (leaf + m_capacity) / 2; node > 0; node /= 2) {
+		if (beats(m_tree[node], winner)) std::swap(m_tree[node], winner);
+	}
+	m_tree[0] = winner;
+}
+
+template <typename T, typename Comparator>
+inline void pq_loser_tree<T, Comparator>::ensure_built() {
+	if (m_built) return;
+	m_tree[0] = build(1);
+	m_built = true;
+}
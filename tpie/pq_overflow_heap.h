@@ -25,15 +25,39 @@
 #ifndef _TPIE_PQ_OVERFLOW_HEAP_H_
 #define _TPIE_PQ_OVERFLOW_HEAP_H_
 
-#include <tpie/internal_priority_queue.h>
+#include <tpie/array.h>
+#include <tpie/util.h>
+#include <tpie/tpie_log.h>
+#include <tpie/pq_loser_tree.h>
+#include <tpie/parallel_sort.h>
+
+#include <algorithm>
 
 namespace tpie {
 
+namespace bits {
+
+template <typename T, typename Comparator>
+struct pq_dereference_comparator {
+	Comparator c;
+	pq_dereference_comparator(Comparator c = Comparator()): c(c) {}
+	bool operator()(const T * a, const T * b) const {return c(*a, *b);}
+};
+
+} // namespace bits
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \class pq_overflow_heap
 /// \author Lars Hvam Petersen
 ///
-/// \brief Overflow Priority Queue, based on a simple Heap.
+/// \brief Overflow Priority Queue, based on a sequence heap.
+///
+/// Inserted elements go into a small binary heap that fits in cache. When it
+/// is full, it is sorted into a sequence, and the heads of the sequences are
+/// merged by a loser tree. Popping from a sequence leaves a gap at its front;
+/// when the gaps prevent a new sequence from being formed, the sequences are
+/// moved together, unless the gaps are too few to be worth it, in which case
+/// the queue reports that it is full.
 ///////////////////////////////////////////////////////////////////////////////
 template<typename T, typename Comparator = std::less<T> >
 class pq_overflow_heap {
@@ -45,6 +69,15 @@ public:
     ///////////////////////////////////////////////////////////////////////////
     pq_overflow_heap(memory_size_type maxsize, Comparator c=Comparator());
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Constructor.
+    ///
+    /// \param maxsize Maximal size of queue.
+    /// \param c Comparator.
+    /// \param heapSize Maximal size of the insertion heap.
+    ///////////////////////////////////////////////////////////////////////////
+    pq_overflow_heap(memory_size_type maxsize, Comparator c, memory_size_type heapSize);
+
     ///////////////////////////////////////////////////////////////////////////
     /// \brief Insert an element into the priority queue.
     ///
@@ -52,6 +85,14 @@ public:
     ///////////////////////////////////////////////////////////////////////////
     void push(const T& x);
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief Insert the elements [a, b) into the priority queue.
+    ///
+    /// The queue must have room for the elements, that is, size() plus their
+    /// number must not exceed the maximal size.
+    ///////////////////////////////////////////////////////////////////////////
+    void push_batch(const T * a, const T * b);
+
     ///////////////////////////////////////////////////////////////////////////
     /// \brief Remove the top element from the priority queue.
     ///////////////////////////////////////////////////////////////////////////
@@ -86,6 +127,9 @@ public:
     ///////////////////////////////////////////////////////////////////////////
     /// \brief Returns whether the overflow heap is full or not.
     ///
+    /// The overflow heap may be full before size() reaches the maximal size,
+    /// if the gaps left by popping are too few to be worth reclaiming.
+    ///
     /// \return Boolean - full or not.
     ///////////////////////////////////////////////////////////////////////////
     bool full() const;
@@ -99,7 +143,7 @@ public:
     T* sorted_array();
 
     ///////////////////////////////////////////////////////////////////////////
-    /// \brief Return size of sorted array.
+    /// \brief Return size of sorted array, which is size().
     ///
     /// \return Size.
     ///////////////////////////////////////////////////////////////////////////
@@ -110,11 +154,38 @@ public:
     ///////////////////////////////////////////////////////////////////////////
     void sorted_pop();
 
+    ///////////////////////////////////////////////////////////////////////////
+    /// \brief The default maximal size of the insertion heap, chosen such
+    /// that it fits in the L2 cache.
+    ///////////////////////////////////////////////////////////////////////////
+    static memory_size_type default_heap_size();
+
 private:
+	typedef bits::pq_dereference_comparator<T, Comparator> head_comparator;
+
+	T * heap_begin() {return m_items.get() + m_sequenceArea;}
+	memory_size_type heap_capacity() const;
+	void order_heap();
+	void make_room();
+	void seal_heap();
+	void compact();
+	void rebuild_merger();
+	static memory_size_type sequence_limit(memory_size_type maxsize, memory_size_type heapSize);
+
     Comparator comp;
-	internal_priority_queue<T, Comparator> h;
+	binary_argument_swap<Comparator> heap_comp;
+	/** Sequences in [0, m_sequenceArea), then the insertion heap. */
+	array<T> m_items;
+	array<memory_size_type> m_sequenceBegin;
+	array<memory_size_type> m_sequenceEnd;
+	memory_size_type m_sequences;
+	memory_size_type m_sequenceArea;
+	memory_size_type m_heapSize;
+	bool m_heapOrdered;
+	memory_size_type m_heapCapacity;
+	memory_size_type m_size;
+	pq_loser_tree<const T *, head_comparator> m_merger;
     memory_size_type maxsize;
-    //T dummy;
 };
 	
 	template<typename T, typename Comparator>
@@ -19,60 +19,231 @@
 
 
 template<typename T, typename Comparator>
-pq_overflow_heap<T, Comparator>::pq_overflow_heap(memory_size_type m, Comparator c):
-  comp(c), h(m, comp), maxsize(m) {}
+pq_overflow_heap<T, Comparator>::pq_overflow_heap(memory_size_type m, Comparator c)
+	: pq_overflow_heap(m, c, default_heap_size()) {}
+
+template<typename T, typename Comparator>
+pq_overflow_heap<T, Comparator>::pq_overflow_heap(memory_size_type m, Comparator c, memory_size_type heapSize)
+	: comp(c)
+	, heap_comp(c)
+	, m_items(m)
+	, m_sequenceBegin(sequence_limit(m, heapSize))
+	, m_sequenceEnd(sequence_limit(m, heapSize))
+	, m_sequences(0)
+	, m_sequenceArea(0)
+	, m_heapSize(0)
+	, m_heapOrdered(false)
+	, m_heapCapacity(std::max<memory_size_type>(heapSize, 1))
+	, m_size(0)
+	, m_merger(sequence_limit(m, heapSize), head_comparator(c))
+	, maxsize(m)
+{
+}
 
 template<typename T, typename Comparator>
 inline void pq_overflow_heap<T, Comparator>::push(const T& x) {
 #ifndef NDEBUG
-	if(h.size() == maxsize) {
+	if(full()) {
 		TP_LOG_FATAL_ID("pq_overflow_heap: push error");
 		exit(-1);
 	}
 #endif
-	h.push(x);
+	if(m_heapSize == heap_capacity()) make_room();
+	T * h = heap_begin();
+	h[m_heapSize++] = x;
+	if(m_heapOrdered) std::push_heap(h, h + m_heapSize, heap_comp);
+	++m_size;
+}
+
+template<typename T, typename Comparator>
+inline void pq_overflow_heap<T, Comparator>::push_batch(const T * a, const T * b) {
+	assert(m_size + static_cast<memory_size_type>(b - a) <= maxsize);
+	while(a != b) {
+		if(m_heapSize == heap_capacity()) make_room();
+		memory_size_type n = std::min(static_cast<memory_size_type>(b - a),
+									  heap_capacity() - m_heapSize);
+		T * h = heap_begin();
+		if(!m_heapOrdered) {
+			std::copy(a, a + n, h + m_heapSize);
+			m_heapSize += n;
+		} else if(n < m_heapSize) {
+			// Sifting up a few elements is cheaper than rebuilding the heap.
+			for(memory_size_type i = 0; i < n; ++i) {
+				h[m_heapSize++] = a[i];
+				std::push_heap(h, h + m_heapSize, heap_comp);
+			}
+		} else {
+			std::copy(a, a + n, h + m_heapSize);
+			m_heapSize += n;
+			std::make_heap(h, h + m_heapSize, heap_comp);
+		}
+		a += n;
+		m_size += n;
+	}
 }
 
 template<typename T, typename Comparator>
 inline void pq_overflow_heap<T, Comparator>::pop() {
 	assert(!empty());
-	h.pop();
+	order_heap();
+	T * h = heap_begin();
+	if(m_heapSize > 0 && (m_merger.empty() || !comp(*m_merger.top(), h[0]))) {
+		std::pop_heap(h, h + m_heapSize, heap_comp);
+		--m_heapSize;
+	} else {
+		memory_size_type s = m_merger.top_run();
+		if(++m_sequenceBegin[s] == m_sequenceEnd[s])
+			m_merger.pop();
+		else
+			m_merger.pop_and_push(m_items.get() + m_sequenceBegin[s], s);
+	}
+	if(--m_size == 0) sorted_pop();
 }
 
 template<typename T, typename Comparator>
 inline const T& pq_overflow_heap<T, Comparator>::top() {
 	assert(!empty());
-	return h.top();
+	order_heap();
+	T * h = heap_begin();
+	if(m_heapSize > 0 && (m_merger.empty() || !comp(*m_merger.top(), h[0])))
+		return h[0];
+	return *m_merger.top();
 }
 
 template<typename T, typename Comparator>
 inline stream_size_type pq_overflow_heap<T, Comparator>::size() const {
-	return h.size();
+	return m_size;
 }
 
 template<typename T, typename Comparator>
 inline bool pq_overflow_heap<T, Comparator>::full() const {
-	return maxsize == h.size();
+	// Moving the sequences together costs O(maxsize), so only do it when it
+	// reclaims a constant fraction of the space.
+	return m_sequenceArea + m_heapSize == maxsize
+		&& maxsize - m_size < std::max<memory_size_type>(1, maxsize / 4);
 }
 
 template<typename T, typename Comparator>
 inline T* pq_overflow_heap<T, Comparator>::sorted_array() {
-	tpie::array<T> & a = h.get_array();
-	std::sort(a.begin(), a.begin() + h.size(), comp);
-	return a.get();
+	compact();
+	std::sort(m_items.get(), m_items.get() + m_size, comp);
+	return m_items.get();
 }
 
 template<typename T, typename Comparator>
 inline memory_size_type pq_overflow_heap<T, Comparator>::sorted_size() const{
-	return maxsize;
+	return m_size;
 }
 
 template<typename T, typename Comparator>
 inline void pq_overflow_heap<T, Comparator>::sorted_pop() {
-	h.clear();
+	m_sequences = 0;
+	m_sequenceArea = 0;
+	m_heapSize = 0;
+	m_heapOrdered = false;
+	m_size = 0;
+	m_merger.clear();
 }
 
 template<typename T, typename Comparator>
 inline bool pq_overflow_heap<T, Comparator>::empty() const {
-	return h.empty();
-} 
+	return m_size == 0;
+}
+
+template<typename T, typename Comparator>
+memory_size_type pq_overflow_heap<T, Comparator>::default_heap_size() {
+	return std::max<memory_size_type>(64, 128*1024/sizeof(T));
+}
+
+///////////////////////////////////////
+// Private
+///////////////////////////////////////
+
+template<typename T, typename Comparator>
+memory_size_type pq_overflow_heap<T, Comparator>::sequence_limit(memory_size_type m, memory_size_type heapSize) {
+	return 2 * (m / std::max<memory_size_type>(heapSize, 1)) + 2;
+}
+
+// Elements pushed since the insertion heap was last sealed are only ordered as
+// a heap when they are needed by top() or pop(), as sealing sorts them anyway.
+template<typename T, typename Comparator>
+inline void pq_overflow_heap<T, Comparator>::order_heap() {
+	if(m_heapOrdered) return;
+	std::make_heap(heap_begin(), heap_begin() + m_heapSize, heap_comp);
+	m_heapOrdered = true;
+}
+
+template<typename T, typename Comparator>
+inline memory_size_type pq_overflow_heap<T, Comparator>::heap_capacity() const {
+	return std::min(m_heapCapacity, maxsize - m_sequenceArea);
+}
+
+// Called when the insertion heap is at capacity but the queue is not.
+template<typename T, typename Comparator>
+void pq_overflow_heap<T, Comparator>::make_room() {
+	assert(m_size < maxsize);
+	if(m_sequenceArea + m_heapSize == maxsize) {
+		compact();
+		if(m_heapSize < heap_capacity()) return;
+	}
+	seal_heap();
+}
+
+template<typename T, typename Comparator>
+void pq_overflow_heap<T, Comparator>::seal_heap() {
+	if(m_sequences == m_sequenceBegin.size()) {
+		// Too many sequences have been emptied partially; sort everything
+		// into a single sequence.
+		compact();
+		std::sort(m_items.get(), m_items.get() + m_size, comp);
+		m_sequences = 1;
+		m_sequenceBegin[0] = 0;
+		m_sequenceEnd[0] = m_size;
+		m_sequenceArea = m_size;
+		m_heapSize = 0;
+		m_heapOrdered = false;
+		rebuild_merger();
+		return;
+	}
+	T * h = heap_begin();
+	bits::sequential_sort(h, h + m_heapSize, comp);
+	m_sequenceBegin[m_sequences] = m_sequenceArea;
+	m_sequenceEnd[m_sequences] = m_sequenceArea + m_heapSize;
+	m_merger.push(h, m_sequences);
+	++m_sequences;
+	m_sequenceArea += m_heapSize;
+	m_heapSize = 0;
+	m_heapOrdered = false;
+}
+
+// Move the sequences and the insertion heap to close the gaps left by popping.
+template<typename T, typename Comparator>
+void pq_overflow_heap<T, Comparator>::compact() {
+	T * items = m_items.get();
+	memory_size_type to = 0;
+	memory_size_type n = 0;
+	for(memory_size_type s = 0; s < m_sequences; ++s) {
+		memory_size_type b = m_sequenceBegin[s];
+		memory_size_type e = m_sequenceEnd[s];
+		if(b == e) continue;
+		if(b != to) std::copy(items + b, items + e, items + to);
+		m_sequenceBegin[n] = to;
+		m_sequenceEnd[n] = to + (e - b);
+		to += e - b;
+		++n;
+	}
+	m_sequences = n;
+	if(m_sequenceArea != to)
+		std::copy(items + m_sequenceArea, items + m_sequenceArea + m_heapSize, items + to);
+	m_sequenceArea = to;
+	rebuild_merger();
+}
+
+template<typename T, typename Comparator>
+void pq_overflow_heap<T, Comparator>::rebuild_merger() {
+	m_merger.clear();
+	for(memory_size_type s = 0; s < m_sequences; ++s) {
+		if(m_sequenceBegin[s] != m_sequenceEnd[s])
+			m_merger.push(m_items.get() + m_sequenceBegin[s], s);
+	}
+}
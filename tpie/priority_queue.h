@@ -37,10 +37,14 @@
 #include <string>
 #include <cstring> // for memcpy
 #include <sstream>
+#include <exception>
 #include "pq_merge_heap.h"
+#include "pq_loser_tree.h"
 #include <tpie/err.h>
 #include <tpie/stream.h>
 #include <tpie/array.h>
+#include <tpie/array_view.h>
+#include <tpie/job.h>
 #include <boost/filesystem.hpp>
 
 namespace tpie {
@@ -50,6 +54,124 @@ namespace tpie {
 		{ }
 	};
 
+namespace bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Merges the slots of a full priority_queue group into a slot of the
+/// next group on a worker thread.
+///
+/// The priority queue opens the streams before the job is enqueued, so the
+/// worker thread only reads and writes them. An exception thrown by the merge
+/// is stored and rethrown by rethrow() on the thread that joins the job.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename Comparator>
+class pq_merge_job : public job {
+public:
+	pq_merge_job(memory_size_type fanout, float blockFactor, Comparator comp)
+		: m_inputs(fanout)
+		, m_remaining(fanout)
+		, m_files(fanout)
+		, m_inputCount(0)
+		, m_output(blockFactor)
+		, m_outputSize(0)
+		, m_target(0)
+		, m_blockFactor(blockFactor)
+		, m_comp(comp)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Add the non-empty slot stored in the given data file.
+	///
+	/// \param least An item not greater than any item in the slot.
+	///////////////////////////////////////////////////////////////////////////
+	void add_input(temp_file & file, memory_size_type fileIndex,
+				   memory_size_type start, memory_size_type size, const T & least) {
+		assert(size > 0);
+		if(m_inputCount == 0 || m_comp(least, m_least)) m_least = least;
+		m_inputs[m_inputCount].reset(tpie_new<file_stream<T> >(m_blockFactor));
+		m_inputs[m_inputCount]->open(file);
+		m_inputs[m_inputCount]->seek(start);
+		m_remaining[m_inputCount] = size;
+		m_files[m_inputCount] = fileIndex;
+		m_outputSize += size;
+		++m_inputCount;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set the slot receiving the merged items.
+	///////////////////////////////////////////////////////////////////////////
+	void set_output(temp_file & file, memory_size_type target) {
+		m_output.open(file);
+		m_target = target;
+	}
+
+	memory_size_type target() const {return m_target;}
+	memory_size_type output_size() const {return m_outputSize;}
+	memory_size_type input_count() const {return m_inputCount;}
+	memory_size_type input_file(memory_size_type i) const {return m_files[i];}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief An item not greater than any item being merged.
+	///////////////////////////////////////////////////////////////////////////
+	const T & least() const {return m_least;}
+
+	virtual void operator()() override {
+		try {
+			merge();
+		} catch (...) {
+			m_exception = std::current_exception();
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Rethrow the exception thrown by the merge, if any. Call this
+	/// after join().
+	///////////////////////////////////////////////////////////////////////////
+	void rethrow() {
+		if (!m_exception) return;
+		std::exception_ptr e = m_exception;
+		m_exception = nullptr;
+		std::rethrow_exception(e);
+	}
+
+private:
+	void merge() {
+		pq_loser_tree<T, Comparator> tree(m_inputCount, m_comp);
+		for(memory_size_type i = 0; i < m_inputCount; ++i) {
+			tree.push(m_inputs[i]->read(), i);
+			--m_remaining[i];
+		}
+		while(!tree.empty()) {
+			memory_size_type i = tree.top_run();
+			m_output.write(tree.top());
+			if(m_remaining[i] == 0) {
+				tree.pop();
+			} else {
+				--m_remaining[i];
+				tree.pop_and_push(m_inputs[i]->read(), i);
+			}
+		}
+		for(memory_size_type i = 0; i < m_inputCount; ++i) m_inputs[i].reset();
+		m_output.close();
+	}
+
+private:
+	array<unique_ptr<file_stream<T> > > m_inputs;
+	array<memory_size_type> m_remaining;
+	array<memory_size_type> m_files;
+	memory_size_type m_inputCount;
+	file_stream<T> m_output;
+	memory_size_type m_outputSize;
+	memory_size_type m_target;
+	T m_least;
+	float m_blockFactor;
+	Comparator m_comp;
+	std::exception_ptr m_exception;
+};
+
+} // namespace bits
+
 ///////////////////////////////////////////////////////////////////////////////
 /// \class priority_queue
 /// \brief External memory priority queue implementation. The top of the 
@@ -84,13 +206,21 @@ public:
 	///
 	/// \param f Factor of memory that the priority queue is allowed to use.
 	/// \param b Block factor
+	/// \param backgroundMerges Number of group merges that may run on worker
+	/// threads at a time. With the default of zero, a full group is merged
+	/// by the push or pop that needs its slots, which can take long for the
+	/// higher groups. Otherwise, the slots of a full group are swapped for
+	/// empty ones, and the old slots are merged while the queue is used.
+	/// Each background merge reserves memory for streams to all slots of a
+	/// group, leaving less memory for the rest of the queue.
 	///////////////////////////////////////////////////////////////////////////
-	priority_queue(double f=1.0, float b=0.0625);
+	priority_queue(double f=1.0, float b=0.0625, memory_size_type backgroundMerges=0);
 
 #ifndef DOXYGEN
 	// \param mmavail Number of bytes the priority queue is allowed to use.
 	// \param b Block factor
-	priority_queue(memory_size_type mm_avail, float b=0.0625);
+	// \param backgroundMerges Number of group merges on worker threads
+	priority_queue(memory_size_type mm_avail, float b=0.0625, memory_size_type backgroundMerges=0);
 #endif
 
 
@@ -110,6 +240,19 @@ public:
     /////////////////////////////////////////////////////////
     void push(const T& x);
 
+    /////////////////////////////////////////////////////////
+    ///
+    /// Insert a batch of elements into the priority queue.
+    ///
+    /// The elements are inserted into the insertion heap in
+    /// bulk, and the insertion heap is moved to a new slot
+    /// whenever it is full.
+    ///
+    /// \param items The items
+    ///
+    /////////////////////////////////////////////////////////
+    void push_batch(array_view<const T> items);
+
     /////////////////////////////////////////////////////////
     ///
     /// Remove the top element from the priority queue
@@ -157,6 +300,37 @@ public:
     /////////////////////////////////////////////////////////
     template <typename F> F pop_equals(F f);
 
+    /////////////////////////////////////////////////////////
+    ///
+    /// Remove the n least elements (or all elements if
+    /// there are fewer) and write them to out in order.
+    ///
+    /// Runs of elements are copied from the deletion buffer
+    /// at a time instead of being popped one by one.
+    ///
+    /// \param out Output iterator receiving the elements.
+    /// \param n Maximum number of elements to remove.
+    ///
+    /// \return The output iterator after the last element.
+    ///
+    /////////////////////////////////////////////////////////
+    template <typename OutputIterator>
+    OutputIterator pop_batch(OutputIterator out, memory_size_type n);
+
+    /////////////////////////////////////////////////////////
+    ///
+    /// Remove all elements less than key in the specified
+    /// ordering and write them to out in order.
+    ///
+    /// \param key Elements not less than key are kept.
+    /// \param out Output iterator receiving the elements.
+    ///
+    /// \return The output iterator after the last element.
+    ///
+    /////////////////////////////////////////////////////////
+    template <typename OutputIterator>
+    OutputIterator pop_until(const T & key, OutputIterator out);
+
 private:
     Comparator comp_;
     T dummy;
@@ -184,6 +358,11 @@ private:
 	 * Its data is in data file index slot_state[3*i+2]. */
 	tpie::array<memory_size_type> slot_state;
 
+	/** An element not greater than any element of slot i, for each slot,
+	 * when merging in the background. Slots are only read from the front,
+	 * so the bound stays valid until the slot is written again. */
+	tpie::array<T> slot_least;
+
 	/** 2*(#groups) integers. Group buffer i has its elements in cyclic ascending order,
 	 * starting at index group_state[2*i]. Gbuffer i contains group_state[2*i+1] elements. */
 	tpie::array<memory_size_type> group_state;
@@ -196,6 +375,17 @@ private:
 	memory_size_type setting_m;
 	/** m', the size of the deletion buffer. */
 	memory_size_type setting_mmark;
+	/** Number of group merges that may run on worker threads at a time. */
+	memory_size_type setting_background_merges;
+
+	/** Group merges running on worker threads, oldest first. The target slot
+	 * of each merge is reserved until the merge is finished. */
+	tpie::array<tpie::unique_ptr<bits::pq_merge_job<T, Comparator> > > background_merges;
+	memory_size_type background_merge_count;
+	/** Data files not used by any slot. When a group is merged in the
+	 * background, its slots swap their data files for spare ones. */
+	tpie::array<memory_size_type> spare_files;
+	memory_size_type spare_file_count;
 
     memory_size_type slot_data_id;
 
@@ -207,6 +397,10 @@ private:
 
 	void init(memory_size_type mm_avail);
 
+    void empty_overflow_heap();
+    template <typename OutputIterator>
+    OutputIterator pop_bounded(OutputIterator out, memory_size_type n, const T * key);
+
     void             slot_start_set(slot_type slot, memory_size_type n);
     memory_size_type slot_start(slot_type slot) const;
     void             slot_size_set(slot_type slot, memory_size_type n);
@@ -226,6 +420,9 @@ private:
     void write_slot(slot_type slotid, T* arr, memory_size_type len);
     slot_type free_slot(group_type group);
     void empty_group(group_type group);
+    void empty_group_in_background(group_type group);
+    void finish_background_merge(memory_size_type i);
+    bool slot_reserved(slot_type slot) const;
     void fill_buffer();
     void fill_group_buffer(group_type group);
     void compact(slot_type slot);
@@ -18,8 +18,8 @@
 // along with TPIE.  If not, see <http://www.gnu.org/licenses/>
 
 template<typename T, typename Comparator, typename OPQType>
-priority_queue<T, Comparator, OPQType>::priority_queue(double f, float b) :
-block_factor(b) { // constructor mem fraction
+priority_queue<T, Comparator, OPQType>::priority_queue(double f, float b, memory_size_type backgroundMerges) :
+setting_background_merges(backgroundMerges), block_factor(b) { // constructor mem fraction
 	assert(f<= 1.0 && f > 0);
 	assert(b > 0.0);
 	memory_size_type mm_avail = consecutive_memory_available();
@@ -32,8 +32,8 @@ block_factor(b) { // constructor mem fraction
 
 #ifndef DOXYGEN
 template<typename T, typename Comparator, typename OPQType>
-priority_queue<T, Comparator, OPQType>::priority_queue(memory_size_type mm_avail, float b) :
-block_factor(b) { // constructor absolute mem
+priority_queue<T, Comparator, OPQType>::priority_queue(memory_size_type mm_avail, float b, memory_size_type backgroundMerges) :
+setting_background_merges(backgroundMerges), block_factor(b) { // constructor absolute mem
 	assert(mm_avail <= get_memory_manager().limit() && mm_avail > 0);
 	assert(b > 0.0);
 	TP_LOG_DEBUG("priority_queue: Memory limit: " 
@@ -68,8 +68,11 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 		//Compute overhead of the parameters
 		const memory_size_type fanout_overhead = 2*sizeof(stream_size_type)// group state
 			+ (usage+sizeof(file_stream<T>*)+alloc_overhead) //temporary streams
-			+ (sizeof(T)+sizeof(group_type)); //mergeheap
-		const memory_size_type sq_fanout_overhead = 3*sizeof(stream_size_type); //slot_state
+			+ (sizeof(T)+sizeof(group_type)) //mergeheap
+			+ setting_background_merges*(usage+sizeof(file_stream<T>*)+alloc_overhead //background merge streams
+										 +sizeof(T)+3*sizeof(memory_size_type)); //background merge heap and spare files
+		const memory_size_type sq_fanout_overhead = 3*sizeof(stream_size_type) //slot_state
+			+ (setting_background_merges > 0 ? sizeof(T) : 0); //slot_least
 		const memory_size_type heap_m_overhead = sizeof(T) //opg
 			+ sizeof(T) //gbuffer0
 			+ sizeof(T) //extra buffer for remove_group_buffer
@@ -77,7 +80,8 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 		const memory_size_type buffer_m_overhead = sizeof(T) + 2*sizeof(T); //buffer
 		const memory_size_type extra_overhead =
 			  2*(usage+sizeof(file_stream<T>*)+alloc_overhead) //temporary streams
-			+ 2*(sizeof(T)+sizeof(group_type)); //mergeheap
+			+ 2*(sizeof(T)+sizeof(group_type)) //mergeheap
+			+ setting_background_merges*(usage+sizeof(bits::pq_merge_job<T, Comparator>)); //background merge output
 		const memory_size_type additional_overhead = 16*1024; //Just leave a bit unused
 		TP_LOG_DEBUG("fanout_overhead     " << fanout_overhead     << ",\n" <<
 		             "sq_fanout_overhead  " << sq_fanout_overhead  << ",\n" <<
@@ -176,6 +180,7 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 
 	// state arrays contain: start + size
 	slot_state.resize(setting_k*setting_k*3);
+	if(setting_background_merges > 0) slot_least.resize(setting_k*setting_k);
 	group_state.resize(setting_k*2);
 
 	buffer.resize(setting_mmark);
@@ -196,14 +201,26 @@ void priority_queue<T, Comparator, OPQType>::init(memory_size_type mm_avail) { /
 
 	std::stringstream ss;
 	ss << tempname::tpie_name("pq_data");
-	datafiles.resize(setting_k*setting_k);
+	datafiles.resize(setting_k*setting_k+setting_background_merges*setting_k);
 	groupdatafiles.resize(setting_k);
+
+	background_merges.resize(setting_background_merges);
+	background_merge_count = 0;
+	spare_files.resize(setting_background_merges*setting_k);
+	for(memory_size_type i = 0; i < spare_files.size(); i++) {
+		spare_files[i] = setting_k*setting_k+i;
+	}
+	spare_file_count = spare_files.size();
 	TP_LOG_DEBUG("memory after alloc: " 
 				 << get_memory_manager().available() << "b" << "\n");
 }
 
 template <typename T, typename Comparator, typename OPQType>
 priority_queue<T, Comparator, OPQType>::~priority_queue() { // destructor
+	for(memory_size_type i = 0; i < background_merge_count; i++) {
+		background_merges[i]->join();
+	}
+	background_merges.resize(0);
 	datafiles.resize(0); // unlink slots
 	groupdatafiles.resize(0); // unlink groups 
 
@@ -214,84 +231,106 @@ priority_queue<T, Comparator, OPQType>::~priority_queue() { // destructor
 
 template <typename T, typename Comparator, typename OPQType>
 void priority_queue<T, Comparator, OPQType>::push(const T& x) {
-
 	if(opq->full()) {
-		// When the overflow priority queue (aka. insertion buffer) is full,
-		// insert its contents into a new slot in group 0.
-		//
-		// To maintain the heap invariant
-		//     deletion buffer <= group buffer 0 <= group 0 slots
-		// we bubble lesser elements from insertion buffer down into
-		// deletion buffer and group buffer 0.
+		empty_overflow_heap();
+	}
 
-		slot_type slot = free_slot(0); // (if group 0 is full, we recursively empty group i
-		                               // by merging it into a slot in group i+1)
+	// insertion buffer is non-full. insert element.
+	opq->push(x);
+	m_size++;
+#ifndef NDEBUG
+	validate();
+#endif
+}
 
-		assert(opq->sorted_size() == setting_m);
-		T* arr = opq->sorted_array();
+template <typename T, typename Comparator, typename OPQType>
+void priority_queue<T, Comparator, OPQType>::push_batch(array_view<const T> items) {
+	memory_size_type i = 0;
+	while(i < items.size()) {
+		if(opq->full()) {
+			empty_overflow_heap();
+		}
 
-		// Bubble lesser elements down into deletion buffer
-		if(buffer_size > 0) {
+		// insert as many elements as fit in the insertion buffer at once.
+		memory_size_type n = std::min(items.size() - i,
+									  setting_m - static_cast<memory_size_type>(opq->size()));
+		opq->push_batch(&items[i], &items[i] + n);
+		i += n;
+		m_size += n;
+	}
+#ifndef NDEBUG
+	validate();
+#endif
+}
 
-			// fetch insertion buffer
-			memcpy(&mergebuffer[0], &arr[0], sizeof(T)*opq->sorted_size());
+template <typename T, typename Comparator, typename OPQType>
+void priority_queue<T, Comparator, OPQType>::empty_overflow_heap() {
+	// When the overflow priority queue (aka. insertion buffer) is full,
+	// insert its contents into a new slot in group 0.
+	//
+	// To maintain the heap invariant
+	//     deletion buffer <= group buffer 0 <= group 0 slots
+	// we bubble lesser elements from insertion buffer down into
+	// deletion buffer and group buffer 0.
 
-			// fetch deletion buffer
-			memcpy(&mergebuffer[opq->sorted_size()], &buffer[buffer_start], sizeof(T)*buffer_size);
+	slot_type slot = free_slot(0); // (if group 0 is full, we recursively empty group i
+	                               // by merging it into a slot in group i+1)
 
-			// sort buffer elements
-			std::sort(mergebuffer.get(), mergebuffer.get()+(buffer_size+opq->sorted_size()), comp_);
+	T* arr = opq->sorted_array();
 
-			// smaller elements go in deletion buffer
-			memcpy(buffer.get()+buffer_start, mergebuffer.get(), sizeof(T)*buffer_size);
+	// Bubble lesser elements down into deletion buffer
+	if(buffer_size > 0) {
 
-			// larger elements go in insertion buffer
-			memcpy(&arr[0], mergebuffer.get()+buffer_size, sizeof(T)*opq->sorted_size());
-		}
+		// fetch insertion buffer
+		memcpy(&mergebuffer[0], &arr[0], sizeof(T)*opq->sorted_size());
 
-		// Bubble lesser elements down into group buffer 0
-		if(group_size(0)> 0) {
+		// fetch deletion buffer
+		memcpy(&mergebuffer[opq->sorted_size()], &buffer[buffer_start], sizeof(T)*buffer_size);
 
-			// Merge insertion buffer and group buffer 0
-			assert(group_size(0)+opq->sorted_size() <= setting_m*2);
-			memory_size_type j = 0;
+		// sort buffer elements
+		std::sort(mergebuffer.get(), mergebuffer.get()+(buffer_size+opq->sorted_size()), comp_);
 
-			// fetch gbuffer0
-			for(stream_size_type i = group_start(0); i < group_start(0)+group_size(0); i++) {
-				mergebuffer[j] = gbuffer0[static_cast<memory_size_type>(i%setting_m)];
-				++j;
-			}
+		// smaller elements go in deletion buffer
+		memcpy(buffer.get()+buffer_start, mergebuffer.get(), sizeof(T)*buffer_size);
 
-			// fetch insertion buffer
-			memcpy(&mergebuffer[j], &arr[0], sizeof(T)*opq->sorted_size());
+		// larger elements go in insertion buffer
+		memcpy(&arr[0], mergebuffer.get()+buffer_size, sizeof(T)*opq->sorted_size());
+	}
 
-			// sort
-			std::sort(mergebuffer.get(), mergebuffer.get()+(group_size(0)+opq->sorted_size()), comp_);
+	// Bubble lesser elements down into group buffer 0
+	if(group_size(0)> 0) {
 
-			// smaller elements go in gbuffer0
-			memcpy(gbuffer0.get(), mergebuffer.get(), static_cast<size_t>(sizeof(T)*group_size(0)));
-			group_start_set(0,0);
+		// Merge insertion buffer and group buffer 0
+		assert(group_size(0)+opq->sorted_size() <= setting_m*2);
+		memory_size_type j = 0;
 
-			// larger elements go in insertion buffer (actually a free group 0 slot)
-			memcpy(&arr[0], &mergebuffer[group_size(0)], sizeof(T)*opq->sorted_size());
+		// fetch gbuffer0
+		for(stream_size_type i = group_start(0); i < group_start(0)+group_size(0); i++) {
+			mergebuffer[j] = gbuffer0[static_cast<memory_size_type>(i%setting_m)];
+			++j;
 		}
 
-		// move insertion buffer (which has elements larger than all of
-		// gbuffer0 and deletion buffer) into a free group 0 slot
+		// fetch insertion buffer
+		memcpy(&mergebuffer[j], &arr[0], sizeof(T)*opq->sorted_size());
 
-		write_slot(slot, arr, opq->sorted_size());
-		opq->sorted_pop();
+		// sort
+		std::sort(mergebuffer.get(), mergebuffer.get()+(group_size(0)+opq->sorted_size()), comp_);
 
-		// insertion buffer is now empty
+		// smaller elements go in gbuffer0
+		memcpy(gbuffer0.get(), mergebuffer.get(), static_cast<size_t>(sizeof(T)*group_size(0)));
+		group_start_set(0,0);
 
+		// larger elements go in insertion buffer (actually a free group 0 slot)
+		memcpy(&arr[0], &mergebuffer[group_size(0)], sizeof(T)*opq->sorted_size());
 	}
 
-	// insertion buffer is non-full. insert element.
-	opq->push(x);
-	m_size++;
-#ifndef NDEBUG
-	validate();
-#endif
+	// move insertion buffer (which has elements larger than all of
+	// gbuffer0 and deletion buffer) into a free group 0 slot
+
+	write_slot(slot, arr, opq->sorted_size());
+	opq->sorted_pop();
+
+	// insertion buffer is now empty
 }
 
 template <typename T, typename Comparator, typename OPQType>
@@ -374,6 +413,67 @@ F priority_queue<T, Comparator, OPQType>::pop_equals(F f) {
 	return f;
 }
 
+template <typename T, typename Comparator, typename OPQType> template <typename OutputIterator>
+OutputIterator priority_queue<T, Comparator, OPQType>::pop_batch(OutputIterator out, memory_size_type n) {
+	return pop_bounded(out, n, 0);
+}
+
+template <typename T, typename Comparator, typename OPQType> template <typename OutputIterator>
+OutputIterator priority_queue<T, Comparator, OPQType>::pop_until(const T & key, OutputIterator out) {
+	return pop_bounded(out, std::numeric_limits<memory_size_type>::max(), &key);
+}
+
+template <typename T, typename Comparator, typename OPQType> template <typename OutputIterator>
+OutputIterator priority_queue<T, Comparator, OPQType>::pop_bounded(OutputIterator out, memory_size_type n, const T * key) {
+	while(n > 0 && m_size > 0) {
+		// refill the deletion buffer if it is empty, as in top()
+		if(buffer_size == 0 && opq->size() != m_size) {
+			fill_buffer();
+		}
+
+		if(buffer_size > 0) {
+			// The deletion buffer is sorted and holds the least elements outside
+			// the insertion buffer, so we take its prefix of elements less than
+			// the top of the insertion buffer (and less than key).
+			const T * first = buffer.get() + buffer_start;
+			const T * last = first + std::min(n, buffer_size);
+			if(opq->size() > 0) {
+				last = std::lower_bound(first, last, opq->top(), comp_);
+			}
+			if(key) {
+				last = std::lower_bound(first, last, *key, comp_);
+			}
+			memory_size_type taken = static_cast<memory_size_type>(last - first);
+			out = std::copy(first, last, out);
+			buffer_start += taken;
+			buffer_size -= taken;
+			if(buffer_size == 0) {
+				buffer_start = 0;
+			}
+			m_size -= taken;
+			n -= taken;
+			if(n == 0 || m_size == 0) break;
+		}
+
+		// an emptied deletion buffer must be refilled from the groups first.
+		if(buffer_size == 0 && opq->size() != m_size) continue;
+
+		// Otherwise the top of the insertion buffer is the least element,
+		// unless the deletion buffer stopped at key.
+		if(opq->size() == 0) break;
+		if(key && !comp_(opq->top(), *key)) break;
+		*out = opq->top();
+		++out;
+		opq->pop();
+		--m_size;
+		--n;
+	}
+#ifndef NDEBUG
+	validate();
+#endif
+	return out;
+}
+
 template <typename T, typename Comparator, typename OPQType>
 void priority_queue<T, Comparator, OPQType>::dump() {
 	TP_LOG_DEBUG( "--------------------------------------------------------------" << "\n"
@@ -478,7 +578,7 @@ priority_queue<T, Comparator, OPQType>::free_slot(group_type group) {
 	}
 
 	for(i = group*setting_k; i < group*setting_k+setting_k; i++) {
-		if(slot_size(i) == 0) {
+		if(slot_size(i) == 0 && !slot_reserved(i)) {
 			// This slot is good
 			break;
 		}
@@ -490,7 +590,7 @@ priority_queue<T, Comparator, OPQType>::free_slot(group_type group) {
 
 		empty_group(group);
 
-		if(slot_size(group*setting_k) != 0) {
+		if(slot_size(group*setting_k) != 0 || slot_reserved(group*setting_k)) {
 			return free_slot(group); // some group buffers might have been moved
 		}
 		return group*setting_k;
@@ -504,6 +604,23 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 	if(buffer_size !=0) {
 		return;
 	}
+	// The group buffers are refilled from the slots, so the merges into the
+	// groups being refilled must be in place. Merges into other groups keep
+	// running.
+	while(true) {
+		bool changed = false;
+		for(memory_size_type i = 0; i < background_merge_count; i++) {
+			group_type group = background_merges[i]->target()/setting_k;
+			if(group_size(group) < static_cast<stream_size_type>(setting_mmark)) {
+				// Finishing a merge may start or finish others; start over.
+				finish_background_merge(i);
+				changed = true;
+				break;
+			}
+		}
+		if(!changed) break;
+	}
+
 	if(current_r == 0) { // todo: check that this is ok
 		return;
 	}
@@ -518,6 +635,19 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 		}
 	}
 
+	// The elements of the running merges are in no group buffer, so the
+	// deletion buffer may only take elements not greater than the least
+	// of them.
+	bool bounded = background_merge_count > 0;
+	T bound = T();
+	for(memory_size_type i = 0; i < background_merge_count; i++) {
+		if(i == 0 || comp_(background_merges[i]->least(), bound)) {
+			bound = background_merges[i]->least();
+		}
+	}
+	bool blocked = false;
+	T least = T();
+
 	// merge to buffer
 	mergebuffer.resize(0);
 #ifndef TPIE_NDEBUG
@@ -526,7 +656,7 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 #endif
 
 	{
-	pq_merge_heap<T, Comparator> heap(current_r);
+	pq_loser_tree<T, Comparator> heap(current_r);
 
 	tpie::array<tpie::unique_ptr<file_stream<T> > > data(current_r);
 	for(memory_size_type i = 0; i<current_r; i++) {
@@ -543,6 +673,11 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 	}
 
 	while(!heap.empty() && buffer_size!=setting_mmark) {
+		if(bounded && comp_(bound, heap.top())) {
+			blocked = true;
+			least = heap.top();
+			break;
+		}
 		group_type current_group = heap.top_run();
 		if(current_group!= 0 && data[current_group]->offset() == setting_m) {
 			data[current_group]->seek(0);
@@ -569,6 +704,20 @@ void priority_queue<T, Comparator, OPQType>::fill_buffer() {
 			  << get_memory_manager().available() << "b" << std::endl;
 #endif
 	mergebuffer.resize(setting_m*2);
+
+	if(buffer_size == 0 && background_merge_count > 0) {
+		// The least remaining elements are in running merges. Wait for the
+		// merges that may hold elements less than the group buffers, and
+		// try again.
+		for(memory_size_type i = 0; i < background_merge_count;) {
+			if(!blocked || !comp_(least, background_merges[i]->least())) {
+				finish_background_merge(i);
+			} else {
+				i++;
+			}
+		}
+		fill_buffer();
+	}
 }
 
 template <typename T, typename Comparator, typename OPQType>
@@ -599,7 +748,7 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 		}
 
 		//merge heap for the setting_k slots
-		pq_merge_heap<T, Comparator> heap(setting_k);
+		pq_loser_tree<T, Comparator> heap(setting_k);
 
 		//Create streams for the non-empty slots and initialize
 		//internal heap with one element per slot
@@ -666,7 +815,7 @@ void priority_queue<T, Comparator, OPQType>::fill_group_buffer(group_type group)
 // Memory usage:
 // Deallocates mergebuffer : -2*setting_m
 // Opens newstream         : sizeof(file_stream<T>)
-// PQ merge heap           : setting_k * (sizeof T + sizeof size_type)
+// PQ loser tree           : pq_loser_tree<T>::memory_usage(setting_k)
 // Opens old streams       : setting_k * sizeof(file_stream<T>)
 // Reallocates mergebuffer : +2*setting_m
 // (no net heap usage since 2*setting_m > temporary heap usage)
@@ -677,6 +826,11 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 		throw exception("Priority queue is full");
 	}
 
+	if(setting_background_merges > 0) {
+		empty_group_in_background(group);
+		return;
+	}
+
 	// All slots are occupied. Empty this group by merging slots into a
 	// single free slot in group+1.
 
@@ -701,7 +855,7 @@ void priority_queue<T, Comparator, OPQType>::empty_group(group_type group) {
 
 		file_stream<T> newstream(block_factor);
 		newstream.open(slot_data(newslot));
-		pq_merge_heap<T, Comparator> heap(setting_k);
+		pq_loser_tree<T, Comparator> heap(setting_k);
 
 		// Open streams to slots in group `group', push top element to merge heap
 		tpie::array<tpie::unique_ptr<file_stream<T> > > data(setting_k);
@@ -764,6 +918,9 @@ void priority_queue<T, Comparator, OPQType>::validate() {
 	for(stream_size_type i = 0; i<setting_k*setting_k;i++) {
 		size = size + slot_size(i);
 	}
+	for(memory_size_type i = 0; i<background_merge_count;i++) {
+		size = size + background_merges[i]->output_size();
+	}
 	if(m_size != size) {
 		TP_LOG_FATAL_ID("Error: Validate: Size not ok");
 		exit(-1);
@@ -935,6 +1092,104 @@ void priority_queue<T, Comparator, OPQType>::remove_group_buffer(group_type grou
 	group_size_set(group, 0);
 }
 
+// Swap the data files of the slots in a full group for spare ones, and merge
+// the old files into a reserved slot of the next group on a worker thread.
+// Memory usage: one pq_merge_job, accounted for in init.
+template <typename T, typename Comparator, typename OPQType>
+void priority_queue<T, Comparator, OPQType>::empty_group_in_background(group_type group) {
+	slot_type newslot;
+	while(true) {
+		// Finishing a merge may remove a group buffer into group 0, and
+		// getting a slot in group+1 may empty that group, both of which
+		// may in turn finish or start merges. Start over until nothing
+		// has changed.
+		bool changed = false;
+		for(memory_size_type i = 0; i < background_merge_count; i++) {
+			if(background_merges[i]->target()/setting_k == group) {
+				// A slot in this group is reserved; fill it.
+				finish_background_merge(i);
+				changed = true;
+				break;
+			}
+		}
+		if(changed) continue;
+		if(background_merge_count == setting_background_merges) {
+			finish_background_merge(0);
+			continue;
+		}
+		for(slot_type i = group*setting_k; i < group*setting_k+setting_k; i++) {
+			if(slot_size(i) == 0) return; // not full anymore
+		}
+		newslot = free_slot(group+1);
+		if(background_merge_count == setting_background_merges) continue;
+		bool full = true;
+		for(slot_type i = group*setting_k; i < group*setting_k+setting_k; i++) {
+			if(slot_size(i) == 0) full = false;
+		}
+		if(!full) return;
+		if(slot_size(newslot) == 0 && !slot_reserved(newslot)) break;
+	}
+
+	if(current_r < newslot/setting_k+1) {
+		// create a new group
+		current_r = newslot/setting_k+1;
+	}
+
+	tpie::unique_ptr<bits::pq_merge_job<T, Comparator> > job(
+		tpie_new<bits::pq_merge_job<T, Comparator> >(setting_k, block_factor, comp_));
+	for(slot_type i = group*setting_k; i < group*setting_k+setting_k; i++) {
+		job->add_input(slot_data(i), slot_state[i*3+2], slot_start(i), slot_size(i), slot_least[i]);
+		assert(spare_file_count > 0);
+		slot_data_set(i, spare_files[--spare_file_count]);
+		slot_start_set(i, 0);
+		slot_size_set(i, 0);
+	}
+	job->set_output(slot_data(newslot), newslot);
+	job->enqueue();
+	background_merges[background_merge_count++].reset(job.release());
+}
+
+// Wait for the i'th background merge, fill its target slot and recycle the
+// data files of the merged slots. Rethrows an exception thrown by the merge.
+template <typename T, typename Comparator, typename OPQType>
+void priority_queue<T, Comparator, OPQType>::finish_background_merge(memory_size_type i) {
+	assert(i < background_merge_count);
+	tpie::unique_ptr<bits::pq_merge_job<T, Comparator> > job;
+	job.swap(background_merges[i]);
+	for(memory_size_type j = i+1; j < background_merge_count; j++) {
+		background_merges[j-1].swap(background_merges[j]);
+	}
+	--background_merge_count;
+
+	job->join();
+	job->rethrow();
+	slot_type slot = job->target();
+	slot_start_set(slot, 0);
+	slot_size_set(slot, job->output_size());
+	slot_least[slot] = job->least();
+	for(memory_size_type j = 0; j < job->input_count(); j++) {
+		datafiles[job->input_file(j)].free();
+		spare_files[spare_file_count++] = job->input_file(j);
+	}
+	job.reset();
+
+	// Maintain heap invariant:
+	//     group buffer i <= group i slots
+	// as in empty_group.
+	group_type group = slot/setting_k;
+	if(group_size(group) > 0) {
+		remove_group_buffer(group);
+	}
+}
+
+template <typename T, typename Comparator, typename OPQType>
+bool priority_queue<T, Comparator, OPQType>::slot_reserved(slot_type slot) const {
+	for(memory_size_type i = 0; i < background_merge_count; i++) {
+		if(background_merges[i]->target() == slot) return true;
+	}
+	return false;
+}
+
 //////////////////
 // TPIE wrappers
 template <typename T, typename Comparator, typename OPQType>
@@ -1010,6 +1265,7 @@ void priority_queue<T, Comparator, OPQType>::write_slot(slot_type slotid, T* arr
 	data.write(arr+0, arr+len);
 	slot_start_set(slotid, 0);
 	slot_size_set(slotid, len);
+	if(setting_background_merges > 0) slot_least[slotid] = arr[0];
 	if(current_r == 0 && slotid < setting_k) {
 		current_r = 1;
 	}
@@ -0,0 +1,277 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file serialization_priority_queue.h  External memory priority queue of
+/// variable-length items.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef TPIE_SERIALIZATION_PRIORITY_QUEUE_H
+#define TPIE_SERIALIZATION_PRIORITY_QUEUE_H
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <tpie/memory.h>
+#include <tpie/tempname.h>
+#include <tpie/tpie_assert.h>
+
+#include <tpie/serialization2.h>
+#include <tpie/serialization_stream.h>
+
+namespace tpie {
+
+namespace serialization_bits {
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief A sorted run on disk together with its smallest unread item.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct pq_run {
+	temp_file file;
+	serialization_reader reader;
+	T front;
+	// Items left in the run, including front.
+	stream_size_type items;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Read the next item into front. Returns false if the run is
+	/// exhausted.
+	///////////////////////////////////////////////////////////////////////////
+	bool advance() {
+		if (--items == 0) return false;
+		reader.unserialize(front);
+		return true;
+	}
+};
+
+} // namespace serialization_bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief External memory priority queue of items that are serialized
+/// rather than stored in fixed-size slots.
+///
+/// Items are kept in an internal heap until it fills up, after which the
+/// heap is sorted and written as a run with a serialization_writer. The
+/// smallest unread item of every run is kept in memory. When the number of
+/// runs reaches the fanout, the smaller half of the runs are merged into
+/// one, so every item is rewritten a logarithmic number of times.
+///
+/// Items are written using serialize() and read using unserialize(), as in
+/// serialization_sorter, and the memory of an item in the heap is estimated
+/// by serialized_size().
+///
+/// \tparam T The type of items.
+/// \tparam pred_t The ordering; top() returns the smallest item.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t = std::less<T> >
+class serialization_priority_queue {
+	typedef serialization_bits::pq_run<T> run_type;
+	typedef tpie::unique_ptr<run_type> run_ptr;
+
+	// Orders the heaps so that the smallest item is on top.
+	struct item_comparator {
+		item_comparator(pred_t pred) : pred(pred) {}
+		bool operator()(const T & a, const T & b) const {return pred(b, a);}
+		pred_t pred;
+	};
+
+	struct run_comparator {
+		run_comparator(pred_t pred) : pred(pred) {}
+		bool operator()(const run_ptr & a, const run_ptr & b) const {return pred(b->front, a->front);}
+		pred_t pred;
+	};
+
+	struct run_size_comparator {
+		bool operator()(const run_ptr & a, const run_ptr & b) const {return a->items < b->items;}
+	};
+
+public:
+	typedef T item_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Constructor.
+	///
+	/// \param mm_avail Memory to use. Half of it is used for the internal
+	/// heap and half for the buffers of the runs.
+	/// \param pred The ordering of items.
+	///////////////////////////////////////////////////////////////////////////
+	serialization_priority_queue(memory_size_type mm_avail, pred_t pred = pred_t())
+		: m_pred(pred)
+		, m_itemComp(pred)
+		, m_runComp(pred)
+		, m_bufferMemory(0)
+		, m_bufferLimit(mm_avail / 2)
+		, m_fanout(std::max<memory_size_type>(mm_avail / 2 / serialization_reader::memory_usage(), 3) - 1)
+		, m_size(0)
+	{
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Memory needed for a fanout of two.
+	///////////////////////////////////////////////////////////////////////////
+	static memory_size_type minimum_memory() {
+		return 6 * serialization_reader::memory_usage();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Insert an item.
+	///////////////////////////////////////////////////////////////////////////
+	void push(const T & item) {
+		memory_size_type itemMemory = sizeof(T) + serialized_size(item);
+		if (!m_buffer.empty() && m_bufferMemory + itemMemory > m_bufferLimit)
+			flush_buffer();
+		m_buffer.push_back(item);
+		std::push_heap(m_buffer.begin(), m_buffer.end(), m_itemComp);
+		m_bufferMemory += itemMemory;
+		++m_size;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the smallest item.
+	///////////////////////////////////////////////////////////////////////////
+	const T & top() const {
+		tp_assert(!empty(), "top() on an empty serialization_priority_queue");
+		if (top_in_buffer()) return m_buffer.front();
+		return m_runs.front()->front;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Remove the smallest item.
+	///////////////////////////////////////////////////////////////////////////
+	void pop() {
+		tp_assert(!empty(), "pop() on an empty serialization_priority_queue");
+		--m_size;
+		if (top_in_buffer()) {
+			m_bufferMemory -= sizeof(T) + serialized_size(m_buffer.front());
+			std::pop_heap(m_buffer.begin(), m_buffer.end(), m_itemComp);
+			m_buffer.pop_back();
+			return;
+		}
+		std::pop_heap(m_runs.begin(), m_runs.end(), m_runComp);
+		if (m_runs.back()->advance())
+			std::push_heap(m_runs.begin(), m_runs.end(), m_runComp);
+		else
+			m_runs.pop_back();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return true if the queue is empty.
+	///////////////////////////////////////////////////////////////////////////
+	bool empty() const {
+		return m_size == 0;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the number of items in the queue.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type size() const {
+		return m_size;
+	}
+
+private:
+	bool top_in_buffer() const {
+		if (m_runs.empty()) return true;
+		if (m_buffer.empty()) return false;
+		return !m_pred(m_runs.front()->front, m_buffer.front());
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Write the internal heap as a sorted run.
+	///////////////////////////////////////////////////////////////////////////
+	void flush_buffer() {
+		if (m_runs.size() >= m_fanout) merge_runs();
+
+		std::sort(m_buffer.begin(), m_buffer.end(), m_pred);
+		run_ptr run(tpie_new<run_type>());
+		{
+			serialization_writer writer;
+			writer.open(run->file);
+			for (size_t i = 0; i < m_buffer.size(); ++i)
+				writer.serialize(m_buffer[i]);
+			writer.close();
+		}
+		run->items = m_buffer.size();
+		m_buffer.clear();
+		m_bufferMemory = 0;
+
+		open_run(*run);
+		m_runs.push_back(std::move(run));
+		std::push_heap(m_runs.begin(), m_runs.end(), m_runComp);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Merge the smaller half of the runs into one.
+	///////////////////////////////////////////////////////////////////////////
+	void merge_runs() {
+		std::sort(m_runs.begin(), m_runs.end(), run_size_comparator());
+		size_t count = std::max<size_t>(m_runs.size() / 2, 2);
+
+		std::vector<run_ptr> inputs;
+		for (size_t i = 0; i < count; ++i) inputs.push_back(std::move(m_runs[i]));
+		m_runs.erase(m_runs.begin(), m_runs.begin() + count);
+
+		run_ptr run(tpie_new<run_type>());
+		run->items = 0;
+		{
+			serialization_writer writer;
+			writer.open(run->file);
+			std::make_heap(inputs.begin(), inputs.end(), m_runComp);
+			while (!inputs.empty()) {
+				std::pop_heap(inputs.begin(), inputs.end(), m_runComp);
+				writer.serialize(inputs.back()->front);
+				++run->items;
+				if (inputs.back()->advance())
+					std::push_heap(inputs.begin(), inputs.end(), m_runComp);
+				else
+					inputs.pop_back();
+			}
+			writer.close();
+		}
+
+		open_run(*run);
+		m_runs.push_back(std::move(run));
+		std::make_heap(m_runs.begin(), m_runs.end(), m_runComp);
+	}
+
+	void open_run(run_type & run) {
+		run.reader.open(run.file);
+		run.reader.unserialize(run.front);
+	}
+
+	pred_t m_pred;
+	item_comparator m_itemComp;
+	run_comparator m_runComp;
+
+	// Internal heap of items not yet written to a run.
+	std::vector<T, allocator<T> > m_buffer;
+	memory_size_type m_bufferMemory;
+	memory_size_type m_bufferLimit;
+
+	// Heap of runs ordered by their smallest unread item.
+	std::vector<run_ptr> m_runs;
+	memory_size_type m_fanout;
+
+	stream_size_type m_size;
+};
+
+} // namespace tpie
+
+#endif // TPIE_SERIALIZATION_PRIORITY_QUEUE_H
@@ -21,6 +21,7 @@
 #define TPIE_SERIALIZATION_SORTER_H
 
 #include <queue>
+#include <exception>
 #include <boost/filesystem.hpp>
 
 #include <tpie/array.h>
@@ -29,6 +30,7 @@
 #include <tpie/tpie_log.h>
 #include <tpie/stats.h>
 #include <tpie/parallel_sort.h>
+#include <tpie/job.h>
 
 #include <tpie/serialization2.h>
 #include <tpie/serialization_stream.h>
@@ -48,6 +50,8 @@ struct sort_parameters {
 	memory_size_type memoryPhase3;
 	/** Minimum size of serialized items. */
 	memory_size_type minimumItemSize;
+	/** Maximum number of runs formed or merged concurrently. */
+	memory_size_type workers;
 	/** Directory in which temporary files are stored. */
 	std::string tempDir;
 
@@ -57,12 +61,17 @@ struct sort_parameters {
 			<< "Phase 2 memory:              " << memoryPhase2 << '\n'
 			<< "Phase 3 memory:              " << memoryPhase3 << '\n'
 			<< "Minimum item size:           " << minimumItemSize << '\n'
+			<< "Workers:                     " << workers << '\n'
 			<< "Temporary directory:         " << tempDir << '\n';
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Account for the memory used by item outside the sort buffer.
+/// \returns The amount added to the bucket.
+///////////////////////////////////////////////////////////////////////////////
 template <typename T>
-void set_owner(memory_bucket_ref b, T & item) {
+memory_size_type set_owner(memory_bucket_ref b, T & item) {
 	memory_size_type serSize = serialized_size(item);
 
 	if (serSize > sizeof(T)) {
@@ -70,7 +79,8 @@ void set_owner(memory_bucket_ref b, T & item) {
 		serSize -= sizeof(T);
 	}
 
-	b->count += serSize;	
+	b->count += serSize;
+	return serSize;
 }
 
 template <typename T>
@@ -81,6 +91,8 @@ class internal_sort {
 	array<T> m_buffer;
 	memory_size_type m_items;
 	memory_size_type m_memForItems;
+	// Part of the item bucket accounted for the items in this buffer.
+	memory_size_type m_itemMemory;
 
 	memory_size_type m_largestItem;
 
@@ -97,6 +109,8 @@ public:
 				  pred_t pred = pred_t())
 		: m_buffer(buffer_bucket)
 		, m_items(0)
+		, m_memForItems(0)
+		, m_itemMemory(0)
 		, m_largestItem(sizeof(T))
 		, m_pred(pred)
 		, m_full(false)
@@ -110,7 +124,7 @@ public:
 		m_items = 0;
 		m_largestItem = sizeof(T);
 		m_full = false;
-		m_memForItems = memAvail - m_buffer_bucket->count;
+		m_memForItems = memAvail - m_buffer.size() * sizeof(T);
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -127,16 +141,17 @@ public:
 			return false;
 		}
 
-		size_t oldSize = m_item_bucket->count;
-		set_owner(m_item_bucket, item);
+		memory_size_type itemMemory = set_owner(m_item_bucket, item);
 
-		if (m_item_bucket->count > m_memForItems) {
+		if (m_itemMemory + itemMemory > m_memForItems) {
 			unset_owner(m_item_bucket, item);
+			m_item_bucket->count -= itemMemory;
 			m_full = true;
 			return false;
 		}
 
-		m_largestItem = std::max(m_largestItem, m_item_bucket->count - oldSize);
+		m_itemMemory += itemMemory;
+		m_largestItem = std::max(m_largestItem, itemMemory);
 
 		m_buffer[m_items++] = item;
 
@@ -154,7 +169,7 @@ public:
 	/// disk.
 	///////////////////////////////////////////////////////////////////////////
 	memory_size_type current_serialized_size() {
-		return m_item_bucket->count;
+		return m_itemMemory;
 	}
 
 	///////////////////////////////////////////////////////////////////////////
@@ -168,7 +183,7 @@ public:
 	/// calculations.
 	///////////////////////////////////////////////////////////////////////////
 	memory_size_type memory_usage() {
-		return m_buffer_bucket->count + m_item_bucket->count;
+		return m_buffer.size() * sizeof(T) + m_itemMemory;
 	}
 
 	bool can_shrink_buffer() {
@@ -184,6 +199,13 @@ public:
 		parallel_sort(m_buffer.get(), m_buffer.get() + m_items, m_pred);
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sort without spawning jobs, for use in a job.
+	///////////////////////////////////////////////////////////////////////////
+	void sort_sequential() {
+		std::sort(m_buffer.get(), m_buffer.get() + m_items, m_pred);
+	}
+
 	const T * begin() const {
 		return m_buffer.get();
 	}
@@ -192,6 +214,18 @@ public:
 		return m_buffer.get() + m_items;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Exchange the buffers and items of two sorters sharing buckets.
+	///////////////////////////////////////////////////////////////////////////
+	void swap(internal_sort & other) {
+		m_buffer.swap(other.m_buffer);
+		std::swap(m_items, other.m_items);
+		std::swap(m_memForItems, other.m_memForItems);
+		std::swap(m_itemMemory, other.m_itemMemory);
+		std::swap(m_largestItem, other.m_largestItem);
+		std::swap(m_full, other.m_full);
+	}
+
 	///////////////////////////////////////////////////////////////////////////
 	/// \brief Deallocate buffer and call reset().
 	///////////////////////////////////////////////////////////////////////////
@@ -207,7 +241,8 @@ public:
 	void reset() {
 		for (size_t i = 0 ; i < m_items ; ++i)
 			unset_owner(m_item_bucket, m_buffer[i]);
-		m_item_bucket->count = 0;
+		m_item_bucket->count -= m_itemMemory;
+		m_itemMemory = 0;
 		m_items = 0;
 		m_full = false;
 	}
@@ -236,6 +271,12 @@ public:
 /// On open_readers(fanout): (0, fanout+y) -> (fanout+y, 0),
 /// On close_readers_and_delete(): (fanout+x, y) -> (x, y).
 ///
+/// reserve_run() and claim_runs(fanout) are the counterparts of
+/// open_new_writer() and open_readers(fanout) followed by
+/// close_readers_and_delete() for runs that are written and merged by jobs;
+/// see run_formation_job and merge_job. The files are accessed concurrently,
+/// but the state above is only changed by the thread owning the sorter.
+///
 /// ## Merge sorter usage
 ///
 /// During run formation (the first phase of merge sort), we repeatedly call
@@ -271,14 +312,14 @@ class file_handler {
 
 	std::string m_tempDir;
 
-	std::string run_file(size_t physicalIndex) {
+public:
+	std::string run_file(size_t physicalIndex) const {
 		if (m_tempDir.size() == 0) throw exception("run_file: temp dir is the empty string");
 		std::stringstream ss;
 		ss << m_tempDir << '/' << physicalIndex << ".tpie";
 		return ss.str();
 	}
 
-public:
 	file_handler()
 		: m_fileOffset(0)
 		, m_nextLevelFileOffset(0)
@@ -322,6 +363,57 @@ public:
 		m_writerOpen = false;
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Reserve the next run in the next level, to be written by
+	/// write_run().
+	/// \returns The physical index of the run.
+	///////////////////////////////////////////////////////////////////////////
+	size_t reserve_run() {
+		if (m_writerOpen) throw exception("reserve_run: Writer open");
+		return m_nextFileOffset++;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Write the sorted items [a, b) to a reserved run.
+	///
+	/// May be called concurrently for distinct runs.
+	///////////////////////////////////////////////////////////////////////////
+	void write_run(size_t physicalIndex, const T * a, const T * b) const {
+		serialization_writer wr;
+		wr.open(run_file(physicalIndex));
+		for (; a != b; ++a) wr.serialize(*a);
+		wr.close();
+		increment_temp_file_usage(static_cast<stream_offset_type>(wr.file_size()));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Hand over the next fanout runs of the current level to the
+	/// caller, who must remove them with remove_run() after merging.
+	/// \returns The physical index of the first run.
+	///////////////////////////////////////////////////////////////////////////
+	size_t claim_runs(size_t fanout) {
+		if (m_readersOpen != 0) throw exception("claim_runs: readers open");
+		if (fanout == 0) throw exception("claim_runs: fanout == 0");
+		if (remaining_runs() == 0) {
+			if (m_writerOpen) throw exception("Writer open while moving to next merge level");
+			m_nextLevelFileOffset = m_nextFileOffset;
+		}
+		if (fanout > remaining_runs()) throw exception("claim_runs: fanout out of bounds");
+		size_t first = m_fileOffset;
+		m_fileOffset += fanout;
+		return first;
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Delete a claimed run of the given size after merging it.
+	///
+	/// May be called concurrently for distinct runs.
+	///////////////////////////////////////////////////////////////////////////
+	void remove_run(size_t physicalIndex, stream_size_type sz) const {
+		increment_temp_file_usage(-static_cast<stream_offset_type>(sz));
+		boost::filesystem::remove(run_file(physicalIndex));
+	}
+
 	size_t remaining_runs() {
 		return m_nextLevelFileOffset - m_fileOffset;
 	}
@@ -416,7 +508,11 @@ private:
 	}
 };
 
-template <typename T, typename pred_t>
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Merges the runs read from a source, which is either the
+/// file_handler or a run_group.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t, typename source_t = file_handler<T> >
 class merger {
 	class mergepred_t {
 		pred_t m_pred;
@@ -434,14 +530,14 @@ class merger {
 
 	typedef typename mergepred_t::item_type item_type;
 
-	file_handler<T> & files;
+	source_t & files;
 	pred_t pred;
 	std::vector<serialization_reader> rd;
 	typedef std::priority_queue<item_type, std::vector<item_type>, mergepred_t> priority_queue_type;
 	priority_queue_type pq;
 
 public:
-	merger(file_handler<T> & files, const pred_t & pred)
+	merger(source_t & files, const pred_t & pred)
 		: files(files)
 		, pred(pred)
 		, pq(mergepred_t(pred))
@@ -486,6 +582,184 @@ private:
 	}
 };
 
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Readers of runs claimed from a file_handler by a merge_job.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+class run_group {
+	const file_handler<T> & m_files;
+	size_t m_first;
+	array<serialization_reader> m_readers;
+
+public:
+	run_group(const file_handler<T> & files, size_t first, size_t count)
+		: m_files(files)
+		, m_first(first)
+		, m_readers(count)
+	{
+		for (size_t i = 0; i < count; ++i)
+			m_readers[i].open(m_files.run_file(m_first + i));
+	}
+
+	bool can_read(size_t idx) {
+		return m_readers[idx].can_read();
+	}
+
+	T read(size_t idx) {
+		T res;
+		m_readers[idx].unserialize(res);
+		return res;
+	}
+
+	void close_and_delete() {
+		for (size_t i = 0; i < m_readers.size(); ++i) {
+			stream_size_type sz = m_readers[i].file_size();
+			m_readers[i].close();
+			m_files.remove_run(m_first + i, sz);
+		}
+		m_readers.resize(0);
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Rethrow and clear the exception stored by a job, if any.
+///////////////////////////////////////////////////////////////////////////////
+inline void rethrow_job_exception(std::exception_ptr & e) {
+	if (!e) return;
+	std::exception_ptr thrown;
+	std::swap(thrown, e);
+	std::rethrow_exception(thrown);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Job sorting a full run buffer and writing it to a reserved run,
+/// while the sorter fills another buffer.
+///
+/// The sorter swaps its full buffer with the empty buffer of an idle job
+/// before starting it. An exception thrown by the job is rethrown by
+/// finish() on the calling thread.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+class run_formation_job : public job {
+	internal_sort<T, pred_t> m_sorter;
+	const file_handler<T> & m_files;
+	size_t m_run;
+	bool m_pending;
+	std::exception_ptr m_exception;
+
+public:
+	run_formation_job(memory_bucket_ref buffer_bucket,
+					  memory_bucket_ref item_bucket,
+					  const pred_t & pred,
+					  const file_handler<T> & files)
+		: m_sorter(buffer_bucket, item_bucket, pred)
+		, m_files(files)
+		, m_run(0)
+		, m_pending(false)
+	{
+	}
+
+	internal_sort<T, pred_t> & sorter() {
+		return m_sorter;
+	}
+
+	bool pending() const {
+		return m_pending;
+	}
+
+	void start(size_t run) {
+		m_run = run;
+		m_pending = true;
+		enqueue();
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Wait for the run to be written and clear the buffer.
+	///////////////////////////////////////////////////////////////////////////
+	void finish() {
+		if (!m_pending) return;
+		join();
+		m_pending = false;
+		m_sorter.reset();
+		rethrow_job_exception(m_exception);
+	}
+
+	virtual void operator()() override {
+		try {
+			m_sorter.sort_sequential();
+			m_files.write_run(m_run, m_sorter.begin(), m_sorter.end());
+		} catch (...) {
+			m_exception = std::current_exception();
+		}
+	}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief  Job merging a group of claimed runs into a reserved run.
+/// An exception thrown by the job is rethrown by finish().
+///////////////////////////////////////////////////////////////////////////////
+template <typename T, typename pred_t>
+class merge_job : public job {
+	const file_handler<T> & m_files;
+	pred_t m_pred;
+	size_t m_first;
+	size_t m_fanout;
+	size_t m_output;
+	bool m_pending;
+	std::exception_ptr m_exception;
+
+public:
+	merge_job(const file_handler<T> & files, const pred_t & pred)
+		: m_files(files)
+		, m_pred(pred)
+		, m_first(0)
+		, m_fanout(0)
+		, m_output(0)
+		, m_pending(false)
+	{
+	}
+
+	void start(size_t first, size_t fanout, size_t output) {
+		m_first = first;
+		m_fanout = fanout;
+		m_output = output;
+		m_pending = true;
+		enqueue();
+	}
+
+	void finish() {
+		if (!m_pending) return;
+		join();
+		m_pending = false;
+		rethrow_job_exception(m_exception);
+	}
+
+	virtual void operator()() override {
+		try {
+			merge();
+		} catch (...) {
+			m_exception = std::current_exception();
+		}
+	}
+
+private:
+	void merge() {
+		run_group<T> group(m_files, m_first, m_fanout);
+		merger<T, pred_t, run_group<T> > m(group, m_pred);
+		m.init(m_fanout);
+		serialization_writer wr;
+		wr.open(m_files.run_file(m_output));
+		while (!m.empty()) {
+			wr.serialize(m.top());
+			m.pop();
+		}
+		m.free();
+		group.close_and_delete();
+		wr.close();
+		increment_temp_file_usage(static_cast<stream_offset_type>(wr.file_size()));
+	}
+};
+
 } // namespace serialization_bits
 
 template <typename T, typename pred_t = std::less<T> >
@@ -502,13 +776,26 @@ private:
 	memory_bucket_ref m_item_bucket;
 	pipelining::node * m_owning_node;
 
+	typedef serialization_bits::run_formation_job<T, pred_t> run_formation_job_t;
+	typedef serialization_bits::merge_job<T, pred_t> merge_job_t;
+
 	sorter_state m_state;
+	pred_t m_pred;
 	serialization_bits::internal_sort<T, pred_t> m_sorter;
 	serialization_bits::sort_parameters m_params;
 	bool m_parametersSet;
 	serialization_bits::file_handler<T> m_files;
 	serialization_bits::merger<T, pred_t> m_merger;
 
+	// Jobs writing full run buffers in phase 1, used round robin.
+	array<std::unique_ptr<run_formation_job_t> > m_runJobs;
+	memory_size_type m_nextRunJob;
+	// Largest item in the buffers of freed run formation jobs.
+	memory_size_type m_runJobsLargestItem;
+	// Jobs merging groups of runs in phase 2, used round robin.
+	array<std::unique_ptr<merge_job_t> > m_mergeJobs;
+	memory_size_type m_nextMergeJob;
+
 	stream_size_type m_items;
 	bool m_reportInternal;
 	const T * m_nextInternalItem;
@@ -521,10 +808,14 @@ public:
 		, m_item_bucket(memory_bucket_ref(m_item_bucket_ptr.get()))
 		, m_owning_node(nullptr)
 		, m_state(state_initial)
+		, m_pred(pred)
 		, m_sorter(m_buffer_bucket, m_item_bucket, pred)
 		, m_parametersSet(false)
 		, m_files()
 		, m_merger(m_files, pred)
+		, m_nextRunJob(0)
+		, m_runJobsLargestItem(0)
+		, m_nextMergeJob(0)
 		, m_items(0)
 		, m_reportInternal(false)
 		, m_nextInternalItem(0)
@@ -533,6 +824,34 @@ public:
 		m_params.memoryPhase2 = 0;
 		m_params.memoryPhase3 = 0;
 		m_params.minimumItemSize = minimumItemSize;
+		m_params.workers = default_worker_count();
+	}
+
+	~serialization_sorter() {
+		// Errors of the jobs are only reported while sorting.
+		try {
+			finish_run_jobs();
+		} catch (...) {
+		}
+		try {
+			finish_merge_jobs();
+		} catch (...) {
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Set the number of run buffers filled and sorted concurrently,
+	/// and the number of groups of runs merged concurrently.
+	///
+	/// The memory of phase 1 and 2 is divided evenly between the workers, so
+	/// more workers give shorter runs and a smaller merge fanout. With a
+	/// single worker, runs are formed and merged by the calling thread.
+	/// The default is default_worker_count().
+	///////////////////////////////////////////////////////////////////////////
+	void set_workers(memory_size_type workers) {
+		if (m_state != state_initial)
+			throw tpie::exception("Bad state in set_workers");
+		m_params.workers = std::max(workers, static_cast<memory_size_type>(1));
 	}
 
 private:
@@ -593,7 +912,7 @@ public:
 		if (m_reportInternal)
 			return m_sorter.memory_usage();
 		else
-			return m_files.next_level_runs() * (m_sorter.get_largest_item_size() + serialization_reader::memory_usage());
+			return m_files.next_level_runs() * (largest_item_size() + serialization_reader::memory_usage());
 	}
 
 	void set_owner(pipelining::node * n) {
@@ -687,9 +1006,21 @@ public:
 
 		log_debug() << "Before begin; mem usage = "
 			<< get_memory_manager().used() << std::endl;
-		m_sorter.begin(m_params.memoryPhase1 - serialization_writer::memory_usage());
+		// Each run buffer needs a writer of its own.
+		memory_size_type writerMemory = serialization_writer::memory_usage();
+		memory_size_type buffers = m_params.workers;
+		while (buffers > 1 && m_params.memoryPhase1 / buffers < 2*writerMemory)
+			--buffers;
+		memory_size_type bufferMemory = m_params.memoryPhase1 / buffers - writerMemory;
+		m_sorter.begin(bufferMemory);
+		m_runJobs.resize(buffers - 1);
+		for (memory_size_type i = 0; i < m_runJobs.size(); ++i) {
+			m_runJobs[i].reset(new run_formation_job_t(m_buffer_bucket, m_item_bucket, m_pred, m_files));
+			m_runJobs[i]->sorter().begin(bufferMemory);
+		}
+		m_nextRunJob = 0;
 		log_debug() << "After internal sorter begin; mem usage = "
-			<< get_memory_manager().used() << std::endl;
+			<< get_memory_manager().used() << "; " << buffers << " run buffers" << std::endl;
 		boost::filesystem::create_directory(m_params.tempDir);
 	}
 
@@ -716,6 +1047,11 @@ public:
 		log_debug() << "m_sorter.memory_usage == " << m_sorter.memory_usage() << '\n'
 			<< "internalThreshold == " << internalThreshold << std::endl;
 
+		if (m_files.next_level_runs() == 0) {
+			// All items are in m_sorter, so the other buffers are not needed.
+			free_run_jobs();
+		}
+
 		if (m_items == 0) {
 			m_reportInternal = true;
 			m_nextInternalItem = 0;
@@ -744,6 +1080,7 @@ public:
 		} else {
 
 			end_run();
+			free_run_jobs();
 			log_debug() << "Got " << m_files.next_level_runs() << " runs. "
 				<< "External reporting mode." << std::endl;
 			m_sorter.free();
@@ -770,6 +1107,7 @@ public:
 			case state_3:
 				if (m_reportInternal) {
 					end_run();
+					free_run_jobs();
 					m_sorter.free();
 					m_reportInternal = false;
 					log_debug() << "Evacuate out of internal reporting mode." << std::endl;
@@ -794,7 +1132,7 @@ public:
 			return;
 		}
 
-		memory_size_type largestItem = m_sorter.get_largest_item_size();
+		memory_size_type largestItem = largest_item_size();
 		if (largestItem == 0) {
 			log_warning() << "Largest item is 0 bytes; doing nothing." << std::endl;
 			m_state = state_3;
@@ -833,29 +1171,77 @@ public:
 			throw exception("Not enough memory for merging.");
 		}
 
+		// Merge independent groups of runs concurrently, dividing the memory
+		// between the jobs, as long as each job can merge at least two runs.
+		memory_size_type jobs = m_params.workers;
+		memory_size_type jobFanout = fanout;
+		for (; jobs > 1; --jobs) {
+			memory_size_type jobMemory = m_params.memoryPhase2 / jobs;
+			if (jobMemory <= serialization_writer::memory_usage()) continue;
+			jobFanout = (jobMemory - serialization_writer::memory_usage()) / perFanout;
+			if (jobFanout >= 2) break;
+		}
+		if (jobs <= 1) {
+			jobs = 1;
+			jobFanout = fanout;
+		}
+
 		log_debug() << "Calculated merge phase parameters for serialization sort.\n"
 			<< "Fanout:       " << fanout << '\n'
 			<< "Final fanout: " << finalFanout << '\n'
+			<< "Merge jobs:   " << jobs << '\n'
+			<< "Job fanout:   " << jobFanout << '\n'
 			;
 
+		if (jobs > 1 && m_files.next_level_runs() > finalFanout) {
+			m_mergeJobs.resize(jobs);
+			for (memory_size_type i = 0; i < jobs; ++i)
+				m_mergeJobs[i].reset(new merge_job_t(m_files, m_pred));
+			m_nextMergeJob = 0;
+		}
+
 		while (m_files.next_level_runs() > finalFanout) {
 			if (m_files.remaining_runs() != 0)
 				throw exception("m_files.remaining_runs() != 0");
 			log_debug() << "Runs in current level: " << m_files.next_level_runs() << '\n';
 			for (size_t remainingRuns = m_files.next_level_runs(); remainingRuns > 0;) {
-				size_t f = std::min(fanout, remainingRuns);
-				merge_runs(f);
+				size_t f = std::min(jobFanout, remainingRuns);
+				if (jobs > 1)
+					start_merge_job(f);
+				else
+					merge_runs(f);
 				remainingRuns -= f;
 				if (remainingRuns != m_files.remaining_runs())
 					throw exception("remainingRuns != m_files.remaining_runs()");
 			}
+			// The next level is complete when its runs are written.
+			finish_merge_jobs();
 		}
+		m_mergeJobs.resize(0);
 
 		m_state = state_3;
 	}
 
 private:
+	memory_size_type largest_item_size() {
+		memory_size_type largestItem = std::max(m_sorter.get_largest_item_size(), m_runJobsLargestItem);
+		for (memory_size_type i = 0; i < m_runJobs.size(); ++i)
+			largestItem = std::max(largestItem, m_runJobs[i]->sorter().get_largest_item_size());
+		return largestItem;
+	}
+
 	void end_run() {
+		if (m_runJobs.size() > 0) {
+			if (m_sorter.begin() == m_sorter.end()) return;
+			// Hand the full buffer to the next job and continue with its
+			// empty buffer.
+			run_formation_job_t & j = *m_runJobs[m_nextRunJob];
+			m_nextRunJob = (m_nextRunJob + 1) % m_runJobs.size();
+			j.finish();
+			j.sorter().swap(m_sorter);
+			j.start(m_files.reserve_run());
+			return;
+		}
 		m_sorter.sort();
 		if (m_sorter.begin() == m_sorter.end()) return;
 		m_files.open_new_writer();
@@ -866,6 +1252,63 @@ private:
 		m_sorter.reset();
 	}
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Wait for all run formation jobs, and rethrow the first
+	/// exception thrown by one of them.
+	///////////////////////////////////////////////////////////////////////////
+	void finish_run_jobs() {
+		std::exception_ptr e;
+		for (memory_size_type i = 0; i < m_runJobs.size(); ++i) {
+			try {
+				m_runJobs[i]->finish();
+			} catch (...) {
+				if (!e) e = std::current_exception();
+			}
+		}
+		serialization_bits::rethrow_job_exception(e);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Wait for all runs to be written and free the run formation
+	/// jobs, keeping the largest item size.
+	///////////////////////////////////////////////////////////////////////////
+	void free_run_jobs() {
+		finish_run_jobs();
+		m_runJobsLargestItem = largest_item_size();
+		m_runJobs.resize(0);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Wait for all merge jobs, and rethrow the first exception thrown
+	/// by one of them.
+	///////////////////////////////////////////////////////////////////////////
+	void finish_merge_jobs() {
+		std::exception_ptr e;
+		for (memory_size_type i = 0; i < m_mergeJobs.size(); ++i) {
+			try {
+				m_mergeJobs[i]->finish();
+			} catch (...) {
+				if (!e) e = std::current_exception();
+			}
+		}
+		serialization_bits::rethrow_job_exception(e);
+	}
+
+	void start_merge_job(size_t fanout) {
+		if (fanout == 0) throw exception("start_merge_job: fanout == 0");
+
+		if (fanout == 1 && m_files.remaining_runs() == 1) {
+			m_files.move_last_reader_to_next_level();
+			return;
+		}
+
+		merge_job_t & j = *m_mergeJobs[m_nextMergeJob];
+		m_nextMergeJob = (m_nextMergeJob + 1) % m_mergeJobs.size();
+		j.finish();
+		size_t first = m_files.claim_runs(fanout);
+		j.start(first, fanout, m_files.reserve_run());
+	}
+
 	void initialize_merger(size_t fanout) {
 		if (fanout == 0) throw exception("initialize_merger: fanout == 0");
 		m_files.open_readers(fanout);
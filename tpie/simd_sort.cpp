@@ -0,0 +1,113 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+#include <tpie/simd_sort.h>
+
+#ifdef TPIE_HAVE_SIMD_SORT
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+namespace tpie {
+
+namespace bits {
+
+namespace {
+
+#ifdef _MSC_VER
+bool cpu_has(int leaf, int reg, int bit) {
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < leaf) return false;
+	__cpuidex(info, leaf, 0);
+	return (info[reg] >> bit) & 1;
+}
+
+bool detect_sse41() {
+	return cpu_has(1, 2, 19);
+}
+
+bool detect_avx2() {
+	// AVX2 also requires the OS to save the YMM registers.
+	if (!cpu_has(1, 2, 27) || !cpu_has(1, 2, 28)) return false;
+	if ((_xgetbv(0) & 6) != 6) return false;
+	return cpu_has(7, 1, 5);
+}
+
+bool detect_avx512() {
+	// AVX-512F and AVX-512VL, with the OS saving the ZMM registers too.
+	if (!cpu_has(1, 2, 27)) return false;
+	if ((_xgetbv(0) & 0xE6) != 0xE6) return false;
+	return cpu_has(7, 1, 16) && cpu_has(7, 1, 31);
+}
+#else
+bool detect_sse41() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.1");
+}
+
+bool detect_avx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+bool detect_avx512() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl");
+}
+#endif
+
+} // unnamed namespace
+
+bool simd_sort_has_sse41() {
+	static const bool has = detect_sse41();
+	return has;
+}
+
+bool simd_sort_has_avx2() {
+	static const bool has = detect_avx2();
+	return has;
+}
+
+bool simd_sort_has_avx512() {
+	static const bool has = detect_avx2() && detect_avx512();
+	return has;
+}
+
+void simd_sort_block(uint64_t * a, size_t n, uint64_t * tmp) {
+	if (simd_sort_has_avx512())
+		simd_sort_block_avx512(a, n, tmp);
+	else
+		simd_sort_block_avx2(a, n, tmp);
+}
+
+void simd_merge_block(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out) {
+	if (simd_sort_has_avx512())
+		simd_merge_block_avx512(a, na, b, nb, out);
+	else
+		simd_merge_block_avx2(a, na, b, nb, out);
+}
+
+} // namespace bits
+
+} // namespace tpie
+
+#endif // TPIE_HAVE_SIMD_SORT
@@ -0,0 +1,252 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file simd_sort.h
+/// \brief Sorting and merging of primitive types using SIMD bitonic merge
+/// networks.
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef __TPIE_SIMD_SORT_H__
+#define __TPIE_SIMD_SORT_H__
+
+#include <tpie/config.h>
+#include <tpie/array.h>
+#include <algorithm>
+#include <type_traits>
+#include <cstdint>
+#include <cstddef>
+
+namespace tpie {
+
+namespace bits {
+
+#ifdef TPIE_HAVE_SIMD_SORT
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Runtime detection of the instruction sets used by the kernels.
+///////////////////////////////////////////////////////////////////////////////
+bool simd_sort_has_sse41();
+bool simd_sort_has_avx2();
+bool simd_sort_has_avx512(); // AVX-512F and AVX-512VL
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort the n items in a ascending using a SIMD merge sort.
+/// tmp must have room for simd_sort_buffer_size(n) items.
+/// Only call these when the corresponding instruction set is available.
+///////////////////////////////////////////////////////////////////////////////
+void simd_sort_block(uint32_t * a, size_t n, uint32_t * tmp); // SSE4.1
+void simd_sort_block(uint64_t * a, size_t n, uint64_t * tmp); // AVX2
+void simd_sort_block(double * a, size_t n, double * tmp); // AVX2
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Merge the sorted runs [a, a+na) and [b, b+nb) into out, which
+/// must not overlap them. The runs may have any length.
+/// Only call these when the corresponding instruction set is available.
+///////////////////////////////////////////////////////////////////////////////
+void simd_merge_block(const uint32_t * a, size_t na, const uint32_t * b, size_t nb, uint32_t * out); // SSE4.1
+void simd_merge_block(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out); // AVX2
+void simd_merge_block(const double * a, size_t na, const double * b, size_t nb, double * out); // AVX2
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief The uint64_t kernels for a specific instruction set.
+/// The overloads above use the AVX-512 kernels when available.
+///////////////////////////////////////////////////////////////////////////////
+void simd_sort_block_avx2(uint64_t * a, size_t n, uint64_t * tmp);
+void simd_merge_block_avx2(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out);
+void simd_sort_block_avx512(uint64_t * a, size_t n, uint64_t * tmp);
+void simd_merge_block_avx512(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out);
+#endif // TPIE_HAVE_SIMD_SORT
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Merge of types without SIMD kernels.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void simd_merge_block(const T * a, size_t na, const T * b, size_t nb, T * out) {
+	std::merge(a, a + na, b, b + nb, out);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Merge the k sorted runs [runs[i], runs[i]+sizes[i]) with a tree of
+/// two-way merges.
+///
+/// The first level of the tree merges pairs of runs into a, and the
+/// following levels merge pairs of the merged runs back and forth between a
+/// and b. Both must have room for the total number of items.
+/// sizes is used as scratch space.
+/// \returns a or b, whichever holds the merged items.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+T * simd_merge_tree(const T * const * runs, size_t * sizes, size_t k, T * a, T * b) {
+	size_t offset = 0;
+	for (size_t i = 0; i < k; i += 2) {
+		size_t n = sizes[i];
+		if (i + 1 < k) {
+			simd_merge_block(runs[i], sizes[i], runs[i+1], sizes[i+1], a + offset);
+			n += sizes[i+1];
+		} else {
+			std::copy(runs[i], runs[i] + n, a + offset);
+		}
+		sizes[i/2] = n;
+		offset += n;
+	}
+	k = (k + 1) / 2;
+	while (k > 1) {
+		offset = 0;
+		for (size_t i = 0; i < k; i += 2) {
+			size_t n = sizes[i];
+			if (i + 1 < k) {
+				simd_merge_block(a + offset, sizes[i], a + offset + sizes[i], sizes[i+1], b + offset);
+				n += sizes[i+1];
+			} else {
+				std::copy(a + offset, a + offset + n, b + offset);
+			}
+			sizes[i/2] = n;
+			offset += n;
+		}
+		k = (k + 1) / 2;
+		std::swap(a, b);
+	}
+	return a;
+}
+
+inline size_t simd_sort_buffer_size(size_t n) {
+	return 2 * ((n + 7) / 8 * 8);
+}
+
+/** Partitions of at most this many items are sorted by simd_sort_block. */
+const size_t simd_sort_block_items = 2048;
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Types with SIMD kernels have supported set to true.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+struct simd_sort_traits {
+	static const bool supported = false;
+	static bool available() {return false;}
+};
+
+#ifdef TPIE_HAVE_SIMD_SORT
+template <>
+struct simd_sort_traits<uint32_t> {
+	static const bool supported = true;
+	static bool available() {return simd_sort_has_sse41();}
+};
+
+template <>
+struct simd_sort_traits<uint64_t> {
+	static const bool supported = true;
+	static bool available() {return simd_sort_has_avx2();}
+};
+
+template <>
+struct simd_sort_traits<double> {
+	static const bool supported = true;
+	static bool available() {return simd_sort_has_avx2();}
+};
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Quick sort [a, b) until the partitions fit in a block, and sort the
+/// blocks with simd_sort_block.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void simd_quick_sort(T * a, T * b, T * tmp, size_t depth) {
+	while (static_cast<size_t>(b - a) > simd_sort_block_items) {
+		if (depth-- == 0) {
+			std::sort(a, b);
+			return;
+		}
+		// Move the median of three to the front and use Hoare partitioning.
+		T * m = a + (b - a) / 2;
+		if (*m < *a) std::swap(*m, *a);
+		if (b[-1] < *m) {
+			std::swap(b[-1], *m);
+			if (*m < *a) std::swap(*m, *a);
+		}
+		std::swap(*a, *m);
+		const T pivot = *a;
+		T * i = a - 1;
+		T * j = b;
+		while (true) {
+			do --j; while (pivot < *j);
+			do ++i; while (*i < pivot);
+			if (i >= j) break;
+			std::swap(*i, *j);
+		}
+		++j;
+		if (j - a < b - j) {
+			simd_quick_sort(a, j, tmp, depth);
+			a = j;
+		} else {
+			simd_quick_sort(j, b, tmp, depth);
+			b = j;
+		}
+	}
+	simd_sort_block(a, static_cast<size_t>(b - a), tmp);
+}
+
+template <typename T>
+void simd_sort(T * a, T * b, std::true_type) {
+	if (simd_sort_traits<T>::available()) {
+		size_t n = static_cast<size_t>(b - a);
+		size_t depth = 0;
+		while (n > 1) { n /= 2; depth += 2; }
+		array<T> tmp(simd_sort_buffer_size(simd_sort_block_items));
+		simd_quick_sort(a, b, tmp.get(), depth);
+		return;
+	}
+	std::sort(a, b);
+}
+#endif // TPIE_HAVE_SIMD_SORT
+
+template <typename T, typename Supported>
+void simd_sort(T * a, T * b, Supported) {
+	std::sort(a, b);
+}
+
+} // namespace bits
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Whether simd_sort uses SIMD instructions for items of type T on
+/// this machine.
+///
+/// This is the case for uint32_t when SSE4.1 is available and for uint64_t
+/// and double when AVX2 is available. uint64_t uses AVX-512 when available.
+/// There are no kernels for key/value pairs, which are sorted by std::sort.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+bool simd_sort_available() {
+	return bits::simd_sort_traits<T>::available();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// \brief Sort [a, b) in ascending order.
+///
+/// When simd_sort_available<T>(), the range is quick sorted into blocks that
+/// fit in cache, and each block is sorted by a merge sort using in-register
+/// sorting networks and bitonic merge networks.
+/// Otherwise, this is the same as std::sort.
+///////////////////////////////////////////////////////////////////////////////
+template <typename T>
+void simd_sort(T * a, T * b) {
+	bits::simd_sort(a, b, std::integral_constant<bool, bits::simd_sort_traits<T>::supported>());
+}
+
+} // namespace tpie
+
+#endif // __TPIE_SIMD_SORT_H__
@@ -0,0 +1,136 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+// SIMD sorting and merging kernels for uint64_t and double using AVX2.
+// This file is compiled with AVX2 code generation enabled; see simd_sort_kernels.inl.
+
+// Only include headers without inline code that could be emitted for this
+// instruction set; the declarations are in tpie/simd_sort.h.
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+#include <cmath>
+
+namespace tpie {
+
+namespace bits {
+
+namespace {
+
+struct avx2_uint64 {
+	typedef uint64_t value_type;
+	typedef __m256i vector_type;
+
+	static inline vector_type load(const value_type * p) {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	}
+	static inline void store(value_type * p, vector_type v) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+	}
+	static inline void minmax(vector_type a, vector_type b, vector_type & mn, vector_type & mx) {
+		// AVX2 only has a signed 64-bit comparison, so flip the sign bits.
+		const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(0x8000000000000000ull));
+		__m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+		mn = _mm256_blendv_epi8(a, b, gt);
+		mx = _mm256_blendv_epi8(b, a, gt);
+	}
+	static inline vector_type swap_pairs(vector_type v) {
+		return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+	}
+	static inline vector_type swap_halves(vector_type v) {
+		return _mm256_permute2x128_si256(v, v, 1);
+	}
+	static inline vector_type reverse(vector_type v) {
+		return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3));
+	}
+	static inline vector_type blend_0110(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0x3C);
+	}
+	static inline vector_type blend_0011(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0xF0);
+	}
+	static inline vector_type blend_0101(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0xCC);
+	}
+	static inline value_type sentinel() {
+		return 0xFFFFFFFFFFFFFFFFull;
+	}
+};
+
+struct avx2_double {
+	typedef double value_type;
+	typedef __m256d vector_type;
+
+	static inline vector_type load(const value_type * p) {
+		return _mm256_loadu_pd(p);
+	}
+	static inline void store(value_type * p, vector_type v) {
+		_mm256_storeu_pd(p, v);
+	}
+	static inline void minmax(vector_type a, vector_type b, vector_type & mn, vector_type & mx) {
+		mn = _mm256_min_pd(a, b);
+		mx = _mm256_max_pd(a, b);
+	}
+	static inline vector_type swap_pairs(vector_type v) {
+		return _mm256_permute_pd(v, 0x5);
+	}
+	static inline vector_type swap_halves(vector_type v) {
+		return _mm256_permute2f128_pd(v, v, 1);
+	}
+	static inline vector_type reverse(vector_type v) {
+		return _mm256_permute4x64_pd(v, _MM_SHUFFLE(0, 1, 2, 3));
+	}
+	static inline vector_type blend_0110(vector_type a, vector_type b) {
+		return _mm256_blend_pd(a, b, 0x6);
+	}
+	static inline vector_type blend_0011(vector_type a, vector_type b) {
+		return _mm256_blend_pd(a, b, 0xC);
+	}
+	static inline vector_type blend_0101(vector_type a, vector_type b) {
+		return _mm256_blend_pd(a, b, 0xA);
+	}
+	static inline value_type sentinel() {
+		return HUGE_VAL;
+	}
+};
+
+#include <tpie/simd_sort_kernels.inl>
+
+} // unnamed namespace
+
+void simd_sort_block_avx2(uint64_t * a, size_t n, uint64_t * tmp) {
+	simd_kernels<avx2_uint64>::sort_block(a, n, tmp);
+}
+
+void simd_merge_block_avx2(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out) {
+	simd_kernels<avx2_uint64>::merge(a, na, b, nb, out);
+}
+
+void simd_sort_block(double * a, size_t n, double * tmp) {
+	simd_kernels<avx2_double>::sort_block(a, n, tmp);
+}
+
+void simd_merge_block(const double * a, size_t na, const double * b, size_t nb, double * out) {
+	simd_kernels<avx2_double>::merge(a, na, b, nb, out);
+}
+
+} // namespace bits
+
+} // namespace tpie
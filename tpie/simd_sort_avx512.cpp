@@ -0,0 +1,92 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+// SIMD sorting and merging kernels for uint64_t using AVX-512.
+// This file is compiled with AVX-512F and AVX-512VL code generation enabled;
+// see simd_sort_kernels.inl.
+//
+// The kernels use the same four-lane networks as the AVX2 kernels, but
+// AVX-512VL has unsigned 64-bit min and max, so a compare-exchange is two
+// instructions instead of the sign flips, comparison and blends of AVX2.
+
+// Only include headers without inline code that could be emitted for this
+// instruction set; the declarations are in tpie/simd_sort.h.
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace tpie {
+
+namespace bits {
+
+namespace {
+
+struct avx512_uint64 {
+	typedef uint64_t value_type;
+	typedef __m256i vector_type;
+
+	static inline vector_type load(const value_type * p) {
+		return _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+	}
+	static inline void store(value_type * p, vector_type v) {
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(p), v);
+	}
+	static inline void minmax(vector_type a, vector_type b, vector_type & mn, vector_type & mx) {
+		mn = _mm256_min_epu64(a, b);
+		mx = _mm256_max_epu64(a, b);
+	}
+	static inline vector_type swap_pairs(vector_type v) {
+		return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 3, 0, 1));
+	}
+	static inline vector_type swap_halves(vector_type v) {
+		return _mm256_permute2x128_si256(v, v, 1);
+	}
+	static inline vector_type reverse(vector_type v) {
+		return _mm256_permute4x64_epi64(v, _MM_SHUFFLE(0, 1, 2, 3));
+	}
+	static inline vector_type blend_0110(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0x3C);
+	}
+	static inline vector_type blend_0011(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0xF0);
+	}
+	static inline vector_type blend_0101(vector_type a, vector_type b) {
+		return _mm256_blend_epi32(a, b, 0xCC);
+	}
+	static inline value_type sentinel() {
+		return 0xFFFFFFFFFFFFFFFFull;
+	}
+};
+
+#include <tpie/simd_sort_kernels.inl>
+
+} // unnamed namespace
+
+void simd_sort_block_avx512(uint64_t * a, size_t n, uint64_t * tmp) {
+	simd_kernels<avx512_uint64>::sort_block(a, n, tmp);
+}
+
+void simd_merge_block_avx512(const uint64_t * a, size_t na, const uint64_t * b, size_t nb, uint64_t * out) {
+	simd_kernels<avx512_uint64>::merge(a, na, b, nb, out);
+}
+
+} // namespace bits
+
+} // namespace tpie
@@ -0,0 +1,243 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+///////////////////////////////////////////////////////////////////////////////
+/// \file simd_sort_kernels.inl
+/// \brief SIMD merge sort of a block, generic over a four-lane vector type.
+///
+/// This file is included in an unnamed namespace by the translation units
+/// compiled for a specific instruction set, after defining a traits class V
+/// with the following members:
+///
+///   typedef ... value_type;    // The scalar type.
+///   typedef ... vector_type;   // A vector of four value_type.
+///   static vector_type load(const value_type *);
+///   static void store(value_type *, vector_type);
+///   static void minmax(vector_type, vector_type, vector_type & mn, vector_type & mx);
+///   static vector_type swap_pairs(vector_type);   // lanes 1, 0, 3, 2
+///   static vector_type swap_halves(vector_type);  // lanes 2, 3, 0, 1
+///   static vector_type reverse(vector_type);      // lanes 3, 2, 1, 0
+///   static vector_type blend_0110(vector_type a, vector_type b); // a, b, b, a
+///   static vector_type blend_0011(vector_type a, vector_type b); // a, a, b, b
+///   static vector_type blend_0101(vector_type a, vector_type b); // a, b, a, b
+///   static value_type sentinel();  // No less than any item.
+///
+/// To avoid emitting inline functions compiled for another instruction set
+/// than the rest of the library, this file must not use the standard library.
+///////////////////////////////////////////////////////////////////////////////
+
+template <typename V>
+struct simd_kernels {
+	typedef typename V::value_type value_type;
+	typedef typename V::vector_type vector_type;
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sort a bitonic vector.
+	///////////////////////////////////////////////////////////////////////////
+	static inline vector_type bitonic_clean(vector_type v) {
+		vector_type mn, mx;
+		V::minmax(v, V::swap_halves(v), mn, mx);
+		v = V::blend_0011(mn, mx);
+		V::minmax(v, V::swap_pairs(v), mn, mx);
+		return V::blend_0101(mn, mx);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sort a vector.
+	///////////////////////////////////////////////////////////////////////////
+	static inline vector_type sort_vector(vector_type v) {
+		vector_type mn, mx;
+		// Sort the first pair ascending and the second pair descending.
+		V::minmax(v, V::swap_pairs(v), mn, mx);
+		return bitonic_clean(V::blend_0110(mn, mx));
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Merge the sorted vectors a and b, such that a holds the four
+	/// smallest items in sorted order and b the four largest.
+	///////////////////////////////////////////////////////////////////////////
+	static inline void bitonic_merge(vector_type & a, vector_type & b) {
+		vector_type mn, mx;
+		V::minmax(a, V::reverse(b), mn, mx);
+		a = bitonic_clean(mn);
+		b = bitonic_clean(mx);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Merge the sorted runs [a, a+na) and [b, b+nb) into out.
+	/// na and nb must be multiples of four.
+	///////////////////////////////////////////////////////////////////////////
+	static void merge_runs(const value_type * a, size_t na,
+						   const value_type * b, size_t nb,
+						   value_type * out) {
+		if (na == 0 || nb == 0) {
+			const value_type * src = (na == 0) ? b : a;
+			size_t n = na + nb;
+			for (size_t i = 0; i < n; i += 4) V::store(out + i, V::load(src + i));
+			return;
+		}
+		const value_type * aEnd = a + na;
+		const value_type * bEnd = b + nb;
+		vector_type lo = V::load(a);
+		vector_type hi = V::load(b);
+		a += 4;
+		b += 4;
+		bitonic_merge(lo, hi);
+		V::store(out, lo);
+		out += 4;
+		while (a != aEnd && b != bEnd) {
+			if (*a < *b) {
+				lo = V::load(a);
+				a += 4;
+			} else {
+				lo = V::load(b);
+				b += 4;
+			}
+			bitonic_merge(lo, hi);
+			V::store(out, lo);
+			out += 4;
+		}
+		for (; a != aEnd; a += 4) {
+			lo = V::load(a);
+			bitonic_merge(lo, hi);
+			V::store(out, lo);
+			out += 4;
+		}
+		for (; b != bEnd; b += 4) {
+			lo = V::load(b);
+			bitonic_merge(lo, hi);
+			V::store(out, lo);
+			out += 4;
+		}
+		V::store(out, hi);
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Merge the sorted runs [a, a+na) and [b, b+nb) of any length
+	/// into out.
+	///
+	/// Vectors are merged while both runs have four items left. Then the
+	/// four pending items in the merge network and the shorter tail are
+	/// merged into the rest of the other run one item at a time.
+	///////////////////////////////////////////////////////////////////////////
+	static void merge(const value_type * a, size_t na,
+					  const value_type * b, size_t nb,
+					  value_type * out) {
+		if (na < 4 || nb < 4) {
+			scalar_merge(a, na, b, nb, out);
+			return;
+		}
+		const value_type * aEnd = a + na;
+		const value_type * bEnd = b + nb;
+		vector_type lo = V::load(a);
+		vector_type hi = V::load(b);
+		a += 4;
+		b += 4;
+		bitonic_merge(lo, hi);
+		V::store(out, lo);
+		out += 4;
+		while (aEnd - a >= 4 && bEnd - b >= 4) {
+			if (*a < *b) {
+				lo = V::load(a);
+				a += 4;
+			} else {
+				lo = V::load(b);
+				b += 4;
+			}
+			bitonic_merge(lo, hi);
+			V::store(out, lo);
+			out += 4;
+		}
+		// Everything written so far is no greater than what is left.
+		value_type pending[8];
+		V::store(pending, hi);
+		size_t n = 4;
+		if (aEnd - a < 4) {
+			for (; a != aEnd; ++a) insert_sorted(pending, n++, *a);
+			scalar_merge(pending, n, b, static_cast<size_t>(bEnd - b), out);
+		} else {
+			for (; b != bEnd; ++b) insert_sorted(pending, n++, *b);
+			scalar_merge(pending, n, a, static_cast<size_t>(aEnd - a), out);
+		}
+	}
+
+	static void scalar_merge(const value_type * a, size_t na,
+							 const value_type * b, size_t nb,
+							 value_type * out) {
+		const value_type * aEnd = a + na;
+		const value_type * bEnd = b + nb;
+		while (a != aEnd && b != bEnd) *out++ = (*b < *a) ? *b++ : *a++;
+		while (a != aEnd) *out++ = *a++;
+		while (b != bEnd) *out++ = *b++;
+	}
+
+	/** Insert x into the sorted items [a, a+n). */
+	static inline void insert_sorted(value_type * a, size_t n, value_type x) {
+		for (; n > 0 && x < a[n-1]; --n) a[n] = a[n-1];
+		a[n] = x;
+	}
+
+	static void insertion_sort(value_type * a, size_t n) {
+		for (size_t i = 1; i < n; ++i) {
+			value_type x = a[i];
+			size_t j = i;
+			for (; j > 0 && x < a[j-1]; --j) a[j] = a[j-1];
+			a[j] = x;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Sort [a, a+n) using tmp as scratch space for 2*m items, where m
+	/// is n rounded up to a multiple of eight.
+	///////////////////////////////////////////////////////////////////////////
+	static void sort_block(value_type * a, size_t n, value_type * tmp) {
+		if (n < 16) {
+			insertion_sort(a, n);
+			return;
+		}
+		size_t m = (n + 7) / 8 * 8;
+		value_type * src = tmp;
+		value_type * dst = tmp + m;
+		for (size_t i = 0; i < n; ++i) src[i] = a[i];
+		// Padding sorts to the end and is dropped.
+		for (size_t i = n; i < m; ++i) src[i] = V::sentinel();
+
+		// Form sorted runs of eight items in registers.
+		for (size_t i = 0; i < m; i += 8) {
+			vector_type lo = sort_vector(V::load(src + i));
+			vector_type hi = sort_vector(V::load(src + i + 4));
+			bitonic_merge(lo, hi);
+			V::store(src + i, lo);
+			V::store(src + i + 4, hi);
+		}
+
+		// Merge pairs of runs until one run remains.
+		for (size_t run = 8; run < m; run *= 2) {
+			for (size_t i = 0; i < m; i += 2 * run) {
+				size_t na = (m - i < run) ? m - i : run;
+				size_t nb = (m - i - na < run) ? m - i - na : run;
+				merge_runs(src + i, na, src + i + na, nb, dst + i);
+			}
+			value_type * t = src;
+			src = dst;
+			dst = t;
+		}
+		for (size_t i = 0; i < n; ++i) a[i] = src[i];
+	}
+};
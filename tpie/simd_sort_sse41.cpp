@@ -0,0 +1,87 @@
+// -*- mode: c++; tab-width: 4; indent-tabs-mode: t; eval: (progn (c-set-style "stroustrup") (c-set-offset 'innamespace 0)); -*-
+// vi:set ts=4 sts=4 sw=4 noet :
+// Copyright 2016, The TPIE development team
+//
+// This file is part of TPIE.
+//
+// TPIE is free software: you can redistribute it and/or modify it under
+// the terms of the GNU Lesser General Public License as published by the
+// Free Software Foundation, either version 3 of the License, or (at your
+// option) any later version.
+//
+// TPIE is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+// License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with TPIE.  If not, see <http://www.gnu.org/licenses/>
+
+
+// SIMD sorting and merging kernels for uint32_t using SSE4.1.
+// This file is compiled with SSE4.1 code generation enabled; see simd_sort_kernels.inl.
+
+// Only include headers without inline code that could be emitted for this
+// instruction set; the declarations are in tpie/simd_sort.h.
+#include <cstddef>
+#include <cstdint>
+#include <smmintrin.h>
+
+namespace tpie {
+
+namespace bits {
+
+namespace {
+
+struct sse41_uint32 {
+	typedef uint32_t value_type;
+	typedef __m128i vector_type;
+
+	static inline vector_type load(const value_type * p) {
+		return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+	}
+	static inline void store(value_type * p, vector_type v) {
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(p), v);
+	}
+	static inline void minmax(vector_type a, vector_type b, vector_type & mn, vector_type & mx) {
+		mn = _mm_min_epu32(a, b);
+		mx = _mm_max_epu32(a, b);
+	}
+	static inline vector_type swap_pairs(vector_type v) {
+		return _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+	}
+	static inline vector_type swap_halves(vector_type v) {
+		return _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+	}
+	static inline vector_type reverse(vector_type v) {
+		return _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+	}
+	static inline vector_type blend_0110(vector_type a, vector_type b) {
+		return _mm_blend_epi16(a, b, 0x3C);
+	}
+	static inline vector_type blend_0011(vector_type a, vector_type b) {
+		return _mm_blend_epi16(a, b, 0xF0);
+	}
+	static inline vector_type blend_0101(vector_type a, vector_type b) {
+		return _mm_blend_epi16(a, b, 0xCC);
+	}
+	static inline value_type sentinel() {
+		return 0xFFFFFFFFu;
+	}
+};
+
+#include <tpie/simd_sort_kernels.inl>
+
+} // unnamed namespace
+
+void simd_sort_block(uint32_t * a, size_t n, uint32_t * tmp) {
+	simd_kernels<sse41_uint32>::sort_block(a, n, tmp);
+}
+
+void simd_merge_block(const uint32_t * a, size_t na, const uint32_t * b, size_t nb, uint32_t * out) {
+	simd_kernels<sse41_uint32>::merge(a, na, b, nb, out);
+}
+
+} // namespace bits
+
+} // namespace tpie
@@ -27,6 +27,8 @@ namespace {
 	std::atomic<tpie::stream_size_type> temp_file_usage;
 	std::atomic<tpie::stream_size_type> bytes_read;
 	std::atomic<tpie::stream_size_type> bytes_written;
+	std::atomic<tpie::stream_size_type> sort_presorted_runs;
+	std::atomic<tpie::stream_size_type> sort_extended_runs;
 	std::atomic<tpie::stream_size_type> user[20];
 } // unnamed namespace
 
@@ -63,6 +65,22 @@ namespace tpie {
 		bytes_written.fetch_add(delta);
 	}
 
+	stream_size_type get_sort_presorted_runs() {
+		return sort_presorted_runs.load();
+	}
+
+	stream_size_type get_sort_extended_runs() {
+		return sort_extended_runs.load();
+	}
+
+	void increment_sort_presorted_runs(stream_size_type delta) {
+		sort_presorted_runs.fetch_add(delta);
+	}
+
+	void increment_sort_extended_runs(stream_size_type delta) {
+		sort_extended_runs.fetch_add(delta);
+	}
+
 	stream_size_type get_user(size_t i) {
 		return (i < sizeof(user)) ? user[i].load() : 0;
 	}
@@ -61,6 +61,21 @@ namespace tpie {
 	///////////////////////////////////////////////////////////////////////////
 	void increment_bytes_written(stream_size_type delta);
 
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the number of full merge sort run buffers that were
+	/// already sorted when they were formed, so sorting was skipped.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type get_sort_presorted_runs();
+
+	///////////////////////////////////////////////////////////////////////////
+	/// \brief Return the number of merge sort run buffers that were appended
+	/// to the previous run instead of being written as a new run.
+	///////////////////////////////////////////////////////////////////////////
+	stream_size_type get_sort_extended_runs();
+
+	void increment_sort_presorted_runs(stream_size_type delta);
+	void increment_sort_extended_runs(stream_size_type delta);
+
 	stream_size_type get_user(size_t i);
 	void increment_user(size_t i, stream_size_type delta);
 